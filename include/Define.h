@@ -1,11 +1,58 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
 namespace LitTorrent {
 using SHA1Hash = std::array<uint8_t, 20>;
 using Buffer = std::string;
 namespace fs {
 using namespace std::filesystem;
 }
+
+// Non-owning view over contiguous bytes; stands in for
+// std::span<const uint8_t> while the project targets C++17
+class ByteSpan {
+public:
+  ByteSpan() = default;
+  ByteSpan(const uint8_t *data, size_t size) : data_(data), size_(size) {}
+  ByteSpan(const std::vector<uint8_t> &bytes)
+      : data_(bytes.data()), size_(bytes.size()) {}
+
+  const uint8_t *data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const uint8_t *begin() const { return data_; }
+  const uint8_t *end() const { return data_ + size_; }
+  const uint8_t &operator[](size_t i) const { return data_[i]; }
+
+  ByteSpan subspan(size_t offset, size_t count) const {
+    return ByteSpan(data_ + offset, count);
+  }
+
+private:
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Read-only bytes kept valid by their owner (a file mapping or a buffer)
+// for as long as the view is alive
+struct BlockView {
+  ByteSpan data;
+  std::shared_ptr<const void> owner;
+};
+
+// Reference-counted immutable buffer, so a receive buffer can be handed to
+// the storage layer (and kept alive by it) without copying
+using SharedBuffer = std::shared_ptr<const std::vector<uint8_t>>;
+
+// Completions of asynchronous block I/O. error is 0 or an errno value; read
+// data is only valid for the duration of the callback
+using ReadCompletion = std::function<void(int error, ByteSpan data)>;
+using WriteCompletion = std::function<void(int error)>;
 } // namespace LitTorrent
@@ -21,7 +21,8 @@ enum class ErrorCode {
   MissingTrackers,
   NetworkError,
   InvalidParameter,
-  OutOfBounds
+  OutOfBounds,
+  InvalidResumeData
 };
 
 class ErrorCategory : public std::error_category {
@@ -58,6 +59,8 @@ public:
       return "Invalid parameter";
     case ErrorCode::OutOfBounds:
       return "Index out of bounds";
+    case ErrorCode::InvalidResumeData:
+      return "Invalid resume data";
     default:
       return "Unknown error";
     }
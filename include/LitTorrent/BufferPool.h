@@ -0,0 +1,139 @@
+#pragma once
+
+#include "Define.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace LitTorrent {
+
+// Forward declaration
+class BufferPool;
+
+// Reference-counted handle to a buffer from a BufferPool, or from the heap
+// when no pool buffer fits. Copies share the memory, which returns to its
+// pool when the last handle is dropped; the pool may be destroyed first.
+// Contents start out as whatever the previous user left behind
+class BlockBuffer {
+public:
+  BlockBuffer() = default;
+  BlockBuffer(const BlockBuffer &other);
+  BlockBuffer(BlockBuffer &&other) noexcept;
+  BlockBuffer &operator=(const BlockBuffer &other);
+  BlockBuffer &operator=(BlockBuffer &&other) noexcept;
+  ~BlockBuffer();
+
+  // A buffer of its own, page aligned, outside any pool
+  static BlockBuffer allocate(size_t size);
+
+  uint8_t *data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  uint8_t *begin() const { return data_; }
+  uint8_t *end() const { return data_ + size_; }
+  uint8_t &operator[](size_t i) const { return data_[i]; }
+  explicit operator bool() const { return slot_ != nullptr; }
+  operator ByteSpan() const { return ByteSpan(data_, size_); }
+
+  // Another handle on [offset, offset + count) of the same memory
+  BlockBuffer subrange(size_t offset, size_t count) const;
+
+  // True when the memory came from a pool slab
+  bool pooled() const;
+
+private:
+  friend class BufferPool;
+  struct Slot;
+
+  Slot *slot_ = nullptr;
+  uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+
+  BlockBuffer(Slot *slot, uint8_t *data, size_t size)
+      : slot_(slot), data_(data), size_(size) {}
+  void release();
+};
+
+struct BufferClassStats {
+  size_t bufferSize = 0;
+  size_t buffers = 0; // carved out of slabs so far
+  size_t inUse = 0;
+};
+
+// Pool occupancy
+struct BufferPoolStats {
+  std::vector<BufferClassStats> classes;
+  size_t bytesReserved = 0;   // held in slabs
+  size_t bytesInUse = 0;      // of which handed out
+  size_t hugePageBytes = 0;   // of which backed by explicit huge pages
+  uint64_t acquired = 0;      // buffers handed out, pooled or not
+  uint64_t slabs = 0;         // slab allocations
+  uint64_t heapBuffers = 0;   // requests no pool buffer could serve
+};
+
+// Buffers for block and piece data, in a fixed set of size classes. A
+// request gets a buffer of the smallest class that fits; buffers of a class
+// are carved out of slabs of about 2 MiB, mapped once and reused, so a
+// steady stream of requests allocates nothing. Slabs are never returned to
+// the system while the pool lives. Requests larger than every class, or
+// that would take the slabs beyond maxBytes, are served from the heap.
+//
+// With hugePages, slabs are first mapped with explicit huge pages
+// (MAP_HUGETLB) and otherwise marked for transparent huge pages. Thread-safe
+class BufferPool : public std::enable_shared_from_this<BufferPool> {
+public:
+  // maxBytes = 0 places no bound on the slabs
+  static std::shared_ptr<BufferPool> create(std::vector<size_t> bufferSizes,
+                                            bool hugePages = false,
+                                            size_t maxBytes = 0);
+  ~BufferPool();
+
+  BufferPool(const BufferPool &) = delete;
+  BufferPool &operator=(const BufferPool &) = delete;
+
+  // A buffer of exactly size bytes (throws std::bad_alloc)
+  BlockBuffer acquire(size_t size);
+
+  BufferPoolStats getStats() const;
+
+private:
+  friend class BlockBuffer;
+
+  struct Slab {
+    uint8_t *memory = nullptr;
+    size_t length = 0;
+    bool hugePages = false;
+    std::unique_ptr<BlockBuffer::Slot[]> slots;
+  };
+
+  struct SizeClass {
+    size_t bufferSize = 0;
+    size_t stride = 0;
+    size_t perSlab = 0;
+    std::mutex mutex;
+    std::vector<BlockBuffer::Slot *> free;
+    std::vector<Slab> slabs;
+    size_t buffers = 0;
+  };
+
+  std::unique_ptr<SizeClass[]> classes_;
+  size_t classCount_ = 0;
+  bool hugePages_;
+  size_t maxBytes_;
+
+  std::atomic<size_t> bytesReserved_{0};
+  std::atomic<size_t> bytesInUse_{0};
+  std::atomic<size_t> hugePageBytes_{0};
+  std::atomic<uint64_t> acquired_{0};
+  std::atomic<uint64_t> slabs_{0};
+  std::atomic<uint64_t> heapBuffers_{0};
+
+  BufferPool(std::vector<size_t> bufferSizes, bool hugePages, size_t maxBytes);
+  bool grow(SizeClass &sizeClass);
+  void release(BlockBuffer::Slot *slot);
+};
+
+} // namespace LitTorrent
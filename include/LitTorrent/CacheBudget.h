@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace LitTorrent {
+
+struct CacheBudgetStats {
+  size_t limit = 0;
+  size_t used = 0;
+  uint64_t reclaims = 0; // times a reservation had to free memory first
+  uint64_t refusals = 0; // reservations that could not be met
+};
+
+// Memory limit shared by the block caches of any number of torrents. A cache
+// reserves bytes before it holds them; when a reservation would go over the
+// limit, the caches attached to the budget are asked to give memory back,
+// lowest rank first (clean read caches before dirty write caches), until it
+// fits. Thread-safe
+class CacheBudget {
+public:
+  class Consumer {
+  public:
+    virtual ~Consumer() = default;
+
+    // Free about bytes (more or less) and return how many were released.
+    // Called on the reserving thread; must not reserve, attach or detach
+    virtual size_t reclaim(size_t bytes) = 0;
+  };
+
+  explicit CacheBudget(size_t limit) : limit_(limit) {}
+
+  CacheBudget(const CacheBudget &) = delete;
+  CacheBudget &operator=(const CacheBudget &) = delete;
+
+  // A consumer must be detached before it is destroyed; detach waits for a
+  // reclaim that is running on it
+  void attach(Consumer *consumer, int rank);
+  void detach(Consumer *consumer);
+
+  // Account for bytes, reclaiming from the consumers while over the limit.
+  // False when not enough could be freed; nothing is reserved then. Callers
+  // must not hold a lock their own reclaim takes
+  bool reserve(size_t bytes);
+  void release(size_t bytes);
+
+  size_t limit() const { return limit_; }
+  size_t used() const { return used_.load(std::memory_order_relaxed); }
+  CacheBudgetStats getStats() const;
+
+private:
+  struct Attached {
+    Consumer *consumer;
+    int rank;
+  };
+
+  size_t limit_;
+  std::atomic<size_t> used_{0};
+  std::atomic<uint64_t> reclaims_{0};
+  std::atomic<uint64_t> refusals_{0};
+
+  // Held while reclaiming, so consumers cannot be detached mid-call and
+  // only one thread evicts at a time
+  std::mutex reclaimMutex_;
+  std::vector<Attached> consumers_; // sorted by rank
+};
+
+} // namespace LitTorrent
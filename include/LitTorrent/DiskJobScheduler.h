@@ -0,0 +1,176 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace LitTorrent {
+
+// Classes of disk work, most urgent first
+enum class DiskJobClass {
+  Upload,    // block reads a peer is waiting for
+  Write,     // received blocks going to disk
+  HashCheck, // piece reads for verifying downloaded pieces
+  Recheck    // background verification of data already on disk
+};
+constexpr size_t kDiskJobClassCount = 4;
+
+struct DiskJobClassStats {
+  size_t queued = 0;
+  size_t running = 0;
+  uint64_t completed = 0;
+  uint64_t cancelled = 0;
+};
+
+// One device's queue. Latency runs from submission to completion
+struct DiskDeviceStats {
+  uint64_t device = 0; // st_dev
+  size_t queued = 0;
+  size_t running = 0;
+  uint64_t completed = 0;
+  double averageLatencyUs = 0;
+  double maxLatencyUs = 0;
+};
+
+struct DiskSchedulerStats {
+  // Summed over devices
+  std::array<DiskJobClassStats, kDiskJobClassCount> classes;
+  std::vector<DiskDeviceStats> devices;
+};
+
+// Runs disk jobs on I/O threads, with a separate queue and set of threads
+// for every device (st_dev) so that a slow disk only stalls its own jobs.
+// Given to every torrent, one scheduler holds the process's only queue and
+// threads per device, and the torrents on a disk are served together rather
+// than contending from queues of their own. A device's queue and threads are
+// created when its first job arrives. Within a device a free thread always
+// takes the most urgent class that has queued jobs and is below its
+// concurrency limit, so limiting the bulk classes keeps threads free and an
+// upload never waits for more than the jobs already running. Within a class
+// jobs are served in elevator order: by owner, then ascending torrent offset
+// (and so file, then offset within it), from where the class last was,
+// wrapping around at the end; the torrents on a device are swept one after
+// another as its files would be.
+//
+// A job may complete asynchronously: it is handed a done callback that must
+// be called exactly once, from any thread, and it counts against its class
+// limit until then
+class DiskJobScheduler {
+public:
+  using Done = std::function<void()>;
+  using Job = std::function<void(Done done)>;
+  using Cancel = std::function<void()>;
+
+  // threadsPerDevice I/O threads serve each device; 0 picks one per
+  // hardware thread. limits[c] is the most jobs of class c in flight at once
+  // on one device; 0 = no limit
+  DiskJobScheduler(unsigned threadsPerDevice,
+                   std::array<unsigned, kDiskJobClassCount> limits);
+  ~DiskJobScheduler();
+
+  // Disable copy and move
+  DiskJobScheduler(const DiskJobScheduler &) = delete;
+  DiskJobScheduler &operator=(const DiskJobScheduler &) = delete;
+  DiskJobScheduler(DiskJobScheduler &&) = delete;
+  DiskJobScheduler &operator=(DiskJobScheduler &&) = delete;
+
+  // Torrents sharing a scheduler each submit their jobs under an owner id
+  // (0 = none), so that one can leave without stopping the others.
+  // removeOwner cancels the owner's queued jobs and waits for its running
+  // ones; its later submissions are cancelled immediately. Must not be
+  // called from a job
+  uint64_t addOwner();
+  void removeOwner(uint64_t owner);
+
+  // Queue a job on a device, positioned at a torrent offset. If the
+  // scheduler stops, or the owner is removed, before the job starts, cancel
+  // runs instead
+  void submit(DiskJobClass jobClass, uint64_t device, uint64_t position,
+              Job job, Cancel cancel = nullptr, uint64_t owner = 0);
+
+  // Run fn as a job of the class and wait for it to finish. Exceptions from
+  // fn propagate; throws TorrentException if the job is cancelled first.
+  // Must not be called from a job
+  void run(DiskJobClass jobClass, uint64_t device, uint64_t position,
+           std::function<void()> fn, uint64_t owner = 0);
+
+  // Block until no job is queued or running
+  void waitIdle();
+
+  // Cancel queued jobs, then wait for running ones and join the threads.
+  // Later submissions are cancelled immediately
+  void stop();
+
+  DiskSchedulerStats getStats() const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    Job job;
+    Cancel cancel;
+    Clock::time_point submitted;
+    uint64_t owner = 0;
+  };
+
+  struct Queue {
+    // Keyed by owner and torrent offset
+    std::multimap<std::pair<uint64_t, uint64_t>, Entry> jobs;
+    std::pair<uint64_t, uint64_t> head{0, 0}; // elevator position
+    unsigned limit = 0;
+    size_t running = 0;
+    uint64_t completed = 0;
+    uint64_t cancelled = 0;
+  };
+
+  // Everything below is guarded by the device's own mutex
+  struct Device {
+    uint64_t id = 0;
+    std::array<Queue, kDiskJobClassCount> queues;
+    size_t queued = 0;
+    size_t running = 0;
+    bool stopping = false;
+    double totalLatencyUs = 0;
+    double maxLatencyUs = 0;
+    // Running jobs per owner, for removeOwner to wait on
+    std::map<uint64_t, size_t> ownersRunning;
+
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable idle;
+    std::vector<std::thread> workers;
+  };
+
+  // Called with devicesMutex_ held
+  Device *getDeviceLocked(uint64_t device);
+  void workerLoop(Device &device);
+  bool popNext(Device &device, Entry &entry, size_t &jobClass);
+  void complete(Device &device, size_t jobClass, Clock::time_point submitted,
+                uint64_t owner);
+  void stopDevice(Device &device);
+
+  unsigned threadsPerDevice_;
+  std::array<unsigned, kDiskJobClassCount> limits_;
+
+  // Devices are never removed before stop, so pointers stay valid. Jobs
+  // are queued with this held, so none of a removed owner's slips in after
+  // its queues have been cleared
+  mutable std::mutex devicesMutex_;
+  std::map<uint64_t, std::unique_ptr<Device>> devices_;
+  bool stopping_ = false;
+  std::set<uint64_t> owners_;
+  uint64_t nextOwner_ = 1;
+  std::array<uint64_t, kDiskJobClassCount> rejected_{};
+};
+
+} // namespace LitTorrent
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "Define.h"
+#include "LitTorrent/StorageOptions.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace LitTorrent {
+
+// Forward declaration
+class FileItem;
+
+// One buffer of a vectored write or read, at a torrent offset
+struct WriteSlice {
+  uint64_t start;
+  ByteSpan data;
+};
+struct ReadSlice {
+  uint64_t start;
+  uint8_t *data;
+  size_t size;
+};
+
+// A contiguous part of a torrent range that lives in one file. The owner
+// keeps the descriptor open for as long as the extent is in use
+struct FileExtent {
+  std::shared_ptr<const void> owner;
+  int fd = -1;
+  size_t fileIndex = 0;
+  uint64_t fileOffset = 0;
+  uint64_t rangeOffset = 0;
+  uint64_t length = 0;
+};
+
+// A contiguous part of a torrent range stored on one device
+struct DeviceExtent {
+  uint64_t device = 0; // st_dev
+  uint64_t start = 0;
+  uint64_t length = 0;
+};
+
+// A contiguous part of a torrent range that may hold data. What lies
+// between the extents of a range are holes, which read as zeros
+struct DataExtent {
+  uint64_t start = 0;
+  uint64_t length = 0;
+};
+
+// Size and footprint of a storage backend
+struct StorageStat {
+  uint64_t size = 0;           // bytes addressable by the torrent
+  uint64_t bytesAllocated = 0; // bytes actually backed by disk or memory
+  size_t openFiles = 0;        // descriptors held open
+};
+
+// Where a torrent's bytes live. Offsets are torrent offsets: the files are
+// laid out back to back and a backend maps ranges onto whatever it stores
+// them in. Implementations must allow concurrent reads and writes of
+// disjoint ranges from any thread, and throw TorrentException on errors
+class Storage {
+public:
+  virtual ~Storage() = default;
+
+  virtual std::vector<uint8_t> read(uint64_t start, size_t count) const = 0;
+  virtual void write(uint64_t start, ByteSpan data) = 0;
+
+  // Read without copying where the backend can; by default the view owns a
+  // freshly read buffer
+  virtual BlockView view(uint64_t start, size_t count) const;
+
+  // Batches of non-overlapping slices, in any order
+  virtual void readv(std::vector<ReadSlice> slices) const = 0;
+  virtual void writev(std::vector<WriteSlice> slices) = 0;
+
+  // Create whatever backs the torrent, reserving space according to the
+  // allocation mode; may finish in the background
+  virtual void allocate() = 0;
+  virtual AllocationStatus getAllocationStatus() const = 0;
+
+  // The file is not wanted: allocate leaves it out, and space is only
+  // taken for what is written into it (by pieces it shares with others)
+  virtual void setFileSkipped(size_t /*fileIndex*/, bool /*skipped*/) {}
+
+  // The range (a verified piece) is final
+  virtual void onRangeComplete(uint64_t /*start*/, size_t /*count*/) {}
+
+  // Force everything written so far to stable storage
+  virtual void sync() {}
+
+  // Release open resources; the storage stays usable and reopens on demand
+  virtual void close() = 0;
+
+  virtual StorageStat stat() const = 0;
+
+  // Split a range by the device holding each part, so that I/O can be
+  // queued per device. Backends without devices return a single extent on
+  // device 0
+  virtual std::vector<DeviceExtent> deviceExtents(uint64_t start,
+                                                  uint64_t count) const;
+
+  // The parts of a range that hold data, in order and merged where they
+  // meet, so that holes in sparse storage can be skipped without reading
+  // them. Backends that cannot tell return the whole range
+  virtual std::vector<DataExtent> dataExtents(uint64_t start,
+                                              uint64_t count) const;
+
+  // Backends built on file descriptors hand them out so that I/O can be
+  // issued directly (io_uring); others are driven through readv/writev
+  virtual bool hasDescriptors() const { return false; }
+  virtual std::vector<FileExtent> resolve(uint64_t start, size_t count,
+                                          bool write) const;
+  // Record a write made through descriptors returned by resolve
+  virtual void markWritten(uint64_t /*start*/, size_t /*count*/) {}
+};
+
+// Build the backend selected by options.backend, or by options.storageFactory
+// when one is set. files must outlive the storage
+std::unique_ptr<Storage> makeStorage(const std::vector<FileItem> &files,
+                                     const StorageOptions &options);
+
+} // namespace LitTorrent
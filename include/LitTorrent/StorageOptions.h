@@ -0,0 +1,136 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace LitTorrent {
+
+// Forward declarations
+class BufferPool;
+class CacheBudget;
+class DiskJobScheduler;
+class FileItem;
+class Storage;
+
+// Where block data is kept
+enum class StorageBackend {
+  Files, // The torrent's files on disk
+  Memory // Lazily allocated memory; nothing touches the disk
+};
+
+// When written data is forced to stable storage
+enum class DurabilityMode {
+  None,            // Leave write-back to the kernel
+  PieceComplete,   // fdatasync a piece's files once it has been verified
+  Periodic         // fdatasync dirty files from a background thread
+};
+
+// How block data moves between memory and files
+enum class IoMode {
+  Pread, // pread/pwrite through the descriptor cache
+  Mmap,  // Map files (in windows) and copy from the mapping; writes use
+         // pwrite, so a full disk is an error rather than SIGBUS
+  Direct // pread/pwrite with O_DIRECT, bypassing the page cache; falls back
+         // to Pread on filesystems that reject it. Asynchronous block I/O
+         // then runs on the thread pool rather than io_uring
+};
+
+// Expected access pattern, passed to the kernel as madvise hints
+enum class AccessPattern { Random, Sequential };
+
+// How disk space is reserved for a torrent's files
+enum class AllocationMode {
+  Sparse,      // Files are created at full length with no blocks reserved
+  Full,        // Every file is preallocated with fallocate in the background
+  OnFirstWrite // A file is created and preallocated when first written
+};
+
+// Progress of space preallocation
+struct AllocationStatus {
+  AllocationMode mode = AllocationMode::Sparse;
+  bool inProgress = false;
+  uint64_t bytesAllocated = 0;
+  // False once a filesystem rejected fallocate; files then stay sparse
+  bool fallocateSupported = true;
+  std::string error;
+};
+
+struct StorageOptions;
+using StorageFactory = std::function<std::unique_ptr<Storage>(
+    const std::vector<FileItem> &files, const StorageOptions &options)>;
+
+// Per-torrent storage configuration
+struct StorageOptions {
+  StorageBackend backend = StorageBackend::Files;
+  // Overrides backend with a custom Storage implementation when set
+  StorageFactory storageFactory;
+  // Granularity of MemoryStorage allocations
+  size_t memoryChunkSize = size_t(1) << 20;
+
+  // Upper bound on simultaneously open file descriptors
+  size_t maxOpenFiles = 512;
+
+  AllocationMode allocation = AllocationMode::Sparse;
+
+  IoMode ioMode = IoMode::Pread;
+  // Files are mapped in windows of this size (rounded to whole pages)
+  size_t mmapWindowSize = size_t(256) << 20;
+  AccessPattern accessPattern = AccessPattern::Random;
+
+  // Requests in flight at once for readBlockAsync/writeBlockAsync
+  unsigned asyncQueueDepth = 128;
+  // Use io_uring where available; otherwise a pool of blocking threads
+  bool useIoUring = true;
+
+  // Disk jobs. Torrents given the same scheduler share its queues and
+  // threads, so an upload of one is served ahead of another's recheck;
+  // otherwise each torrent gets its own with diskThreads threads per device
+  // the files live on (0 = one per hardware thread) and at most the given
+  // number of jobs of each class in flight at once on a device (0 = no
+  // limit). Keeping the bulk classes limited leaves threads free for uploads
+  std::shared_ptr<DiskJobScheduler> diskScheduler;
+  unsigned diskThreads = 4;
+  unsigned maxUploadJobs = 0;
+  unsigned maxWriteJobs = 0;
+  unsigned maxHashJobs = 2;
+  unsigned maxRecheckJobs = 1;
+  // Threads hashing completed pieces (0 = maxHashJobs, or one per hardware
+  // thread when that is unlimited). Reads for hashing are held to
+  // maxHashJobs anyway, so more threads than that mostly wait
+  unsigned verifyThreads = 0;
+
+  // Block and piece buffers. Torrents given the same pool share it;
+  // otherwise each torrent gets its own, with a block and a piece size
+  // class, slabs limited to bufferPoolBytes (0 = no limit) and backed by
+  // huge pages when hugePageBuffers is set
+  std::shared_ptr<BufferPool> bufferPool;
+  size_t bufferPoolBytes = 0;
+  bool hugePageBuffers = false;
+
+  // Memory for caching blocks: a budget shared with other torrents, or
+  // cacheSize bytes of the torrent's own (0 = no caching). Within it, the
+  // write cache keeps downloaded pieces in memory until they have hashed,
+  // and the read cache keeps verified data that peers request, reading
+  // readAhead bytes of a piece at a time (0 = the whole piece)
+  std::shared_ptr<CacheBudget> cacheBudget;
+  size_t cacheSize = 0;
+  bool writeCache = true;
+  bool readCache = true;
+  size_t readAhead = 0;
+
+  // Resume data is saved here when set, at most every resumeSaveInterval as
+  // pieces complete and when the torrent is destroyed (see
+  // Torrent::saveResumeData)
+  std::string resumeDataPath;
+  std::chrono::seconds resumeSaveInterval{30};
+
+  DurabilityMode durability = DurabilityMode::None;
+  std::chrono::milliseconds syncInterval{5000};
+};
+
+} // namespace LitTorrent
@@ -1,10 +1,24 @@
 #pragma once
 
 #include "LitTorrent/BEncoding.h"
+#include "LitTorrent/BufferPool.h"
+#include "LitTorrent/CacheBudget.h"
+#include "LitTorrent/DiskJobScheduler.h"
+#include "LitTorrent/Storage.h"
+#include "LitTorrent/StorageOptions.h"
 #include "LitTorrent/Tracker.h"
+#include "BlockStateTable.h"
+#include "PiecePicker.h"
 #include "PieceVerifier.h"
+#include "ReadCache.h"
+#include "RecheckJob.h"
+#include "ResumeData.h"
+#include "VerificationQueue.h"
+#include "WriteCache.h"
 #include "TorrentMetadata.h"
 #include "Define.h"
+#include <atomic>
+#include <chrono>
 #include <ctime>
 #include <filesystem>
 #include <memory>
@@ -19,13 +33,21 @@ class FileItem;
 class Tracker;
 using TorrentPtr = std::shared_ptr<class Torrent>;
 
+// One block of a writeBlocks batch
+struct BlockWrite {
+  int pieceIdx;
+  int blockIdx;
+  ByteSpan data;
+};
+
 class Torrent : public std::enable_shared_from_this<Torrent> {
 public:
   // Constructor
   Torrent(std::string name, std::string location, std::vector<FileItem> files,
           std::vector<std::string> trackers, int pieceSize,
           std::vector<Hash> pieceHashes, int blockSize = 16384,
-          bool isPrivate = false);
+          bool isPrivate = false,
+          const StorageOptions &storageOptions = StorageOptions());
 
   // Destructor
   ~Torrent();
@@ -36,33 +58,149 @@ public:
   Torrent(Torrent &&) = delete;
   Torrent &operator=(Torrent &&) = delete;
 
-  // Piece operations (throw on error)
+  // Piece operations (throw on error). Reads return buffers from the
+  // torrent's buffer pool
   int getPieceCount() const;
   int getPieceSize(int pieceIdx) const;
   bool isPieceVerified(int pieceIdx) const;
-  std::vector<uint8_t> readPiece(int pieceIdx) const;
-  bool writePiece(int pieceIdx, const std::vector<uint8_t>& data);
+  BlockBuffer readPiece(int pieceIdx) const;
+  bool writePiece(int pieceIdx, ByteSpan data);
+  bool writePiece(int pieceIdx, SharedBuffer data);
 
   // Block operations (throw on error)
   int getBlockCount(int pieceIdx) const;
   int getBlockSize(int pieceIdx, int blockIdx) const;
-  std::vector<uint8_t> readBlock(int pieceIdx, int blockIdx) const;
-  bool writeBlock(int pieceIdx, int blockIdx, const std::vector<uint8_t>& data);
+  BlockBuffer readBlock(int pieceIdx, int blockIdx) const;
+  // With memory-mapped storage the view points into the mapping, so a block
+  // can be uploaded without copying; otherwise it owns a read buffer
+  BlockView readBlockView(int pieceIdx, int blockIdx) const;
+
+  // Stores the block and returns once it is held: written to storage, or,
+  // with a cache budget (StorageOptions::cacheSize), taken into the write
+  // cache and written only after its piece has hashed. When the block
+  // completes its piece, the piece is queued for hashing on a verification
+  // worker and the result is reported through the PieceVerifiedCallback.
+  // Data written to storage is not copied, and a block already held (an
+  // endgame duplicate) is dropped. Nothing is synced here: call
+  // flushWriteCache to get cached blocks to storage, and see
+  // StorageOptions::durability for when files reach the disk
+  bool writeBlock(int pieceIdx, int blockIdx, ByteSpan data);
+  bool writeBlock(int pieceIdx, int blockIdx, SharedBuffer data);
+
+  // Stores a burst of blocks at once: blocks that are back to back on disk
+  // are merged and written with one pwritev per file. Blocks may be held in
+  // the write cache, and completed pieces are queued for verification, as
+  // with writeBlock
+  bool writeBlocks(const std::vector<BlockWrite> &blocks);
+
+  // Asynchronous variants: validation happens up front (throws on error),
+  // then the request is queued on the disk job scheduler (reads as uploads,
+  // ahead of everything else) and the callback runs on a disk thread once the
+  // I/O completes, with ECANCELED if the torrent is destroyed first. A write
+  // completes once the block is held as with writeBlock, which for a block
+  // taken into the write cache means without any I/O. A completed piece is
+  // queued for verification as with writeBlock
+  void readBlockAsync(int pieceIdx, int blockIdx, ReadCompletion done);
+  void writeBlockAsync(int pieceIdx, int blockIdx, SharedBuffer data,
+                       WriteCompletion done);
+  void writeBlockAsync(int pieceIdx, int blockIdx, BlockBuffer data,
+                       WriteCompletion done);
+
+  // Where block and piece buffers come from; receive buffers taken from it
+  // are written without copying
+  const std::shared_ptr<BufferPool> &getBufferPool() const {
+    return bufferPool_;
+  }
+  BufferPoolStats getBufferPoolStats() const;
+
+  // With a cache budget, blocks are held in memory until their piece has
+  // hashed (see WriteCache). flushWriteCache writes out the partial pieces
+  // held, e.g. before the files are inspected from outside or whenever the
+  // blocks written so far must be on storage
+  void flushWriteCache();
+  WriteCacheStats getWriteCacheStats() const;
+  // Blocks of verified pieces are read through the read cache (see
+  // ReadCache); its counters give the torrent's hit rate
+  ReadCacheStats getReadCacheStats() const;
+
+  // Resume data (see ResumeData) lets a restart skip rehashing.
+  // saveResumeData syncs the storage and records the verified pieces and the
+  // blocks of partial pieces, with each file's size and mtime; it returns
+  // false without writing when nothing changed since the last save to path.
+  // loadResumeData, called before any block is written, restores that state
+  // for files whose size and mtime still match and reports what it did;
+  // pieces in other files are left to be downloaded again. Neither hashes
+  // anything. With StorageOptions::resumeDataPath set, saves also happen as
+  // pieces complete and when the torrent is destroyed
+  bool saveResumeData(const fs::path &path);
+  ResumeLoadResult loadResumeData(const fs::path &path);
+
+  // Verify everything on storage again (see RecheckJob). Pieces are
+  // hashed on a pool of threads with their reads queued as Recheck jobs,
+  // and each piece's state changes as soon as it is checked: intact pieces
+  // become verified with all their blocks, verified ones found damaged or
+  // missing are reset and dropped from the read cache. Pieces still being
+  // downloaded are left to the download, so blocks may be written while
+  // the check runs. Pieces whose state changes are reported through the
+  // PieceVerifiedCallback. startRecheck returns false if a check is already
+  // running; recheck starts one if none is and waits for it
+  bool startRecheck(const RecheckOptions &options = RecheckOptions());
+  void cancelRecheck();
+  RecheckResult waitForRecheck();
+  RecheckResult recheck(const RecheckOptions &options = RecheckOptions());
+
+  // Verification scheduling
+  void setPieceTimeCritical(int pieceIdx, bool critical);
+  void waitForVerification();
+
+  // Queued and running disk jobs per class, of every torrent sharing the
+  // scheduler
+  DiskSchedulerStats getDiskSchedulerStats() const;
+
+  // Piece selection (see PiecePicker). Peers' bitfields are added when they
+  // connect and removed when they leave, with a HAVE counting as one more
+  // piece in between; seeds are counted apart. pickPieces returns up to
+  // count pieces to request from a peer, given its bitfield (empty for a
+  // seed): pieces with blocks written first, then the rarest. Pieces
+  // verified are never picked, and come back when a check finds them
+  // damaged
+  void addPeerAvailability(const std::vector<bool> &bitfield);
+  void removePeerAvailability(const std::vector<bool> &bitfield);
+  void addPieceAvailability(int pieceIdx);
+  void addSeedAvailability();
+  void removeSeedAvailability();
+  int getPieceAvailability(int pieceIdx) const;
+  std::vector<int> pickPieces(const std::vector<bool> &peerHas, int count);
+
+  // File priorities, Normal to start with. A piece takes the highest
+  // priority of the files it overlaps, so one straddling a skipped file is
+  // still downloaded; that file is then created sparse when the piece is
+  // written, while ensureFilesExist neither creates nor preallocates it.
+  // A change updates only the file's own pieces (throws on a bad index)
+  void setFilePriority(size_t fileIdx, DownloadPriority priority);
+  void setFilePriorities(const std::vector<DownloadPriority> &priorities);
+  DownloadPriority getFilePriority(size_t fileIdx) const;
+  DownloadPriority getPiecePriority(int pieceIdx) const;
 
   // Hash operations
   const Hash &getHash(int pieceIdx) const;
   const Hash &getInfoHash() const;
 
-  int getUploaded() const;
-  int getDownloaded() const;
+  // Byte counts for the tracker, 64-bit: torrents run well past 4 GiB
+  uint64_t getUploaded() const;
+  uint64_t getDownloaded() const;
   int getVerifiedPieceCount() const;
-  int getLeft() const;
+  uint64_t getLeft() const;
 
-  // Callback management
+  // Callback management. The callback runs on a verification worker thread
+  // for pieces completed through writeBlock
   void setPieceVerifiedCallback(PieceVerifiedCallback callback);
 
-  // File operations (throw on error)
+  // File operations (throw on error). With AllocationMode::Full,
+  // ensureFilesExist returns while space is still being reserved
   void ensureFilesExist();
+  AllocationStatus getAllocationStatus() const;
+  StorageStat getStorageStat() const;
   void closeFiles();
   
   // Tracker utilities
@@ -73,19 +211,23 @@ public:
   const std::vector<FileItem> &getFiles() const { return files_; }
   const std::string &getDownloadDirectory() const { return downloadDirectory_; }
   const TorrentMetadata &getMetadata() const { return metadata_; }
-  size_t getTotalSize() const { return totalSize_; }
+  uint64_t getTotalSize() const { return totalSize_; }
 
   // Progress tracking
   double getProgress() const;
-  size_t getDownloadedBytes() const;
+  uint64_t getDownloadedBytes() const;
 
   // Static methods for serialization (throw on error)
   static TorrentPtr loadFromFile(fs::path filePath,
-                                 fs::path downloadDir);
+                                 fs::path downloadDir,
+                                 const StorageOptions &storageOptions =
+                                     StorageOptions());
   static void saveToFile(TorrentPtr torrent, fs::path outputPath);
 
   static TorrentPtr fromBEncodedObj(BEncodedValuePtr object,
-                                    const std::string &downloadPath);
+                                    const std::string &downloadPath,
+                                    const StorageOptions &storageOptions =
+                                        StorageOptions());
   static BEncodedValuePtr toBEncodedObj(TorrentPtr torrent);
 
   static TorrentPtr create(const fs::path &path,
@@ -96,11 +238,29 @@ private:
   // Helper methods
   void validatePieceIndex(int pieceIdx) const;
   void validateBlockIndex(int pieceIdx, int blockIdx) const;
-  size_t calculateTotalSize() const;
-  int calculateBlockOffset(int pieceIdx, int blockIdx) const;
+  uint64_t calculateTotalSize() const;
+  // Position of a piece or block in the torrent's byte stream
+  uint64_t calculatePieceOffset(int pieceIdx) const;
+  uint64_t calculateBlockOffset(int pieceIdx, int blockIdx) const;
+  // The highest priority among the files a piece overlaps
+  DownloadPriority calculatePiecePriority(int pieceIdx) const;
+  void verifyCompletedPiece(int pieceIdx);
+  // The storage's device extents, never empty
+  std::vector<DeviceExtent> deviceExtents(uint64_t start, size_t count) const;
+  void acquireBlock(int pieceIdx, int blockIdx);
+  void recheckPiece(int pieceIdx, const std::vector<DataExtent> *data,
+                    RecheckResult &tally);
+  const Hash &zeroHash(int pieceIdx);
+  void notifyPieceVerified(int pieceIdx, bool verified);
+  bool saveResumeDataLocked(const fs::path &path);
+  void saveResumeDataPeriodically();
+  template <typename Buffer>
+  void writeBlockAsyncImpl(int pieceIdx, int blockIdx, Buffer data,
+                           WriteCompletion done);
 
-  std::vector<uint8_t> read(size_t start, size_t count) const;
-  void write(size_t start, const std::vector<uint8_t>& buffer);
+  BlockBuffer read(uint64_t start, size_t count) const;
+  void write(uint64_t start, ByteSpan buffer);
+  class AsyncDiskIO &asyncIO() const;
 
   static BEncodedValuePtr torrentInfoToBEncodedObj(TorrentPtr torrent);
 
@@ -109,18 +269,60 @@ private:
   std::vector<FileItem> files_;
   std::string downloadDirectory_;
   std::vector<std::unique_ptr<Tracker>> trackers_;
-  size_t totalSize_;
-  int uploaded_;
-  std::vector<std::vector<bool>> blockAcquired_;
+  uint64_t totalSize_;
+  uint64_t uploaded_ = 0;
+  std::unique_ptr<BlockStateTable> blockStates_;
+
+  // Block storage: the torrent's files or another backend
+  StorageOptions storageOptions_;
+  std::shared_ptr<BufferPool> bufferPool_;
+  std::shared_ptr<CacheBudget> cacheBudget_;
+  std::unique_ptr<WriteCache> writeCache_;
+  std::unique_ptr<ReadCache> readCache_;
+  std::unique_ptr<Storage> storage_;
 
-  // File management
-  std::unique_ptr<class FileManager> fileManager_;
+  // Started on first asynchronous request
+  mutable std::once_flag asyncIOOnce_;
+  mutable std::unique_ptr<class AsyncDiskIO> asyncIO_;
+
+  // Asynchronous block I/O and verification reads, by priority; jobs are
+  // submitted as diskOwner_ so that leaving a shared scheduler cancels only
+  // this torrent's
+  std::shared_ptr<DiskJobScheduler> diskScheduler_;
+  uint64_t diskOwner_ = 0;
 
   // Piece verification
   std::unique_ptr<PieceVerifier> verifier_;
+  std::unique_ptr<VerificationQueue> verificationQueue_;
+  PieceVerifiedCallback pieceVerifiedCallback_;
 
-  // Thread safety
+  // Guards the verified callback; block state is lock-free
   mutable std::mutex mutex_;
+
+  // Piece selection, one caller at a time, and the file priorities it
+  // follows
+  std::unique_ptr<PiecePicker> picker_;
+  std::vector<DownloadPriority> filePriorities_;
+  mutable std::mutex pickerMutex_;
+  // Pieces the picker holds as partial, so that later blocks of a piece
+  // write without taking pickerMutex_
+  std::unique_ptr<std::atomic<bool>[]> partialPieces_;
+
+  // The running or last recheck. Hashes of all-zero pieces, for those
+  // found in holes; the last piece may be shorter
+  std::mutex recheckMutex_;
+  std::shared_ptr<RecheckJob> recheck_;
+  std::once_flag zeroHashOnce_[2];
+  Hash zeroHash_[2]{};
+
+  // Resume data: bumped on every block and piece state change, so saves of
+  // an unchanged state can be skipped
+  std::atomic<uint64_t> stateGeneration_{0};
+  std::mutex resumeMutex_;
+  uint64_t savedGeneration_ = 0;
+  fs::path savedResumePath_;
+  std::chrono::steady_clock::time_point lastResumeSave_ =
+      std::chrono::steady_clock::now();
 };
 
 } // namespace LitTorrent
@@ -2,7 +2,9 @@
 
 #include <array>
 #include <cstdint>
+#include <ctime>
 #include <optional>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -50,6 +52,25 @@ inline Hash BytesToHash(const std::string &bytes) {
   return hash;
 }
 
+// Convert a 40-character hex digest (as produced by SHA1::computeHash) to Hash
+inline Hash HexToHash(const std::string &hex) {
+  if (hex.size() != 40) {
+    throw std::invalid_argument("Hex hash must be exactly 40 characters");
+  }
+  auto nibble = [](char c) -> uint8_t {
+    if (c >= '0' && c <= '9') return static_cast<uint8_t>(c - '0');
+    if (c >= 'a' && c <= 'f') return static_cast<uint8_t>(c - 'a' + 10);
+    if (c >= 'A' && c <= 'F') return static_cast<uint8_t>(c - 'A' + 10);
+    throw std::invalid_argument("Invalid hex character in hash");
+  };
+  Hash hash;
+  for (size_t i = 0; i < hash.size(); i++) {
+    hash[i] = static_cast<uint8_t>((nibble(hex[2 * i]) << 4) |
+                                   nibble(hex[2 * i + 1]));
+  }
+  return hash;
+}
+
 // Convert Hash to raw bytes
 inline std::string HashToBytes(const Hash &hash) {
   return std::string(hash.begin(), hash.end());
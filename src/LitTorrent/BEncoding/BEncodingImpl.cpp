@@ -1,6 +1,7 @@
 #include "BEncodingImpl.h"
 #include "LitTorrent/BEncoding.h"
 
+#include <algorithm>
 #include <fstream>
 #include <iomanip>
 #include <sstream>
@@ -0,0 +1,57 @@
+#include "BlockStateTable.h"
+
+namespace LitTorrent {
+
+BlockStateTable::BlockStateTable(int pieceCount, int blocksPerPiece,
+                                 int lastPieceBlocks)
+    : pieceCount_(pieceCount), blocksPerPiece_(blocksPerPiece),
+      lastPieceBlocks_(lastPieceBlocks),
+      acquired_(static_cast<size_t>(pieceCount) * blocksPerPiece),
+      remaining_(new std::atomic<int32_t>[pieceCount > 0 ? pieceCount : 1]) {
+  for (int i = 0; i < pieceCount_; i++) {
+    remaining_[i].store(getBlockCount(i), std::memory_order_relaxed);
+  }
+}
+
+int BlockStateTable::getBlockCount(int pieceIdx) const {
+  return pieceIdx == pieceCount_ - 1 ? lastPieceBlocks_ : blocksPerPiece_;
+}
+
+bool BlockStateTable::markAcquired(int pieceIdx, int blockIdx) {
+  if (acquired_.set(bitIndex(pieceIdx, blockIdx))) {
+    return false; // Duplicate block
+  }
+  return remaining_[pieceIdx].fetch_sub(1, std::memory_order_acq_rel) == 1;
+}
+
+void BlockStateTable::markPieceAcquired(int pieceIdx) {
+  size_t begin = bitIndex(pieceIdx, 0);
+  size_t newlySet = acquired_.setRange(begin, begin + getBlockCount(pieceIdx));
+  remaining_[pieceIdx].fetch_sub(static_cast<int32_t>(newlySet),
+                                 std::memory_order_acq_rel);
+}
+
+void BlockStateTable::resetPiece(int pieceIdx) {
+  // The counter is 0 for a complete piece. Clearing bits first and adding
+  // them back afterwards means a block arriving in between only drives the
+  // counter negative, so it can never be mistaken for the completing block
+  size_t begin = bitIndex(pieceIdx, 0);
+  size_t cleared =
+      acquired_.resetRange(begin, begin + getBlockCount(pieceIdx));
+  remaining_[pieceIdx].fetch_add(static_cast<int32_t>(cleared),
+                                 std::memory_order_acq_rel);
+}
+
+bool BlockStateTable::isAcquired(int pieceIdx, int blockIdx) const {
+  return acquired_.test(bitIndex(pieceIdx, blockIdx));
+}
+
+bool BlockStateTable::isPieceComplete(int pieceIdx) const {
+  return getRemainingBlocks(pieceIdx) == 0;
+}
+
+int BlockStateTable::getRemainingBlocks(int pieceIdx) const {
+  return remaining_[pieceIdx].load(std::memory_order_acquire);
+}
+
+} // namespace LitTorrent
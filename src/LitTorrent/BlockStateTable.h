@@ -0,0 +1,53 @@
+#pragma once
+
+#include "../Utils/AtomicBitfield.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace LitTorrent {
+
+// Tracks which blocks of every piece have been written. All blocks share one
+// contiguous bitmap and each piece keeps an atomic count of blocks still
+// missing, so marking a block and detecting piece completion costs one
+// fetch_or and one fetch_sub with no lock
+class BlockStateTable {
+public:
+  // Every piece but the last has blocksPerPiece blocks
+  BlockStateTable(int pieceCount, int blocksPerPiece, int lastPieceBlocks);
+
+  // Disable copy and move
+  BlockStateTable(const BlockStateTable &) = delete;
+  BlockStateTable &operator=(const BlockStateTable &) = delete;
+
+  int getPieceCount() const { return pieceCount_; }
+  int getBlockCount(int pieceIdx) const;
+
+  // Mark a block as written. Returns true for exactly one caller: the one
+  // whose block completed the piece
+  bool markAcquired(int pieceIdx, int blockIdx);
+
+  // Mark every block of the piece as written
+  void markPieceAcquired(int pieceIdx);
+
+  // Forget all blocks of a completed piece (e.g. after a hash mismatch).
+  // Blocks written while the reset is in progress are kept
+  void resetPiece(int pieceIdx);
+
+  bool isAcquired(int pieceIdx, int blockIdx) const;
+  bool isPieceComplete(int pieceIdx) const;
+  int getRemainingBlocks(int pieceIdx) const;
+
+private:
+  size_t bitIndex(int pieceIdx, int blockIdx) const {
+    return static_cast<size_t>(pieceIdx) * blocksPerPiece_ + blockIdx;
+  }
+
+  int pieceCount_;
+  int blocksPerPiece_;
+  int lastPieceBlocks_;
+  AtomicBitfield acquired_;
+  std::unique_ptr<std::atomic<int32_t>[]> remaining_;
+};
+
+} // namespace LitTorrent
@@ -0,0 +1,336 @@
+#include "LitTorrent/DiskJobScheduler.h"
+#include "Error.h"
+#include "Logger.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+namespace LitTorrent {
+
+DiskJobScheduler::DiskJobScheduler(
+    unsigned threadsPerDevice, std::array<unsigned, kDiskJobClassCount> limits)
+    : threadsPerDevice_(threadsPerDevice), limits_(limits) {
+  if (threadsPerDevice_ == 0) {
+    threadsPerDevice_ = std::max(1u, std::thread::hardware_concurrency());
+  }
+}
+
+DiskJobScheduler::~DiskJobScheduler() { stop(); }
+
+DiskJobScheduler::Device *DiskJobScheduler::getDeviceLocked(uint64_t device) {
+  auto &slot = devices_[device];
+  if (!slot) {
+    slot = std::make_unique<Device>();
+    slot->id = device;
+    for (size_t c = 0; c < kDiskJobClassCount; c++) {
+      slot->queues[c].limit = limits_[c];
+    }
+    slot->workers.reserve(threadsPerDevice_);
+    for (unsigned i = 0; i < threadsPerDevice_; i++) {
+      slot->workers.emplace_back(&DiskJobScheduler::workerLoop, this,
+                                 std::ref(*slot));
+    }
+  }
+  return slot.get();
+}
+
+uint64_t DiskJobScheduler::addOwner() {
+  std::lock_guard<std::mutex> lock(devicesMutex_);
+  uint64_t owner = nextOwner_++;
+  owners_.insert(owner);
+  return owner;
+}
+
+void DiskJobScheduler::removeOwner(uint64_t owner) {
+  std::vector<Device *> devices;
+  {
+    std::lock_guard<std::mutex> lock(devicesMutex_);
+    owners_.erase(owner);
+    for (auto &device : devices_) {
+      devices.push_back(device.second.get());
+    }
+  }
+
+  for (Device *device : devices) {
+    std::vector<Cancel> cancels;
+    {
+      std::lock_guard<std::mutex> lock(device->mutex);
+      for (auto &queue : device->queues) {
+        auto first = queue.jobs.lower_bound({owner, 0});
+        auto last = queue.jobs.lower_bound({owner + 1, 0});
+        for (auto it = first; it != last; ++it) {
+          if (it->second.cancel) {
+            cancels.push_back(std::move(it->second.cancel));
+          }
+          queue.cancelled++;
+          device->queued--;
+        }
+        queue.jobs.erase(first, last);
+      }
+      if (device->queued == 0 && device->running == 0) {
+        device->idle.notify_all();
+      }
+    }
+    for (auto &cancel : cancels) {
+      cancel();
+    }
+
+    std::unique_lock<std::mutex> lock(device->mutex);
+    device->idle.wait(lock, [&] {
+      return device->ownersRunning.count(owner) == 0;
+    });
+  }
+}
+
+void DiskJobScheduler::submit(DiskJobClass jobClass, uint64_t device,
+                              uint64_t position, Job job, Cancel cancel,
+                              uint64_t owner) {
+  size_t c = static_cast<size_t>(jobClass);
+  {
+    std::lock_guard<std::mutex> lock(devicesMutex_);
+    if (!stopping_ && (owner == 0 || owners_.count(owner) != 0)) {
+      Device *target = getDeviceLocked(device);
+      std::lock_guard<std::mutex> deviceLock(target->mutex);
+      target->queues[c].jobs.emplace(
+          std::make_pair(owner, position),
+          Entry{std::move(job), std::move(cancel), Clock::now(), owner});
+      target->queued++;
+      target->workAvailable.notify_one();
+      return;
+    }
+    // Rejected after stop() or removeOwner()
+    rejected_[c]++;
+  }
+  if (cancel) {
+    cancel();
+  }
+}
+
+void DiskJobScheduler::run(DiskJobClass jobClass, uint64_t device,
+                           uint64_t position, std::function<void()> fn,
+                           uint64_t owner) {
+  struct State {
+    std::mutex mutex;
+    std::condition_variable finished;
+    bool done = false;
+    bool cancelled = false;
+    std::exception_ptr error;
+  };
+  auto state = std::make_shared<State>();
+
+  auto finish = [state](bool cancelled, std::exception_ptr error) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->done = true;
+    state->cancelled = cancelled;
+    state->error = error;
+    state->finished.notify_all();
+  };
+
+  submit(
+      jobClass, device, position,
+      [fn = std::move(fn), finish](Done done) {
+        std::exception_ptr error;
+        try {
+          fn();
+        } catch (...) {
+          error = std::current_exception();
+        }
+        done();
+        finish(false, error);
+      },
+      [finish] { finish(true, nullptr); }, owner);
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->finished.wait(lock, [&] { return state->done; });
+  if (state->cancelled) {
+    throw TorrentException(ErrorCode::FileReadError,
+                           "Disk job cancelled before it ran");
+  }
+  if (state->error) {
+    std::rethrow_exception(state->error);
+  }
+}
+
+void DiskJobScheduler::waitIdle() {
+  std::vector<Device *> devices;
+  {
+    std::lock_guard<std::mutex> lock(devicesMutex_);
+    for (auto &device : devices_) {
+      devices.push_back(device.second.get());
+    }
+  }
+  for (Device *device : devices) {
+    std::unique_lock<std::mutex> lock(device->mutex);
+    device->idle.wait(lock, [device] {
+      return device->queued == 0 && device->running == 0;
+    });
+  }
+}
+
+void DiskJobScheduler::stop() {
+  {
+    std::lock_guard<std::mutex> lock(devicesMutex_);
+    if (stopping_) {
+      return;
+    }
+    stopping_ = true;
+  }
+  // No device is added once stopping_ is set
+  for (auto &device : devices_) {
+    stopDevice(*device.second);
+  }
+}
+
+void DiskJobScheduler::stopDevice(Device &device) {
+  std::vector<Cancel> cancels;
+  {
+    std::lock_guard<std::mutex> lock(device.mutex);
+    device.stopping = true;
+    for (auto &queue : device.queues) {
+      for (auto &job : queue.jobs) {
+        if (job.second.cancel) {
+          cancels.push_back(std::move(job.second.cancel));
+        }
+      }
+      queue.cancelled += queue.jobs.size();
+      queue.jobs.clear();
+    }
+    device.queued = 0;
+  }
+  device.workAvailable.notify_all();
+
+  for (auto &cancel : cancels) {
+    cancel();
+  }
+  for (auto &worker : device.workers) {
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+
+  // Asynchronous jobs may still be completing on other threads
+  std::unique_lock<std::mutex> lock(device.mutex);
+  device.idle.wait(lock, [&] { return device.running == 0; });
+}
+
+bool DiskJobScheduler::popNext(Device &device, Entry &entry,
+                               size_t &jobClass) {
+  for (size_t c = 0; c < kDiskJobClassCount; c++) {
+    Queue &queue = device.queues[c];
+    if (queue.jobs.empty() ||
+        (queue.limit != 0 && queue.running >= queue.limit)) {
+      continue;
+    }
+
+    // Continue the sweep from the last position, wrapping to the start
+    auto it = queue.jobs.lower_bound(queue.head);
+    if (it == queue.jobs.end()) {
+      it = queue.jobs.begin();
+    }
+    queue.head = it->first;
+    entry = std::move(it->second);
+    queue.jobs.erase(it);
+    queue.running++;
+    device.queued--;
+    device.running++;
+    if (entry.owner != 0) {
+      device.ownersRunning[entry.owner]++;
+    }
+    jobClass = c;
+    return true;
+  }
+  return false;
+}
+
+void DiskJobScheduler::complete(Device &device, size_t jobClass,
+                                Clock::time_point submitted, uint64_t owner) {
+  double latencyUs =
+      std::chrono::duration<double, std::micro>(Clock::now() - submitted)
+          .count();
+  {
+    std::lock_guard<std::mutex> lock(device.mutex);
+    device.queues[jobClass].running--;
+    device.queues[jobClass].completed++;
+    device.running--;
+    device.totalLatencyUs += latencyUs;
+    device.maxLatencyUs = std::max(device.maxLatencyUs, latencyUs);
+    bool ownerIdle = false;
+    if (owner != 0) {
+      auto it = device.ownersRunning.find(owner);
+      if (--it->second == 0) {
+        device.ownersRunning.erase(it);
+        ownerIdle = true;
+      }
+    }
+    if (ownerIdle || (device.queued == 0 && device.running == 0)) {
+      device.idle.notify_all();
+    }
+  }
+  // A class below its limit again may unblock any waiting thread
+  device.workAvailable.notify_all();
+}
+
+void DiskJobScheduler::workerLoop(Device &device) {
+  std::unique_lock<std::mutex> lock(device.mutex);
+  while (true) {
+    Entry entry;
+    size_t jobClass = 0;
+    device.workAvailable.wait(lock, [&] {
+      return device.stopping || popNext(device, entry, jobClass);
+    });
+    if (device.stopping) {
+      return;
+    }
+
+    lock.unlock();
+    auto finished = std::make_shared<std::atomic<bool>>(false);
+    Clock::time_point submitted = entry.submitted;
+    uint64_t owner = entry.owner;
+    Done done = [this, &device, jobClass, submitted, owner, finished] {
+      if (!finished->exchange(true)) {
+        complete(device, jobClass, submitted, owner);
+      }
+    };
+    try {
+      entry.job(done);
+    } catch (const std::exception &e) {
+      LOG_ERROR("Disk job failed: %s", e.what());
+      done();
+    }
+    lock.lock();
+  }
+}
+
+DiskSchedulerStats DiskJobScheduler::getStats() const {
+  DiskSchedulerStats stats;
+  std::lock_guard<std::mutex> lock(devicesMutex_);
+  for (size_t c = 0; c < kDiskJobClassCount; c++) {
+    stats.classes[c].cancelled = rejected_[c];
+  }
+
+  for (const auto &slot : devices_) {
+    Device &device = *slot.second;
+    std::lock_guard<std::mutex> deviceLock(device.mutex);
+    DiskDeviceStats deviceStats;
+    deviceStats.device = device.id;
+    deviceStats.queued = device.queued;
+    deviceStats.running = device.running;
+    for (size_t c = 0; c < kDiskJobClassCount; c++) {
+      const Queue &queue = device.queues[c];
+      stats.classes[c].queued += queue.jobs.size();
+      stats.classes[c].running += queue.running;
+      stats.classes[c].completed += queue.completed;
+      stats.classes[c].cancelled += queue.cancelled;
+      deviceStats.completed += queue.completed;
+    }
+    if (deviceStats.completed > 0) {
+      deviceStats.averageLatencyUs =
+          device.totalLatencyUs / static_cast<double>(deviceStats.completed);
+    }
+    deviceStats.maxLatencyUs = device.maxLatencyUs;
+    stats.devices.push_back(deviceStats);
+  }
+  return stats;
+}
+
+} // namespace LitTorrent
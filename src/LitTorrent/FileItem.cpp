@@ -1,7 +1,7 @@
 #include "FileItem.h"
 
 namespace LitTorrent {
-size_t FileItem::getSize() const { return size_; }
-int FileItem::getOffset() const { return offset_; }
-std::filesystem::path FileItem::getFilePath() const { return path_; }
+uint64_t FileItem::getSize() const { return size_; }
+int64_t FileItem::getOffset() const { return offset_; }
+const std::filesystem::path &FileItem::getFilePath() const { return path_; }
 } // namespace LitTorrent
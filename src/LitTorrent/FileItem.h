@@ -1,21 +1,23 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
 namespace LitTorrent {
 class FileItem {
 public:
-  FileItem(const std::filesystem::path &path, const size_t &size,
-           const int &offset = 0)
-      : offset_(offset), path_(path), size_(size) {}
+  // offset is the file's position in the torrent's byte stream
+  FileItem(const std::filesystem::path &path, const uint64_t &size,
+           const int64_t &offset = 0)
+      : path_(path), size_(size), offset_(offset) {}
 
-  size_t getSize() const;
-  int getOffset() const;
-  std::filesystem::path getFilePath() const;
+  uint64_t getSize() const;
+  int64_t getOffset() const;
+  const std::filesystem::path &getFilePath() const;
 
 private:
   std::filesystem::path path_;
-  size_t size_;
-  int offset_;
+  uint64_t size_;
+  int64_t offset_;
 };
 } // namespace LitTorrent
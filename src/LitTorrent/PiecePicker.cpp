@@ -0,0 +1,247 @@
+#include "PiecePicker.h"
+#include <algorithm>
+#include <numeric>
+
+namespace LitTorrent {
+
+namespace {
+namespace Internal {
+static constexpr int kPartialReserve = 256;
+} // namespace Internal
+} // namespace
+
+PiecePicker::PiecePicker(int pieceCount, uint32_t seed)
+    : availability_(pieceCount, 0), position_(pieceCount),
+      priority_(pieceCount, static_cast<uint8_t>(DownloadPriority::Normal)),
+      state_(pieceCount, 0), rng_(seed) {
+  // Pieces start shuffled, so ties among them fall at random
+  Level &level = levels_[static_cast<int>(DownloadPriority::Normal) - 1];
+  level.order.resize(pieceCount);
+  std::iota(level.order.begin(), level.order.end(), 0);
+  std::shuffle(level.order.begin(), level.order.end(), rng_);
+  level.bucketStart = {0, pieceCount};
+  for (int32_t i = 0; i < pieceCount; i++) {
+    position_[level.order[i]] = i;
+  }
+  // Room for the usual number of pieces in flight, so that starting one
+  // does not allocate on the block write path
+  partial_.reserve(std::min(pieceCount, Internal::kPartialReserve));
+}
+
+void PiecePicker::swapPositions(Level &level, int32_t a, int32_t b) {
+  int32_t pieceA = level.order[a];
+  int32_t pieceB = level.order[b];
+  level.order[a] = pieceB;
+  level.order[b] = pieceA;
+  position_[pieceA] = b;
+  position_[pieceB] = a;
+}
+
+void PiecePicker::trimBuckets(Level &level) {
+  while (level.bucketCount() > 1 &&
+         level.bucketStart[level.bucketCount() - 1] ==
+             level.bucketStart[level.bucketCount()]) {
+    level.bucketStart.pop_back();
+  }
+}
+
+void PiecePicker::incAvailability(int piece) {
+  int32_t avail = availability_[piece]++;
+  int32_t pos = position_[piece];
+  if (pos < 0) {
+    return;
+  }
+  Level &level = levelOf(piece);
+  if (avail + 1 == level.bucketCount()) {
+    level.bucketStart.push_back(static_cast<int32_t>(level.order.size()));
+  }
+  // Last of its bucket, then first of the next
+  int32_t last = level.bucketStart[avail + 1] - 1;
+  swapPositions(level, pos, last);
+  level.bucketStart[avail + 1]--;
+}
+
+void PiecePicker::decAvailability(int piece) {
+  if (availability_[piece] == 0) {
+    return;
+  }
+  int32_t avail = availability_[piece]--;
+  int32_t pos = position_[piece];
+  if (pos < 0) {
+    return;
+  }
+  // First of its bucket, then last of the previous
+  Level &level = levelOf(piece);
+  int32_t first = level.bucketStart[avail];
+  swapPositions(level, pos, first);
+  level.bucketStart[avail]++;
+  trimBuckets(level);
+}
+
+void PiecePicker::addPeer(const std::vector<bool> &bitfield) {
+  size_t end = std::min(bitfield.size(), availability_.size());
+  for (size_t piece = 0; piece < end; piece++) {
+    if (bitfield[piece]) {
+      incAvailability(static_cast<int>(piece));
+    }
+  }
+}
+
+void PiecePicker::removePeer(const std::vector<bool> &bitfield) {
+  size_t end = std::min(bitfield.size(), availability_.size());
+  for (size_t piece = 0; piece < end; piece++) {
+    if (bitfield[piece]) {
+      decAvailability(static_cast<int>(piece));
+    }
+  }
+}
+
+void PiecePicker::erase(int piece) {
+  // Up through the buckets above to the end of the array
+  Level &level = levelOf(piece);
+  int32_t pos = position_[piece];
+  for (int bucket = availability_[piece]; bucket < level.bucketCount();
+       bucket++) {
+    int32_t last = level.bucketStart[bucket + 1] - 1;
+    swapPositions(level, pos, last);
+    pos = last;
+    level.bucketStart[bucket + 1]--;
+  }
+  level.order.pop_back();
+  position_[piece] = -1;
+  trimBuckets(level);
+}
+
+void PiecePicker::insert(int piece) {
+  // In at the end of the array and down to its own bucket
+  Level &level = levelOf(piece);
+  int32_t avail = availability_[piece];
+  while (level.bucketCount() <= avail) {
+    level.bucketStart.push_back(static_cast<int32_t>(level.order.size()));
+  }
+  int32_t pos = static_cast<int32_t>(level.order.size());
+  level.order.push_back(piece);
+  position_[piece] = pos;
+  level.bucketStart.back()++;
+  for (int bucket = level.bucketCount() - 1; bucket > avail; bucket--) {
+    int32_t first = level.bucketStart[bucket];
+    swapPositions(level, pos, first);
+    pos = first;
+    level.bucketStart[bucket]++;
+  }
+}
+
+void PiecePicker::setHave(int piece, bool have) {
+  if (have == this->have(piece)) {
+    return;
+  }
+  if (have) {
+    setPartial(piece, false);
+    state_[piece] |= kHave;
+    if (listed(piece)) {
+      erase(piece);
+    }
+    return;
+  }
+  state_[piece] &= ~kHave;
+  if (getPriority(piece) != DownloadPriority::Skip) {
+    insert(piece);
+  }
+}
+
+void PiecePicker::setPriority(int piece, DownloadPriority priority) {
+  if (priority == getPriority(piece)) {
+    return;
+  }
+  if (listed(piece)) {
+    erase(piece);
+  }
+  priority_[piece] = static_cast<uint8_t>(priority);
+  if (priority != DownloadPriority::Skip && !have(piece)) {
+    insert(piece);
+  }
+}
+
+void PiecePicker::setPartial(int piece, bool partial) {
+  if (partial == isPartial(piece) || (partial && have(piece))) {
+    return;
+  }
+  if (partial) {
+    state_[piece] |= kPartial;
+    partial_.push_back(piece);
+  } else {
+    state_[piece] &= ~kPartial;
+    auto it = std::find(partial_.begin(), partial_.end(), piece);
+    *it = partial_.back();
+    partial_.pop_back();
+  }
+}
+
+std::vector<int> PiecePicker::pick(const std::vector<bool> &peerHas,
+                                   int count) {
+  std::vector<int> picked;
+  if (count <= 0) {
+    return picked;
+  }
+  bool seed = peerHas.empty();
+  auto peerHasPiece = [&](int32_t piece) {
+    return seed || (static_cast<size_t>(piece) < peerHas.size() &&
+                    peerHas[piece]);
+  };
+
+  // Partial pieces by priority, then rarest first; shuffled first so that
+  // the sort, being stable, breaks ties at random. Skipped ones are left
+  // where they are
+  std::vector<int32_t> candidates;
+  for (int32_t piece : partial_) {
+    if (listed(piece) && peerHasPiece(piece)) {
+      candidates.push_back(piece);
+    }
+  }
+  std::shuffle(candidates.begin(), candidates.end(), rng_);
+  std::stable_sort(candidates.begin(), candidates.end(),
+                   [&](int32_t a, int32_t b) {
+                     if (priority_[a] != priority_[b]) {
+                       return priority_[a] > priority_[b];
+                     }
+                     return availability_[a] < availability_[b];
+                   });
+
+  auto partial = candidates.begin();
+  for (int index = kLevelCount - 1; index >= 0; index--) {
+    for (; partial != candidates.end() && priority_[*partial] == index + 1;
+         partial++) {
+      picked.push_back(*partial);
+      if (static_cast<int>(picked.size()) == count) {
+        return picked;
+      }
+    }
+
+    // Then the buckets in order, each from a random point. A peer that is
+    // not a seed counts towards every piece it has, so it has none of
+    // those nobody holds but seeds
+    const Level &level = levels_[index];
+    for (int bucket = seed ? 0 : 1; bucket < level.bucketCount(); bucket++) {
+      int32_t begin = level.bucketStart[bucket];
+      int32_t size = level.bucketStart[bucket + 1] - begin;
+      if (size == 0) {
+        continue;
+      }
+      int32_t start =
+          std::uniform_int_distribution<int32_t>(0, size - 1)(rng_);
+      for (int32_t i = 0; i < size; i++) {
+        int32_t piece = level.order[begin + (start + i) % size];
+        if (isPartial(piece) || !peerHasPiece(piece)) {
+          continue;
+        }
+        picked.push_back(piece);
+        if (static_cast<int>(picked.size()) == count) {
+          return picked;
+        }
+      }
+    }
+  }
+  return picked;
+}
+
+} // namespace LitTorrent
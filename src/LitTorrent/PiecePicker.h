@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace LitTorrent {
+
+// How much a file, or a piece, is wanted. Skipped pieces are never picked
+enum class DownloadPriority : uint8_t { Skip = 0, Low, Normal, High };
+
+// Chooses the pieces to request from a peer: higher priorities first, and
+// within a priority pieces started already first, so partial pieces are
+// finished rather than multiplied, then rarest-first with ties broken at
+// random.
+//
+// The pieces still wanted are kept in one array per priority sorted by
+// availability, each availability a contiguous bucket of it, with every
+// piece's position alongside. A peer announcing or losing a piece moves it
+// to the edge of its bucket and shifts the boundary by one, so availability
+// changes are O(1) with no allocation. Taking a piece out of its array
+// (once we have it, or when its priority changes) or putting it back moves
+// it through the buckets above its own, one swap each. Seeds have every
+// piece, so they are counted on their own and leave the order alone.
+//
+// Not thread-safe: the owner serializes calls
+class PiecePicker {
+public:
+  explicit PiecePicker(int pieceCount,
+                       uint32_t seed = std::random_device{}());
+
+  // Disable copy and move
+  PiecePicker(const PiecePicker &) = delete;
+  PiecePicker &operator=(const PiecePicker &) = delete;
+
+  int getPieceCount() const { return static_cast<int>(availability_.size()); }
+
+  // Peers holding the piece, seeds included
+  int getAvailability(int piece) const { return availability_[piece] + seeds_; }
+
+  // A peer's bitfield when it connects and when it leaves, its HAVE
+  // messages in between. A bitfield may be shorter than the piece count;
+  // the pieces past its end are not held. Decrementing a piece no peer
+  // holds is ignored
+  void incAvailability(int piece);
+  void decAvailability(int piece);
+  void addPeer(const std::vector<bool> &bitfield);
+  void removePeer(const std::vector<bool> &bitfield);
+  void addSeed() { seeds_++; }
+  void removeSeed() { seeds_ -= seeds_ > 0; }
+
+  // Pieces we have are never picked
+  void setHave(int piece, bool have);
+  bool have(int piece) const { return (state_[piece] & kHave) != 0; }
+
+  // Pieces start at Normal. A change moves one piece, so a file's pieces
+  // are re-prioritized without touching the others
+  void setPriority(int piece, DownloadPriority priority);
+  DownloadPriority getPriority(int piece) const {
+    return static_cast<DownloadPriority>(priority_[piece]);
+  }
+
+  // Pieces with blocks written or requested are picked before any other of
+  // their priority. Setting a piece we have is ignored
+  void setPartial(int piece, bool partial);
+  bool isPartial(int piece) const { return (state_[piece] & kPartial) != 0; }
+  int getPartialCount() const { return static_cast<int>(partial_.size()); }
+
+  // Up to count pieces that the peer has and we want, in the order above.
+  // An empty bitfield stands for a seed
+  std::vector<int> pick(const std::vector<bool> &peerHas, int count);
+
+private:
+  static constexpr uint8_t kHave = 1;
+  static constexpr uint8_t kPartial = 2;
+  static constexpr int kLevelCount = 3; // Low, Normal, High
+
+  // The wanted pieces of one priority. bucketStart[a] is where pieces held
+  // by a peers start in order; the last entry is order.size()
+  struct Level {
+    std::vector<int32_t> order;
+    std::vector<int32_t> bucketStart{0, 0};
+
+    int bucketCount() const { return static_cast<int>(bucketStart.size()) - 1; }
+  };
+
+  Level &levelOf(int piece) { return levels_[priority_[piece] - 1]; }
+  bool listed(int piece) const { return position_[piece] >= 0; }
+  void swapPositions(Level &level, int32_t a, int32_t b);
+  void insert(int piece);
+  void erase(int piece);
+  // Drop empty buckets off the top
+  static void trimBuckets(Level &level);
+
+  std::vector<int32_t> availability_; // per piece, seeds not counted
+  std::vector<int32_t> position_;     // index in its level, -1 if unlisted
+  std::vector<uint8_t> priority_;     // DownloadPriority
+  std::vector<uint8_t> state_;        // kHave, kPartial
+  Level levels_[kLevelCount];
+  int seeds_ = 0;
+
+  std::vector<int32_t> partial_; // few at a time: peers x pieces in flight
+
+  std::mt19937 rng_;
+};
+
+} // namespace LitTorrent
@@ -5,36 +5,63 @@
 
 namespace LitTorrent {
 
-PieceVerifier::PieceVerifier(const std::vector<Hash> &expectedHashes)
-    : expectedHashes_(expectedHashes), verified_(expectedHashes.size(), false) {
-}
+PieceVerifier::PieceVerifier(const std::vector<Hash> &expectedHashes,
+                             int64_t pieceSize, int64_t totalSize)
+    : expectedHashes_(expectedHashes), pieceSize_(pieceSize),
+      totalSize_(totalSize), verified_(expectedHashes.size()) {}
 
-Hash PieceVerifier::computeHash(const std::vector<uint8_t> &data) const {
+Hash PieceVerifier::computeHash(ByteSpan data) const {
   std::string dataStr(data.begin(), data.end());
   std::string hashStr = SHA1::computeHash(dataStr);
-  return BytesToHash(hashStr);
+  return HexToHash(hashStr);
+}
+
+int64_t PieceVerifier::pieceLength(int pieceIndex) const {
+  int64_t start = pieceSize_ * pieceIndex;
+  return std::min(pieceSize_, totalSize_ - start);
+}
+
+void PieceVerifier::markVerified(int pieceIndex, bool verified) {
+  // Only the thread that actually flips the bit adjusts the counters
+  if (verified) {
+    if (!verified_.set(pieceIndex)) {
+      verifiedCount_.fetch_add(1, std::memory_order_relaxed);
+      verifiedBytes_.fetch_add(pieceLength(pieceIndex),
+                               std::memory_order_relaxed);
+    }
+  } else if (verified_.reset(pieceIndex)) {
+    verifiedCount_.fetch_sub(1, std::memory_order_relaxed);
+    verifiedBytes_.fetch_sub(pieceLength(pieceIndex),
+                             std::memory_order_relaxed);
+  }
+}
+
+bool PieceVerifier::verify(int pieceIndex, ByteSpan data) {
+  bool matched = matches(pieceIndex, data);
+  record(pieceIndex, matched);
+  return matched;
 }
 
-bool PieceVerifier::verify(int pieceIndex, const std::vector<uint8_t> &data) {
+bool PieceVerifier::matches(int pieceIndex, ByteSpan data) const {
   if (pieceIndex < 0 ||
       pieceIndex >= static_cast<int>(expectedHashes_.size())) {
     throw TorrentException(ErrorCode::InvalidPieceIndex,
                            "Piece index " + std::to_string(pieceIndex) +
                                " out of range");
   }
+  return computeHash(data) == expectedHashes_[pieceIndex];
+}
 
-  Hash computed = computeHash(data);
-  bool matches = (computed == expectedHashes_[pieceIndex]);
-
-  verified_[pieceIndex] = matches;
+void PieceVerifier::record(int pieceIndex, bool verified) {
+  markVerified(pieceIndex, verified);
 
   if (callback_) {
-    callback_(pieceIndex, matches);
+    callback_(pieceIndex, verified);
   }
-
-  return matches;
 }
 
+void PieceVerifier::restore(int pieceIndex) { markVerified(pieceIndex, true); }
+
 void PieceVerifier::setPieceVerifiedCallback(PieceVerifiedCallback callback) {
   callback_ = std::move(callback);
 }
@@ -43,15 +70,33 @@ bool PieceVerifier::isPieceVerified(int pieceIndex) const {
   if (pieceIndex < 0 || pieceIndex >= static_cast<int>(verified_.size())) {
     return false;
   }
-  return verified_[pieceIndex];
+  return verified_.test(pieceIndex);
+}
+
+std::vector<bool> PieceVerifier::getVerificationStatus() const {
+  return verified_.toVector();
+}
+
+int PieceVerifier::getVerifiedPieceCount() const {
+  return verifiedCount_.load(std::memory_order_relaxed);
 }
 
-const std::vector<bool> &PieceVerifier::getVerificationStatus() const {
-  return verified_;
+int64_t PieceVerifier::getVerifiedBytes() const {
+  return verifiedBytes_.load(std::memory_order_relaxed);
+}
+
+double PieceVerifier::getProgress() const {
+  if (verified_.size() == 0) {
+    return 0.0;
+  }
+  return static_cast<double>(getVerifiedPieceCount()) / verified_.size() *
+         100.0;
 }
 
 void PieceVerifier::reset() {
-  std::fill(verified_.begin(), verified_.end(), false);
+  for (size_t i = 0; i < verified_.size(); i++) {
+    markVerified(static_cast<int>(i), false);
+  }
 }
 
 } // namespace LitTorrent
@@ -1,6 +1,10 @@
 #pragma once
 
 #include "LitTorrent/TorrentMetadata.h"
+#include "Define.h"
+#include "../Utils/AtomicBitfield.h"
+#include <atomic>
+#include <cstdint>
 #include <functional>
 #include <vector>
 
@@ -11,10 +15,24 @@ using PieceVerifiedCallback = std::function<void(int pieceIndex, bool success)>;
 
 class PieceVerifier {
 public:
-  PieceVerifier(const std::vector<Hash> &expectedHashes);
+  // pieceSize and totalSize are used to keep the verified byte count, which
+  // accounts for a shorter last piece
+  PieceVerifier(const std::vector<Hash> &expectedHashes, int64_t pieceSize,
+                int64_t totalSize);
 
-  // Verify a piece against its expected hash (returns true if valid)
-  bool verify(int pieceIndex, const std::vector<uint8_t> &data);
+  // Verify a piece against its expected hash (returns true if valid).
+  // Safe to call concurrently with any other member
+  bool verify(int pieceIndex, ByteSpan data);
+
+  // The two halves of verify, for callers with work to do in between:
+  // compare against the expected hash without recording anything, then
+  // record the outcome
+  bool matches(int pieceIndex, ByteSpan data) const;
+  void record(int pieceIndex, bool verified);
+
+  // Mark a piece verified without hashing or reporting it, e.g. from resume
+  // data
+  void restore(int pieceIndex);
 
   // Set callback for piece verification
   void setPieceVerifiedCallback(PieceVerifiedCallback callback);
@@ -22,18 +40,32 @@ public:
   // Check if a piece is verified
   bool isPieceVerified(int pieceIndex) const;
 
-  // Get verification status for all pieces
-  const std::vector<bool> &getVerificationStatus() const;
+  // Get a snapshot of the verification status for all pieces
+  std::vector<bool> getVerificationStatus() const;
+
+  // Progress counters, maintained on every status change (O(1))
+  int getVerifiedPieceCount() const;
+  int64_t getVerifiedBytes() const;
+  double getProgress() const;
 
   // Reset verification status
   void reset();
 
 private:
   const std::vector<Hash> &expectedHashes_;
-  std::vector<bool> verified_;
+  int64_t pieceSize_;
+  int64_t totalSize_;
+  AtomicBitfield verified_;
   PieceVerifiedCallback callback_;
 
-  Hash computeHash(const std::vector<uint8_t> &data) const;
+  // Kept on their own cache lines so verifiers bumping them do not contend
+  // with readers of the bitfield
+  alignas(64) std::atomic<int> verifiedCount_{0};
+  alignas(64) std::atomic<int64_t> verifiedBytes_{0};
+
+  Hash computeHash(ByteSpan data) const;
+  int64_t pieceLength(int pieceIndex) const;
+  void markVerified(int pieceIndex, bool verified);
 };
 
 } // namespace LitTorrent
@@ -0,0 +1,200 @@
+#include "ReadCache.h"
+#include <algorithm>
+
+namespace LitTorrent {
+
+ReadCache::ReadCache(std::shared_ptr<CacheBudget> budget,
+                     std::shared_ptr<BufferPool> pool, uint64_t pieceSize,
+                     uint64_t totalSize, size_t blockSize, size_t lineSize,
+                     Reader reader)
+    : budget_(std::move(budget)), pool_(std::move(pool)),
+      pieceSize_(pieceSize), totalSize_(totalSize), reader_(std::move(reader)) {
+  if (lineSize == 0 || lineSize >= pieceSize_) {
+    lineSize_ = static_cast<size_t>(pieceSize_);
+  } else {
+    lineSize_ = (lineSize + blockSize - 1) / blockSize * blockSize;
+  }
+  linesPerPiece_ = (pieceSize_ + lineSize_ - 1) / lineSize_;
+  // Remember about as many evicted lines as the budget holds
+  ghostLimit_ = std::max<size_t>(budget_->limit() / lineSize_, 16);
+
+  // Clean data is the first to give back
+  budget_->attach(this, 0);
+}
+
+ReadCache::~ReadCache() {
+  budget_->detach(this);
+  budget_->release(recentBytes_ + frequentBytes_);
+}
+
+BlockBuffer ReadCache::read(uint64_t start, size_t count) {
+  uint64_t pieceIdx = start / pieceSize_;
+  uint64_t pieceStart = pieceIdx * pieceSize_;
+  uint64_t lineIdx = (start - pieceStart) / lineSize_;
+  uint64_t lineStart = pieceStart + lineIdx * lineSize_;
+  size_t lineLength = static_cast<size_t>(std::min<uint64_t>(
+      {lineSize_, pieceSize_ - lineIdx * lineSize_, totalSize_ - lineStart}));
+  uint64_t key = pieceIdx * linesPerPiece_ + lineIdx;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  // Requests for a line being read wait for it rather than read it again
+  loaded_.wait(lock, [&] { return loading_.count(key) == 0; });
+
+  auto it = lines_.find(key);
+  if (it != lines_.end() && it->second.buffer) {
+    Line &line = it->second;
+    if (line.list == List::Recent) {
+      recentBytes_ -= line.buffer.size();
+      frequentBytes_ += line.buffer.size();
+    }
+    moveTo(key, line, List::Frequent);
+    stats_.hits++;
+    return line.buffer.subrange(start - lineStart, count);
+  }
+
+  // A recently evicted line shows which list should have been larger
+  bool ghost = it != lines_.end();
+  if (ghost) {
+    size_t recentGhosts = listOf(List::RecentGhost).size();
+    size_t frequentGhosts = listOf(List::FrequentGhost).size();
+    if (it->second.list == List::RecentGhost) {
+      size_t step = lineSize_ * std::max<size_t>(
+                                    1, frequentGhosts / recentGhosts);
+      recentTarget_ = std::min(recentTarget_ + step, budget_->limit());
+    } else {
+      size_t step = lineSize_ * std::max<size_t>(
+                                    1, recentGhosts / frequentGhosts);
+      recentTarget_ = recentTarget_ > step ? recentTarget_ - step : 0;
+    }
+    stats_.ghostHits++;
+  }
+  loading_.insert(key);
+  lock.unlock();
+
+  // The reservation may evict lines, so it is made unlocked
+  bool reserved =
+      lineLength <= budget_->limit() && budget_->reserve(lineLength);
+  BlockBuffer buffer;
+  try {
+    if (reserved) {
+      buffer = pool_->acquire(lineLength);
+      reader_(lineStart, buffer);
+    } else {
+      buffer = pool_->acquire(count);
+      reader_(start, buffer);
+    }
+  } catch (...) {
+    if (reserved) {
+      budget_->release(lineLength);
+    }
+    lock.lock();
+    loading_.erase(key);
+    loaded_.notify_all();
+    throw;
+  }
+
+  lock.lock();
+  loading_.erase(key);
+  loaded_.notify_all();
+  if (!reserved) {
+    stats_.bypassed++;
+    return buffer;
+  }
+
+  // Lines read before go to the frequent list straight away
+  it = lines_.find(key);
+  if (it == lines_.end()) {
+    Line line;
+    line.list = List::Recent;
+    it = lines_.emplace(key, line).first;
+    listOf(List::Recent).push_front(key);
+    it->second.position = listOf(List::Recent).begin();
+  }
+  Line &line = it->second;
+  moveTo(key, line, ghost ? List::Frequent : List::Recent);
+  line.buffer = buffer;
+  (ghost ? frequentBytes_ : recentBytes_) += lineLength;
+  stats_.misses++;
+  return buffer.subrange(start - lineStart, count);
+}
+
+void ReadCache::moveTo(uint64_t key, Line &line, List list) {
+  listOf(line.list).erase(line.position);
+  line.list = list;
+  listOf(list).push_front(key);
+  line.position = listOf(list).begin();
+}
+
+// Evicts the least recently used line of the list that is over its share,
+// remembering its key. Called with the lock held
+void ReadCache::evictOne() {
+  auto &recent = listOf(List::Recent);
+  auto &frequent = listOf(List::Frequent);
+  bool fromRecent = !recent.empty() &&
+                    (recentBytes_ > recentTarget_ || frequent.empty());
+  uint64_t key = fromRecent ? recent.back() : frequent.back();
+  Line &line = lines_.at(key);
+
+  size_t size = line.buffer.size();
+  (fromRecent ? recentBytes_ : frequentBytes_) -= size;
+  line.buffer = BlockBuffer();
+  List ghost = fromRecent ? List::RecentGhost : List::FrequentGhost;
+  moveTo(key, line, ghost);
+  trimGhosts(ghost);
+  budget_->release(size);
+  stats_.evictions++;
+}
+
+void ReadCache::trimGhosts(List list) {
+  auto &ghosts = listOf(list);
+  while (ghosts.size() > ghostLimit_) {
+    lines_.erase(ghosts.back());
+    ghosts.pop_back();
+  }
+}
+
+void ReadCache::forget(uint64_t key, Line &line) {
+  if (line.buffer) {
+    size_t size = line.buffer.size();
+    (line.list == List::Recent ? recentBytes_ : frequentBytes_) -= size;
+    budget_->release(size);
+  }
+  listOf(line.list).erase(line.position);
+  lines_.erase(key);
+}
+
+void ReadCache::invalidate(int pieceIdx) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  uint64_t first = static_cast<uint64_t>(pieceIdx) * linesPerPiece_;
+  for (uint64_t key = first; key < first + linesPerPiece_; key++) {
+    // A line being read holds the old data; let it land, then drop it
+    loaded_.wait(lock, [&] { return loading_.count(key) == 0; });
+    auto it = lines_.find(key);
+    if (it != lines_.end()) {
+      forget(key, it->second);
+    }
+  }
+}
+
+size_t ReadCache::reclaim(size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t before = recentBytes_ + frequentBytes_;
+  while (before - (recentBytes_ + frequentBytes_) < bytes &&
+         recentBytes_ + frequentBytes_ > 0) {
+    evictOne();
+  }
+  return before - (recentBytes_ + frequentBytes_);
+}
+
+ReadCacheStats ReadCache::getStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ReadCacheStats stats = stats_;
+  stats.cachedLines = lists_[static_cast<int>(List::Recent)].size() +
+                      lists_[static_cast<int>(List::Frequent)].size();
+  stats.cachedBytes = recentBytes_ + frequentBytes_;
+  stats.recentBytes = recentBytes_;
+  stats.recentTargetBytes = recentTarget_;
+  return stats;
+}
+
+} // namespace LitTorrent
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "Define.h"
+#include "LitTorrent/BufferPool.h"
+#include "LitTorrent/CacheBudget.h"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace LitTorrent {
+
+struct ReadCacheStats {
+  uint64_t hits = 0;       // requests served from memory
+  uint64_t misses = 0;     // requests that read a line from storage
+  uint64_t bypassed = 0;   // requests read directly, the budget being full
+  uint64_t ghostHits = 0;  // misses on lines evicted recently
+  uint64_t evictions = 0;
+  size_t cachedLines = 0;
+  size_t cachedBytes = 0;
+  size_t recentBytes = 0;       // of which read once since caching
+  size_t recentTargetBytes = 0; // share ARC currently aims to give those
+
+  double hitRate() const {
+    uint64_t total = hits + misses + bypassed;
+    return total ? static_cast<double>(hits) / total : 0.0;
+  }
+};
+
+// Read cache for seeding. Data is cached in lines: a whole piece, or a
+// read-ahead window of it, read from storage in one I/O on the first request
+// for any block inside, so that the blocks peers ask for next are served
+// from memory.
+//
+// Lines are kept with ARC (adaptive replacement): lines read once and lines
+// read again are in separate LRU lists, and the recently evicted keys of
+// each decide how much memory the first list gets. A peer streaming through
+// the whole torrent then cannot push out the pieces every peer asks for.
+//
+// Lines reserve their size from the shared budget and are given back when
+// it runs short. Requests are served directly, uncached, when nothing can be
+// freed. Thread-safe
+class ReadCache : public CacheBudget::Consumer {
+public:
+  // Fills buffer with the bytes at start (throws TorrentException)
+  using Reader = std::function<void(uint64_t start, BlockBuffer &buffer)>;
+
+  // lineSize = 0 or anything not below pieceSize caches whole pieces;
+  // otherwise it is rounded up to a multiple of blockSize
+  ReadCache(std::shared_ptr<CacheBudget> budget,
+            std::shared_ptr<BufferPool> pool, uint64_t pieceSize,
+            uint64_t totalSize, size_t blockSize, size_t lineSize,
+            Reader reader);
+  ~ReadCache() override;
+
+  // Disable copy and move
+  ReadCache(const ReadCache &) = delete;
+  ReadCache &operator=(const ReadCache &) = delete;
+  ReadCache(ReadCache &&) = delete;
+  ReadCache &operator=(ReadCache &&) = delete;
+
+  // The count bytes at start, which lie within one block
+  BlockBuffer read(uint64_t start, size_t count);
+
+  // Drop what is cached of a piece whose data has changed
+  void invalidate(int pieceIdx);
+
+  size_t reclaim(size_t bytes) override;
+
+  ReadCacheStats getStats() const;
+
+private:
+  enum class List { Recent, Frequent, RecentGhost, FrequentGhost };
+
+  struct Line {
+    List list;
+    std::list<uint64_t>::iterator position;
+    BlockBuffer buffer; // empty for ghosts
+  };
+
+  std::shared_ptr<CacheBudget> budget_;
+  std::shared_ptr<BufferPool> pool_;
+  uint64_t pieceSize_;
+  uint64_t totalSize_;
+  size_t lineSize_;
+  uint64_t linesPerPiece_;
+  size_t ghostLimit_;
+  Reader reader_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable loaded_;
+  std::unordered_set<uint64_t> loading_;
+  std::unordered_map<uint64_t, Line> lines_;
+  // Most recently used first
+  std::list<uint64_t> lists_[4];
+  size_t recentBytes_ = 0;
+  size_t frequentBytes_ = 0;
+  size_t recentTarget_ = 0;
+  ReadCacheStats stats_;
+
+  std::list<uint64_t> &listOf(List list) {
+    return lists_[static_cast<int>(list)];
+  }
+  void moveTo(uint64_t key, Line &line, List list);
+  void evictOne();
+  void forget(uint64_t key, Line &line);
+  void trimGhosts(List list);
+};
+
+} // namespace LitTorrent
@@ -0,0 +1,81 @@
+#include "RecheckJob.h"
+#include "Logger.h"
+#include <algorithm>
+#include <exception>
+
+namespace LitTorrent {
+
+RecheckJob::RecheckJob(int pieceCount, int piecesPerRun, unsigned threads,
+                       CheckPiece check, RecheckProgressCallback progress)
+    : pieceCount_(pieceCount), piecesPerRun_(std::max(1, piecesPerRun)),
+      check_(std::move(check)), progress_(std::move(progress)) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // More threads than runs would have nothing to do
+  int runs = (pieceCount_ + piecesPerRun_ - 1) / piecesPerRun_;
+  threads = std::max(1u, std::min(threads, static_cast<unsigned>(runs)));
+  running_ = threads;
+  threads_.reserve(threads);
+  for (unsigned i = 0; i < threads; i++) {
+    threads_.emplace_back(&RecheckJob::work, this);
+  }
+}
+
+RecheckJob::~RecheckJob() {
+  cancel();
+  wait();
+}
+
+void RecheckJob::cancel() { cancelled_ = true; }
+
+RecheckResult RecheckJob::wait() {
+  std::lock_guard<std::mutex> lock(joinMutex_);
+  for (auto &thread : threads_) {
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+  std::lock_guard<std::mutex> resultLock(resultMutex_);
+  RecheckResult result = result_;
+  result.cancelled = checked_.load() < pieceCount_;
+  return result;
+}
+
+void RecheckJob::work() {
+  RecheckResult tally;
+  while (!cancelled_.load(std::memory_order_relaxed)) {
+    int first = nextRun_.fetch_add(1, std::memory_order_relaxed) *
+                piecesPerRun_;
+    if (first >= pieceCount_) {
+      break;
+    }
+    int last = std::min(pieceCount_, first + piecesPerRun_);
+    for (int piece = first;
+         piece < last && !cancelled_.load(std::memory_order_relaxed);
+         piece++) {
+      try {
+        check_(piece, tally);
+      } catch (const std::exception &e) {
+        LOG_ERROR("Recheck of piece %d failed: %s", piece, e.what());
+        tally.failedPieces++;
+      }
+      int checked = checked_.fetch_add(1, std::memory_order_relaxed) + 1;
+      if (progress_) {
+        progress_(checked, pieceCount_);
+      }
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(resultMutex_);
+    result_.verifiedPieces += tally.verifiedPieces;
+    result_.failedPieces += tally.failedPieces;
+    result_.skippedPieces += tally.skippedPieces;
+    result_.bytesHashed += tally.bytesHashed;
+  }
+  running_.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+} // namespace LitTorrent
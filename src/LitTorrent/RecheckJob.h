@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace LitTorrent {
+
+// Called after each piece a recheck finishes, on a checking thread. It may
+// cancel the recheck but must not wait for it
+using RecheckProgressCallback = std::function<void(int checked, int total)>;
+
+// How Torrent::recheck goes over the storage
+struct RecheckOptions {
+  // A hole in sparse storage reads as zeros, so a piece overlapping one
+  // cannot hold its data: such pieces are marked missing without being
+  // read, and only the allocated regions are hashed. Off, every piece is
+  // read. Filesystems that turn written zeros into holes (compression,
+  // deduplication) can hide a valid piece that is partly zeros; a piece
+  // lying wholly in a hole still passes if it is all zeros
+  bool skipHoles = true;
+  // Hashing threads; 0 picks one per hardware thread
+  unsigned threads = 0;
+  RecheckProgressCallback progress;
+};
+
+// Outcome of Torrent::recheck
+struct RecheckResult {
+  int verifiedPieces = 0; // found intact
+  int failedPieces = 0;   // read and not matching, or unreadable
+  int skippedPieces = 0;  // overlapping a hole, never read
+  uint64_t bytesHashed = 0;
+  bool cancelled = false; // stopped before every piece was checked
+};
+
+// Checks every piece of a torrent on a pool of threads. Pieces are handed
+// out in runs of consecutive pieces, so each thread reads its part of a
+// file front to back and the disk sees long sequential reads rather than
+// one scattered piece per thread. The check function does the work for a
+// piece and adds its outcome to the calling thread's tally; the tallies are
+// summed once every thread has finished
+class RecheckJob {
+public:
+  using CheckPiece = std::function<void(int pieceIndex, RecheckResult &tally)>;
+
+  // Starts the threads; threads == 0 picks one per hardware thread
+  RecheckJob(int pieceCount, int piecesPerRun, unsigned threads,
+             CheckPiece check, RecheckProgressCallback progress = nullptr);
+  // Cancels and waits
+  ~RecheckJob();
+
+  // Disable copy and move
+  RecheckJob(const RecheckJob &) = delete;
+  RecheckJob &operator=(const RecheckJob &) = delete;
+
+  // Stop handing out pieces; those being checked are finished
+  void cancel();
+
+  // Block until every thread has finished, and return the summed outcome
+  RecheckResult wait();
+
+  bool done() const { return running_.load(std::memory_order_acquire) == 0; }
+  int checked() const { return checked_.load(std::memory_order_relaxed); }
+
+private:
+  void work();
+
+  int pieceCount_;
+  int piecesPerRun_;
+  CheckPiece check_;
+  RecheckProgressCallback progress_;
+
+  std::atomic<int> nextRun_{0};
+  std::atomic<int> checked_{0};
+  std::atomic<bool> cancelled_{false};
+  std::atomic<unsigned> running_{0};
+
+  // Threads add their tallies to result_ as they finish; waiters join them
+  // one caller at a time
+  std::mutex resultMutex_;
+  RecheckResult result_;
+  std::mutex joinMutex_;
+  std::vector<std::thread> threads_;
+};
+
+} // namespace LitTorrent
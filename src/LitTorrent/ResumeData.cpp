@@ -0,0 +1,264 @@
+#include "ResumeData.h"
+#include "Error.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace LitTorrent {
+
+namespace {
+namespace Internal {
+static const char *kFormat = "LitTorrent resume data";
+static const int64_t kVersion = 1;
+
+static BEncodedValuePtr number(int64_t value) {
+  return BEncodedValue::CreateNumber(value);
+}
+
+static BEncodedValuePtr bytes(const std::string &value) {
+  return BEncodedValue::CreateByteArray(ByteArray(value.begin(), value.end()));
+}
+
+// High bit first, as in the peer protocol's bitfield message
+static BEncodedValuePtr bitfield(const std::vector<bool> &bits) {
+  ByteArray packed((bits.size() + 7) / 8, 0);
+  for (size_t i = 0; i < bits.size(); i++) {
+    if (bits[i]) {
+      packed[i / 8] |= static_cast<uint8_t>(0x80 >> (i % 8));
+    }
+  }
+  return BEncodedValue::CreateByteArray(packed);
+}
+
+static std::vector<bool> unpack(const ByteArray &packed, size_t count) {
+  if (packed.size() != (count + 7) / 8) {
+    throw TorrentException(ErrorCode::InvalidResumeData,
+                           "bitfield of " + std::to_string(packed.size()) +
+                               " bytes for " + std::to_string(count) +
+                               " bits");
+  }
+  std::vector<bool> bits(count);
+  for (size_t i = 0; i < count; i++) {
+    bits[i] = packed[i / 8] & (0x80 >> (i % 8));
+  }
+  return bits;
+}
+
+static BEncodedValuePtr field(BEncodedDict &dict, const std::string &key,
+                              BEncodedValue::Type type) {
+  auto it = dict.find(key);
+  if (it == dict.end() || !it->second || it->second->GetType() != type) {
+    throw TorrentException(ErrorCode::InvalidResumeData,
+                           "missing or mistyped '" + key + "'");
+  }
+  return it->second;
+}
+
+static int64_t numberField(BEncodedDict &dict, const std::string &key,
+                           int64_t min, int64_t max) {
+  int64_t value =
+      field(dict, key, BEncodedValue::Type::Number)->GetNumber();
+  if (value < min || value > max) {
+    throw TorrentException(ErrorCode::InvalidResumeData,
+                           "'" + key + "' out of range");
+  }
+  return value;
+}
+
+static void writeAll(int fd, const ByteArray &data, const std::string &path) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      throw TorrentException(ErrorCode::FileWriteError,
+                             path + ": " + std::strerror(errno));
+    }
+    written += static_cast<size_t>(n);
+  }
+}
+} // namespace Internal
+} // namespace
+
+ByteArray ResumeData::encode() const {
+  BEncodedList partialList;
+  for (const auto &piece : partial) {
+    partialList.push_back(BEncodedValue::CreateDictionary(
+        {{"piece", Internal::number(piece.first)},
+         {"blocks", Internal::bitfield(piece.second)}}));
+  }
+  BEncodedList fileList;
+  for (const auto &file : files) {
+    fileList.push_back(BEncodedValue::CreateDictionary(
+        {{"size", Internal::number(static_cast<int64_t>(file.size))},
+         {"mtime", Internal::number(file.mtime)}}));
+  }
+
+  BEncodedDict root{
+      {"file-format", Internal::bytes(Internal::kFormat)},
+      {"file-version", Internal::number(Internal::kVersion)},
+      {"info-hash", BEncodedValue::CreateByteArray(
+                        ByteArray(infoHash.begin(), infoHash.end()))},
+      {"total-size", Internal::number(static_cast<int64_t>(totalSize))},
+      {"piece-size", Internal::number(pieceSize)},
+      {"block-size", Internal::number(blockSize)},
+      {"allocation", Internal::number(static_cast<int64_t>(allocation))},
+      {"piece-count", Internal::number(static_cast<int64_t>(verified.size()))},
+      {"pieces", Internal::bitfield(verified)},
+      {"partial", BEncodedValue::CreateList(partialList)},
+      {"files", BEncodedValue::CreateList(fileList)}};
+  return BEncoding::Encode(BEncodedValue::CreateDictionary(root));
+}
+
+ResumeData ResumeData::decode(const ByteArray &bytes) {
+  BEncodedValuePtr value;
+  try {
+    value = BEncoding::Decode(bytes);
+  } catch (const std::exception &e) {
+    throw TorrentException(ErrorCode::InvalidResumeData, e.what());
+  }
+  if (!value || value->GetType() != BEncodedValue::Type::Dictionary) {
+    throw TorrentException(ErrorCode::InvalidResumeData,
+                           "root is not a dictionary");
+  }
+
+  BEncodedDict root = value->GetDictionary();
+  ByteArray format =
+      Internal::field(root, "file-format", BEncodedValue::Type::ByteArray)
+          ->GetByteArray();
+  if (std::string(format.begin(), format.end()) != Internal::kFormat) {
+    throw TorrentException(ErrorCode::InvalidResumeData, "unknown format");
+  }
+  if (Internal::numberField(root, "file-version", 0, INT64_MAX) !=
+      Internal::kVersion) {
+    throw TorrentException(ErrorCode::InvalidResumeData,
+                           "unsupported version");
+  }
+
+  ResumeData data;
+  ByteArray hash =
+      Internal::field(root, "info-hash", BEncodedValue::Type::ByteArray)
+          ->GetByteArray();
+  if (hash.size() != data.infoHash.size()) {
+    throw TorrentException(ErrorCode::InvalidResumeData, "bad info-hash");
+  }
+  std::copy(hash.begin(), hash.end(), data.infoHash.begin());
+  data.totalSize = static_cast<uint64_t>(
+      Internal::numberField(root, "total-size", 0, INT64_MAX));
+  data.pieceSize =
+      static_cast<int>(Internal::numberField(root, "piece-size", 1, INT32_MAX));
+  data.blockSize =
+      static_cast<int>(Internal::numberField(root, "block-size", 1, INT32_MAX));
+  data.allocation = static_cast<AllocationMode>(Internal::numberField(
+      root, "allocation", 0, static_cast<int64_t>(AllocationMode::OnFirstWrite)));
+
+  size_t pieceCount = static_cast<size_t>(
+      Internal::numberField(root, "piece-count", 0, INT32_MAX));
+  data.verified = Internal::unpack(
+      Internal::field(root, "pieces", BEncodedValue::Type::ByteArray)
+          ->GetByteArray(),
+      pieceCount);
+
+  size_t blocksPerPiece =
+      (static_cast<size_t>(data.pieceSize) + data.blockSize - 1) /
+      data.blockSize;
+  for (const auto &item :
+       Internal::field(root, "partial", BEncodedValue::Type::List)
+           ->GetList()) {
+    if (!item || item->GetType() != BEncodedValue::Type::Dictionary) {
+      throw TorrentException(ErrorCode::InvalidResumeData,
+                             "partial entry is not a dictionary");
+    }
+    BEncodedDict entry = item->GetDictionary();
+    int piece = static_cast<int>(Internal::numberField(
+        entry, "piece", 0, static_cast<int64_t>(pieceCount) - 1));
+    data.partial[piece] = Internal::unpack(
+        Internal::field(entry, "blocks", BEncodedValue::Type::ByteArray)
+            ->GetByteArray(),
+        blocksPerPiece);
+  }
+
+  for (const auto &item :
+       Internal::field(root, "files", BEncodedValue::Type::List)->GetList()) {
+    if (!item || item->GetType() != BEncodedValue::Type::Dictionary) {
+      throw TorrentException(ErrorCode::InvalidResumeData,
+                             "file entry is not a dictionary");
+    }
+    BEncodedDict entry = item->GetDictionary();
+    ResumeFileState file;
+    file.size = static_cast<uint64_t>(
+        Internal::numberField(entry, "size", 0, INT64_MAX));
+    file.mtime = Internal::numberField(entry, "mtime", 0, INT64_MAX);
+    data.files.push_back(file);
+  }
+  return data;
+}
+
+void ResumeData::save(const std::filesystem::path &path) const {
+  ByteArray bytes = encode();
+  std::string temporary = path.string() + ".tmp";
+
+  int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  if (fd < 0) {
+    throw TorrentException(ErrorCode::FileWriteError,
+                           temporary + ": " + std::strerror(errno));
+  }
+  try {
+    Internal::writeAll(fd, bytes, temporary);
+    if (::fsync(fd) != 0) {
+      throw TorrentException(ErrorCode::FileWriteError,
+                             temporary + ": " + std::strerror(errno));
+    }
+  } catch (...) {
+    ::close(fd);
+    ::unlink(temporary.c_str());
+    throw;
+  }
+  ::close(fd);
+
+  if (::rename(temporary.c_str(), path.c_str()) != 0) {
+    int error = errno;
+    ::unlink(temporary.c_str());
+    throw TorrentException(ErrorCode::FileWriteError,
+                           path.string() + ": " + std::strerror(error));
+  }
+
+  // Make the rename itself durable
+  std::filesystem::path parent = path.parent_path();
+  int dirFd = ::open(parent.empty() ? "." : parent.c_str(),
+                     O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dirFd >= 0) {
+    ::fsync(dirFd);
+    ::close(dirFd);
+  }
+}
+
+ResumeData ResumeData::load(const std::filesystem::path &path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    throw TorrentException(ErrorCode::FileNotFound, path.string());
+  }
+  ByteArray bytes((std::istreambuf_iterator<char>(in)),
+                  std::istreambuf_iterator<char>());
+  return decode(bytes);
+}
+
+ResumeFileState ResumeData::stateOf(const std::filesystem::path &file) {
+  ResumeFileState state;
+  struct stat st;
+  if (::stat(file.c_str(), &st) == 0) {
+    state.size = static_cast<uint64_t>(st.st_size);
+    state.mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+                  st.st_mtim.tv_nsec;
+  }
+  return state;
+}
+
+} // namespace LitTorrent
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "LitTorrent/BEncoding.h"
+#include "LitTorrent/StorageOptions.h"
+#include "LitTorrent/TorrentMetadata.h"
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace LitTorrent {
+
+// A file as it was when resume data was saved
+struct ResumeFileState {
+  uint64_t size = 0;
+  int64_t mtime = 0; // nanoseconds since the epoch; 0 when the file is missing
+
+  bool operator==(const ResumeFileState &other) const {
+    return size == other.size && mtime == other.mtime;
+  }
+  bool operator!=(const ResumeFileState &other) const {
+    return !(*this == other);
+  }
+};
+
+// What a torrent knows about its data, saved so that a restart can trust it
+// instead of hashing everything again. Stored as a bencoded dictionary:
+//
+//   file-format  "LitTorrent resume data"
+//   file-version 1
+//   info-hash    20 bytes
+//   total-size, piece-size, block-size, allocation
+//   pieces       verified pieces, one bit per piece, high bit first
+//   partial      list of {piece, blocks}: blocks on storage of pieces not
+//                yet verified, as a bitfield like pieces
+//   files        list of {size, mtime}, in torrent order
+//
+// The data is only as good as the files it describes: a torrent trusts the
+// pieces of a file only while its size and mtime are those recorded
+struct ResumeData {
+  Hash infoHash{};
+  uint64_t totalSize = 0;
+  int pieceSize = 0;
+  int blockSize = 0;
+  AllocationMode allocation = AllocationMode::Sparse;
+  std::vector<bool> verified;               // per piece
+  std::map<int, std::vector<bool>> partial; // per block of the piece
+  std::vector<ResumeFileState> files;
+
+  ByteArray encode() const;
+  // Throws TorrentException(InvalidResumeData) on anything malformed
+  static ResumeData decode(const ByteArray &bytes);
+
+  // Replace the file at path atomically: the data goes to a temporary file
+  // next to it, which is synced and renamed over it (throws
+  // TorrentException)
+  void save(const std::filesystem::path &path) const;
+  static ResumeData load(const std::filesystem::path &path);
+
+  // The current size and mtime of a file
+  static ResumeFileState stateOf(const std::filesystem::path &file);
+};
+
+// Outcome of Torrent::loadResumeData
+struct ResumeLoadResult {
+  bool loaded = false;    // the data was read and describes this torrent
+  int verifiedPieces = 0; // restored without hashing
+  int partialPieces = 0;  // with some blocks restored
+  int changedFiles = 0;   // whose pieces were not trusted
+  std::string error;      // why nothing was loaded
+};
+
+} // namespace LitTorrent
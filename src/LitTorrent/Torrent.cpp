@@ -1,19 +1,25 @@
 #include "LitTorrent/Torrent.h"
 #include "PieceVerifier.h"
-#include "../Utils/FileManager.h"
+#include "../Utils/AsyncDiskIO.h"
 #include "../Utils/SHA1.h"
 #include "FileItem.h"
 #include "Error.h"
 #include "LitTorrent/BEncoding.h"
+#include "LitTorrent/Storage.h"
 #include "LitTorrent/Tracker.h"
 #include "Logger.h"
 #include <algorithm>
-#include <cmath>
+#include <atomic>
+#include <cerrno>
+#include <thread>
 
 namespace LitTorrent {
 
 namespace {
 namespace Internal {
+// Consecutive bytes a recheck thread reads before taking the next run
+static const uint64_t kRecheckRunBytes = 64 << 20;
+
 static ByteArray encodeUTF8String(const std::string &str) {
   return ByteArray(str.begin(), str.end());
 }
@@ -21,6 +27,67 @@ static ByteArray encodeUTF8String(const std::string &str) {
 static std::string decodeUTF8String(const ByteArray &bytes) {
   return std::string(bytes.begin(), bytes.end());
 }
+
+// Whether data extents, in order, cover [start, end) entirely; noData when
+// none of them reaches into it
+static bool coversRange(const std::vector<DataExtent> &data, uint64_t start,
+                        uint64_t end, bool &noData) {
+  // The first extent that ends past the range's start
+  auto extent = std::partition_point(
+      data.begin(), data.end(), [start](const DataExtent &candidate) {
+        return candidate.start + candidate.length <= start;
+      });
+  noData = extent == data.end() || extent->start >= end;
+  return !noData && extent->start <= start &&
+         extent->start + extent->length >= end;
+}
+
+// Completion of an operation split into parts; the first error wins
+struct PartCountdown {
+  std::atomic<size_t> remaining;
+  std::atomic<int> error{0};
+
+  explicit PartCountdown(size_t parts) : remaining(parts) {}
+
+  // True for the part that finishes last
+  bool finish(int partError) {
+    if (partError != 0) {
+      int expected = 0;
+      error.compare_exchange_strong(expected, partError);
+    }
+    return remaining.fetch_sub(1) == 1;
+  }
+};
+
+// A block read in parts, assembled into one buffer
+struct PartialRead : PartCountdown {
+  BlockBuffer data;
+
+  PartialRead(BlockBuffer buffer, size_t parts)
+      : PartCountdown(parts), data(std::move(buffer)) {}
+
+  bool add(uint64_t at, int partError, ByteSpan part) {
+    if (partError == 0) {
+      std::copy(part.begin(), part.end(), data.begin() + at);
+    }
+    return finish(partError);
+  }
+};
+
+// The bytes of a block buffer, and a part of it to write on its own: pool
+// buffers share their memory, shared vectors are copied
+static ByteSpan bytesOf(const SharedBuffer &buffer) { return ByteSpan(*buffer); }
+static ByteSpan bytesOf(const BlockBuffer &buffer) { return buffer; }
+
+static SharedBuffer partOf(const SharedBuffer &buffer, size_t offset,
+                           size_t count) {
+  auto first = buffer->begin() + offset;
+  return std::make_shared<std::vector<uint8_t>>(first, first + count);
+}
+static BlockBuffer partOf(const BlockBuffer &buffer, size_t offset,
+                          size_t count) {
+  return buffer.subrange(offset, count);
+}
 } // namespace Internal
 } // namespace
 
@@ -28,9 +95,9 @@ static std::string decodeUTF8String(const ByteArray &bytes) {
 Torrent::Torrent(std::string name, std::string location,
                  std::vector<FileItem> files, std::vector<std::string> trackers,
                  int pieceSize, std::vector<Hash> pieceHashes, int blockSize,
-                 bool isPrivate)
+                 bool isPrivate, const StorageOptions &storageOptions)
     : files_(std::move(files)), downloadDirectory_(std::move(location)),
-      totalSize_(0), blockAcquired_() {
+      totalSize_(0), storageOptions_(storageOptions) {
 
   metadata_.name = std::move(name);
   metadata_.isPrivate = isPrivate;
@@ -39,6 +106,13 @@ Torrent::Torrent(std::string name, std::string location,
   metadata_.pieceHashes = std::move(pieceHashes);
   metadata_.creationDate = std::time(nullptr);
 
+  bufferPool_ = storageOptions.bufferPool;
+  if (!bufferPool_) {
+    bufferPool_ = BufferPool::create(
+        {static_cast<size_t>(blockSize), static_cast<size_t>(pieceSize)},
+        storageOptions.hugePageBuffers, storageOptions.bufferPoolBytes);
+  }
+
   // Calculate total size
   totalSize_ = calculateTotalSize();
 
@@ -48,7 +122,16 @@ Torrent::Torrent(std::string name, std::string location,
     trackers_.push_back(std::move(tracker));
   }
 
-  int pieceCount = static_cast<int>(std::ceil(totalSize_ * 1.0 / pieceSize));
+  // Piece indices are ints on the wire and everywhere else
+  uint64_t pieceCount64 =
+      pieceSize > 0 ? (totalSize_ + pieceSize - 1) / pieceSize : 0;
+  if (pieceSize <= 0 || blockSize <= 0 || pieceCount64 > INT32_MAX) {
+    throw TorrentException(ErrorCode::InvalidParameter,
+                           "Invalid piece size " + std::to_string(pieceSize) +
+                               " for " + std::to_string(totalSize_) +
+                               " bytes");
+  }
+  int pieceCount = static_cast<int>(pieceCount64);
 
   // Initialize piece hashes if not provided
   if (metadata_.pieceHashes.empty()) {
@@ -57,21 +140,64 @@ Torrent::Torrent(std::string name, std::string location,
       auto pieceData = readPiece(i);
       std::string hashStr =
           SHA1::computeHash(std::string(pieceData.begin(), pieceData.end()));
-      metadata_.pieceHashes[i] = BytesToHash(hashStr);
+      metadata_.pieceHashes[i] = HexToHash(hashStr);
     }
   }
 
   // Initialize block tracking
-  blockAcquired_.resize(pieceCount);
-  for (int i = 0; i < pieceCount; i++) {
-    blockAcquired_[i].resize(getBlockCount(i), false);
-  }
+  int blocksPerPiece =
+      (metadata_.pieceSize + metadata_.blockSize - 1) / metadata_.blockSize;
+  blockStates_ = std::make_unique<BlockStateTable>(
+      pieceCount, blocksPerPiece,
+      pieceCount > 0 ? getBlockCount(pieceCount - 1) : 0);
+  picker_ = std::make_unique<PiecePicker>(pieceCount);
+  partialPieces_.reset(new std::atomic<bool>[pieceCount]());
+  filePriorities_.assign(files_.size(), DownloadPriority::Normal);
 
-  // Initialize file manager
-  fileManager_ = std::make_unique<FileManager>(files_);
+  // Initialize storage
+  storage_ = makeStorage(files_, storageOptions);
+
+  // Disk jobs go through a scheduler shared with other torrents, or one of
+  // the torrent's own
+  diskScheduler_ = storageOptions.diskScheduler;
+  if (!diskScheduler_) {
+    diskScheduler_ = std::make_shared<DiskJobScheduler>(
+        storageOptions.diskThreads,
+        std::array<unsigned, kDiskJobClassCount>{
+            storageOptions.maxUploadJobs, storageOptions.maxWriteJobs,
+            storageOptions.maxHashJobs, storageOptions.maxRecheckJobs});
+  }
+  diskOwner_ = diskScheduler_->addOwner();
 
   // Initialize verifier
-  verifier_ = std::make_unique<PieceVerifier>(metadata_.pieceHashes);
+  verifier_ = std::make_unique<PieceVerifier>(
+      metadata_.pieceHashes, metadata_.pieceSize,
+      static_cast<int64_t>(totalSize_));
+  verificationQueue_ = std::make_unique<VerificationQueue>(
+      [this](int pieceIdx) { verifyCompletedPiece(pieceIdx); },
+      storageOptions.verifyThreads > 0 ? storageOptions.verifyThreads
+                                       : storageOptions.maxHashJobs);
+
+  // Block caches, with their own budget unless one is shared
+  cacheBudget_ = storageOptions.cacheBudget;
+  if (!cacheBudget_ && storageOptions.cacheSize > 0) {
+    cacheBudget_ = std::make_shared<CacheBudget>(storageOptions.cacheSize);
+  }
+  if (cacheBudget_ && storageOptions.writeCache) {
+    writeCache_ = std::make_unique<WriteCache>(
+        cacheBudget_, bufferPool_, metadata_.pieceSize, totalSize_,
+        metadata_.blockSize, [this](std::vector<WriteSlice> slices) {
+          storage_->writev(std::move(slices));
+        });
+  }
+  if (cacheBudget_ && storageOptions.readCache) {
+    readCache_ = std::make_unique<ReadCache>(
+        cacheBudget_, bufferPool_, metadata_.pieceSize, totalSize_,
+        metadata_.blockSize, storageOptions.readAhead,
+        [this](uint64_t start, BlockBuffer &buffer) {
+          storage_->readv({ReadSlice{start, buffer.data(), buffer.size()}});
+        });
+  }
 
   // Compute info hash (placeholder - should be computed from bencoded info dict)
   metadata_.infoHash = Hash{};
@@ -79,13 +205,43 @@ Torrent::Torrent(std::string name, std::string location,
 
 // Destructor
 Torrent::~Torrent() {
-  if (fileManager_) {
-    fileManager_->closeAll();
+  // A recheck reads through the disk scheduler, so it is cancelled and
+  // waited for first
+  recheck_.reset();
+
+  // Verification workers wait for scheduled reads, scheduled jobs hand
+  // their I/O to the async engine, and everything reads through the
+  // storage, so stop them in that order. Write completions arriving after
+  // the verification queue has stopped are dropped by it
+  if (verificationQueue_) {
+    verificationQueue_->stop();
+  }
+  if (diskScheduler_) {
+    diskScheduler_->removeOwner(diskOwner_);
+  }
+  if (asyncIO_) {
+    asyncIO_->stop();
+  }
+  // Partial pieces still in memory are kept for the next session. The
+  // caches go before the storage: while attached to a shared budget, other
+  // torrents can make them flush or read through it
+  flushWriteCache();
+  if (!storageOptions_.resumeDataPath.empty()) {
+    try {
+      saveResumeData(storageOptions_.resumeDataPath);
+    } catch (const std::exception &e) {
+      LOG_ERROR("Saving resume data failed: %s", e.what());
+    }
+  }
+  writeCache_.reset();
+  readCache_.reset();
+  if (storage_) {
+    storage_->close();
   }
 }
 
-size_t Torrent::calculateTotalSize() const {
-  size_t total = 0;
+uint64_t Torrent::calculateTotalSize() const {
+  uint64_t total = 0;
   for (const auto &file : files_) {
     total += file.getSize();
   }
@@ -123,7 +279,7 @@ int Torrent::getPieceSize(int pieceIdx) const {
   }
 
   // Last piece might be smaller
-  size_t remainder = totalSize_ % metadata_.pieceSize;
+  uint64_t remainder = totalSize_ % metadata_.pieceSize;
   return remainder == 0 ? metadata_.pieceSize : static_cast<int>(remainder);
 }
 
@@ -142,8 +298,8 @@ int Torrent::getBlockSize(int pieceIdx, int blockIdx) const {
 
 int Torrent::getBlockCount(int pieceIdx) const {
   validatePieceIndex(pieceIdx);
-  return static_cast<int>(
-      std::ceil(getPieceSize(pieceIdx) * 1.0 / metadata_.blockSize));
+  return (getPieceSize(pieceIdx) + metadata_.blockSize - 1) /
+         metadata_.blockSize;
 }
 
 bool Torrent::isPieceVerified(int pieceIdx) const {
@@ -151,24 +307,40 @@ bool Torrent::isPieceVerified(int pieceIdx) const {
   return verifier_->isPieceVerified(pieceIdx);
 }
 
-int Torrent::calculateBlockOffset(int pieceIdx, int blockIdx) const {
-  return metadata_.pieceSize * pieceIdx + blockIdx * metadata_.blockSize;
+uint64_t Torrent::calculatePieceOffset(int pieceIdx) const {
+  return static_cast<uint64_t>(metadata_.pieceSize) * pieceIdx;
+}
+
+uint64_t Torrent::calculateBlockOffset(int pieceIdx, int blockIdx) const {
+  return calculatePieceOffset(pieceIdx) +
+         static_cast<uint64_t>(metadata_.blockSize) * blockIdx;
 }
 
-std::vector<uint8_t> Torrent::readPiece(int pieceIdx) const {
+BlockBuffer Torrent::readPiece(int pieceIdx) const {
   validatePieceIndex(pieceIdx);
-  return read(metadata_.pieceSize * pieceIdx, getPieceSize(pieceIdx));
+  return read(calculatePieceOffset(pieceIdx), getPieceSize(pieceIdx));
 }
 
-std::vector<uint8_t> Torrent::readBlock(int pieceIdx, int blockIdx) const {
+BlockBuffer Torrent::readBlock(int pieceIdx, int blockIdx) const {
   validateBlockIndex(pieceIdx, blockIdx);
-  int offset = calculateBlockOffset(pieceIdx, blockIdx);
+  uint64_t offset = calculateBlockOffset(pieceIdx, blockIdx);
   int length = getBlockSize(pieceIdx, blockIdx);
+  if (readCache_ && verifier_->isPieceVerified(pieceIdx)) {
+    return readCache_->read(offset, length);
+  }
   return read(offset, length);
 }
 
-bool Torrent::writeBlock(int pieceIdx, int blockIdx,
-                         const std::vector<uint8_t> &data) {
+BlockView Torrent::readBlockView(int pieceIdx, int blockIdx) const {
+  validateBlockIndex(pieceIdx, blockIdx);
+  if (!storage_) {
+    throw TorrentException(ErrorCode::FileReadError, "Storage not initialized");
+  }
+  return storage_->view(calculateBlockOffset(pieceIdx, blockIdx),
+                            getBlockSize(pieceIdx, blockIdx));
+}
+
+bool Torrent::writeBlock(int pieceIdx, int blockIdx, ByteSpan data) {
   validateBlockIndex(pieceIdx, blockIdx);
 
   int expectedSize = getBlockSize(pieceIdx, blockIdx);
@@ -179,51 +351,643 @@ bool Torrent::writeBlock(int pieceIdx, int blockIdx,
                               std::to_string(data.size()));
   }
 
-  int offset = calculateBlockOffset(pieceIdx, blockIdx);
-  std::vector<uint8_t> buffer(data.begin(), data.end());
+  // A block already held, typically an endgame duplicate, is dropped: once
+  // its piece has hashed and left the write cache, taking it in again would
+  // open an entry that never completes
+  if (blockStates_->isAcquired(pieceIdx, blockIdx)) {
+    return true;
+  }
+
+  // Pieces held in the write cache reach storage once they have hashed
+  if (!writeCache_ ||
+      !writeCache_->insert(pieceIdx, blockIdx * metadata_.blockSize, data)) {
+    write(calculateBlockOffset(pieceIdx, blockIdx), data);
+  }
 
-  write(offset, buffer);
+  acquireBlock(pieceIdx, blockIdx);
 
-  // Mark block as acquired
-  {
-    std::lock_guard<std::mutex> lock(mutex_);
-    blockAcquired_[pieceIdx][blockIdx] = true;
+  return true;
+}
+
+bool Torrent::writeBlock(int pieceIdx, int blockIdx, SharedBuffer data) {
+  if (!data) {
+    throw TorrentException(ErrorCode::InvalidParameter, "Block buffer is null");
   }
+  return writeBlock(pieceIdx, blockIdx, ByteSpan(*data));
+}
 
-  // Check if all blocks for this piece are acquired
-  bool allBlocksAcquired = true;
-  {
-    std::lock_guard<std::mutex> lock(mutex_);
-    for (bool acquired : blockAcquired_[pieceIdx]) {
-      if (!acquired) {
-        allBlocksAcquired = false;
-        break;
+bool Torrent::writeBlocks(const std::vector<BlockWrite> &blocks) {
+  std::vector<WriteSlice> slices;
+  slices.reserve(blocks.size());
+  std::vector<const BlockWrite *> accepted;
+  accepted.reserve(blocks.size());
+  for (const auto &block : blocks) {
+    validateBlockIndex(block.pieceIdx, block.blockIdx);
+    int expectedSize = getBlockSize(block.pieceIdx, block.blockIdx);
+    if (static_cast<int>(block.data.size()) != expectedSize) {
+      throw TorrentException(ErrorCode::InvalidParameter,
+                            "Block size mismatch: expected " +
+                                std::to_string(expectedSize) + ", got " +
+                                std::to_string(block.data.size()));
+    }
+    // Blocks already held are dropped as with writeBlock
+    if (blockStates_->isAcquired(block.pieceIdx, block.blockIdx)) {
+      continue;
+    }
+    accepted.push_back(&block);
+    if (writeCache_ &&
+        writeCache_->insert(block.pieceIdx,
+                            block.blockIdx * metadata_.blockSize,
+                            block.data)) {
+      continue;
+    }
+    slices.push_back(WriteSlice{
+        calculateBlockOffset(block.pieceIdx, block.blockIdx), block.data});
+  }
+
+  storage_->writev(std::move(slices));
+
+  for (const BlockWrite *block : accepted) {
+    acquireBlock(block->pieceIdx, block->blockIdx);
+  }
+  return true;
+}
+
+AsyncDiskIO &Torrent::asyncIO() const {
+  std::call_once(asyncIOOnce_, [this] {
+    asyncIO_ = std::make_unique<AsyncDiskIO>(*storage_,
+                                             storageOptions_.asyncQueueDepth,
+                                             metadata_.blockSize,
+                                             storageOptions_.useIoUring,
+                                             bufferPool_);
+  });
+  return *asyncIO_;
+}
+
+std::vector<DeviceExtent> Torrent::deviceExtents(uint64_t start,
+                                                size_t count) const {
+  auto extents = storage_->deviceExtents(start, count);
+  if (extents.empty()) {
+    extents.push_back(DeviceExtent{0, start, count});
+  }
+  return extents;
+}
+
+void Torrent::readBlockAsync(int pieceIdx, int blockIdx, ReadCompletion done) {
+  validateBlockIndex(pieceIdx, blockIdx);
+  uint64_t offset = calculateBlockOffset(pieceIdx, blockIdx);
+  size_t length = getBlockSize(pieceIdx, blockIdx);
+
+  auto callback = std::make_shared<ReadCompletion>(std::move(done));
+  auto extents = deviceExtents(offset, length);
+
+  // Blocks of verified pieces come from the read cache, which on a miss
+  // reads the surrounding line synchronously on the disk thread
+  if (readCache_ && verifier_->isPieceVerified(pieceIdx)) {
+    diskScheduler_->submit(
+        DiskJobClass::Upload, extents.front().device, offset,
+        [this, offset, length, callback](DiskJobScheduler::Done finished) {
+          BlockBuffer data;
+          int error = 0;
+          try {
+            data = readCache_->read(offset, length);
+          } catch (const std::exception &e) {
+            LOG_ERROR("Cached read at %llu failed: %s",
+                      static_cast<unsigned long long>(offset), e.what());
+            error = EIO;
+          }
+          if (*callback) {
+            (*callback)(error, error == 0 ? ByteSpan(data) : ByteSpan());
+          }
+          finished();
+        },
+        [callback] {
+          if (*callback) {
+            (*callback)(ECANCELED, ByteSpan());
+          }
+        },
+        diskOwner_);
+    return;
+  }
+
+  // A block that straddles devices is read in parts, one job per device
+  // queue, and handed over once the last part is in
+  std::shared_ptr<Internal::PartialRead> parts;
+  if (extents.size() > 1) {
+    parts = std::make_shared<Internal::PartialRead>(
+        bufferPool_->acquire(length), extents.size());
+  }
+  for (const auto &extent : extents) {
+    auto complete = [callback, parts, at = extent.start - offset](
+                        int error, ByteSpan data) {
+      if (parts) {
+        if (!parts->add(at, error, data)) {
+          return;
+        }
+        error = parts->error;
+        data = error == 0 ? ByteSpan(parts->data) : ByteSpan();
       }
+      if (*callback) {
+        (*callback)(error, data);
+      }
+    };
+    diskScheduler_->submit(
+        DiskJobClass::Upload, extent.device, extent.start,
+        [this, extent, complete](DiskJobScheduler::Done finished) {
+          asyncIO().read(extent.start, extent.length,
+                         [complete, finished](int error, ByteSpan data) {
+                           complete(error, data);
+                           finished();
+                         });
+        },
+        [complete] { complete(ECANCELED, ByteSpan()); }, diskOwner_);
+  }
+}
+
+void Torrent::writeBlockAsync(int pieceIdx, int blockIdx, SharedBuffer data,
+                              WriteCompletion done) {
+  writeBlockAsyncImpl(pieceIdx, blockIdx, std::move(data), std::move(done));
+}
+
+void Torrent::writeBlockAsync(int pieceIdx, int blockIdx, BlockBuffer data,
+                              WriteCompletion done) {
+  writeBlockAsyncImpl(pieceIdx, blockIdx, std::move(data), std::move(done));
+}
+
+template <typename Buffer>
+void Torrent::writeBlockAsyncImpl(int pieceIdx, int blockIdx, Buffer data,
+                                  WriteCompletion done) {
+  validateBlockIndex(pieceIdx, blockIdx);
+  if (!data) {
+    throw TorrentException(ErrorCode::InvalidParameter, "Block buffer is null");
+  }
+
+  size_t size = Internal::bytesOf(data).size();
+  int expectedSize = getBlockSize(pieceIdx, blockIdx);
+  if (static_cast<int>(size) != expectedSize) {
+    throw TorrentException(ErrorCode::InvalidParameter,
+                          "Block size mismatch: expected " +
+                              std::to_string(expectedSize) + ", got " +
+                              std::to_string(size));
+  }
+
+  // A block taken into the write cache, or dropped as a duplicate of one
+  // already held, needs no I/O; its completion still runs on a disk thread
+  uint64_t offset = calculateBlockOffset(pieceIdx, blockIdx);
+  bool duplicate = blockStates_->isAcquired(pieceIdx, blockIdx);
+  bool cached = !duplicate && writeCache_ &&
+                writeCache_->insert(pieceIdx, blockIdx * metadata_.blockSize,
+                                    Internal::bytesOf(data));
+  auto extents = deviceExtents(offset, size);
+  auto parts = std::make_shared<Internal::PartCountdown>(
+      cached || duplicate ? 1 : extents.size());
+  auto complete = [this, pieceIdx, blockIdx, duplicate, parts,
+                   done](int error) {
+    if (!parts->finish(error)) {
+      return;
+    }
+    error = parts->error;
+    if (error == 0 && !duplicate) {
+      acquireBlock(pieceIdx, blockIdx);
     }
+    if (done) {
+      done(error);
+    }
+  };
+
+  if (cached || duplicate) {
+    diskScheduler_->submit(
+        DiskJobClass::Write, extents.front().device, offset,
+        [complete](DiskJobScheduler::Done finished) {
+          complete(0);
+          finished();
+        },
+        [complete] { complete(ECANCELED); }, diskOwner_);
+    return;
+  }
+
+  for (const auto &extent : extents) {
+    // Parts of a block that straddles devices are written separately, one
+    // job per device queue
+    Buffer part = extents.size() > 1
+                      ? Internal::partOf(data, extent.start - offset,
+                                         extent.length)
+                      : data;
+    diskScheduler_->submit(
+        DiskJobClass::Write, extent.device, extent.start,
+        [this, extent, part = std::move(part),
+         complete](DiskJobScheduler::Done finished) {
+          asyncIO().write(extent.start, part,
+                          [complete, finished](int error) {
+                            complete(error);
+                            finished();
+                          });
+        },
+        [complete] { complete(ECANCELED); }, diskOwner_);
   }
+}
+
+void Torrent::verifyCompletedPiece(int pieceIdx) {
+  uint64_t start = calculatePieceOffset(pieceIdx);
+  size_t length = getPieceSize(pieceIdx);
+  auto extents = deviceExtents(start, length);
 
-  // If all blocks acquired, verify the piece
-  if (allBlocksAcquired) {
-    auto pieceData = readPiece(pieceIdx);
-    bool verified = verifier_->verify(pieceIdx, pieceData);
+  // A piece held in the write cache is hashed in memory; otherwise one hash
+  // job per device the piece lives on reads its part
+  BlockBuffer pieceData;
+  if (writeCache_) {
+    pieceData = writeCache_->takeComplete(pieceIdx);
+  }
+  bool cached = static_cast<bool>(pieceData);
+  if (!cached) {
+    pieceData = bufferPool_->acquire(length);
+    try {
+      for (const auto &extent : extents) {
+        diskScheduler_->run(
+            DiskJobClass::HashCheck, extent.device, extent.start, [&] {
+              storage_->readv(
+                  {ReadSlice{extent.start,
+                             pieceData.data() + (extent.start - start),
+                             static_cast<size_t>(extent.length)}});
+            },
+            diskOwner_);
+      }
+    } catch (...) {
+      // A piece that cannot be read back is downloaded again
+      if (writeCache_) {
+        writeCache_->release(pieceIdx, false);
+      }
+      blockStates_->resetPiece(pieceIdx);
+      notifyPieceVerified(pieceIdx, false);
+      throw;
+    }
+  }
+  bool verified = verifier_->matches(pieceIdx, pieceData);
 
-    if (!verified) {
-      // Hash mismatch - reset block tracking
-      LOG_INFO("Hash verification failed for piece %d", pieceIdx);
-      std::lock_guard<std::mutex> lock(mutex_);
-      std::fill(blockAcquired_[pieceIdx].begin(),
-                blockAcquired_[pieceIdx].end(), false);
-      return false;
+  // A cached piece that passed goes to storage in one write per device
+  // before it is reported; one that failed never touches the disk
+  if (cached) {
+    try {
+      if (verified) {
+        for (const auto &extent : extents) {
+          diskScheduler_->run(
+              DiskJobClass::Write, extent.device, extent.start, [&] {
+                storage_->write(extent.start,
+                                ByteSpan(pieceData.data() +
+                                             (extent.start - start),
+                                         extent.length));
+              },
+              diskOwner_);
+        }
+      }
+    } catch (...) {
+      writeCache_->release(pieceIdx, false);
+      blockStates_->resetPiece(pieceIdx);
+      notifyPieceVerified(pieceIdx, false);
+      throw;
     }
+    writeCache_->release(pieceIdx, verified);
+  } else if (writeCache_) {
+    writeCache_->release(pieceIdx, verified);
+  }
+  verifier_->record(pieceIdx, verified);
 
+  if (verified) {
     LOG_INFO("Piece %d verified successfully", pieceIdx);
-    return true;
+    storage_->onRangeComplete(start, length);
+  } else {
+    // Hash mismatch - reset block tracking before anyone is notified
+    LOG_INFO("Hash verification failed for piece %d", pieceIdx);
+    blockStates_->resetPiece(pieceIdx);
+  }
+
+  notifyPieceVerified(pieceIdx, verified);
+}
+
+// Mark a block as acquired; exactly one writer sees the piece complete and
+// hands it to the verification workers
+void Torrent::acquireBlock(int pieceIdx, int blockIdx) {
+  stateGeneration_.fetch_add(1, std::memory_order_relaxed);
+  // Partial before the piece can complete, so its verification always
+  // comes after. Only the piece's first block takes the picker's lock
+  if (!partialPieces_[pieceIdx].load(std::memory_order_acquire)) {
+    std::lock_guard<std::mutex> lock(pickerMutex_);
+    if (!partialPieces_[pieceIdx].load(std::memory_order_relaxed)) {
+      picker_->setPartial(pieceIdx, true);
+      partialPieces_[pieceIdx].store(true, std::memory_order_release);
+    }
   }
+  if (blockStates_->markAcquired(pieceIdx, blockIdx)) {
+    verificationQueue_->submit(pieceIdx);
+  }
+}
+
+void Torrent::notifyPieceVerified(int pieceIdx, bool verified) {
+  stateGeneration_.fetch_add(1, std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> lock(pickerMutex_);
+    partialPieces_[pieceIdx].store(false, std::memory_order_relaxed);
+    picker_->setPartial(pieceIdx, false);
+    picker_->setHave(pieceIdx, verified);
+  }
+  PieceVerifiedCallback callback;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    callback = pieceVerifiedCallback_;
+  }
+  if (callback) {
+    callback(pieceIdx, verified);
+  }
+  saveResumeDataPeriodically();
+}
+
+bool Torrent::saveResumeData(const fs::path &path) {
+  std::lock_guard<std::mutex> lock(resumeMutex_);
+  return saveResumeDataLocked(path);
+}
 
+bool Torrent::saveResumeDataLocked(const fs::path &path) {
+  uint64_t generation = stateGeneration_.load(std::memory_order_relaxed);
+  if (generation == savedGeneration_ && path == savedResumePath_) {
+    return false;
+  }
+
+  // Only blocks that are on storage count: those of pieces still held in
+  // the write cache are left out
+  ResumeData data;
+  data.infoHash = metadata_.infoHash;
+  data.totalSize = totalSize_;
+  data.pieceSize = metadata_.pieceSize;
+  data.blockSize = metadata_.blockSize;
+  data.allocation = storageOptions_.allocation;
+  data.verified = verifier_->getVerificationStatus();
+  for (int piece = 0; piece < getPieceCount(); piece++) {
+    int blockCount = blockStates_->getBlockCount(piece);
+    if (data.verified[piece] ||
+        blockStates_->getRemainingBlocks(piece) == blockCount ||
+        (writeCache_ && writeCache_->holds(piece))) {
+      continue;
+    }
+    std::vector<bool> blocks(
+        (metadata_.pieceSize + metadata_.blockSize - 1) / metadata_.blockSize);
+    for (int block = 0; block < blockCount; block++) {
+      blocks[block] = blockStates_->isAcquired(piece, block);
+    }
+    data.partial.emplace(piece, std::move(blocks));
+  }
+
+  // Everything recorded must be durable before the record is, and the
+  // mtimes are taken once nothing more of it is pending
+  storage_->sync();
+  for (const auto &file : files_) {
+    data.files.push_back(ResumeData::stateOf(file.getFilePath()));
+  }
+  data.save(path);
+
+  savedGeneration_ = generation;
+  savedResumePath_ = path;
+  lastResumeSave_ = std::chrono::steady_clock::now();
+  return true;
+}
+
+// Saves to StorageOptions::resumeDataPath once the interval has passed;
+// skipped while another save is running
+void Torrent::saveResumeDataPeriodically() {
+  if (storageOptions_.resumeDataPath.empty()) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(resumeMutex_, std::try_to_lock);
+  if (!lock.owns_lock() || std::chrono::steady_clock::now() - lastResumeSave_ <
+                               storageOptions_.resumeSaveInterval) {
+    return;
+  }
+  try {
+    saveResumeDataLocked(storageOptions_.resumeDataPath);
+  } catch (const std::exception &e) {
+    LOG_ERROR("Saving resume data failed: %s", e.what());
+    lastResumeSave_ = std::chrono::steady_clock::now();
+  }
+}
+
+ResumeLoadResult Torrent::loadResumeData(const fs::path &path) {
+  ResumeLoadResult result;
+  ResumeData data;
+  try {
+    data = ResumeData::load(path);
+  } catch (const TorrentException &e) {
+    result.error = e.what();
+    return result;
+  }
+
+  int pieceCount = getPieceCount();
+  if (data.infoHash != metadata_.infoHash || data.totalSize != totalSize_ ||
+      data.pieceSize != metadata_.pieceSize ||
+      data.blockSize != metadata_.blockSize ||
+      data.verified.size() != static_cast<size_t>(pieceCount) ||
+      data.files.size() != files_.size()) {
+    result.error = "Resume data describes a different torrent";
+    return result;
+  }
+
+  // Pieces touching a file that changed since the save are not trusted. A
+  // file with data that was missing then has nothing to vouch for it either
+  std::vector<bool> untrusted(pieceCount, false);
+  for (size_t i = 0; i < files_.size(); i++) {
+    const auto &file = files_[i];
+    if (file.getSize() == 0) {
+      continue;
+    }
+    if (data.files[i].mtime != 0 &&
+        ResumeData::stateOf(file.getFilePath()) == data.files[i]) {
+      continue;
+    }
+    result.changedFiles++;
+    uint64_t first = file.getOffset() / metadata_.pieceSize;
+    uint64_t last = (file.getOffset() + file.getSize() - 1) /
+                    metadata_.pieceSize;
+    for (uint64_t piece = first; piece <= last; piece++) {
+      untrusted[piece] = true;
+    }
+  }
+
+  for (int piece = 0; piece < pieceCount; piece++) {
+    if (data.verified[piece] && !untrusted[piece]) {
+      blockStates_->markPieceAcquired(piece);
+      verifier_->restore(piece);
+      {
+        std::lock_guard<std::mutex> lock(pickerMutex_);
+        picker_->setHave(piece, true);
+      }
+      result.verifiedPieces++;
+    }
+  }
+  for (const auto &partial : data.partial) {
+    int piece = partial.first;
+    if (data.verified[piece] || untrusted[piece]) {
+      continue;
+    }
+    int blockCount = blockStates_->getBlockCount(piece);
+    for (int block = 0; block < blockCount; block++) {
+      if (partial.second[block]) {
+        acquireBlock(piece, block);
+      }
+    }
+    result.partialPieces++;
+  }
+
+  // A file that matches what is on disk need not be written again
+  std::lock_guard<std::mutex> lock(resumeMutex_);
+  if (result.changedFiles == 0) {
+    savedGeneration_ = stateGeneration_.load(std::memory_order_relaxed);
+    savedResumePath_ = path;
+  }
+  result.loaded = true;
+  LOG_INFO("Resumed %d verified and %d partial pieces; %d files changed",
+           result.verifiedPieces, result.partialPieces, result.changedFiles);
+  return result;
+}
+
+bool Torrent::startRecheck(const RecheckOptions &options) {
+  std::lock_guard<std::mutex> lock(recheckMutex_);
+  if (recheck_ && !recheck_->done()) {
+    return false;
+  }
+
+  std::shared_ptr<const std::vector<DataExtent>> data;
+  if (options.skipHoles) {
+    data = std::make_shared<const std::vector<DataExtent>>(
+        storage_->dataExtents(0, totalSize_));
+  }
+
+  // Runs long enough for the disk to stream, yet enough of them to keep
+  // every thread busy until the end
+  int pieceCount = getPieceCount();
+  unsigned threads = options.threads > 0
+                         ? options.threads
+                         : std::max(1u, std::thread::hardware_concurrency());
+  int piecesPerRun = std::max(
+      1, std::min(static_cast<int>(Internal::kRecheckRunBytes /
+                                   metadata_.pieceSize),
+                  pieceCount / static_cast<int>(threads * 4)));
+
+  recheck_ = std::make_shared<RecheckJob>(
+      pieceCount, piecesPerRun, threads,
+      [this, data](int pieceIdx, RecheckResult &tally) {
+        recheckPiece(pieceIdx, data.get(), tally);
+      },
+      options.progress);
+  LOG_INFO("Rechecking %d pieces on %u threads", pieceCount, threads);
   return true;
 }
 
-bool Torrent::writePiece(int pieceIdx, const std::vector<uint8_t> &data) {
+void Torrent::cancelRecheck() {
+  std::lock_guard<std::mutex> lock(recheckMutex_);
+  if (recheck_) {
+    recheck_->cancel();
+  }
+}
+
+RecheckResult Torrent::waitForRecheck() {
+  std::shared_ptr<RecheckJob> job;
+  {
+    std::lock_guard<std::mutex> lock(recheckMutex_);
+    job = recheck_;
+  }
+  if (!job) {
+    return RecheckResult();
+  }
+  RecheckResult result = job->wait();
+  LOG_INFO("Recheck found %d pieces intact, %d failed, %d skipped in holes%s",
+           result.verifiedPieces, result.failedPieces, result.skippedPieces,
+           result.cancelled ? " before it was cancelled" : "");
+  return result;
+}
+
+RecheckResult Torrent::recheck(const RecheckOptions &options) {
+  startRecheck(options);
+  return waitForRecheck();
+}
+
+void Torrent::recheckPiece(int pieceIdx, const std::vector<DataExtent> *data,
+                           RecheckResult &tally) {
+  uint64_t start = calculatePieceOffset(pieceIdx);
+  size_t length = getPieceSize(pieceIdx);
+  uint64_t end = start + length;
+
+  // Taken before reading: a piece completed by a download while it is
+  // read here would look damaged
+  bool wasVerified = verifier_->isPieceVerified(pieceIdx);
+  bool read = true;
+  bool verified = false;
+  if (data) {
+    bool noData = false;
+    read = Internal::coversRange(*data, start, end, noData);
+    // The extents were taken when the recheck started; a piece verified
+    // since, by a download, is looked up again rather than judged by them
+    if (!read && wasVerified) {
+      read = Internal::coversRange(storage_->dataExtents(start, length), start,
+                                   end, noData);
+    }
+    if (!read && noData) {
+      verified = zeroHash(pieceIdx) == metadata_.pieceHashes[pieceIdx];
+    }
+  }
+
+  if (read) {
+    try {
+      BlockBuffer pieceData = bufferPool_->acquire(length);
+      for (const auto &device : deviceExtents(start, length)) {
+        diskScheduler_->run(
+            DiskJobClass::Recheck, device.device, device.start, [&] {
+              storage_->readv({ReadSlice{
+                  device.start, pieceData.data() + (device.start - start),
+                  static_cast<size_t>(device.length)}});
+            },
+            diskOwner_);
+      }
+      verified = verifier_->matches(pieceIdx, pieceData);
+      tally.bytesHashed += length;
+    } catch (const TorrentException &e) {
+      LOG_ERROR("Recheck cannot read piece %d: %s", pieceIdx, e.what());
+    }
+  }
+
+  // A piece that is neither intact nor believed to be is left as it is:
+  // its blocks may be arriving right now
+  if (verified) {
+    tally.verifiedPieces++;
+    blockStates_->markPieceAcquired(pieceIdx);
+    if (!verifier_->isPieceVerified(pieceIdx)) {
+      verifier_->record(pieceIdx, true);
+      notifyPieceVerified(pieceIdx, true);
+    }
+    return;
+  }
+
+  (read ? tally.failedPieces : tally.skippedPieces)++;
+  if (wasVerified) {
+    verifier_->record(pieceIdx, false);
+    blockStates_->resetPiece(pieceIdx);
+    if (readCache_) {
+      readCache_->invalidate(pieceIdx);
+    }
+    notifyPieceVerified(pieceIdx, false);
+  }
+}
+
+// SHA-1 of a piece of zeros: one for full pieces, one for a shorter last
+// piece, each computed on first use
+const Hash &Torrent::zeroHash(int pieceIdx) {
+  size_t length = getPieceSize(pieceIdx);
+  int slot = length == static_cast<size_t>(metadata_.pieceSize) ? 0 : 1;
+  std::call_once(zeroHashOnce_[slot], [&] {
+    zeroHash_[slot] =
+        HexToHash(SHA1::computeHash(std::string(length, '\0')));
+  });
+  return zeroHash_[slot];
+}
+
+bool Torrent::writePiece(int pieceIdx, ByteSpan data) {
   validatePieceIndex(pieceIdx);
 
   int expectedSize = getPieceSize(pieceIdx);
@@ -234,21 +998,28 @@ bool Torrent::writePiece(int pieceIdx, const std::vector<uint8_t> &data) {
                               std::to_string(data.size()));
   }
 
-  write(metadata_.pieceSize * pieceIdx, data);
+  write(calculatePieceOffset(pieceIdx), data);
 
   // Verify the piece
   bool verified = verifier_->verify(pieceIdx, data);
 
   if (verified) {
     // Mark all blocks as acquired
-    std::lock_guard<std::mutex> lock(mutex_);
-    std::fill(blockAcquired_[pieceIdx].begin(), blockAcquired_[pieceIdx].end(),
-              true);
+    blockStates_->markPieceAcquired(pieceIdx);
+    storage_->onRangeComplete(calculatePieceOffset(pieceIdx), data.size());
   }
 
+  notifyPieceVerified(pieceIdx, verified);
   return verified;
 }
 
+bool Torrent::writePiece(int pieceIdx, SharedBuffer data) {
+  if (!data) {
+    throw TorrentException(ErrorCode::InvalidParameter, "Piece buffer is null");
+  }
+  return writePiece(pieceIdx, ByteSpan(*data));
+}
+
 const Hash &Torrent::getHash(int pieceIdx) const {
   validatePieceIndex(pieceIdx);
   return metadata_.pieceHashes[pieceIdx];
@@ -256,49 +1027,86 @@ const Hash &Torrent::getHash(int pieceIdx) const {
 
 const Hash &Torrent::getInfoHash() const { return metadata_.infoHash; }
 
-int Torrent::getUploaded() const { return uploaded_; }
+uint64_t Torrent::getUploaded() const { return uploaded_; }
 int Torrent::getVerifiedPieceCount() const {
-  const auto &status = verifier_->getVerificationStatus();
-  return std::count(status.begin(), status.end(), true);
+  return verifier_->getVerifiedPieceCount();
 }
 
-int Torrent::getDownloaded() const {
-  return metadata_.pieceSize * getVerifiedPieceCount();
+uint64_t Torrent::getDownloaded() const {
+  return static_cast<uint64_t>(verifier_->getVerifiedBytes());
 }
-int Torrent::getLeft() const { return getTotalSize() - getDownloaded(); }
+uint64_t Torrent::getLeft() const { return getTotalSize() - getDownloaded(); }
 
-std::vector<uint8_t> Torrent::read(size_t start, size_t count) const {
-  if (!fileManager_) {
-    throw TorrentException(ErrorCode::FileReadError, "FileManager not initialized");
+BlockBuffer Torrent::read(uint64_t start, size_t count) const {
+  if (!storage_) {
+    throw TorrentException(ErrorCode::FileReadError, "Storage not initialized");
   }
-  return fileManager_->read(start, count);
+  BlockBuffer buffer = bufferPool_->acquire(count);
+  storage_->readv({ReadSlice{start, buffer.data(), count}});
+  return buffer;
 }
 
-void Torrent::write(size_t start, const std::vector<uint8_t> &buffer) {
-  if (!fileManager_) {
+void Torrent::write(uint64_t start, ByteSpan buffer) {
+  if (!storage_) {
     throw TorrentException(ErrorCode::FileWriteError,
-                           "FileManager not initialized");
+                           "Storage not initialized");
   }
-
-  std::vector<uint8_t> vec(buffer.begin(), buffer.end());
-  fileManager_->write(start, vec);
+  storage_->write(start, buffer);
 }
 
 void Torrent::setPieceVerifiedCallback(PieceVerifiedCallback callback) {
-  verifier_->setPieceVerifiedCallback(std::move(callback));
+  std::lock_guard<std::mutex> lock(mutex_);
+  pieceVerifiedCallback_ = std::move(callback);
+}
+
+void Torrent::setPieceTimeCritical(int pieceIdx, bool critical) {
+  validatePieceIndex(pieceIdx);
+  verificationQueue_->setTimeCritical(pieceIdx, critical);
+}
+
+void Torrent::waitForVerification() { verificationQueue_->waitIdle(); }
+
+DiskSchedulerStats Torrent::getDiskSchedulerStats() const {
+  return diskScheduler_->getStats();
+}
+
+BufferPoolStats Torrent::getBufferPoolStats() const {
+  return bufferPool_->getStats();
+}
+
+void Torrent::flushWriteCache() {
+  if (writeCache_) {
+    writeCache_->flushAll();
+    // Blocks now on storage belong in the next resume data
+    stateGeneration_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+WriteCacheStats Torrent::getWriteCacheStats() const {
+  return writeCache_ ? writeCache_->getStats() : WriteCacheStats();
+}
+
+ReadCacheStats Torrent::getReadCacheStats() const {
+  return readCache_ ? readCache_->getStats() : ReadCacheStats();
 }
 
 void Torrent::ensureFilesExist() {
-  if (!fileManager_) {
+  if (!storage_) {
     throw TorrentException(ErrorCode::FileAccessDenied,
-                          "FileManager not initialized");
+                          "Storage not initialized");
   }
-  fileManager_->ensureFilesExist();
+  storage_->allocate();
+}
+
+AllocationStatus Torrent::getAllocationStatus() const {
+  return storage_->getAllocationStatus();
 }
 
+StorageStat Torrent::getStorageStat() const { return storage_->stat(); }
+
 void Torrent::closeFiles() {
-  if (fileManager_) {
-    fileManager_->closeAll();
+  if (storage_) {
+    storage_->close();
   }
 }
 
@@ -309,29 +1117,128 @@ void Torrent::updateTracker(TrackerEvent ev, const std::string &id,
   }
 }
 
-double Torrent::getProgress() const {
-  if (getPieceCount() == 0) {
-    return 0.0;
+void Torrent::addPeerAvailability(const std::vector<bool> &bitfield) {
+  std::lock_guard<std::mutex> lock(pickerMutex_);
+  picker_->addPeer(bitfield);
+}
+
+void Torrent::removePeerAvailability(const std::vector<bool> &bitfield) {
+  std::lock_guard<std::mutex> lock(pickerMutex_);
+  picker_->removePeer(bitfield);
+}
+
+void Torrent::addPieceAvailability(int pieceIdx) {
+  validatePieceIndex(pieceIdx);
+  std::lock_guard<std::mutex> lock(pickerMutex_);
+  picker_->incAvailability(pieceIdx);
+}
+
+void Torrent::addSeedAvailability() {
+  std::lock_guard<std::mutex> lock(pickerMutex_);
+  picker_->addSeed();
+}
+
+void Torrent::removeSeedAvailability() {
+  std::lock_guard<std::mutex> lock(pickerMutex_);
+  picker_->removeSeed();
+}
+
+int Torrent::getPieceAvailability(int pieceIdx) const {
+  validatePieceIndex(pieceIdx);
+  std::lock_guard<std::mutex> lock(pickerMutex_);
+  return picker_->getAvailability(pieceIdx);
+}
+
+std::vector<int> Torrent::pickPieces(const std::vector<bool> &peerHas,
+                                     int count) {
+  std::lock_guard<std::mutex> lock(pickerMutex_);
+  return picker_->pick(peerHas, count);
+}
+
+DownloadPriority Torrent::calculatePiecePriority(int pieceIdx) const {
+  uint64_t start = calculatePieceOffset(pieceIdx);
+  uint64_t end = start + getPieceSize(pieceIdx);
+
+  // First file ending past the piece's start, then those it runs into
+  auto it = std::upper_bound(
+      files_.begin(), files_.end(), start,
+      [](uint64_t value, const FileItem &file) {
+        return value < static_cast<uint64_t>(file.getOffset()) + file.getSize();
+      });
+  DownloadPriority priority = DownloadPriority::Skip;
+  for (; it != files_.end() && static_cast<uint64_t>(it->getOffset()) < end;
+       ++it) {
+    if (it->getSize() > 0) {
+      priority = std::max(priority, filePriorities_[it - files_.begin()]);
+    }
   }
+  return priority;
+}
 
-  int verifiedCount = 0;
-  for (int i = 0; i < getPieceCount(); i++) {
-    if (verifier_->isPieceVerified(i)) {
-      verifiedCount++;
+void Torrent::setFilePriority(size_t fileIdx, DownloadPriority priority) {
+  if (fileIdx >= files_.size()) {
+    throw TorrentException(ErrorCode::InvalidParameter,
+                           "Invalid file index: " + std::to_string(fileIdx));
+  }
+  const FileItem &file = files_[fileIdx];
+  {
+    std::lock_guard<std::mutex> lock(pickerMutex_);
+    if (filePriorities_[fileIdx] == priority) {
+      return;
+    }
+    filePriorities_[fileIdx] = priority;
+    // Changed together with the picker, so a block picked for a file that
+    // was just unskipped always finds the storage flag cleared
+    storage_->setFileSkipped(fileIdx, priority == DownloadPriority::Skip);
+
+    // Pieces inside the file take its priority; the two at its ends may
+    // share bytes with other files
+    int pieceSize = metadata_.pieceSize;
+    uint64_t start = static_cast<uint64_t>(file.getOffset());
+    if (file.getSize() > 0 && start < totalSize_) {
+      int first = static_cast<int>(start / pieceSize);
+      int last = static_cast<int>((start + file.getSize() - 1) / pieceSize);
+      for (int piece = first + 1; piece < last; piece++) {
+        picker_->setPriority(piece, priority);
+      }
+      picker_->setPriority(first, calculatePiecePriority(first));
+      picker_->setPriority(last, calculatePiecePriority(last));
     }
   }
+}
 
-  return static_cast<double>(verifiedCount) / getPieceCount() * 100.0;
+void Torrent::setFilePriorities(
+    const std::vector<DownloadPriority> &priorities) {
+  if (priorities.size() != files_.size()) {
+    throw TorrentException(ErrorCode::InvalidParameter,
+                           "Expected " + std::to_string(files_.size()) +
+                               " file priorities, got " +
+                               std::to_string(priorities.size()));
+  }
+  for (size_t i = 0; i < priorities.size(); i++) {
+    setFilePriority(i, priorities[i]);
+  }
 }
 
-size_t Torrent::getDownloadedBytes() const {
-  size_t downloaded = 0;
-  for (int i = 0; i < getPieceCount(); i++) {
-    if (verifier_->isPieceVerified(i)) {
-      downloaded += getPieceSize(i);
-    }
+DownloadPriority Torrent::getFilePriority(size_t fileIdx) const {
+  if (fileIdx >= files_.size()) {
+    throw TorrentException(ErrorCode::InvalidParameter,
+                           "Invalid file index: " + std::to_string(fileIdx));
   }
-  return downloaded;
+  std::lock_guard<std::mutex> lock(pickerMutex_);
+  return filePriorities_[fileIdx];
+}
+
+DownloadPriority Torrent::getPiecePriority(int pieceIdx) const {
+  validatePieceIndex(pieceIdx);
+  std::lock_guard<std::mutex> lock(pickerMutex_);
+  return picker_->getPriority(pieceIdx);
+}
+
+double Torrent::getProgress() const { return verifier_->getProgress(); }
+
+uint64_t Torrent::getDownloadedBytes() const {
+  return static_cast<uint64_t>(verifier_->getVerifiedBytes());
 }
 
 } // namespace LitTorrent
@@ -22,12 +22,15 @@ static std::string decodeUTF8String(const ByteArray &bytes) {
 
 static std::vector<FileItem> collectFileWithinDir(const fs::path& path){
     std::vector<FileItem> files;
+    int64_t running = 0;
     
     try {
         for (const auto& entry : fs::recursive_directory_iterator(path)) {
             if (entry.is_regular_file()) {
                 auto filepath = entry.path();
-                files.push_back(FileItem(filepath, fs::file_size(filepath)));
+                auto size = fs::file_size(filepath);
+                files.push_back(FileItem(filepath, size, running));
+                running += size;
             }
         }
     } catch (const fs::filesystem_error &e) {
@@ -41,7 +44,8 @@ static std::vector<FileItem> collectFileWithinDir(const fs::path& path){
 
 // Static method to load from BEncoded object
 TorrentPtr Torrent::fromBEncodedObj(BEncodedValuePtr object,
-                                    const std::string &downloadPath) {
+                                    const std::string &downloadPath,
+                                    const StorageOptions &storageOptions) {
   if (!object || object->GetType() != BEncodedValue::Type::Dictionary) {
     throw TorrentException(ErrorCode::InvalidTorrentFile,
                           "Root element is not a dictionary");
@@ -182,7 +186,7 @@ TorrentPtr Torrent::fromBEncodedObj(BEncodedValuePtr object,
   // Create torrent
   auto torrent = std::make_shared<Torrent>(torrentName, downloadPath, files,
                                            trackers, pieceSize, pieceHashes,
-                                           16384, isPrivate);
+                                           16384, isPrivate, storageOptions);
 
   // Set optional metadata fields
   if (obj.find("comment") != obj.end()) {
@@ -207,7 +211,7 @@ TorrentPtr Torrent::fromBEncodedObj(BEncodedValuePtr object,
   // Compute info hash
   auto infoEncoded = Internal::decodeUTF8String(BEncoding::Encode(infoValue));
   std::string infoHashStr = SHA1::computeHash(infoEncoded);
-  torrent->metadata_.infoHash = BytesToHash(infoHashStr);
+  torrent->metadata_.infoHash = HexToHash(infoHashStr);
 
   return torrent;
 }
@@ -334,10 +338,11 @@ BEncodedValuePtr Torrent::toBEncodedObj(TorrentPtr torrent) {
 }
 
 TorrentPtr Torrent::loadFromFile(fs::path filePath,
-                                 fs::path downloadDir) {
+                                 fs::path downloadDir,
+                                 const StorageOptions &storageOptions) {
   try {
     auto object = BEncoding::DecodeFile(filePath);
-    return fromBEncodedObj(object, downloadDir.string());
+    return fromBEncodedObj(object, downloadDir.string(), storageOptions);
   } catch (const TorrentException &) {
     throw; // Re-throw our exceptions
   } catch (const std::exception &e) {
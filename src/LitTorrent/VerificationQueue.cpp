@@ -0,0 +1,134 @@
+#include "VerificationQueue.h"
+#include "Logger.h"
+#include <algorithm>
+#include <exception>
+
+namespace LitTorrent {
+
+VerificationQueue::VerificationQueue(Handler handler, unsigned workerCount)
+    : handler_(std::move(handler)) {
+  if (workerCount == 0) {
+    workerCount = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  workers_.reserve(workerCount);
+  for (unsigned i = 0; i < workerCount; i++) {
+    workers_.emplace_back(&VerificationQueue::workerLoop, this);
+  }
+}
+
+VerificationQueue::~VerificationQueue() { stop(); }
+
+void VerificationQueue::submit(int pieceIndex, VerifyPriority priority) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) {
+      return;
+    }
+
+    bool critical = priority == VerifyPriority::TimeCritical ||
+                    timeCritical_.count(pieceIndex) > 0;
+    bool alreadyPending = !pending_.insert(pieceIndex).second;
+
+    if (alreadyPending && !critical) {
+      return;
+    }
+
+    // A promoted piece stays in the normal lane as well; popNext skips
+    // entries that are no longer pending
+    (critical ? priorityLane_ : normalLane_).push_back(pieceIndex);
+  }
+  workAvailable_.notify_one();
+}
+
+void VerificationQueue::setTimeCritical(int pieceIndex, bool critical) {
+  bool promoted = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!critical) {
+      timeCritical_.erase(pieceIndex);
+      return;
+    }
+
+    timeCritical_.insert(pieceIndex);
+    if (pending_.count(pieceIndex) > 0) {
+      priorityLane_.push_back(pieceIndex);
+      promoted = true;
+    }
+  }
+  if (promoted) {
+    workAvailable_.notify_one();
+  }
+}
+
+void VerificationQueue::waitIdle() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [this] { return pending_.empty() && running_ == 0; });
+}
+
+size_t VerificationQueue::pending() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pending_.size();
+}
+
+void VerificationQueue::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) {
+      return;
+    }
+    stopping_ = true;
+    priorityLane_.clear();
+    normalLane_.clear();
+    pending_.clear();
+  }
+  workAvailable_.notify_all();
+
+  for (auto &worker : workers_) {
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+  idle_.notify_all();
+}
+
+bool VerificationQueue::popNext(int &pieceIndex) {
+  for (auto *lane : {&priorityLane_, &normalLane_}) {
+    while (!lane->empty()) {
+      int candidate = lane->front();
+      lane->pop_front();
+      if (pending_.erase(candidate) > 0) {
+        pieceIndex = candidate;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void VerificationQueue::workerLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    int pieceIndex = -1;
+    workAvailable_.wait(lock, [&] { return stopping_ || popNext(pieceIndex); });
+    if (stopping_) {
+      return;
+    }
+
+    running_++;
+    lock.unlock();
+    try {
+      handler_(pieceIndex);
+    } catch (const std::exception &e) {
+      LOG_ERROR("Verification of piece %d failed: %s", pieceIndex, e.what());
+    }
+    lock.lock();
+    running_--;
+
+    if (pending_.empty() && running_ == 0) {
+      idle_.notify_all();
+    }
+  }
+}
+
+} // namespace LitTorrent
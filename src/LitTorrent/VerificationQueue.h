@@ -0,0 +1,70 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace LitTorrent {
+
+// Lane a completed piece is queued on; time-critical pieces (e.g. the ones a
+// streaming player is waiting for) are always hashed before normal ones
+enum class VerifyPriority { Normal, TimeCritical };
+
+// Hashes completed pieces on a pool of worker threads so the thread writing
+// blocks never waits for SHA-1. The handler is invoked on a worker thread with
+// the index of the piece to verify and is responsible for reporting the result
+class VerificationQueue {
+public:
+  using Handler = std::function<void(int pieceIndex)>;
+
+  // workerCount == 0 picks one worker per hardware thread
+  explicit VerificationQueue(Handler handler, unsigned workerCount = 0);
+  ~VerificationQueue();
+
+  // Disable copy and move
+  VerificationQueue(const VerificationQueue &) = delete;
+  VerificationQueue &operator=(const VerificationQueue &) = delete;
+  VerificationQueue(VerificationQueue &&) = delete;
+  VerificationQueue &operator=(VerificationQueue &&) = delete;
+
+  // Queue a piece for verification. A piece that is already pending is not
+  // queued twice; submitting it as TimeCritical promotes it instead
+  void submit(int pieceIndex, VerifyPriority priority = VerifyPriority::Normal);
+
+  // Route future submits of this piece to the priority lane, and promote it
+  // if it is already pending
+  void setTimeCritical(int pieceIndex, bool critical);
+
+  // Block until every queued and running job has finished
+  void waitIdle();
+
+  // Number of pieces waiting for a worker
+  size_t pending() const;
+
+  // Stop the workers; jobs that have not started are dropped
+  void stop();
+
+private:
+  void workerLoop();
+  bool popNext(int &pieceIndex);
+
+  Handler handler_;
+  std::deque<int> priorityLane_;
+  std::deque<int> normalLane_;
+  std::unordered_set<int> pending_;
+  std::unordered_set<int> timeCritical_;
+  size_t running_ = 0;
+  bool stopping_ = false;
+
+  mutable std::mutex mutex_;
+  std::condition_variable workAvailable_;
+  std::condition_variable idle_;
+  std::vector<std::thread> workers_;
+};
+
+} // namespace LitTorrent
@@ -0,0 +1,255 @@
+#include "WriteCache.h"
+#include "Logger.h"
+#include <algorithm>
+#include <cstring>
+#include <exception>
+
+namespace LitTorrent {
+
+WriteCache::WriteCache(std::shared_ptr<CacheBudget> budget,
+                       std::shared_ptr<BufferPool> pool, uint64_t pieceSize,
+                       uint64_t totalSize, size_t blockSize, Writer writer)
+    : budget_(std::move(budget)), pool_(std::move(pool)),
+      pieceSize_(pieceSize), totalSize_(totalSize), blockSize_(blockSize),
+      writer_(std::move(writer)) {
+  // Dirty data is the last thing to give back
+  budget_->attach(this, 1);
+}
+
+WriteCache::~WriteCache() {
+  budget_->detach(this);
+  for (auto &entry : entries_) {
+    if (entry.second.buffer) {
+      budget_->release(entry.second.size);
+    }
+  }
+}
+
+size_t WriteCache::pieceLength(int pieceIdx) const {
+  uint64_t start = pieceSize_ * pieceIdx;
+  return static_cast<size_t>(std::min(pieceSize_, totalSize_ - start));
+}
+
+bool WriteCache::insert(int pieceIdx, size_t offset, ByteSpan data) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto it = entries_.find(pieceIdx);
+  if (it == entries_.end()) {
+    // The reservation may flush pieces, this cache's included
+    lock.unlock();
+    createEntry(pieceIdx);
+    lock.lock();
+    it = entries_.find(pieceIdx);
+    if (it == entries_.end()) {
+      // A duplicate of a block whose piece has been hashed meanwhile
+      stats_.writtenThrough++;
+      return false;
+    }
+  }
+
+  Entry &entry = it->second;
+  if (entry.state != State::Caching) {
+    stats_.writtenThrough++;
+    return false;
+  }
+
+  std::memcpy(entry.buffer.data() + offset, data.data(), data.size());
+  size_t block = offset / blockSize_;
+  if (!entry.received[block]) {
+    entry.received[block] = true;
+    entry.receivedCount++;
+  }
+  stats_.cachedBlocks++;
+  return true;
+}
+
+// Every piece seen gets an entry, so once one block of a piece has been
+// written through, the rest of it is too
+bool WriteCache::createEntry(int pieceIdx) {
+  size_t size = pieceLength(pieceIdx);
+  BlockBuffer buffer;
+  if (size <= budget_->limit() && budget_->reserve(size)) {
+    try {
+      buffer = pool_->acquire(size);
+    } catch (const std::bad_alloc &) {
+      budget_->release(size);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto inserted = entries_.emplace(pieceIdx, Entry());
+  if (!inserted.second) {
+    // Created by another writer in the meantime
+    if (buffer) {
+      budget_->release(size);
+    }
+    return false;
+  }
+
+  Entry &entry = inserted.first->second;
+  entry.size = size;
+  entry.created = Clock::now();
+  entry.received.assign((size + blockSize_ - 1) / blockSize_, false);
+  entry.state = buffer ? State::Caching : State::Flushed;
+  entry.buffer = std::move(buffer);
+  return true;
+}
+
+// Writes out the blocks received so far and frees the buffer. Called with
+// the lock held; it is released during the write
+void WriteCache::flush(int pieceIdx, Entry &entry,
+                       std::unique_lock<std::mutex> &lock) {
+  entry.state = State::Flushing;
+  BlockBuffer buffer = std::move(entry.buffer);
+  size_t size = entry.size;
+
+  std::vector<WriteSlice> slices;
+  uint64_t start = pieceSize_ * pieceIdx;
+  for (size_t block = 0; block < entry.received.size(); block++) {
+    if (entry.received[block]) {
+      size_t offset = block * blockSize_;
+      slices.push_back(WriteSlice{
+          start + offset, ByteSpan(buffer.data() + offset,
+                                   std::min(blockSize_, size - offset))});
+    }
+  }
+
+  lock.unlock();
+  bool failed = false;
+  try {
+    // Slices that are back to back go out as one vectored write
+    if (!slices.empty()) {
+      writer_(std::move(slices));
+    }
+  } catch (const std::exception &e) {
+    LOG_ERROR("Flushing cached piece %d failed: %s", pieceIdx, e.what());
+    failed = true;
+  }
+  buffer = BlockBuffer();
+  budget_->release(size);
+  lock.lock();
+
+  // Entries are only erased by release(), which waits for the flush
+  entry.state = State::Flushed;
+  stats_.flushedPieces++;
+  stats_.flushErrors += failed;
+  flushDone_.notify_all();
+}
+
+BlockBuffer WriteCache::takeComplete(int pieceIdx) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto it = entries_.find(pieceIdx);
+  if (it == entries_.end()) {
+    return BlockBuffer();
+  }
+
+  Entry &entry = it->second;
+  flushDone_.wait(lock, [&] { return entry.state != State::Flushing; });
+  if (entry.state != State::Caching) {
+    return BlockBuffer();
+  }
+  if (entry.receivedCount < entry.received.size()) {
+    // Not every block came through the cache; hash what storage holds
+    flush(pieceIdx, entry, lock);
+    return BlockBuffer();
+  }
+
+  entry.state = State::Pinned;
+  stats_.hashedInMemory++;
+  return entry.buffer;
+}
+
+void WriteCache::release(int pieceIdx, bool passed) {
+  size_t reserved = 0;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = entries_.find(pieceIdx);
+    if (it == entries_.end()) {
+      return;
+    }
+    Entry &entry = it->second;
+    flushDone_.wait(lock, [&] { return entry.state != State::Flushing; });
+    if (entry.state == State::Pinned && !passed) {
+      stats_.discarded++;
+    }
+    if (entry.buffer) {
+      reserved = entry.size;
+    }
+    entries_.erase(it);
+  }
+  budget_->release(reserved);
+}
+
+bool WriteCache::holds(int pieceIdx) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(pieceIdx);
+  return it != entries_.end() && it->second.state != State::Flushed;
+}
+
+void WriteCache::flushAll() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::vector<int> pieces;
+  for (const auto &entry : entries_) {
+    if (entry.second.state == State::Caching) {
+      pieces.push_back(entry.first);
+    }
+  }
+  for (int pieceIdx : pieces) {
+    auto it = entries_.find(pieceIdx);
+    if (it != entries_.end() && it->second.state == State::Caching) {
+      flush(pieceIdx, it->second, lock);
+    }
+  }
+}
+
+size_t WriteCache::reclaim(size_t bytes) {
+  size_t freed = 0;
+  std::unique_lock<std::mutex> lock(mutex_);
+  bool takeComplete = false;
+  while (freed < bytes) {
+    // The most complete piece goes first, as it makes the longest write;
+    // among equals, the one that has waited longest. Complete pieces are
+    // about to be hashed, so they are only flushed when nothing else is left
+    int victim = -1;
+    Entry *best = nullptr;
+    for (auto &candidate : entries_) {
+      Entry &entry = candidate.second;
+      if (entry.state != State::Caching ||
+          (!takeComplete && entry.receivedCount == entry.received.size())) {
+        continue;
+      }
+      if (!best ||
+          entry.receivedCount * best->received.size() >
+              best->receivedCount * entry.received.size() ||
+          (entry.receivedCount * best->received.size() ==
+               best->receivedCount * entry.received.size() &&
+           entry.created < best->created)) {
+        victim = candidate.first;
+        best = &entry;
+      }
+    }
+    if (!best) {
+      if (takeComplete) {
+        break;
+      }
+      takeComplete = true;
+      continue;
+    }
+    freed += best->size;
+    flush(victim, *best, lock);
+  }
+  return freed;
+}
+
+WriteCacheStats WriteCache::getStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  WriteCacheStats stats = stats_;
+  for (const auto &entry : entries_) {
+    if (entry.second.buffer) {
+      stats.cachedPieces++;
+      stats.cachedBytes += entry.second.size;
+    }
+  }
+  return stats;
+}
+
+} // namespace LitTorrent
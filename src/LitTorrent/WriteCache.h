@@ -0,0 +1,117 @@
+#pragma once
+
+#include "Define.h"
+#include "LitTorrent/BufferPool.h"
+#include "LitTorrent/CacheBudget.h"
+#include "LitTorrent/Storage.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace LitTorrent {
+
+struct WriteCacheStats {
+  size_t cachedPieces = 0;
+  size_t cachedBytes = 0;     // reserved for pieces held in memory
+  uint64_t cachedBlocks = 0;  // blocks taken into memory
+  uint64_t writtenThrough = 0; // blocks of pieces that are not cached
+  uint64_t hashedInMemory = 0; // complete pieces hashed from memory
+  uint64_t discarded = 0;     // of which failed and never reached the disk
+  uint64_t flushedPieces = 0; // pieces written out early to free memory
+  uint64_t flushErrors = 0;
+};
+
+// Write-back cache of pieces being downloaded. Blocks are copied into a
+// piece-sized pool buffer and kept there until the piece is complete, so a
+// piece is hashed straight from memory and, once it has passed, written with
+// one large sequential write; a piece that fails never touches the disk.
+//
+// Each cached piece reserves its full size from the shared budget. When the
+// budget runs short, pieces are flushed early, the most complete (then the
+// oldest) first: the blocks received so far are written out and the memory
+// freed. That partial flush is also how pieces too large to hold many of
+// are handled. The remaining blocks of a flushed piece are written through,
+// and the piece is read back from storage to be hashed. Pieces larger than
+// the whole budget are never cached
+class WriteCache : public CacheBudget::Consumer {
+public:
+  // Persists flushed blocks (throws TorrentException)
+  using Writer = std::function<void(std::vector<WriteSlice> slices)>;
+
+  WriteCache(std::shared_ptr<CacheBudget> budget,
+             std::shared_ptr<BufferPool> pool, uint64_t pieceSize,
+             uint64_t totalSize, size_t blockSize, Writer writer);
+  ~WriteCache() override;
+
+  // Disable copy and move
+  WriteCache(const WriteCache &) = delete;
+  WriteCache &operator=(const WriteCache &) = delete;
+  WriteCache(WriteCache &&) = delete;
+  WriteCache &operator=(WriteCache &&) = delete;
+
+  // Copy a block in at offset within its piece. False when the piece is not
+  // cached, in which case the caller writes the block through
+  bool insert(int pieceIdx, size_t offset, ByteSpan data);
+
+  // For a piece whose blocks have all arrived: its data if it is held in
+  // memory, pinned until release(). Otherwise waits for any flush of the
+  // piece to finish and returns an empty buffer; the piece is on storage
+  BlockBuffer takeComplete(int pieceIdx);
+
+  // Forget a piece once it has been hashed, after writing it out if it
+  // passed. A piece that failed is counted as discarded
+  void release(int pieceIdx, bool passed);
+
+  // True while blocks of the piece are in memory and not yet on storage
+  bool holds(int pieceIdx) const;
+
+  // Write out every piece held in memory, e.g. before shutting down
+  void flushAll();
+
+  size_t reclaim(size_t bytes) override;
+
+  WriteCacheStats getStats() const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  enum class State {
+    Caching,  // receiving blocks into buffer
+    Flushing, // being written out early; new blocks are written through
+    Flushed,  // on storage; new blocks are written through
+    Pinned    // complete and being hashed
+  };
+
+  struct Entry {
+    State state = State::Caching;
+    BlockBuffer buffer;
+    size_t size = 0;
+    std::vector<bool> received; // per block
+    size_t receivedCount = 0;
+    Clock::time_point created;
+  };
+
+  std::shared_ptr<CacheBudget> budget_;
+  std::shared_ptr<BufferPool> pool_;
+  uint64_t pieceSize_;
+  uint64_t totalSize_;
+  size_t blockSize_;
+  Writer writer_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable flushDone_;
+  std::unordered_map<int, Entry> entries_;
+  WriteCacheStats stats_;
+
+  size_t pieceLength(int pieceIdx) const;
+  bool createEntry(int pieceIdx);
+  void flush(int pieceIdx, Entry &entry, std::unique_lock<std::mutex> &lock);
+};
+
+} // namespace LitTorrent
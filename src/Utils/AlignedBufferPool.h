@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace LitTorrent {
+
+// Fixed-size buffers starting on an alignment boundary, as O_DIRECT requires.
+// Released buffers are kept for reuse up to maxFree; beyond that they are
+// freed. The pool must outlive every buffer it hands out
+class AlignedBufferPool {
+public:
+  struct Deleter {
+    AlignedBufferPool *pool;
+    void operator()(uint8_t *data) const { pool->release(data); }
+  };
+  using Buffer = std::unique_ptr<uint8_t, Deleter>;
+
+  AlignedBufferPool(size_t bufferSize, size_t alignment, size_t maxFree = 16)
+      : bufferSize_(bufferSize), alignment_(alignment), maxFree_(maxFree) {}
+
+  ~AlignedBufferPool() {
+    for (uint8_t *data : free_) {
+      std::free(data);
+    }
+  }
+
+  AlignedBufferPool(const AlignedBufferPool &) = delete;
+  AlignedBufferPool &operator=(const AlignedBufferPool &) = delete;
+
+  // Contents are whatever the previous user left behind
+  Buffer acquire() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!free_.empty()) {
+        uint8_t *data = free_.back();
+        free_.pop_back();
+        return Buffer(data, Deleter{this});
+      }
+    }
+    void *data = nullptr;
+    if (::posix_memalign(&data, alignment_, bufferSize_) != 0) {
+      throw std::bad_alloc();
+    }
+    return Buffer(static_cast<uint8_t *>(data), Deleter{this});
+  }
+
+  size_t bufferSize() const { return bufferSize_; }
+  size_t alignment() const { return alignment_; }
+
+private:
+  size_t bufferSize_;
+  size_t alignment_;
+  size_t maxFree_;
+  std::mutex mutex_;
+  std::vector<uint8_t *> free_;
+
+  void release(uint8_t *data) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (free_.size() < maxFree_) {
+        free_.push_back(data);
+        return;
+      }
+    }
+    std::free(data);
+  }
+};
+
+} // namespace LitTorrent
@@ -0,0 +1,784 @@
+#include "AsyncDiskIO.h"
+#include "Error.h"
+#include "LitTorrent/Storage.h"
+#include "Logger.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace LitTorrent {
+
+namespace {
+namespace Internal {
+// user_data of the eventfd read that wakes the ring thread; operations use
+// their (non-null) address
+constexpr uint64_t kWakeTag = 0;
+
+// Descriptors kept in the ring's fixed file table
+constexpr unsigned kFixedFileSlots = 64;
+
+// Longest single submission; longer transfers complete in several parts
+constexpr uint64_t kMaxTransfer = uint64_t(1) << 30;
+
+// Requests a fallback worker takes from the queue at once
+constexpr size_t kMaxWorkerBatch = 64;
+
+static int errorFor(const TorrentException &e) {
+  return e.code() == ErrorCode::FileNotFound ? ENOENT : EIO;
+}
+} // namespace Internal
+} // namespace
+
+// One submission queue entry's worth of a request: the part of it that
+// lives in a single file
+struct AsyncDiskIO::Operation {
+  Request *request = nullptr;
+  size_t extent = 0;
+  uint64_t done = 0;
+  int slot = -1;
+};
+
+struct AsyncDiskIO::Request {
+  bool write = false;
+  uint64_t start = 0;
+  size_t count = 0;
+  // Write data, kept alive by whichever owner it came with
+  ByteSpan source;
+  SharedBuffer sharedSource;
+  BlockBuffer blockSource;
+  // Read data lands here unless it goes to a registered buffer
+  BlockBuffer buffer;
+  uint8_t *memory = nullptr;
+  int registeredBuffer = -1;
+  ReadCompletion onRead;
+  WriteCompletion onWrite;
+  std::vector<FileExtent> extents;
+  std::vector<Operation> operations;
+  size_t outstanding = 0;
+  int error = 0;
+};
+
+// io_uring set up through the raw system calls: submission and completion
+// rings, registered read buffers, a fixed file table and an eventfd that
+// lets other threads interrupt the ring thread's wait. Only the ring thread
+// touches it, apart from wake()
+class AsyncDiskIO::Ring {
+public:
+  static std::unique_ptr<Ring> create(unsigned queueDepth, size_t bufferSize);
+  ~Ring();
+
+  // Operations that may be in flight; one entry is kept for the wake read
+  unsigned capacity() const { return entries_ - 1; }
+  unsigned inFlight() const { return inFlight_; }
+  size_t bufferSize() const { return bufferSize_; }
+
+  void wake();
+  void clearWake() { wakePending_.store(false, std::memory_order_release); }
+  void armWake();
+
+  void push(Operation &op);
+  int acquireSlot(const FileExtent &extent);
+  void releaseSlot(int slot);
+  uint8_t *acquireBuffer(int &index);
+  void releaseBuffer(int index);
+
+  // Submit queued entries and wait for at least one completion
+  void submitAndWait();
+  void submitPending();
+
+  // Invoke fn(operation, result) for every available completion
+  template <typename Fn> void reap(Fn &&fn);
+
+  std::atomic<uint64_t> batches{0};
+  std::atomic<uint64_t> operations{0};
+
+private:
+  Ring() = default;
+  bool setup(unsigned queueDepth, size_t bufferSize);
+  io_uring_sqe *nextSqe();
+
+  int fd_ = -1;
+  unsigned entries_ = 0;
+  unsigned inFlight_ = 0;
+  unsigned unsubmitted_ = 0;
+
+  void *sqRing_ = MAP_FAILED;
+  void *cqRing_ = MAP_FAILED;
+  size_t sqRingSize_ = 0;
+  size_t cqRingSize_ = 0;
+  io_uring_sqe *sqes_ = static_cast<io_uring_sqe *>(MAP_FAILED);
+  size_t sqesSize_ = 0;
+
+  unsigned *sqHead_ = nullptr;
+  unsigned *sqTail_ = nullptr;
+  unsigned *sqMask_ = nullptr;
+  unsigned *sqArray_ = nullptr;
+  unsigned *cqHead_ = nullptr;
+  unsigned *cqTail_ = nullptr;
+  unsigned *cqMask_ = nullptr;
+  io_uring_cqe *cqes_ = nullptr;
+
+  // Registered read buffers, one per request in flight
+  uint8_t *bufferPool_ = nullptr;
+  size_t bufferPoolSize_ = 0;
+  size_t bufferSize_ = 0;
+  std::vector<int> freeBuffers_;
+
+  // Fixed file table; a slot pins its descriptor until it is reused
+  struct FixedFile {
+    std::shared_ptr<const void> owner;
+    unsigned users = 0;
+  };
+  bool fixedFiles_ = false;
+  std::vector<FixedFile> slots_;
+  std::unordered_map<const void *, int> slotOf_;
+  unsigned nextVictim_ = 0;
+
+  int wakeFd_ = -1;
+  uint64_t wakeValue_ = 0;
+  bool wakeArmed_ = false;
+  std::atomic<bool> wakePending_{false};
+};
+
+std::unique_ptr<AsyncDiskIO::Ring>
+AsyncDiskIO::Ring::create(unsigned queueDepth, size_t bufferSize) {
+  std::unique_ptr<Ring> ring(new Ring());
+  if (!ring->setup(queueDepth, bufferSize)) {
+    return nullptr;
+  }
+  return ring;
+}
+
+bool AsyncDiskIO::Ring::setup(unsigned queueDepth, size_t bufferSize) {
+  io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  fd_ = static_cast<int>(
+      ::syscall(__NR_io_uring_setup, queueDepth + 1, &params));
+  if (fd_ < 0) {
+    LOG_INFO("io_uring unavailable (%s); using worker threads",
+             std::strerror(errno));
+    return false;
+  }
+
+  // IORING_OP_READ/WRITE arrived together with RW_CUR_POS (5.6)
+  const unsigned required = IORING_FEAT_NODROP | IORING_FEAT_RW_CUR_POS;
+  if ((params.features & required) != required) {
+    LOG_INFO("io_uring too old; using worker threads");
+    return false;
+  }
+  entries_ = params.sq_entries;
+
+  sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (singleMmap) {
+    sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+  }
+
+  sqRing_ = ::mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+  if (sqRing_ == MAP_FAILED) {
+    LOG_ERROR("Cannot map io_uring: %s", std::strerror(errno));
+    return false;
+  }
+  if (singleMmap) {
+    cqRing_ = sqRing_;
+  } else {
+    cqRing_ = ::mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+    if (cqRing_ == MAP_FAILED) {
+      LOG_ERROR("Cannot map io_uring: %s", std::strerror(errno));
+      return false;
+    }
+  }
+  sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+  sqes_ = static_cast<io_uring_sqe *>(
+      ::mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+  if (sqes_ == MAP_FAILED) {
+    LOG_ERROR("Cannot map io_uring: %s", std::strerror(errno));
+    return false;
+  }
+
+  auto *sq = static_cast<uint8_t *>(sqRing_);
+  auto *cq = static_cast<uint8_t *>(cqRing_);
+  sqHead_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+  sqTail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  sqMask_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  sqArray_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  cqHead_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  cqTail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  cqMask_ = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+  wakeFd_ = ::eventfd(0, EFD_CLOEXEC);
+  if (wakeFd_ < 0) {
+    LOG_ERROR("Cannot create eventfd: %s", std::strerror(errno));
+    return false;
+  }
+
+  // Registered buffers and fixed files are optimizations; without them
+  // reads go to heap buffers and submissions use plain descriptors
+  bufferSize_ = bufferSize;
+  bufferPoolSize_ = bufferSize * queueDepth;
+  void *pool = ::mmap(nullptr, bufferPoolSize_, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (pool != MAP_FAILED) {
+    std::vector<iovec> iovecs(queueDepth);
+    for (unsigned i = 0; i < queueDepth; i++) {
+      iovecs[i].iov_base = static_cast<uint8_t *>(pool) + i * bufferSize;
+      iovecs[i].iov_len = bufferSize;
+    }
+    if (::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS,
+                  iovecs.data(), queueDepth) == 0) {
+      bufferPool_ = static_cast<uint8_t *>(pool);
+      for (int i = static_cast<int>(queueDepth) - 1; i >= 0; i--) {
+        freeBuffers_.push_back(i);
+      }
+    } else {
+      LOG_INFO("Cannot register io_uring buffers: %s", std::strerror(errno));
+      ::munmap(pool, bufferPoolSize_);
+    }
+  }
+
+  std::vector<int> sparse(Internal::kFixedFileSlots, -1);
+  if (::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_FILES,
+                sparse.data(), Internal::kFixedFileSlots) == 0) {
+    fixedFiles_ = true;
+    slots_.resize(Internal::kFixedFileSlots);
+  } else {
+    LOG_INFO("Cannot register io_uring files: %s", std::strerror(errno));
+  }
+  return true;
+}
+
+AsyncDiskIO::Ring::~Ring() {
+  // Closing the ring cancels the pending wake read and drops registrations
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+  if (wakeFd_ >= 0) {
+    ::close(wakeFd_);
+  }
+  if (sqes_ != MAP_FAILED) {
+    ::munmap(sqes_, sqesSize_);
+  }
+  if (cqRing_ != MAP_FAILED && cqRing_ != sqRing_) {
+    ::munmap(cqRing_, cqRingSize_);
+  }
+  if (sqRing_ != MAP_FAILED) {
+    ::munmap(sqRing_, sqRingSize_);
+  }
+  if (bufferPool_) {
+    ::munmap(bufferPool_, bufferPoolSize_);
+  }
+}
+
+void AsyncDiskIO::Ring::wake() {
+  if (!wakePending_.exchange(true, std::memory_order_acq_rel)) {
+    uint64_t one = 1;
+    ssize_t n = ::write(wakeFd_, &one, sizeof(one));
+    (void)n;
+  }
+}
+
+io_uring_sqe *AsyncDiskIO::Ring::nextSqe() {
+  unsigned tail = *sqTail_;
+  unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+  if (tail - head >= entries_) {
+    return nullptr;
+  }
+  unsigned index = tail & *sqMask_;
+  io_uring_sqe *sqe = &sqes_[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sqArray_[index] = index;
+  __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+  unsubmitted_++;
+  return sqe;
+}
+
+void AsyncDiskIO::Ring::armWake() {
+  if (wakeArmed_) {
+    return;
+  }
+  io_uring_sqe *sqe = nextSqe();
+  if (!sqe) {
+    return;
+  }
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = wakeFd_;
+  sqe->addr = reinterpret_cast<uint64_t>(&wakeValue_);
+  sqe->len = sizeof(wakeValue_);
+  sqe->user_data = Internal::kWakeTag;
+  wakeArmed_ = true;
+}
+
+void AsyncDiskIO::Ring::push(Operation &op) {
+  Request &request = *op.request;
+  const FileExtent &extent = request.extents[op.extent];
+
+  // Only a request split over more files than the ring has entries can
+  // fill the submission queue; hand over what is queued and carry on
+  io_uring_sqe *sqe;
+  while ((sqe = nextSqe()) == nullptr) {
+    submitPending();
+  }
+  uint64_t remaining = extent.length - op.done;
+  sqe->off = extent.fileOffset + op.done;
+  sqe->addr =
+      reinterpret_cast<uint64_t>(request.memory + extent.rangeOffset + op.done);
+  sqe->len = static_cast<uint32_t>(std::min(remaining, Internal::kMaxTransfer));
+  sqe->user_data = reinterpret_cast<uint64_t>(&op);
+
+  if (request.write) {
+    sqe->opcode = IORING_OP_WRITE;
+  } else if (request.registeredBuffer >= 0) {
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->buf_index = static_cast<uint16_t>(request.registeredBuffer);
+  } else {
+    sqe->opcode = IORING_OP_READ;
+  }
+
+  if (op.slot >= 0) {
+    sqe->fd = op.slot;
+    sqe->flags |= IOSQE_FIXED_FILE;
+  } else {
+    sqe->fd = extent.fd;
+  }
+
+  inFlight_++;
+  operations.fetch_add(1, std::memory_order_relaxed);
+}
+
+int AsyncDiskIO::Ring::acquireSlot(const FileExtent &extent) {
+  if (!fixedFiles_) {
+    return -1;
+  }
+
+  auto found = slotOf_.find(extent.owner.get());
+  if (found != slotOf_.end()) {
+    slots_[found->second].users++;
+    return found->second;
+  }
+
+  // Replace an idle slot, round robin; with every slot busy the plain
+  // descriptor is used instead
+  for (unsigned tried = 0; tried < slots_.size(); tried++) {
+    unsigned slot = nextVictim_;
+    nextVictim_ = (nextVictim_ + 1) % slots_.size();
+    if (slots_[slot].users > 0) {
+      continue;
+    }
+
+    int fd = extent.fd;
+    io_uring_files_update update;
+    std::memset(&update, 0, sizeof(update));
+    update.offset = slot;
+    update.fds = reinterpret_cast<uint64_t>(&fd);
+    if (::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_FILES_UPDATE,
+                  &update, 1) != 1) {
+      return -1;
+    }
+
+    if (slots_[slot].owner) {
+      slotOf_.erase(slots_[slot].owner.get());
+    }
+    slots_[slot].owner = extent.owner;
+    slots_[slot].users = 1;
+    slotOf_[extent.owner.get()] = static_cast<int>(slot);
+    return static_cast<int>(slot);
+  }
+  return -1;
+}
+
+void AsyncDiskIO::Ring::releaseSlot(int slot) {
+  if (slot >= 0) {
+    slots_[slot].users--;
+  }
+}
+
+uint8_t *AsyncDiskIO::Ring::acquireBuffer(int &index) {
+  if (freeBuffers_.empty()) {
+    index = -1;
+    return nullptr;
+  }
+  index = freeBuffers_.back();
+  freeBuffers_.pop_back();
+  return bufferPool_ + static_cast<size_t>(index) * bufferSize_;
+}
+
+void AsyncDiskIO::Ring::releaseBuffer(int index) {
+  if (index >= 0) {
+    freeBuffers_.push_back(index);
+  }
+}
+
+void AsyncDiskIO::Ring::submitAndWait() {
+  unsigned toSubmit = unsubmitted_;
+  int submitted = static_cast<int>(
+      ::syscall(__NR_io_uring_enter, fd_, toSubmit, 1,
+                IORING_ENTER_GETEVENTS, nullptr, 0));
+  if (submitted < 0) {
+    if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      LOG_ERROR("io_uring_enter failed: %s", std::strerror(errno));
+    }
+    return;
+  }
+  unsubmitted_ -= static_cast<unsigned>(submitted);
+  if (submitted > 0) {
+    batches.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void AsyncDiskIO::Ring::submitPending() {
+  int submitted = static_cast<int>(::syscall(__NR_io_uring_enter, fd_,
+                                             unsubmitted_, 0, 0, nullptr, 0));
+  if (submitted > 0) {
+    unsubmitted_ -= static_cast<unsigned>(submitted);
+    batches.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+template <typename Fn> void AsyncDiskIO::Ring::reap(Fn &&fn) {
+  unsigned head = *cqHead_;
+  unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    const io_uring_cqe &cqe = cqes_[head & *cqMask_];
+    uint64_t userData = cqe.user_data;
+    int result = cqe.res;
+    head++;
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+
+    if (userData == Internal::kWakeTag) {
+      wakeArmed_ = false;
+    } else {
+      inFlight_--;
+      fn(*reinterpret_cast<Operation *>(userData), result);
+    }
+    tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+  }
+}
+
+AsyncDiskIO::AsyncDiskIO(Storage &files, unsigned queueDepth,
+                         size_t bufferSize, bool useIoUring,
+                         std::shared_ptr<BufferPool> buffers)
+    : files_(files), buffers_(std::move(buffers)) {
+  if (!buffers_) {
+    buffers_ = BufferPool::create({bufferSize});
+  }
+  queueDepth = std::max(1u, queueDepth);
+  if (useIoUring && files_.hasDescriptors()) {
+    ring_ = Ring::create(queueDepth, bufferSize);
+  }
+
+  if (ring_) {
+    threads_.emplace_back(&AsyncDiskIO::ringLoop, this);
+  } else {
+    unsigned workers =
+        std::min(queueDepth, std::max(1u, std::thread::hardware_concurrency()));
+    for (unsigned i = 0; i < workers; i++) {
+      threads_.emplace_back(&AsyncDiskIO::workerLoop, this);
+    }
+  }
+}
+
+AsyncDiskIO::~AsyncDiskIO() { stop(); }
+
+void AsyncDiskIO::read(uint64_t start, size_t count, ReadCompletion done) {
+  auto request = std::make_unique<Request>();
+  request->start = start;
+  request->count = count;
+  request->onRead = std::move(done);
+  enqueue(std::move(request));
+}
+
+void AsyncDiskIO::write(uint64_t start, SharedBuffer data,
+                        WriteCompletion done) {
+  auto request = std::make_unique<Request>();
+  request->write = true;
+  request->start = start;
+  request->count = data ? data->size() : 0;
+  request->source = data ? ByteSpan(*data) : ByteSpan();
+  request->sharedSource = std::move(data);
+  request->onWrite = std::move(done);
+  enqueue(std::move(request));
+}
+
+void AsyncDiskIO::write(uint64_t start, BlockBuffer data,
+                        WriteCompletion done) {
+  auto request = std::make_unique<Request>();
+  request->write = true;
+  request->start = start;
+  request->count = data.size();
+  request->source = data;
+  request->blockSource = std::move(data);
+  request->onWrite = std::move(done);
+  enqueue(std::move(request));
+}
+
+void AsyncDiskIO::enqueue(RequestPtr request) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!stopping_) {
+      active_++;
+      incoming_.push_back(std::move(request));
+    }
+  }
+
+  if (request) {
+    // Rejected after stop()
+    request->error = ECANCELED;
+    if (request->write && request->onWrite) {
+      request->onWrite(ECANCELED);
+    } else if (!request->write && request->onRead) {
+      request->onRead(ECANCELED, ByteSpan());
+    }
+    return;
+  }
+
+  submitted_.fetch_add(1, std::memory_order_relaxed);
+  if (!ring_) {
+    workAvailable_.notify_one();
+  } else if (threads_.empty() ||
+             std::this_thread::get_id() != threads_.front().get_id()) {
+    // The ring thread picks up its own submissions on the next iteration
+    ring_->wake();
+  }
+}
+
+void AsyncDiskIO::finish(Request &request) {
+  try {
+    if (request.write) {
+      if (request.error == 0) {
+        files_.markWritten(request.start, request.count);
+      }
+      if (request.onWrite) {
+        request.onWrite(request.error);
+      }
+    } else if (request.onRead) {
+      request.onRead(request.error, request.error == 0
+                                        ? ByteSpan(request.memory, request.count)
+                                        : ByteSpan());
+    }
+  } catch (const std::exception &e) {
+    LOG_ERROR("Disk I/O completion handler failed: %s", e.what());
+  }
+
+  completed_.fetch_add(1, std::memory_order_relaxed);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (--active_ == 0) {
+    idle_.notify_all();
+  }
+}
+
+void AsyncDiskIO::waitIdle() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [this] { return active_ == 0; });
+}
+
+void AsyncDiskIO::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  workAvailable_.notify_all();
+  if (ring_) {
+    ring_->wake();
+  }
+
+  for (auto &thread : threads_) {
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+}
+
+AsyncIoStats AsyncDiskIO::getStats() const {
+  AsyncIoStats stats;
+  stats.submitted = submitted_.load(std::memory_order_relaxed);
+  stats.completed = completed_.load(std::memory_order_relaxed);
+  if (ring_) {
+    stats.batches = ring_->batches.load(std::memory_order_relaxed);
+    stats.operations = ring_->operations.load(std::memory_order_relaxed);
+  }
+  return stats;
+}
+
+void AsyncDiskIO::ringLoop() {
+  Ring &ring = *ring_;
+  std::deque<RequestPtr> waiting; // accepted, not yet submitted
+  size_t running = 0;             // submitted, not yet completed
+
+  auto complete = [&](Request *request) {
+    finish(*request);
+    ring.releaseBuffer(request->registeredBuffer);
+    delete request;
+    running--;
+  };
+
+  while (true) {
+    // Cleared before taking the queue, so a submission that races with it
+    // always writes the eventfd again
+    ring.clearWake();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      while (!incoming_.empty()) {
+        waiting.push_back(std::move(incoming_.front()));
+        incoming_.pop_front();
+      }
+      if (stopping_ && waiting.empty() && running == 0) {
+        break;
+      }
+    }
+
+    // Everything queued since the last iteration goes out in one batch
+    while (!waiting.empty()) {
+      Request &request = *waiting.front();
+      if (request.extents.empty() && request.count > 0 && request.error == 0) {
+        try {
+          request.extents =
+              files_.resolve(request.start, request.count, request.write);
+        } catch (const TorrentException &e) {
+          request.error = Internal::errorFor(e);
+        }
+      }
+
+      if (request.error != 0 || request.extents.empty()) {
+        RequestPtr done = std::move(waiting.front());
+        waiting.pop_front();
+        finish(*done);
+        continue;
+      }
+
+      size_t parts = request.extents.size();
+      if (ring.inFlight() + parts > ring.capacity() &&
+          ring.inFlight() > 0) {
+        break;
+      }
+
+      if (request.write) {
+        request.memory = const_cast<uint8_t *>(request.source.data());
+      } else if (request.count <= ring.bufferSize() &&
+                 (request.memory = ring.acquireBuffer(
+                      request.registeredBuffer)) != nullptr) {
+        // Landed in a registered buffer; no per-read pinning of user pages
+      } else {
+        request.buffer = buffers_->acquire(request.count);
+        request.memory = request.buffer.data();
+      }
+
+      request.operations.resize(parts);
+      request.outstanding = parts;
+      for (size_t i = 0; i < parts; i++) {
+        Operation &op = request.operations[i];
+        op.request = &request;
+        op.extent = i;
+        op.slot = ring.acquireSlot(request.extents[i]);
+        ring.push(op);
+      }
+      waiting.front().release();
+      waiting.pop_front();
+      running++;
+    }
+
+    ring.armWake();
+    ring.submitAndWait();
+
+    ring.reap([&](Operation &op, int result) {
+      Request &request = *op.request;
+      uint64_t length = request.extents[op.extent].length;
+
+      if (result == -EINTR || result == -EAGAIN) {
+        ring.push(op);
+        return;
+      }
+      if (result < 0) {
+        request.error = -result;
+      } else if (result == 0) {
+        // End of file before the range was complete
+        request.error = EIO;
+      } else {
+        op.done += static_cast<uint64_t>(result);
+        if (op.done < length) {
+          ring.push(op);
+          return;
+        }
+      }
+
+      ring.releaseSlot(op.slot);
+      if (--request.outstanding == 0) {
+        complete(&request);
+      }
+    });
+  }
+}
+
+void AsyncDiskIO::workerLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    workAvailable_.wait(lock, [this] { return stopping_ || !incoming_.empty(); });
+    if (incoming_.empty()) {
+      return;
+    }
+
+    // Take everything queued so back-to-back requests can be coalesced
+    std::vector<RequestPtr> batch;
+    while (!incoming_.empty() && batch.size() < Internal::kMaxWorkerBatch) {
+      batch.push_back(std::move(incoming_.front()));
+      incoming_.pop_front();
+    }
+    lock.unlock();
+
+    std::vector<WriteSlice> writes;
+    std::vector<ReadSlice> reads;
+    for (auto &request : batch) {
+      if (request->write) {
+        if (!request->source.empty()) {
+          writes.push_back(WriteSlice{request->start, request->source});
+        }
+      } else {
+        request->buffer = buffers_->acquire(request->count);
+        request->memory = request->buffer.data();
+        reads.push_back(
+            ReadSlice{request->start, request->memory, request->count});
+      }
+    }
+
+    bool batchFailed = false;
+    try {
+      files_.writev(std::move(writes));
+      files_.readv(std::move(reads));
+    } catch (const TorrentException &) {
+      batchFailed = true;
+    }
+
+    for (auto &request : batch) {
+      // A failed batch is retried request by request to find the culprits
+      if (batchFailed) {
+        try {
+          if (request->write && !request->source.empty()) {
+            files_.write(request->start, request->source);
+          } else if (!request->write) {
+            files_.readv({ReadSlice{request->start, request->memory,
+                                    request->count}});
+          }
+        } catch (const TorrentException &e) {
+          request->error = Internal::errorFor(e);
+        }
+      }
+      finish(*request);
+    }
+
+    lock.lock();
+  }
+}
+
+} // namespace LitTorrent
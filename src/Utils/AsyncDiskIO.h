@@ -0,0 +1,98 @@
+#pragma once
+
+#include "Define.h"
+#include "LitTorrent/BufferPool.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace LitTorrent {
+
+// Forward declaration
+class Storage;
+
+// Asynchronous I/O counters
+struct AsyncIoStats {
+  uint64_t submitted = 0;  // requests accepted
+  uint64_t completed = 0;  // requests whose callback has run
+  uint64_t batches = 0;    // io_uring_enter calls that submitted work
+  uint64_t operations = 0; // submission queue entries (one per file extent)
+};
+
+// Asynchronous block reads and writes on top of a Storage backend. For
+// backends with file descriptors, on Linux, the requests go through an
+// io_uring owned by a single ring thread: requests queued by any thread are
+// submitted together on the next loop iteration, reads of up to bufferSize
+// bytes land in registered buffers, and recently used descriptors are kept
+// in the ring's fixed file table. When io_uring is unavailable, or the
+// backend has no descriptors, the same interface is served by a small pool
+// of threads doing blocking I/O, each taking every queued request at once so
+// back-to-back ones are coalesced into vectored calls. Reads that do not
+// land in a registered buffer are read into buffers from the pool given (or
+// a private one with a single size class of bufferSize).
+//
+// Callbacks run on the ring thread (or a pool thread) and must not block;
+// they may queue further requests. Requests spanning files are split per
+// file and completed once every part has finished
+class AsyncDiskIO {
+public:
+  AsyncDiskIO(Storage &files, unsigned queueDepth = 128,
+              size_t bufferSize = 16384, bool useIoUring = true,
+              std::shared_ptr<BufferPool> buffers = nullptr);
+  ~AsyncDiskIO();
+
+  AsyncDiskIO(const AsyncDiskIO &) = delete;
+  AsyncDiskIO &operator=(const AsyncDiskIO &) = delete;
+
+  // Queue a read of [start, start + count) from the file set
+  void read(uint64_t start, size_t count, ReadCompletion done);
+
+  // Queue a write of data at start; the buffer is kept alive until the
+  // write has completed
+  void write(uint64_t start, SharedBuffer data, WriteCompletion done);
+  void write(uint64_t start, BlockBuffer data, WriteCompletion done);
+
+  // Block until every accepted request has completed
+  void waitIdle();
+
+  // Complete outstanding requests and shut down; later requests fail with
+  // ECANCELED
+  void stop();
+
+  bool usingIoUring() const { return ring_ != nullptr; }
+  AsyncIoStats getStats() const;
+
+private:
+  struct Request;
+  struct Operation;
+  class Ring;
+  using RequestPtr = std::unique_ptr<Request>;
+
+  Storage &files_;
+  std::shared_ptr<BufferPool> buffers_;
+  std::unique_ptr<Ring> ring_; // null when falling back to threads
+
+  // Requests not yet picked up by the ring thread or a pool thread
+  std::mutex mutex_;
+  std::condition_variable workAvailable_;
+  std::condition_variable idle_;
+  std::deque<RequestPtr> incoming_;
+  size_t active_ = 0; // accepted but not completed
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+
+  std::atomic<uint64_t> submitted_{0};
+  std::atomic<uint64_t> completed_{0};
+
+  void enqueue(RequestPtr request);
+  void finish(Request &request);
+  void ringLoop();
+  void workerLoop();
+};
+
+} // namespace LitTorrent
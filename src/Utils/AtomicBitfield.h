@@ -0,0 +1,114 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace LitTorrent {
+
+// Fixed-size bitfield whose bits can be set and cleared concurrently without a
+// lock. Words are grouped into 64-byte lines so the storage starts on a cache
+// line boundary and neighbouring bitfields never share a line
+class AtomicBitfield {
+public:
+  explicit AtomicBitfield(size_t bits = 0)
+      : bits_(bits), lines_(new CacheLine[lineCount(bits)]()) {}
+
+  size_t size() const { return bits_; }
+
+  bool test(size_t index) const {
+    return (word(index).load(std::memory_order_acquire) & mask(index)) != 0;
+  }
+
+  // Set a bit; returns the previous value
+  bool set(size_t index) {
+    uint64_t m = mask(index);
+    return (word(index).fetch_or(m, std::memory_order_acq_rel) & m) != 0;
+  }
+
+  // Clear a bit; returns the previous value
+  bool reset(size_t index) {
+    uint64_t m = mask(index);
+    return (word(index).fetch_and(~m, std::memory_order_acq_rel) & m) != 0;
+  }
+
+  // Clear bits [begin, end); returns how many of them were set
+  size_t resetRange(size_t begin, size_t end) {
+    size_t cleared = 0;
+    while (begin < end) {
+      size_t bit = begin % kWordBits;
+      size_t span = std::min(kWordBits - bit, end - begin);
+      uint64_t m = span == kWordBits ? ~uint64_t(0)
+                                     : ((uint64_t(1) << span) - 1) << bit;
+      uint64_t previous = word(begin).fetch_and(~m, std::memory_order_acq_rel);
+      cleared += popcount(previous & m);
+      begin += span;
+    }
+    return cleared;
+  }
+
+  // Set bits [begin, end); returns how many of them were previously clear
+  size_t setRange(size_t begin, size_t end) {
+    size_t newlySet = 0;
+    while (begin < end) {
+      size_t bit = begin % kWordBits;
+      size_t span = std::min(kWordBits - bit, end - begin);
+      uint64_t m = span == kWordBits ? ~uint64_t(0)
+                                     : ((uint64_t(1) << span) - 1) << bit;
+      uint64_t previous = word(begin).fetch_or(m, std::memory_order_acq_rel);
+      newlySet += popcount(~previous & m);
+      begin += span;
+    }
+    return newlySet;
+  }
+
+  void clear() {
+    for (size_t i = 0; i < lineCount(bits_); i++) {
+      for (auto &w : lines_[i].words) {
+        w.store(0, std::memory_order_release);
+      }
+    }
+  }
+
+  // Snapshot as a plain vector
+  std::vector<bool> toVector() const {
+    std::vector<bool> result(bits_);
+    for (size_t i = 0; i < bits_; i++) {
+      result[i] = test(i);
+    }
+    return result;
+  }
+
+private:
+  static constexpr size_t kWordBits = 64;
+  static constexpr size_t kWordsPerLine = 8;
+  static constexpr size_t kLineBits = kWordBits * kWordsPerLine;
+
+  struct alignas(64) CacheLine {
+    std::atomic<uint64_t> words[kWordsPerLine];
+  };
+
+  static size_t lineCount(size_t bits) {
+    return bits == 0 ? 1 : (bits + kLineBits - 1) / kLineBits;
+  }
+
+  static uint64_t mask(size_t index) {
+    return uint64_t(1) << (index % kWordBits);
+  }
+
+  static size_t popcount(uint64_t v) {
+    return static_cast<size_t>(__builtin_popcountll(v));
+  }
+
+  std::atomic<uint64_t> &word(size_t index) const {
+    return lines_[index / kLineBits].words[(index % kLineBits) / kWordBits];
+  }
+
+  size_t bits_;
+  std::unique_ptr<CacheLine[]> lines_;
+};
+
+} // namespace LitTorrent
@@ -0,0 +1,251 @@
+#include "LitTorrent/BufferPool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <sys/mman.h>
+
+namespace LitTorrent {
+
+namespace {
+namespace Internal {
+// Buffers start on a page boundary so they can be used for O_DIRECT
+constexpr size_t kAlignment = 4096;
+
+// Slabs hold about this much, and at least one buffer
+constexpr size_t kSlabBytes = size_t(2) << 20;
+constexpr size_t kHugePageSize = size_t(2) << 20;
+
+static size_t roundUp(size_t value, size_t multiple) {
+  return (value + multiple - 1) / multiple * multiple;
+}
+} // namespace Internal
+} // namespace
+
+// Shared state of all handles on one buffer. pool is set while a pooled
+// buffer is handed out and keeps the pool alive until it comes back
+struct BlockBuffer::Slot {
+  std::atomic<uint32_t> refs{0};
+  uint8_t *memory = nullptr;
+  std::shared_ptr<BufferPool> pool;
+  size_t sizeClass = 0;
+  bool heap = false;
+};
+
+BlockBuffer::BlockBuffer(const BlockBuffer &other)
+    : slot_(other.slot_), data_(other.data_), size_(other.size_) {
+  if (slot_) {
+    slot_->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+BlockBuffer::BlockBuffer(BlockBuffer &&other) noexcept
+    : slot_(other.slot_), data_(other.data_), size_(other.size_) {
+  other.slot_ = nullptr;
+  other.data_ = nullptr;
+  other.size_ = 0;
+}
+
+BlockBuffer &BlockBuffer::operator=(const BlockBuffer &other) {
+  if (this != &other) {
+    BlockBuffer copy(other);
+    *this = std::move(copy);
+  }
+  return *this;
+}
+
+BlockBuffer &BlockBuffer::operator=(BlockBuffer &&other) noexcept {
+  if (this != &other) {
+    release();
+    std::swap(slot_, other.slot_);
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+  }
+  return *this;
+}
+
+BlockBuffer::~BlockBuffer() { release(); }
+
+void BlockBuffer::release() {
+  if (slot_ && slot_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    if (slot_->heap) {
+      std::free(slot_->memory);
+      delete slot_;
+    } else {
+      // The pool may go away with the last reference to it
+      std::shared_ptr<BufferPool> pool = std::move(slot_->pool);
+      pool->release(slot_);
+    }
+  }
+  slot_ = nullptr;
+  data_ = nullptr;
+  size_ = 0;
+}
+
+BlockBuffer BlockBuffer::allocate(size_t size) {
+  void *memory = nullptr;
+  if (::posix_memalign(&memory, Internal::kAlignment,
+                       std::max<size_t>(size, 1)) != 0) {
+    throw std::bad_alloc();
+  }
+  auto slot = new Slot();
+  slot->refs.store(1, std::memory_order_relaxed);
+  slot->memory = static_cast<uint8_t *>(memory);
+  slot->heap = true;
+  return BlockBuffer(slot, slot->memory, size);
+}
+
+BlockBuffer BlockBuffer::subrange(size_t offset, size_t count) const {
+  BlockBuffer part(*this);
+  part.data_ += offset;
+  part.size_ = count;
+  return part;
+}
+
+bool BlockBuffer::pooled() const { return slot_ && !slot_->heap; }
+
+std::shared_ptr<BufferPool> BufferPool::create(std::vector<size_t> bufferSizes,
+                                               bool hugePages,
+                                               size_t maxBytes) {
+  return std::shared_ptr<BufferPool>(
+      new BufferPool(std::move(bufferSizes), hugePages, maxBytes));
+}
+
+BufferPool::BufferPool(std::vector<size_t> bufferSizes, bool hugePages,
+                       size_t maxBytes)
+    : hugePages_(hugePages), maxBytes_(maxBytes) {
+  bufferSizes.erase(std::remove(bufferSizes.begin(), bufferSizes.end(), 0u),
+                    bufferSizes.end());
+  std::sort(bufferSizes.begin(), bufferSizes.end());
+  bufferSizes.erase(std::unique(bufferSizes.begin(), bufferSizes.end()),
+                    bufferSizes.end());
+
+  classCount_ = bufferSizes.size();
+  classes_.reset(new SizeClass[classCount_]);
+  for (size_t i = 0; i < classCount_; i++) {
+    SizeClass &sizeClass = classes_[i];
+    sizeClass.bufferSize = bufferSizes[i];
+    sizeClass.stride = Internal::roundUp(bufferSizes[i], Internal::kAlignment);
+    sizeClass.perSlab =
+        std::max<size_t>(1, Internal::kSlabBytes / sizeClass.stride);
+  }
+}
+
+BufferPool::~BufferPool() {
+  // Every pooled buffer holds a reference, so none is outstanding here
+  for (size_t i = 0; i < classCount_; i++) {
+    for (auto &slab : classes_[i].slabs) {
+      ::munmap(slab.memory, slab.length);
+    }
+  }
+}
+
+BlockBuffer BufferPool::acquire(size_t size) {
+  acquired_.fetch_add(1, std::memory_order_relaxed);
+
+  for (size_t i = 0; i < classCount_; i++) {
+    SizeClass &sizeClass = classes_[i];
+    if (sizeClass.bufferSize < size) {
+      continue;
+    }
+
+    BlockBuffer::Slot *slot;
+    {
+      std::lock_guard<std::mutex> lock(sizeClass.mutex);
+      if (sizeClass.free.empty() && !grow(sizeClass)) {
+        break;
+      }
+      slot = sizeClass.free.back();
+      sizeClass.free.pop_back();
+    }
+    bytesInUse_.fetch_add(sizeClass.stride, std::memory_order_relaxed);
+    slot->refs.store(1, std::memory_order_relaxed);
+    slot->pool = shared_from_this();
+    return BlockBuffer(slot, slot->memory, size);
+  }
+
+  heapBuffers_.fetch_add(1, std::memory_order_relaxed);
+  return BlockBuffer::allocate(size);
+}
+
+// Called with the class's mutex held
+bool BufferPool::grow(SizeClass &sizeClass) {
+  size_t length = sizeClass.perSlab * sizeClass.stride;
+  if (hugePages_) {
+    length = Internal::roundUp(length, Internal::kHugePageSize);
+  }
+  if (maxBytes_ != 0 &&
+      bytesReserved_.load(std::memory_order_relaxed) + length > maxBytes_) {
+    return false;
+  }
+
+  void *memory = MAP_FAILED;
+  bool huge = false;
+  if (hugePages_) {
+    memory = ::mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    huge = memory != MAP_FAILED;
+  }
+  if (memory == MAP_FAILED) {
+    memory = ::mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+      return false;
+    }
+    if (hugePages_) {
+      ::madvise(memory, length, MADV_HUGEPAGE);
+    }
+  }
+
+  Slab slab;
+  slab.memory = static_cast<uint8_t *>(memory);
+  slab.length = length;
+  slab.hugePages = huge;
+  size_t count = length / sizeClass.stride;
+  slab.slots.reset(new BlockBuffer::Slot[count]);
+
+  // Reserved up front so that releasing a buffer never allocates
+  sizeClass.free.reserve(sizeClass.buffers + count);
+  for (size_t i = count; i-- > 0;) {
+    slab.slots[i].memory = slab.memory + i * sizeClass.stride;
+    slab.slots[i].sizeClass = &sizeClass - classes_.get();
+    sizeClass.free.push_back(&slab.slots[i]);
+  }
+  sizeClass.buffers += count;
+  sizeClass.slabs.push_back(std::move(slab));
+
+  bytesReserved_.fetch_add(length, std::memory_order_relaxed);
+  if (huge) {
+    hugePageBytes_.fetch_add(length, std::memory_order_relaxed);
+  }
+  slabs_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void BufferPool::release(BlockBuffer::Slot *slot) {
+  SizeClass &sizeClass = classes_[slot->sizeClass];
+  bytesInUse_.fetch_sub(sizeClass.stride, std::memory_order_relaxed);
+  std::lock_guard<std::mutex> lock(sizeClass.mutex);
+  sizeClass.free.push_back(slot);
+}
+
+BufferPoolStats BufferPool::getStats() const {
+  BufferPoolStats stats;
+  for (size_t i = 0; i < classCount_; i++) {
+    SizeClass &sizeClass = classes_[i];
+    std::lock_guard<std::mutex> lock(sizeClass.mutex);
+    BufferClassStats classStats;
+    classStats.bufferSize = sizeClass.bufferSize;
+    classStats.buffers = sizeClass.buffers;
+    classStats.inUse = sizeClass.buffers - sizeClass.free.size();
+    stats.classes.push_back(classStats);
+  }
+  stats.bytesReserved = bytesReserved_.load(std::memory_order_relaxed);
+  stats.bytesInUse = bytesInUse_.load(std::memory_order_relaxed);
+  stats.hugePageBytes = hugePageBytes_.load(std::memory_order_relaxed);
+  stats.acquired = acquired_.load(std::memory_order_relaxed);
+  stats.slabs = slabs_.load(std::memory_order_relaxed);
+  stats.heapBuffers = heapBuffers_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+} // namespace LitTorrent
@@ -0,0 +1,61 @@
+#include "LitTorrent/CacheBudget.h"
+#include <algorithm>
+
+namespace LitTorrent {
+
+void CacheBudget::attach(Consumer *consumer, int rank) {
+  std::lock_guard<std::mutex> lock(reclaimMutex_);
+  auto position = std::upper_bound(
+      consumers_.begin(), consumers_.end(), rank,
+      [](int value, const Attached &attached) { return value < attached.rank; });
+  consumers_.insert(position, Attached{consumer, rank});
+}
+
+void CacheBudget::detach(Consumer *consumer) {
+  std::lock_guard<std::mutex> lock(reclaimMutex_);
+  consumers_.erase(std::remove_if(consumers_.begin(), consumers_.end(),
+                                  [consumer](const Attached &attached) {
+                                    return attached.consumer == consumer;
+                                  }),
+                   consumers_.end());
+}
+
+bool CacheBudget::reserve(size_t bytes) {
+  if (used_.fetch_add(bytes, std::memory_order_relaxed) + bytes <= limit_) {
+    return true;
+  }
+
+  reclaims_.fetch_add(1, std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> lock(reclaimMutex_);
+    for (const auto &attached : consumers_) {
+      size_t used = used_.load(std::memory_order_relaxed);
+      if (used <= limit_) {
+        break;
+      }
+      attached.consumer->reclaim(used - limit_);
+    }
+  }
+
+  if (used_.load(std::memory_order_relaxed) <= limit_) {
+    return true;
+  }
+  used_.fetch_sub(bytes, std::memory_order_relaxed);
+  refusals_.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+void CacheBudget::release(size_t bytes) {
+  used_.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+CacheBudgetStats CacheBudget::getStats() const {
+  CacheBudgetStats stats;
+  stats.limit = limit_;
+  stats.used = used_.load(std::memory_order_relaxed);
+  stats.reclaims = reclaims_.load(std::memory_order_relaxed);
+  stats.refusals = refusals_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+} // namespace LitTorrent
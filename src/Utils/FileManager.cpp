@@ -1,152 +1,878 @@
 #include "FileManager.h"
 #include "Error.h"
 #include "FileItem.h"
+#include "Logger.h"
 #include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 namespace LitTorrent {
 
-FileManager::FileManager(const std::vector<FileItem> &files) : files_(files) {}
+namespace {
+namespace Internal {
+static std::string errnoMessage(const fs::path &path) {
+  return path.string() + " (" + std::strerror(errno) + ")";
+}
 
-FileManager::~FileManager() { closeAll(); }
+// pread until count bytes arrive; short reads and EINTR are retried
+static bool preadFully(int fd, uint8_t *data, size_t count, off_t offset) {
+  while (count > 0) {
+    ssize_t n = ::pread(fd, data, count, offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n == 0) {
+      errno = ENODATA; // end of file
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    count -= static_cast<size_t>(n);
+    offset += n;
+  }
+  return true;
+}
 
-FileManager::FileHandle *
-FileManager::getOrOpenFile(const fs::path &path, size_t size,
-                           size_t offset, bool write) const {
-  std::lock_guard<std::mutex> lock(mutex_);
+static bool pwriteFully(int fd, const uint8_t *data, size_t count,
+                        off_t offset) {
+  while (count > 0) {
+    ssize_t n = ::pwrite(fd, data, count, offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    count -= static_cast<size_t>(n);
+    offset += n;
+  }
+  return true;
+}
+
+// O_DIRECT transfers start, end and sit in memory on this boundary, which
+// covers both 512-byte and 4 KiB sector devices
+constexpr size_t kDirectAlignment = 4096;
+// Unaligned direct transfers are bounced through buffers of this size
+constexpr size_t kDirectBounceSize = size_t(1) << 20;
 
-  std::string pathStr = path.string();
-  auto it = handles_.find(pathStr);
+// Preallocation is issued in pieces so that shutdown can interrupt it
+constexpr uint64_t kAllocationChunk = uint64_t(1) << 30;
 
-  if (it != handles_.end()) {
-    return it->second.get();
+// Advance an iovec array past bytes already transferred
+static void consume(std::vector<iovec> &iov, size_t &first, size_t bytes) {
+  while (bytes > 0) {
+    size_t take = std::min(bytes, iov[first].iov_len);
+    iov[first].iov_base = static_cast<uint8_t *>(iov[first].iov_base) + take;
+    iov[first].iov_len -= take;
+    bytes -= take;
+    if (iov[first].iov_len == 0) {
+      first++;
+    }
   }
+}
 
-  // Create new handle
-  auto handle = std::make_unique<FileHandle>();
-  handle->path = path;
-  handle->size = size;
-  handle->offset = offset;
+// preadv/pwritev the whole iovec array, at most IOV_MAX entries per call,
+// retrying EINTR and short transfers. Counts the system calls made
+static bool transferVectorFully(int fd, std::vector<iovec> &iov, off_t offset,
+                                bool write, uint64_t &calls) {
+  size_t first = 0;
+  while (first < iov.size() && iov[first].iov_len == 0) {
+    first++;
+  }
+  while (first < iov.size()) {
+    int count = static_cast<int>(std::min<size_t>(iov.size() - first, IOV_MAX));
+    ssize_t n = write ? ::pwritev(fd, &iov[first], count, offset)
+                      : ::preadv(fd, &iov[first], count, offset);
+    calls++;
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    offset += n;
+    consume(iov, first, static_cast<size_t>(n));
+  }
+  return true;
+}
 
-  // Create parent directories if they don't exist
-  std::error_code ec;
-  std::filesystem::create_directories(path.parent_path(), ec);
-  if (ec) {
-    throw TorrentException(ErrorCode::FileAccessDenied,
-                           "Cannot create directory: " +
-                               path.parent_path().string());
+static uint8_t *sliceData(const WriteSlice &slice) {
+  return const_cast<uint8_t *>(slice.data.data());
+}
+static uint8_t *sliceData(const ReadSlice &slice) { return slice.data; }
+static size_t sliceSize(const WriteSlice &slice) { return slice.data.size(); }
+static size_t sliceSize(const ReadSlice &slice) { return slice.size; }
+} // namespace Internal
+} // namespace
+
+FileManager::FileHandle::~FileHandle() {
+  if (fd >= 0) {
+    ::close(fd);
   }
+  if (directFd >= 0) {
+    ::close(directFd);
+  }
+}
 
-  // Open file
-  std::ios_base::openmode mode = std::ios_base::binary | std::ios_base::in;
-  if (write) {
-    mode |= std::ios_base::out;
+FileManager::Mapping::~Mapping() {
+  if (data) {
+    ::munmap(data, length);
+  }
+}
 
-    // Create file if it doesn't exist
-    if (!std::filesystem::exists(path)) {
-      std::ofstream create(path, std::ios_base::binary);
-      if (!create) {
-        throw TorrentException(ErrorCode::FileAccessDenied,
-                               "Cannot create file: " + path.string());
+FileManager::FileManager(const std::vector<FileItem> &files,
+                         const StorageOptions &options)
+    : files_(files), handles_(files.size()),
+      maxOpenFiles_(std::max<size_t>(1, options.maxOpenFiles)),
+      mmapEnabled_(options.ioMode == IoMode::Mmap),
+      accessPattern_(options.accessPattern),
+      directEnabled_(options.ioMode == IoMode::Direct),
+      directBuffers_(Internal::kDirectBounceSize, Internal::kDirectAlignment),
+      allocation_(options.allocation),
+      dirty_(new std::atomic<bool>[files.size()]()),
+      skipped_(new std::atomic<bool>[files.size()]()),
+      devices_(new std::atomic<uint64_t>[files.size()]),
+      durability_(options.durability), syncInterval_(options.syncInterval) {
+  // Windows must start on page boundaries
+  size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+  windowSize_ = std::max(page, (options.mmapWindowSize + page - 1) / page * page);
+
+  // A 32-bit address space cannot hold useful windows of large files
+  if (mmapEnabled_ && sizeof(void *) < 8) {
+    LOG_INFO("Memory-mapped storage needs 64-bit addressing; using pread");
+    mmapEnabled_ = false;
+  }
+
+  for (size_t i = 0; i < files_.size(); i++) {
+    devices_[i].store(kUnknownDevice, std::memory_order_relaxed);
+  }
+
+  index_.reserve(files_.size());
+  for (size_t i = 0; i < files_.size(); i++) {
+    if (files_[i].getSize() == 0) {
+      continue;
+    }
+    uint64_t start = static_cast<uint64_t>(files_[i].getOffset());
+    index_.push_back({start, start + files_[i].getSize(), i});
+  }
+  std::sort(index_.begin(), index_.end(),
+            [](const FileSpan &a, const FileSpan &b) {
+              return a.start < b.start;
+            });
+
+  if (durability_ == DurabilityMode::Periodic) {
+    syncThread_ = std::thread(&FileManager::syncLoop, this);
+  }
+}
+
+FileManager::~FileManager() {
+  if (allocationThread_.joinable()) {
+    stopAllocation_ = true;
+    allocationThread_.join();
+  }
+  if (syncThread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(syncMutex_);
+      stopSync_ = true;
+    }
+    syncWakeup_.notify_all();
+    syncThread_.join();
+  }
+  close();
+}
+
+FileManager::FileHandlePtr
+FileManager::getOrOpenFile(size_t fileIndex, bool write) const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return getOrOpenLocked(lock, fileIndex, write).handle;
+}
+
+FileManager::CacheEntry &
+FileManager::getOrOpenLocked(std::unique_lock<std::mutex> &lock,
+                             size_t fileIndex, bool write) const {
+  CacheEntry &entry = handles_[fileIndex];
+
+  if (entry.handle && (entry.handle->writable || !write)) {
+    stats_.hits++;
+    lru_.splice(lru_.begin(), lru_, entry.lruPosition);
+    return entry;
+  }
+
+  // Opening may create the file and, with OnFirstWrite, preallocate all of
+  // it, so it is done without the table lock: I/O on the other files goes
+  // on meanwhile. A handle another thread opened in between wins, and this
+  // one closes
+  stats_.misses++;
+  lock.unlock();
+  FileHandlePtr handle = openFile(fileIndex, write);
+  lock.lock();
+  if (entry.handle && (entry.handle->writable || !write)) {
+    lru_.splice(lru_.begin(), lru_, entry.lruPosition);
+    return entry;
+  }
+
+  // A read-only handle is replaced when write access is needed; threads
+  // still reading through the old one keep it alive until they finish.
+  // Its read-only mappings go with it
+  if (entry.handle) {
+    lru_.splice(lru_.begin(), lru_, entry.lruPosition);
+  } else {
+    evictLocked(maxOpenFiles_ - 1);
+    lru_.push_front(fileIndex);
+    entry.lruPosition = lru_.begin();
+    stats_.openFiles++;
+  }
+  entry.handle = handle;
+  entry.windows.clear();
+  entry.mmapFailed = false;
+  return entry;
+}
+
+FileManager::MappingPtr FileManager::getMapping(size_t fileIndex,
+                                                uint64_t fileOffset) const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  CacheEntry &entry = getOrOpenLocked(lock, fileIndex, false);
+  if (entry.mmapFailed) {
+    return nullptr;
+  }
+
+  const FileItem &file = files_[fileIndex];
+  size_t window = static_cast<size_t>(fileOffset / windowSize_);
+  if (entry.windows.size() <= window) {
+    entry.windows.resize((file.getSize() + windowSize_ - 1) / windowSize_);
+  }
+
+  MappingPtr &mapping = entry.windows[window];
+  if (mapping) {
+    return mapping;
+  }
+
+  uint64_t windowStart = static_cast<uint64_t>(window) * windowSize_;
+  size_t length = static_cast<size_t>(
+      std::min<uint64_t>(windowSize_, file.getSize() - windowStart));
+
+  // Touching a mapped page past end of file raises SIGBUS, so a file that
+  // is shorter than expected is read through pread instead
+  struct stat st;
+  if (::fstat(entry.handle->fd, &st) != 0 ||
+      static_cast<uint64_t>(st.st_size) < windowStart + length) {
+    return nullptr;
+  }
+
+  void *data = ::mmap(nullptr, length, PROT_READ, MAP_SHARED,
+                      entry.handle->fd, static_cast<off_t>(windowStart));
+  if (data == MAP_FAILED) {
+    LOG_ERROR("Cannot map %s, falling back to pread: %s",
+              file.getFilePath().c_str(), std::strerror(errno));
+    entry.mmapFailed = true;
+    return nullptr;
+  }
+
+  ::madvise(data, length,
+            accessPattern_ == AccessPattern::Sequential ? MADV_SEQUENTIAL
+                                                        : MADV_RANDOM);
+
+  mapping = std::make_shared<Mapping>();
+  mapping->data = static_cast<uint8_t *>(data);
+  mapping->length = length;
+  mapping->fileOffset = windowStart;
+  return mapping;
+}
+
+void FileManager::transfer(size_t fileIndex, uint64_t fileOffset,
+                           uint8_t *memory, uint64_t length,
+                           bool write) const {
+  while (length > 0) {
+    // Mappings are read-only: a store into a page of a sparse file that
+    // the filesystem cannot back (ENOSPC, EDQUOT) raises SIGBUS, where
+    // pwrite returns the error
+    MappingPtr mapping =
+        mmapEnabled_ && !write ? getMapping(fileIndex, fileOffset) : nullptr;
+
+    if (!mapping) {
+      auto handle = getOrOpenFile(fileIndex, write);
+      if (handle->directFd >= 0 && directSupported_ &&
+          transferDirect(*handle, fileIndex, fileOffset, memory, length,
+                         write)) {
+        return;
       }
-      // Resize to expected size
-      create.close();
-      std::filesystem::resize_file(path, size, ec);
-      if (ec) {
-        throw TorrentException(ErrorCode::FileWriteError,
-                               "Cannot resize file: " + path.string());
+      bool ok = write ? Internal::pwriteFully(handle->fd, memory, length,
+                                              static_cast<off_t>(fileOffset))
+                      : Internal::preadFully(handle->fd, memory, length,
+                                             static_cast<off_t>(fileOffset));
+      if (!ok) {
+        throw TorrentException(
+            write ? ErrorCode::FileWriteError : ErrorCode::FileReadError,
+            (write ? "Cannot write to: " : "Cannot read from: ") +
+                files_[fileIndex].getFilePath().string());
+      }
+      return;
+    }
+
+    uint64_t inWindow = fileOffset - mapping->fileOffset;
+    size_t chunk = static_cast<size_t>(
+        std::min<uint64_t>(length, mapping->length - inWindow));
+    std::memcpy(memory, mapping->data + inWindow, chunk);
+
+    fileOffset += chunk;
+    memory += chunk;
+    length -= chunk;
+  }
+}
+
+bool FileManager::transferDirect(const FileHandle &handle, size_t fileIndex,
+                                 uint64_t fileOffset, uint8_t *memory,
+                                 uint64_t length, bool write) const {
+  const uint64_t align = Internal::kDirectAlignment;
+  auto fail = [&] {
+    // A filesystem may accept O_DIRECT at open time and reject the I/O
+    if (errno == EINVAL) {
+      disableDirect(fileIndex);
+      return false;
+    }
+    throw TorrentException(
+        write ? ErrorCode::FileWriteError : ErrorCode::FileReadError,
+        (write ? "Cannot write to: " : "Cannot read from: ") +
+            Internal::errnoMessage(files_[fileIndex].getFilePath()));
+  };
+
+  // Transferring the partial block at the end of a file whole would move
+  // end of file, so that block always goes through the page cache
+  uint64_t directEnd = files_[fileIndex].getSize() / align * align;
+  if (fileOffset + length > directEnd) {
+    uint64_t tail = std::max(fileOffset, directEnd);
+    uint64_t skip = tail - fileOffset;
+    size_t count = static_cast<size_t>(length - skip);
+    bool ok = write ? Internal::pwriteFully(handle.fd, memory + skip, count,
+                                            static_cast<off_t>(tail))
+                    : Internal::preadFully(handle.fd, memory + skip, count,
+                                           static_cast<off_t>(tail));
+    if (!ok) {
+      return fail();
+    }
+    length = skip;
+  }
+
+  while (length > 0) {
+    uint64_t alignedStart = fileOffset / align * align;
+    size_t take;
+    bool ok;
+
+    if (fileOffset == alignedStart && length >= align &&
+        reinterpret_cast<uintptr_t>(memory) % align == 0) {
+      // Aligned caller memory is transferred in place
+      take = static_cast<size_t>(length / align * align);
+      ok = write ? Internal::pwriteFully(handle.directFd, memory, take,
+                                         static_cast<off_t>(fileOffset))
+                 : Internal::preadFully(handle.directFd, memory, take,
+                                        static_cast<off_t>(fileOffset));
+    } else {
+      uint64_t alignedEnd =
+          std::min((fileOffset + length + align - 1) / align * align,
+                   alignedStart + directBuffers_.bufferSize());
+      take = static_cast<size_t>(
+          std::min<uint64_t>(length, alignedEnd - fileOffset));
+      auto bounce = directBuffers_.acquire();
+      if (write) {
+        ok = editDirect(handle, fileIndex, bounce.get(), alignedStart,
+                        alignedEnd, fileOffset, memory, take);
+      } else {
+        ok = Internal::preadFully(handle.directFd, bounce.get(),
+                                  static_cast<size_t>(alignedEnd - alignedStart),
+                                  static_cast<off_t>(alignedStart));
+        if (ok) {
+          std::memcpy(memory, bounce.get() + (fileOffset - alignedStart), take);
+        }
       }
     }
+
+    if (!ok) {
+      return fail();
+    }
+    fileOffset += take;
+    memory += take;
+    length -= take;
+  }
+  return true;
+}
+
+bool FileManager::editDirect(const FileHandle &handle, size_t fileIndex,
+                             uint8_t *bounce, uint64_t alignedStart,
+                             uint64_t alignedEnd, uint64_t fileOffset,
+                             const uint8_t *memory, size_t length) const {
+  const uint64_t align = Internal::kDirectAlignment;
+  uint64_t lastBlock = alignedEnd - align;
+  bool headPartial = fileOffset != alignedStart;
+  bool tailPartial = fileOffset + length != alignedEnd;
+
+  // Lock the stripes of the edge blocks in index order
+  size_t stripes[2];
+  size_t stripeCount = 0;
+  for (uint64_t block : {headPartial ? alignedStart : UINT64_MAX,
+                         tailPartial ? lastBlock : UINT64_MAX}) {
+    if (block != UINT64_MAX) {
+      stripes[stripeCount++] =
+          static_cast<size_t>((fileIndex * 0x9E3779B1u + block / align) %
+                              kEditStripes);
+    }
+  }
+  if (stripeCount == 2 && stripes[0] > stripes[1]) {
+    std::swap(stripes[0], stripes[1]);
+  }
+  if (stripeCount == 2 && stripes[0] == stripes[1]) {
+    stripeCount = 1;
+  }
+  std::unique_lock<std::mutex> locks[2];
+  for (size_t i = 0; i < stripeCount; i++) {
+    locks[i] = std::unique_lock<std::mutex>(editLocks_[stripes[i]]);
+  }
+
+  if (headPartial &&
+      !Internal::preadFully(handle.directFd, bounce, align,
+                            static_cast<off_t>(alignedStart))) {
+    return false;
+  }
+  if (tailPartial && !(headPartial && lastBlock == alignedStart) &&
+      !Internal::preadFully(handle.directFd, bounce + (lastBlock - alignedStart),
+                            align, static_cast<off_t>(lastBlock))) {
+    return false;
+  }
+  std::memcpy(bounce + (fileOffset - alignedStart), memory, length);
+  return Internal::pwriteFully(handle.directFd, bounce,
+                               static_cast<size_t>(alignedEnd - alignedStart),
+                               static_cast<off_t>(alignedStart));
+}
+
+void FileManager::disableDirect(size_t fileIndex) const {
+  // Reported once per manager
+  if (directSupported_.exchange(false)) {
+    LOG_ERROR("Filesystem rejected O_DIRECT, using buffered I/O: %s",
+              files_[fileIndex].getFilePath().c_str());
+  }
+}
+
+bool FileManager::directIoActive() const {
+  return directEnabled_ && directSupported_;
+}
+
+FileManager::FileHandlePtr FileManager::openFile(size_t fileIndex,
+                                                 bool write) const {
+  const FileItem &file = files_[fileIndex];
+  const fs::path &path = file.getFilePath();
+
+  auto handle = std::make_shared<FileHandle>();
+  handle->writable = write;
+
+  if (write) {
+    // Create parent directories if they don't exist
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+    if (ec) {
+      throw TorrentException(ErrorCode::FileAccessDenied,
+                             "Cannot create directory: " +
+                                 path.parent_path().string());
+    }
+
+    // Create file if it doesn't exist, sized to the expected length
+    handle->fd = createFile(fileIndex);
+    if (handle->fd < 0 && errno == EEXIST) {
+      handle->fd = ::open(path.c_str(), O_RDWR);
+    }
+  } else {
+    handle->fd = ::open(path.c_str(), O_RDONLY);
   }
 
-  handle->stream.open(path, mode);
-  if (!handle->stream.is_open()) {
-    if (!std::filesystem::exists(path)) {
+  if (handle->fd < 0) {
+    if (errno == ENOENT) {
       throw TorrentException(ErrorCode::FileNotFound,
                              "File not found: " + path.string());
     }
     throw TorrentException(ErrorCode::FileAccessDenied,
-                           "Cannot open file: " + path.string());
+                           "Cannot open file: " +
+                               Internal::errnoMessage(path));
   }
 
-  auto *ptr = handle.get();
-  handles_[pathStr] = std::move(handle);
-  return ptr;
+  // The buffered descriptor stays the primary one: syncing, preallocation,
+  // asynchronous I/O and the file's partial last block use it
+  if (directEnabled_ && directSupported_) {
+    handle->directFd = ::open(path.c_str(), (write ? O_RDWR : O_RDONLY) |
+                                                O_DIRECT);
+    if (handle->directFd < 0) {
+      if (errno != EINVAL) {
+        throw TorrentException(ErrorCode::FileAccessDenied,
+                               "Cannot open file: " +
+                                   Internal::errnoMessage(path));
+      }
+      disableDirect(fileIndex);
+    }
+  }
+
+  return handle;
 }
 
-std::vector<uint8_t> FileManager::read(size_t start, size_t count) const {
-  std::vector<uint8_t> buffer(count, 0);
-  size_t end = start + count;
+int FileManager::createFile(size_t fileIndex) const {
+  const FileItem &file = files_[fileIndex];
+  const fs::path &path = file.getFilePath();
 
-  for (const auto &file : files_) {
-    size_t fileStart = file.getOffset();
-    size_t fileEnd = file.getOffset() + file.getSize();
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    return -1;
+  }
 
-    // Check if this file overlaps with the requested range
-    if (fileStart < end && fileEnd > start) {
-      // Calculate offset within the file to start reading
-      size_t fstart = (start > fileStart) ? (start - fileStart) : 0;
+  int error = 0;
+  if (::ftruncate(fd, static_cast<off_t>(file.getSize())) != 0) {
+    error = errno;
+  } else if (allocation_ == AllocationMode::OnFirstWrite &&
+             !skipped_[fileIndex].load(std::memory_order_relaxed)) {
+    error = allocate(fileIndex, fd);
+    // Unsupported filesystems keep the sparse file
+    if (error == EOPNOTSUPP) {
+      error = 0;
+    }
+  }
 
-      // Calculate how many bytes to read from this file
-      size_t readEnd = std::min(end, fileEnd);
-      size_t flength = readEnd - std::max(start, fileStart);
+  if (error != 0) {
+    ::close(fd);
+    errno = error;
+    throw TorrentException(ErrorCode::FileWriteError,
+                           "Cannot allocate file: " +
+                               Internal::errnoMessage(path));
+  }
+  return fd;
+}
 
-      // Calculate offset in the output buffer
-      size_t bstart = (fileStart > start) ? (fileStart - start) : 0;
+int FileManager::allocate(size_t fileIndex, int fd) const {
+  const FileItem &file = files_[fileIndex];
+  uint64_t size = file.getSize();
+  uint64_t offset = 0;
 
-      auto *handle = getOrOpenFile(file.getFilePath(), file.getSize(),
-                                   file.getOffset(), false);
+  while (offset < size && !stopAllocation_) {
+    uint64_t length = std::min(Internal::kAllocationChunk, size - offset);
+    if (::fallocate(fd, 0, static_cast<off_t>(offset),
+                    static_cast<off_t>(length)) != 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EOPNOTSUPP || errno == ENOSYS) {
+        // Reported once per manager
+        if (fallocateSupported_.exchange(false)) {
+          LOG_ERROR("Filesystem does not support fallocate, files stay "
+                    "sparse: %s",
+                    file.getFilePath().c_str());
+        }
+        return EOPNOTSUPP;
+      }
+      return errno;
+    }
+    bytesAllocated_.fetch_add(length, std::memory_order_relaxed);
+    offset += length;
+  }
+  return 0;
+}
 
-      handle->stream.seekg(fstart);
-      if (!handle->stream.read(reinterpret_cast<char *>(&buffer[bstart]),
-                               flength)) {
-        throw TorrentException(ErrorCode::FileReadError,
-                               "Cannot read from: " +
-                                   file.getFilePath().string());
+void FileManager::allocationLoop() {
+  std::string error;
+  for (size_t i = 0; i < files_.size() && !stopAllocation_; i++) {
+    if (files_[i].getSize() == 0 ||
+        skipped_[i].load(std::memory_order_relaxed)) {
+      continue;
+    }
+    try {
+      auto handle = getOrOpenFile(i, true);
+      int result = allocate(i, handle->fd);
+      if (result == EOPNOTSUPP) {
+        break;
       }
+      if (result != 0) {
+        errno = result;
+        error = "Cannot allocate space for: " +
+                Internal::errnoMessage(files_[i].getFilePath());
+        break;
+      }
+    } catch (const TorrentException &e) {
+      error = e.what();
+      break;
     }
   }
 
+  if (!error.empty()) {
+    LOG_ERROR("Preallocation stopped: %s", error.c_str());
+  }
+  std::lock_guard<std::mutex> lock(allocationMutex_);
+  allocationError_ = error;
+  allocating_ = false;
+  allocationDone_.notify_all();
+}
+
+void FileManager::evictLocked(size_t keep) const {
+  while (lru_.size() > keep) {
+    size_t victim = lru_.back();
+    lru_.pop_back();
+    handles_[victim].handle.reset();
+    handles_[victim].windows.clear();
+    stats_.evictions++;
+    stats_.openFiles--;
+  }
+}
+
+template <typename Fn>
+void FileManager::forEachOverlap(uint64_t start, uint64_t count,
+                                 Fn &&fn) const {
+  uint64_t end = start + count;
+
+  // First file starting after `start`; the one before it may contain start
+  auto it = std::upper_bound(
+      index_.begin(), index_.end(), start,
+      [](uint64_t value, const FileSpan &span) { return value < span.start; });
+  if (it != index_.begin()) {
+    --it;
+  }
+
+  for (; it != index_.end() && it->start < end; ++it) {
+    if (it->end <= start) {
+      continue;
+    }
+    uint64_t overlapStart = std::max(start, it->start);
+    uint64_t overlapEnd = std::min(end, it->end);
+    fn(it->fileIndex, overlapStart - it->start, overlapStart - start,
+       overlapEnd - overlapStart);
+  }
+}
+
+std::vector<uint8_t> FileManager::read(uint64_t start, size_t count) const {
+  std::vector<uint8_t> buffer(count, 0);
+
+  forEachOverlap(start, count, [&](size_t fileIndex, uint64_t fstart,
+                                   uint64_t bstart, uint64_t length) {
+    transfer(fileIndex, fstart, &buffer[bstart], length, false);
+  });
+
   return buffer;
 }
 
-void FileManager::write(size_t start, const std::vector<uint8_t> &buffer) {
-  size_t end = start + buffer.size();
+BlockView FileManager::view(uint64_t start, size_t count) const {
+  if (mmapEnabled_) {
+    size_t overlaps = 0;
+    size_t fileIndex = 0;
+    uint64_t fileOffset = 0;
+    forEachOverlap(start, count, [&](size_t index, uint64_t fstart, uint64_t,
+                                     uint64_t) {
+      overlaps++;
+      fileIndex = index;
+      fileOffset = fstart;
+    });
 
-  for (const auto &file : files_) {
-    size_t fileStart = file.getOffset();
-    size_t fileEnd = file.getOffset() + file.getSize();
-
-    // Check if this file overlaps with the requested range
-    if (fileStart < end && fileEnd > start) {
-      size_t fstart = (start > fileStart) ? (start - fileStart) : 0;
-      size_t writeEnd = std::min(end, fileEnd);
-      size_t writeLen = writeEnd - std::max(fileStart, start);
-
-      // Calculate offset in the input buffer
-      size_t bstart = (fileStart > start) ? (fileStart - start) : 0;
-
-      auto *handle = getOrOpenFile(file.getFilePath(), file.getSize(),
-                                   file.getOffset(), true);
-
-      handle->stream.seekp(fstart);
-      if (!handle->stream.write(reinterpret_cast<const char *>(&buffer[bstart]),
-                                writeLen)) {
-        throw TorrentException(ErrorCode::FileWriteError,
-                               "Cannot write to: " +
-                                   file.getFilePath().string());
+    if (overlaps == 1) {
+      MappingPtr mapping = getMapping(fileIndex, fileOffset);
+      if (mapping &&
+          fileOffset + count <= mapping->fileOffset + mapping->length) {
+        const uint8_t *data =
+            mapping->data + (fileOffset - mapping->fileOffset);
+        return BlockView{ByteSpan(data, count), mapping};
       }
-      handle->stream.flush();
     }
   }
+
+  auto owned = std::make_shared<const std::vector<uint8_t>>(read(start, count));
+  return BlockView{ByteSpan(*owned), owned};
 }
 
-void FileManager::ensureFilesExist() {
-  std::error_code ec;
+void FileManager::write(uint64_t start, ByteSpan buffer) {
+  forEachOverlap(start, buffer.size(), [&](size_t fileIndex, uint64_t fstart,
+                                           uint64_t bstart, uint64_t length) {
+    // transfer only reads from memory when writing
+    transfer(fileIndex, fstart, const_cast<uint8_t *>(&buffer[bstart]),
+             length, true);
+    dirty_[fileIndex].store(true, std::memory_order_release);
+  });
+}
 
-  for (const auto &file : files_) {
-    fs::path path = file.getFilePath();
+std::vector<FileExtent> FileManager::resolve(uint64_t start, size_t count,
+                                             bool write) const {
+  std::vector<FileExtent> extents;
+  forEachOverlap(start, count, [&](size_t fileIndex, uint64_t fstart,
+                                   uint64_t bstart, uint64_t length) {
+    FileHandlePtr handle = getOrOpenFile(fileIndex, write);
+    FileExtent extent;
+    extent.fd = handle->fd;
+    extent.owner = std::move(handle);
+    extent.fileIndex = fileIndex;
+    extent.fileOffset = fstart;
+    extent.rangeOffset = bstart;
+    extent.length = length;
+    extents.push_back(std::move(extent));
+  });
+  return extents;
+}
+
+void FileManager::markWritten(uint64_t start, size_t count) {
+  forEachOverlap(start, count,
+                 [&](size_t fileIndex, uint64_t, uint64_t, uint64_t) {
+                   dirty_[fileIndex].store(true, std::memory_order_release);
+                 });
+}
+
+template <typename Slice>
+void FileManager::transferRuns(std::vector<Slice> &slices, bool write) const {
+  vectoredSlices_.fetch_add(slices.size(), std::memory_order_relaxed);
+  std::sort(slices.begin(), slices.end(),
+            [](const Slice &a, const Slice &b) { return a.start < b.start; });
+
+  size_t first = 0;
+  while (first < slices.size()) {
+    // Extend the run while the next slice starts where this one ends
+    uint64_t runStart = slices[first].start;
+    uint64_t runEnd = runStart + Internal::sliceSize(slices[first]);
+    size_t last = first + 1;
+    while (last < slices.size() && slices[last].start == runEnd) {
+      runEnd += Internal::sliceSize(slices[last]);
+      last++;
+    }
+
+    // Gather the run's buffers per file; a slice crossing a file boundary
+    // contributes to both files' vectors
+    size_t cursor = first;
+    uint64_t cursorOffset = 0; // bytes of slices[cursor] already used
+    forEachOverlap(runStart, runEnd - runStart, [&](size_t fileIndex,
+                                                    uint64_t fstart, uint64_t,
+                                                    uint64_t length) {
+      if ((mmapEnabled_ && !write) || directEnabled_) {
+        // Mapped files are copied from directly, and direct I/O aligns each
+        // slice separately
+        uint64_t offset = fstart;
+        while (length > 0) {
+          size_t take = static_cast<size_t>(std::min<uint64_t>(
+              length, Internal::sliceSize(slices[cursor]) - cursorOffset));
+          transfer(fileIndex, offset,
+                   Internal::sliceData(slices[cursor]) + cursorOffset, take,
+                   write);
+          offset += take;
+          length -= take;
+          cursorOffset += take;
+          if (cursorOffset == Internal::sliceSize(slices[cursor])) {
+            cursor++;
+            cursorOffset = 0;
+          }
+        }
+        return;
+      }
+
+      std::vector<iovec> iov;
+      uint64_t remaining = length;
+      while (remaining > 0) {
+        size_t take = static_cast<size_t>(std::min<uint64_t>(
+            remaining, Internal::sliceSize(slices[cursor]) - cursorOffset));
+        iov.push_back(
+            iovec{Internal::sliceData(slices[cursor]) + cursorOffset, take});
+        remaining -= take;
+        cursorOffset += take;
+        if (cursorOffset == Internal::sliceSize(slices[cursor])) {
+          cursor++;
+          cursorOffset = 0;
+        }
+      }
+
+      auto handle = getOrOpenFile(fileIndex, write);
+      uint64_t calls = 0;
+      bool ok = Internal::transferVectorFully(
+          handle->fd, iov, static_cast<off_t>(fstart), write, calls);
+      vectoredCalls_.fetch_add(calls, std::memory_order_relaxed);
+      if (!ok) {
+        throw TorrentException(
+            write ? ErrorCode::FileWriteError : ErrorCode::FileReadError,
+            (write ? "Cannot write to: " : "Cannot read from: ") +
+                files_[fileIndex].getFilePath().string());
+      }
+    });
+
+    if (write) {
+      forEachOverlap(runStart, runEnd - runStart,
+                     [&](size_t fileIndex, uint64_t, uint64_t, uint64_t) {
+                       dirty_[fileIndex].store(true, std::memory_order_release);
+                     });
+    }
+    first = last;
+  }
+}
+
+void FileManager::writev(std::vector<WriteSlice> slices) {
+  transferRuns(slices, true);
+}
+
+void FileManager::readv(std::vector<ReadSlice> slices) const {
+  transferRuns(slices, false);
+}
+
+void FileManager::onRangeComplete(uint64_t start, size_t count) {
+  if (durability_ == DurabilityMode::PieceComplete) {
+    syncRange(start, count);
+  }
+}
+
+void FileManager::syncRange(size_t start, size_t count) {
+  forEachOverlap(start, count,
+                 [&](size_t fileIndex, uint64_t, uint64_t, uint64_t) {
+                   syncFile(fileIndex);
+                 });
+}
+
+void FileManager::sync() { syncAll(); }
+
+void FileManager::syncAll() {
+  for (size_t i = 0; i < files_.size(); i++) {
+    syncFile(i);
+  }
+}
+
+void FileManager::syncFile(size_t fileIndex) {
+  // Clear first so writes racing with the sync mark the file again
+  if (!dirty_[fileIndex].exchange(false, std::memory_order_acq_rel)) {
+    return;
+  }
+
+  // Syncing through any descriptor flushes the whole file, so a handle that
+  // was evicted since the write is simply reopened
+  auto handle = getOrOpenFile(fileIndex, false);
+  if (::fdatasync(handle->fd) != 0) {
+    dirty_[fileIndex].store(true, std::memory_order_release);
+    throw TorrentException(
+        ErrorCode::FileWriteError,
+        "Cannot sync: " +
+            Internal::errnoMessage(files_[fileIndex].getFilePath()));
+  }
+}
+
+void FileManager::syncLoop() {
+  std::unique_lock<std::mutex> lock(syncMutex_);
+  while (!stopSync_) {
+    syncWakeup_.wait_for(lock, syncInterval_);
+    lock.unlock();
+    try {
+      syncAll();
+    } catch (const TorrentException &e) {
+      LOG_ERROR("Periodic sync failed: %s", e.what());
+    }
+    lock.lock();
+  }
+}
+
+void FileManager::allocate() {
+  for (size_t i = 0; i < files_.size(); i++) {
+    const fs::path &path = files_[i].getFilePath();
+    if (skipped_[i].load(std::memory_order_relaxed)) {
+      continue;
+    }
 
     // Create parent directories
+    std::error_code ec;
     std::filesystem::create_directories(path.parent_path(), ec);
     if (ec) {
       throw TorrentException(ErrorCode::FileAccessDenied,
@@ -154,33 +880,188 @@ void FileManager::ensureFilesExist() {
                                  path.parent_path().string());
     }
 
-    // Create file if it doesn't exist
-    if (!std::filesystem::exists(path)) {
-      std::ofstream create(path, std::ios_base::binary);
-      if (!create) {
-        throw TorrentException(ErrorCode::FileAccessDenied,
-                               "Cannot create file: " + path.string());
-      }
-      create.close();
+    // Files with data wait for their first write
+    if (allocation_ == AllocationMode::OnFirstWrite &&
+        files_[i].getSize() > 0) {
+      continue;
+    }
 
-      // Resize to expected size
-      std::filesystem::resize_file(path, file.getSize(), ec);
-      if (ec) {
-        throw TorrentException(ErrorCode::FileWriteError,
-                               "Cannot resize file: " + path.string());
-      }
+    int fd = createFile(i);
+    if (fd >= 0) {
+      ::close(fd);
+    } else if (errno != EEXIST) {
+      throw TorrentException(ErrorCode::FileAccessDenied,
+                             "Cannot create file: " +
+                                 Internal::errnoMessage(path));
     }
   }
+
+  if (allocation_ == AllocationMode::Full && !allocationThread_.joinable()) {
+    std::lock_guard<std::mutex> lock(allocationMutex_);
+    allocating_ = true;
+    allocationThread_ = std::thread(&FileManager::allocationLoop, this);
+  }
+}
+
+void FileManager::setFileSkipped(size_t fileIndex, bool skipped) {
+  skipped_[fileIndex].store(skipped, std::memory_order_relaxed);
+}
+
+AllocationStatus FileManager::getAllocationStatus() const {
+  AllocationStatus status;
+  status.mode = allocation_;
+  status.bytesAllocated = bytesAllocated_.load(std::memory_order_relaxed);
+  status.fallocateSupported = fallocateSupported_;
+  std::lock_guard<std::mutex> lock(allocationMutex_);
+  status.inProgress = allocating_;
+  status.error = allocationError_;
+  return status;
 }
 
-void FileManager::closeAll() {
+void FileManager::waitForAllocation() {
+  std::unique_lock<std::mutex> lock(allocationMutex_);
+  allocationDone_.wait(lock, [this] { return !allocating_; });
+}
+
+void FileManager::close() {
   std::lock_guard<std::mutex> lock(mutex_);
-  for (auto &[path, handle] : handles_) {
-    if (handle->stream.is_open()) {
-      handle->stream.close();
+  for (size_t fileIndex : lru_) {
+    handles_[fileIndex].handle.reset();
+    handles_[fileIndex].windows.clear();
+  }
+  lru_.clear();
+  stats_.openFiles = 0;
+}
+
+void FileManager::setMaxOpenFiles(size_t maxOpenFiles) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  maxOpenFiles_ = std::max<size_t>(1, maxOpenFiles);
+  evictLocked(maxOpenFiles_);
+}
+
+uint64_t FileManager::deviceOf(size_t fileIndex) const {
+  uint64_t device = devices_[fileIndex].load(std::memory_order_relaxed);
+  if (device != kUnknownDevice) {
+    return device;
+  }
+
+  fs::path path = files_[fileIndex].getFilePath();
+  struct stat st;
+  if (::stat(path.c_str(), &st) == 0) {
+    devices_[fileIndex].store(st.st_dev, std::memory_order_relaxed);
+    return st.st_dev;
+  }
+
+  // Not created yet: it will live on the device of its nearest existing
+  // directory. Not cached, as the directory may still become a mount point
+  while (path.has_relative_path()) {
+    path = path.parent_path();
+    if (::stat(path.empty() ? "." : path.c_str(), &st) == 0) {
+      return st.st_dev;
+    }
+  }
+  return 0;
+}
+
+std::vector<DeviceExtent> FileManager::deviceExtents(uint64_t start,
+                                                     uint64_t count) const {
+  std::vector<DeviceExtent> extents;
+  forEachOverlap(start, count, [&](size_t fileIndex, uint64_t,
+                                   uint64_t rangeOffset, uint64_t length) {
+    uint64_t device = deviceOf(fileIndex);
+    if (!extents.empty() && extents.back().device == device) {
+      extents.back().length = start + rangeOffset + length - extents.back().start;
+    } else {
+      extents.push_back(DeviceExtent{device, start + rangeOffset, length});
+    }
+  });
+  return extents;
+}
+
+std::vector<DataExtent> FileManager::dataExtents(uint64_t start,
+                                                 uint64_t count) const {
+  std::vector<DataExtent> extents;
+  auto add = [&](uint64_t begin, uint64_t length) {
+    if (!extents.empty() &&
+        extents.back().start + extents.back().length == begin) {
+      extents.back().length += length;
+    } else {
+      extents.push_back(DataExtent{begin, length});
+    }
+  };
+
+  forEachOverlap(start, count, [&](size_t fileIndex, uint64_t fileOffset,
+                                   uint64_t rangeOffset, uint64_t length) {
+    FileHandlePtr handle;
+    try {
+      handle = getOrOpenFile(fileIndex, false);
+    } catch (const TorrentException &e) {
+      if (e.code() == ErrorCode::FileNotFound) {
+        return;
+      }
+      throw;
+    }
+
+    // Offsets are moved with lseek only here; all I/O is positional
+    uint64_t base = start + rangeOffset - fileOffset;
+    uint64_t end = fileOffset + length;
+    uint64_t position = fileOffset;
+    while (position < end) {
+      off_t data =
+          ::lseek(handle->fd, static_cast<off_t>(position), SEEK_DATA);
+      if (data < 0) {
+        if (errno == ENXIO) {
+          break; // only a hole up to the end of the file
+        }
+        if (errno == EINVAL || errno == EOPNOTSUPP) {
+          add(base + position, end - position);
+          break;
+        }
+        throw TorrentException(ErrorCode::FileReadError,
+                               "Cannot find data: " +
+                                   Internal::errnoMessage(
+                                       files_[fileIndex].getFilePath()));
+      }
+      if (static_cast<uint64_t>(data) >= end) {
+        break;
+      }
+      off_t hole = ::lseek(handle->fd, data, SEEK_HOLE);
+      uint64_t dataEnd =
+          hole < 0 ? end : std::min(end, static_cast<uint64_t>(hole));
+      add(base + static_cast<uint64_t>(data),
+          dataEnd - static_cast<uint64_t>(data));
+      position = dataEnd;
+    }
+  });
+  return extents;
+}
+
+StorageStat FileManager::stat() const {
+  StorageStat stat;
+  for (const auto &file : files_) {
+    stat.size += file.getSize();
+    struct stat st;
+    if (::stat(file.getFilePath().c_str(), &st) == 0) {
+      stat.bytesAllocated += static_cast<uint64_t>(st.st_blocks) * 512;
     }
   }
-  handles_.clear();
+  std::lock_guard<std::mutex> lock(mutex_);
+  stat.openFiles = stats_.openFiles;
+  return stat;
+}
+
+FileIoStats FileManager::getIoStats() const {
+  FileIoStats stats;
+  stats.slices = vectoredSlices_.load(std::memory_order_relaxed);
+  stats.calls = vectoredCalls_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+FileCacheStats FileManager::getCacheStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  FileCacheStats stats = stats_;
+  stats.capacity = maxOpenFiles_;
+  return stats;
 }
 
 } // namespace LitTorrent
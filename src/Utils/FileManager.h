@@ -1,11 +1,17 @@
 #pragma once
 
+#include "AlignedBufferPool.h"
 #include "Define.h"
-#include <fstream>
+#include "LitTorrent/Storage.h"
+#include "LitTorrent/StorageOptions.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
 #include <memory>
 #include <mutex>
 #include <string>
-#include <unordered_map>
+#include <thread>
 #include <vector>
 
 namespace LitTorrent {
@@ -13,12 +19,41 @@ namespace LitTorrent {
 // Forward declaration
 class FileItem;
 
-// Manages file I/O operations with caching and error handling
-// Throws TorrentException on errors
-class FileManager {
+// Descriptor cache counters
+struct FileCacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+  size_t openFiles = 0;
+  size_t capacity = 0;
+};
+
+// Vectored I/O counters: how many slices were handed in and how many
+// preadv/pwritev calls carried them
+struct FileIoStats {
+  uint64_t slices = 0;
+  uint64_t calls = 0;
+};
+
+// The file backend of Storage: manages file I/O with caching and error
+// handling. Data is moved with positional pread/pwrite on raw descriptors, so
+// any number of threads may read and write the same file concurrently; the
+// mutex only guards the handle table. At most maxOpenFiles descriptors are
+// kept open; the least recently used one is closed to make room. Writes are
+// never flushed one by one: files are marked dirty and synced according to
+// the durability mode. In IoMode::Mmap files are mapped read-only in windows
+// that share the descriptor cache's lifetime, and any range that cannot be
+// mapped falls back to pread; writes always use pwrite, which reports a full
+// disk rather than raising SIGBUS. In IoMode::Direct each file also gets an
+// O_DIRECT descriptor: whole aligned blocks go straight between the caller's
+// memory and the device, unaligned edges are read-modify-written through
+// pooled aligned buffers, and the partial block at the end of a file uses the
+// buffered descriptor. Throws TorrentException on errors
+class FileManager : public Storage {
 public:
-  explicit FileManager(const std::vector<FileItem> &files);
-  ~FileManager();
+  explicit FileManager(const std::vector<FileItem> &files,
+                       const StorageOptions &options = StorageOptions());
+  ~FileManager() override;
 
   // Disable copy, allow move
   FileManager(const FileManager &) = delete;
@@ -27,31 +62,210 @@ public:
   FileManager &operator=(FileManager &&) = delete;
 
   // Read data from the file set (throws on error)
-  std::vector<uint8_t> read(size_t start, size_t count) const;
+  std::vector<uint8_t> read(uint64_t start, size_t count) const override;
+
+  // Read data without copying when the range lies inside one mapped window;
+  // otherwise the view owns a freshly read buffer (throws on error)
+  BlockView view(uint64_t start, size_t count) const override;
+
+  // Write data to the file set (throws on error). Writes straight from the
+  // caller's memory; no intermediate copy is made
+  void write(uint64_t start, ByteSpan buffer) override;
+
+  // Open the files overlapping [start, start + count) so that I/O can be
+  // issued on them directly (throws on error). The descriptors are the
+  // buffered ones, and io_uring cannot align callers' buffers, so with
+  // direct I/O none are handed out: asynchronous I/O then goes through
+  // readv/writev, which align every slice
+  bool hasDescriptors() const override { return !directIoActive(); }
+  std::vector<FileExtent> resolve(uint64_t start, size_t count,
+                                  bool write) const override;
+
+  // Record a write made through descriptors returned by resolve
+  void markWritten(uint64_t start, size_t count) override;
+
+  // Write or read a batch of non-overlapping slices. Slices that are back to
+  // back in the torrent are merged, and every run is issued as one
+  // pwritev/preadv per file it touches (throws on error)
+  void writev(std::vector<WriteSlice> slices) override;
+  void readv(std::vector<ReadSlice> slices) const override;
 
-  // Write data to the file set (throws on error)
-  void write(size_t start, const std::vector<uint8_t> &buffer);
+  // Create the files at their full length (throws on error). With
+  // AllocationMode::Full the space is then reserved on a background thread,
+  // so this returns without waiting for it; with OnFirstWrite only the
+  // directories and empty files are created. Skipped files are left out
+  void allocate() override;
 
-  // Ensure all files exist and are properly sized (throws on error)
-  void ensureFilesExist();
+  // A skipped file that a write reaches is created sparse, without
+  // reserving its space
+  void setFileSkipped(size_t fileIndex, bool skipped) override;
 
-  // Close all open file handles
-  void closeAll();
+  // Background preallocation progress
+  AllocationStatus getAllocationStatus() const override;
+  void waitForAllocation();
+
+  // Called once the range (a verified piece) is final; syncs the files it
+  // touches when the durability mode is PieceComplete
+  void onRangeComplete(uint64_t start, size_t count) override;
+
+  // fdatasync every dirty file overlapping the range, or all dirty files
+  void syncRange(size_t start, size_t count);
+  void syncAll();
+  void sync() override;
+
+  // Close all open file handles. Handles still in use by another thread are
+  // closed once that I/O finishes
+  void close() override;
+
+  // Total size, blocks allocated on disk by the files that exist, and open
+  // descriptors
+  StorageStat stat() const override;
+
+  // Consecutive files on the same device form one extent
+  std::vector<DeviceExtent> deviceExtents(uint64_t start,
+                                          uint64_t count) const override;
+
+  // Data and holes of each file, found with lseek(SEEK_DATA/SEEK_HOLE).
+  // Files that do not exist are all hole; filesystems without hole
+  // reporting show every file as data
+  std::vector<DataExtent> dataExtents(uint64_t start,
+                                      uint64_t count) const override;
+
+  // Descriptor cache configuration and counters
+  void setMaxOpenFiles(size_t maxOpenFiles);
+  FileCacheStats getCacheStats() const;
+  FileIoStats getIoStats() const;
+
+  // True while IoMode::Direct is in effect, false once a filesystem has
+  // rejected O_DIRECT and I/O has fallen back to the page cache
+  bool directIoActive() const;
 
 private:
+  // Owns a descriptor; closed when the last user drops its reference.
+  // Handles opened for reading are read-only and get replaced by a
+  // read-write handle on the first write. directFd is the same file opened
+  // with O_DIRECT, or -1
   struct FileHandle {
-    std::fstream stream;
-    fs::path path;
-    size_t size;
-    size_t offset;
+    int fd = -1;
+    int directFd = -1;
+    bool writable = false;
+
+    ~FileHandle();
+  };
+  using FileHandlePtr = std::shared_ptr<FileHandle>;
+
+  // One mapped window of a file; unmapped when the last user lets go
+  struct Mapping {
+    uint8_t *data = nullptr;
+    size_t length = 0;
+    uint64_t fileOffset = 0;
+
+    ~Mapping();
+  };
+  using MappingPtr = std::shared_ptr<Mapping>;
+
+  struct CacheEntry {
+    FileHandlePtr handle;
+    std::vector<MappingPtr> windows;
+    bool mmapFailed = false;
+    std::list<size_t>::iterator lruPosition;
+  };
+
+  // One entry per non-empty file, sorted by torrent offset, so the files a
+  // byte range touches are found with a binary search
+  struct FileSpan {
+    uint64_t start;
+    uint64_t end;
+    size_t fileIndex;
   };
 
   const std::vector<FileItem> &files_;
-  mutable std::unordered_map<std::string, std::unique_ptr<FileHandle>> handles_;
+  std::vector<FileSpan> index_;
+
+  // Handle cache indexed by file index; the list holds open file indices,
+  // most recently used first
+  mutable std::vector<CacheEntry> handles_;
+  mutable std::list<size_t> lru_;
+  mutable FileCacheStats stats_;
+  size_t maxOpenFiles_;
   mutable std::mutex mutex_;
 
-  FileHandle *getOrOpenFile(const fs::path &path,
-                           size_t size, size_t offset, bool write) const;
+  // Memory mapping
+  bool mmapEnabled_;
+  size_t windowSize_;
+  AccessPattern accessPattern_;
+
+  // Direct I/O. Writers whose unaligned edges fall in the same block take
+  // that block's stripe lock for the read-modify-write
+  static constexpr size_t kEditStripes = 64;
+  bool directEnabled_;
+  mutable std::atomic<bool> directSupported_{true};
+  mutable AlignedBufferPool directBuffers_;
+  mutable std::mutex editLocks_[kEditStripes];
+
+  mutable std::atomic<uint64_t> vectoredSlices_{0};
+  mutable std::atomic<uint64_t> vectoredCalls_{0};
+
+  // Preallocation
+  AllocationMode allocation_;
+  std::thread allocationThread_;
+  std::atomic<bool> stopAllocation_{false};
+  mutable std::atomic<uint64_t> bytesAllocated_{0};
+  mutable std::atomic<bool> fallocateSupported_{true};
+  mutable std::mutex allocationMutex_;
+  std::condition_variable allocationDone_;
+  bool allocating_ = false;
+  std::string allocationError_;
+
+  // Files written since their last sync
+  std::unique_ptr<std::atomic<bool>[]> dirty_;
+
+  // Files not wanted, neither created nor preallocated up front
+  std::unique_ptr<std::atomic<bool>[]> skipped_;
+
+  // st_dev of each file once it exists, kUnknownDevice before
+  static constexpr uint64_t kUnknownDevice = UINT64_MAX;
+  mutable std::unique_ptr<std::atomic<uint64_t>[]> devices_;
+
+  // Periodic durability
+  DurabilityMode durability_;
+  std::chrono::milliseconds syncInterval_;
+  std::thread syncThread_;
+  std::mutex syncMutex_;
+  std::condition_variable syncWakeup_;
+  bool stopSync_ = false;
+
+  FileHandlePtr getOrOpenFile(size_t fileIndex, bool write) const;
+  // Called with lock held on mutex_; released while a file is opened
+  CacheEntry &getOrOpenLocked(std::unique_lock<std::mutex> &lock,
+                              size_t fileIndex, bool write) const;
+  FileHandlePtr openFile(size_t fileIndex, bool write) const;
+  int createFile(size_t fileIndex) const;
+  int allocate(size_t fileIndex, int fd) const;
+  void allocationLoop();
+  // A read-only window holding fileOffset, or nullptr to use pread
+  MappingPtr getMapping(size_t fileIndex, uint64_t fileOffset) const;
+  void transfer(size_t fileIndex, uint64_t fileOffset, uint8_t *memory,
+                uint64_t length, bool write) const;
+  bool transferDirect(const FileHandle &handle, size_t fileIndex,
+                      uint64_t fileOffset, uint8_t *memory, uint64_t length,
+                      bool write) const;
+  bool editDirect(const FileHandle &handle, size_t fileIndex, uint8_t *bounce,
+                  uint64_t alignedStart, uint64_t alignedEnd,
+                  uint64_t fileOffset, const uint8_t *memory,
+                  size_t length) const;
+  void disableDirect(size_t fileIndex) const;
+  template <typename Slice>
+  void transferRuns(std::vector<Slice> &slices, bool write) const;
+  void evictLocked(size_t keep) const;
+  uint64_t deviceOf(size_t fileIndex) const;
+  void syncFile(size_t fileIndex);
+  void syncLoop();
+
+  // Invoke fn(fileIndex, fileOffset, rangeOffset, length) for every file that
+  // overlaps [start, start + count), in torrent order
+  template <typename Fn>
+  void forEachOverlap(uint64_t start, uint64_t count, Fn &&fn) const;
 };
 
 } // namespace LitTorrent
@@ -0,0 +1,163 @@
+#include "MemoryStorage.h"
+#include "Error.h"
+#include <algorithm>
+#include <cstring>
+
+namespace LitTorrent {
+
+MemoryStorage::MemoryStorage(uint64_t size, size_t chunkSize,
+                             AllocationMode allocation)
+    : size_(size), chunkSize_(std::max<size_t>(1, chunkSize)),
+      chunkCount_(static_cast<size_t>((size + chunkSize_ - 1) / chunkSize_)),
+      allocation_(allocation),
+      chunks_(new std::atomic<uint8_t *>[chunkCount_]()) {}
+
+MemoryStorage::~MemoryStorage() {
+  for (size_t i = 0; i < chunkCount_; i++) {
+    delete[] chunks_[i].load(std::memory_order_relaxed);
+  }
+}
+
+size_t MemoryStorage::chunkLength(size_t index) const {
+  return static_cast<size_t>(std::min<uint64_t>(
+      chunkSize_, size_ - static_cast<uint64_t>(index) * chunkSize_));
+}
+
+uint8_t *MemoryStorage::chunk(size_t index, bool create) const {
+  uint8_t *data = chunks_[index].load(std::memory_order_acquire);
+  if (data || !create) {
+    return data;
+  }
+
+  // Racing writers each build a chunk; the loser frees its own
+  size_t length = chunkLength(index);
+  uint8_t *fresh = new uint8_t[length]();
+  if (chunks_[index].compare_exchange_strong(data, fresh,
+                                             std::memory_order_acq_rel)) {
+    bytesAllocated_.fetch_add(length, std::memory_order_relaxed);
+    return fresh;
+  }
+  delete[] fresh;
+  return data;
+}
+
+void MemoryStorage::checkRange(uint64_t start, uint64_t count,
+                               bool write) const {
+  if (start > size_ || count > size_ - start) {
+    throw TorrentException(
+        write ? ErrorCode::FileWriteError : ErrorCode::FileReadError,
+        "Range [" + std::to_string(start) + ", " +
+            std::to_string(start + count) + ") beyond end of storage (" +
+            std::to_string(size_) + " bytes)");
+  }
+}
+
+template <typename Fn>
+void MemoryStorage::forEachChunk(uint64_t start, uint64_t count,
+                                 Fn &&fn) const {
+  uint64_t done = 0;
+  while (done < count) {
+    uint64_t offset = start + done;
+    size_t index = static_cast<size_t>(offset / chunkSize_);
+    size_t inChunk = static_cast<size_t>(offset % chunkSize_);
+    size_t length = static_cast<size_t>(
+        std::min<uint64_t>(count - done, chunkLength(index) - inChunk));
+    fn(index, inChunk, done, length);
+    done += length;
+  }
+}
+
+void MemoryStorage::copyOut(uint64_t start, uint8_t *memory,
+                            size_t count) const {
+  forEachChunk(start, count, [&](size_t index, size_t inChunk, uint64_t done,
+                                 size_t length) {
+    const uint8_t *data = chunk(index, false);
+    if (data) {
+      std::memcpy(memory + done, data + inChunk, length);
+    } else {
+      std::memset(memory + done, 0, length);
+    }
+  });
+}
+
+std::vector<uint8_t> MemoryStorage::read(uint64_t start, size_t count) const {
+  checkRange(start, count, false);
+  std::vector<uint8_t> buffer(count);
+  copyOut(start, buffer.data(), count);
+  return buffer;
+}
+
+void MemoryStorage::write(uint64_t start, ByteSpan data) {
+  checkRange(start, data.size(), true);
+  forEachChunk(start, data.size(), [&](size_t index, size_t inChunk,
+                                       uint64_t done, size_t length) {
+    std::memcpy(chunk(index, true) + inChunk, data.data() + done, length);
+  });
+}
+
+BlockView MemoryStorage::view(uint64_t start, size_t count) const {
+  checkRange(start, count, false);
+  size_t index = static_cast<size_t>(start / chunkSize_);
+  size_t inChunk = static_cast<size_t>(start % chunkSize_);
+  const uint8_t *data = count > 0 ? chunk(index, false) : nullptr;
+  if (data && inChunk + count <= chunkLength(index)) {
+    return BlockView{ByteSpan(data + inChunk, count), nullptr};
+  }
+  return Storage::view(start, count);
+}
+
+void MemoryStorage::readv(std::vector<ReadSlice> slices) const {
+  for (const auto &slice : slices) {
+    checkRange(slice.start, slice.size, false);
+    copyOut(slice.start, slice.data, slice.size);
+  }
+}
+
+void MemoryStorage::writev(std::vector<WriteSlice> slices) {
+  for (const auto &slice : slices) {
+    write(slice.start, slice.data);
+  }
+}
+
+std::vector<DataExtent> MemoryStorage::dataExtents(uint64_t start,
+                                                   uint64_t count) const {
+  checkRange(start, count, false);
+  std::vector<DataExtent> extents;
+  forEachChunk(start, count, [&](size_t index, size_t, uint64_t done,
+                                 size_t length) {
+    if (!chunk(index, false)) {
+      return;
+    }
+    if (!extents.empty() &&
+        extents.back().start + extents.back().length == start + done) {
+      extents.back().length += length;
+    } else {
+      extents.push_back(DataExtent{start + done, length});
+    }
+  });
+  return extents;
+}
+
+void MemoryStorage::allocate() {
+  if (allocation_ == AllocationMode::Full) {
+    for (size_t i = 0; i < chunkCount_; i++) {
+      chunk(i, true);
+    }
+  }
+}
+
+AllocationStatus MemoryStorage::getAllocationStatus() const {
+  AllocationStatus status;
+  status.mode = allocation_;
+  status.bytesAllocated = bytesAllocated_.load(std::memory_order_relaxed);
+  return status;
+}
+
+StorageStat MemoryStorage::stat() const {
+  StorageStat stat;
+  stat.size = size_;
+  stat.bytesAllocated = bytesAllocated_.load(std::memory_order_relaxed);
+  return stat;
+}
+
+} // namespace LitTorrent
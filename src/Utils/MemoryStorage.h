@@ -0,0 +1,63 @@
+#pragma once
+
+#include "LitTorrent/Storage.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace LitTorrent {
+
+// Keeps a torrent's bytes in memory, so tests and benchmarks can measure
+// protocol and hashing throughput without touching a disk. Memory is
+// allocated in chunks on first write (all at once with AllocationMode::Full)
+// and never freed before the storage; unwritten ranges read as zeros.
+// Chunks are installed with a compare-and-swap, so the hot path takes no
+// lock. Views point straight into the chunks and stay valid for the
+// lifetime of the storage. Throws TorrentException for ranges past the end
+class MemoryStorage : public Storage {
+public:
+  MemoryStorage(uint64_t size, size_t chunkSize = size_t(1) << 20,
+                AllocationMode allocation = AllocationMode::Sparse);
+  ~MemoryStorage() override;
+
+  MemoryStorage(const MemoryStorage &) = delete;
+  MemoryStorage &operator=(const MemoryStorage &) = delete;
+
+  std::vector<uint8_t> read(uint64_t start, size_t count) const override;
+  void write(uint64_t start, ByteSpan data) override;
+  BlockView view(uint64_t start, size_t count) const override;
+  void readv(std::vector<ReadSlice> slices) const override;
+  void writev(std::vector<WriteSlice> slices) override;
+
+  void allocate() override;
+  AllocationStatus getAllocationStatus() const override;
+  void close() override {}
+  StorageStat stat() const override;
+
+  // Chunks not yet created are holes
+  std::vector<DataExtent> dataExtents(uint64_t start,
+                                      uint64_t count) const override;
+
+private:
+  uint64_t size_;
+  size_t chunkSize_;
+  size_t chunkCount_;
+  AllocationMode allocation_;
+  std::unique_ptr<std::atomic<uint8_t *>[]> chunks_;
+  mutable std::atomic<uint64_t> bytesAllocated_{0};
+
+  size_t chunkLength(size_t index) const;
+  // The chunk's memory, created zero-filled if needed; without create an
+  // absent chunk is nullptr
+  uint8_t *chunk(size_t index, bool create) const;
+  void checkRange(uint64_t start, uint64_t count, bool write) const;
+  void copyOut(uint64_t start, uint8_t *memory, size_t count) const;
+
+  // Invoke fn(chunkIndex, chunkOffset, rangeOffset, length) for every chunk
+  // overlapping [start, start + count)
+  template <typename Fn>
+  void forEachChunk(uint64_t start, uint64_t count, Fn &&fn) const;
+};
+
+} // namespace LitTorrent
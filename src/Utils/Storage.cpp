@@ -0,0 +1,53 @@
+#include "LitTorrent/Storage.h"
+#include "Error.h"
+#include "FileItem.h"
+#include "FileManager.h"
+#include "MemoryStorage.h"
+
+namespace LitTorrent {
+
+BlockView Storage::view(uint64_t start, size_t count) const {
+  auto owned = std::make_shared<const std::vector<uint8_t>>(read(start, count));
+  return BlockView{ByteSpan(*owned), owned};
+}
+
+std::vector<DeviceExtent> Storage::deviceExtents(uint64_t start,
+                                               uint64_t count) const {
+  return {DeviceExtent{0, start, count}};
+}
+
+std::vector<DataExtent> Storage::dataExtents(uint64_t start,
+                                            uint64_t count) const {
+  if (count == 0) {
+    return {};
+  }
+  return {DataExtent{start, count}};
+}
+
+std::vector<FileExtent> Storage::resolve(uint64_t, size_t, bool) const {
+  throw TorrentException(ErrorCode::FileAccessDenied,
+                         "Storage backend has no file descriptors");
+}
+
+std::unique_ptr<Storage> makeStorage(const std::vector<FileItem> &files,
+                                     const StorageOptions &options) {
+  if (options.storageFactory) {
+    return options.storageFactory(files, options);
+  }
+
+  switch (options.backend) {
+  case StorageBackend::Memory: {
+    uint64_t size = 0;
+    for (const auto &file : files) {
+      size += file.getSize();
+    }
+    return std::make_unique<MemoryStorage>(size, options.memoryChunkSize,
+                                           options.allocation);
+  }
+  case StorageBackend::Files:
+    break;
+  }
+  return std::make_unique<FileManager>(files, options);
+}
+
+} // namespace LitTorrent
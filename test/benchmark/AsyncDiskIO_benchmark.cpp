@@ -0,0 +1,167 @@
+// Random 16 KiB reads at queue depths 1 to 256: the synchronous FileManager
+// driven by one blocking thread per outstanding read, against AsyncDiskIO
+// keeping the same number of reads in flight from its completion callbacks.
+// The file is dropped from the page cache before every run.
+// Usage: AsyncDiskIO_benchmark [directory] [file size in MiB] [reads per run]
+#include "../Utils/AsyncDiskIO.h"
+#include "../Utils/FileManager.h"
+#include "FileItem.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace LitTorrent;
+
+namespace {
+
+constexpr size_t kBlockSize = 16384;
+using Clock = std::chrono::steady_clock;
+
+struct Result {
+  double seconds = 0;
+  std::vector<double> latencies; // microseconds
+};
+
+void dropCache(const fs::path &path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+  }
+}
+
+double micros(Clock::duration d) {
+  return std::chrono::duration<double, std::micro>(d).count();
+}
+
+Result runSync(const FileManager &manager, size_t blockCount, int depth,
+               int reads) {
+  Result result;
+  std::mutex mutex;
+  std::atomic<int> issued{0};
+  auto start = Clock::now();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < depth; t++) {
+    threads.emplace_back([&, t] {
+      std::mt19937_64 rng(t + 1);
+      std::vector<double> latencies;
+      while (issued.fetch_add(1) < reads) {
+        auto begin = Clock::now();
+        manager.read((rng() % blockCount) * kBlockSize, kBlockSize);
+        latencies.push_back(micros(Clock::now() - begin));
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      result.latencies.insert(result.latencies.end(), latencies.begin(),
+                              latencies.end());
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  result.seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  return result;
+}
+
+Result runAsync(AsyncDiskIO &io, size_t blockCount, int depth, int reads) {
+  std::mt19937_64 rng(1);
+  std::vector<uint64_t> offsets(reads);
+  for (auto &offset : offsets) {
+    offset = (rng() % blockCount) * kBlockSize;
+  }
+
+  // Each completion issues the next read, keeping depth reads in flight
+  Result result;
+  result.latencies.resize(reads);
+  std::atomic<int> next{0};
+  std::function<void()> issue = [&] {
+    int i = next.fetch_add(1);
+    if (i >= reads) {
+      return;
+    }
+    auto begin = Clock::now();
+    io.read(offsets[i], kBlockSize, [&, i, begin](int error, ByteSpan) {
+      if (error != 0) {
+        std::abort();
+      }
+      result.latencies[i] = micros(Clock::now() - begin);
+      issue();
+    });
+  };
+
+  auto start = Clock::now();
+  for (int i = 0; i < depth; i++) {
+    issue();
+  }
+  io.waitIdle();
+  result.seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  return result;
+}
+
+void report(const char *label, int depth, Result result) {
+  auto &l = result.latencies;
+  std::sort(l.begin(), l.end());
+  auto percentile = [&](double p) {
+    return l[std::min(l.size() - 1, static_cast<size_t>(p * l.size()))];
+  };
+  printf("%-6s %6d %10.0f %10.0f %10.0f %10.0f\n", label, depth,
+         l.size() / result.seconds, percentile(0.50), percentile(0.99),
+         percentile(0.999));
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  fs::path dir = argc > 1 ? fs::path(argv[1])
+                          : fs::temp_directory_path() / "littorrent_bench";
+  size_t sizeMiB = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1024;
+  int reads = argc > 3 ? std::atoi(argv[3]) : 20000;
+  size_t totalSize = sizeMiB * 1024 * 1024;
+  size_t blockCount = totalSize / kBlockSize;
+
+  fs::create_directories(dir);
+  fs::path path = dir / "async_bench.bin";
+  std::vector<FileItem> files{FileItem(path, totalSize, 0)};
+  FileManager manager(files);
+
+  std::vector<uint8_t> block(kBlockSize, 0x5A);
+  for (size_t b = 0; b < blockCount; b++) {
+    manager.write(b * kBlockSize, block);
+  }
+  manager.syncAll();
+
+  AsyncDiskIO io(manager, 256, kBlockSize);
+  printf("random %zu KiB reads, %zu MiB file, %d reads per run, %s\n",
+         kBlockSize / 1024, sizeMiB, reads,
+         io.usingIoUring() ? "io_uring" : "thread fallback");
+  printf("%-6s %6s %10s %10s %10s %10s\n", "engine", "depth", "IOPS",
+         "p50 us", "p99 us", "p99.9 us");
+
+  for (int depth = 1; depth <= 256; depth *= 2) {
+    dropCache(path);
+    report("sync", depth, runSync(manager, blockCount, depth, reads));
+    dropCache(path);
+    report("async", depth, runAsync(io, blockCount, depth, reads));
+  }
+
+  auto stats = io.getStats();
+  printf("async: %llu requests in %llu submission batches\n",
+         static_cast<unsigned long long>(stats.completed),
+         static_cast<unsigned long long>(stats.batches));
+
+  io.stop();
+  manager.close();
+  fs::remove(path);
+  return 0;
+}
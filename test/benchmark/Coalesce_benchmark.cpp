@@ -0,0 +1,100 @@
+// Writes a torrent as 16 KiB blocks arriving in random order within each
+// 1 MiB piece, once block by block and once a piece at a time through the
+// coalescing writev path, for a single file and for many small files.
+// Every run ends with an fdatasync so device throughput is included.
+// Usage: Coalesce_benchmark [directory] [MiB=512]
+#include "../Utils/FileManager.h"
+#include "FileItem.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace LitTorrent;
+
+namespace {
+
+constexpr size_t kBlockSize = 16384;
+constexpr size_t kPieceSize = 1 << 20;
+
+std::vector<FileItem> makeFiles(const fs::path &dir, size_t total,
+                                size_t fileSize) {
+  std::vector<FileItem> files;
+  for (size_t offset = 0; offset < total; offset += fileSize) {
+    files.emplace_back(dir / ("coalesce" + std::to_string(files.size())),
+                       std::min(fileSize, total - offset), offset);
+  }
+  return files;
+}
+
+template <typename WritePiece>
+double run(FileManager &manager, size_t total, WritePiece writePiece) {
+  std::mt19937 rng(3);
+  std::vector<uint8_t> data(kPieceSize, 0xC3);
+  auto start = std::chrono::steady_clock::now();
+  for (size_t piece = 0; piece < total; piece += kPieceSize) {
+    std::vector<WriteSlice> blocks;
+    for (size_t b = 0; b < kPieceSize; b += kBlockSize) {
+      blocks.push_back(WriteSlice{piece + b, ByteSpan(data.data() + b,
+                                                      kBlockSize)});
+    }
+    std::shuffle(blocks.begin(), blocks.end(), rng);
+    writePiece(blocks);
+  }
+  manager.syncAll();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  fs::path dir = argc > 1 ? fs::path(argv[1])
+                          : fs::temp_directory_path() / "littorrent_bench";
+  size_t sizeMiB = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 512;
+  size_t total = sizeMiB << 20;
+  fs::create_directories(dir);
+
+  printf("%zu MiB in %zu KiB blocks, shuffled within 1 MiB pieces\n", sizeMiB,
+         kBlockSize / 1024);
+  printf("%-22s %-12s %10s %12s\n", "layout", "path", "MiB/s", "syscalls");
+
+  for (size_t fileSize : {total, size_t(100) * 1024}) {
+    auto files = makeFiles(dir, total, fileSize);
+    char layout[64];
+    snprintf(layout, sizeof(layout), "%zu file(s)", files.size());
+
+    for (bool vectored : {false, true}) {
+      StorageOptions options;
+      options.durability = DurabilityMode::None;
+      FileManager manager(files, options);
+
+      double seconds =
+          run(manager, total, [&](const std::vector<WriteSlice> &blocks) {
+            if (vectored) {
+              manager.writev(blocks);
+            } else {
+              for (const auto &block : blocks) {
+                manager.write(block.start, block.data);
+              }
+            }
+          });
+
+      // Block by block is one pwrite per block per file it touches
+      uint64_t calls = vectored ? manager.getIoStats().calls
+                                : total / kBlockSize + files.size();
+      printf("%-22s %-12s %10.1f %12llu\n", layout,
+             vectored ? "writev" : "per block", sizeMiB / seconds,
+             static_cast<unsigned long long>(calls));
+      manager.close();
+      for (const auto &file : files) {
+        fs::remove(file.getFilePath());
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,96 @@
+// Random-order 16 KiB block writes over a multi-file torrent under each
+// durability mode. A piece's files are synced as soon as its last block is
+// written when the mode is PieceComplete.
+// Usage: Durability_benchmark [directory] [torrent size in MiB]
+#include "../Utils/FileManager.h"
+#include "FileItem.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace LitTorrent;
+
+namespace {
+
+constexpr size_t kBlockSize = 16384;
+constexpr size_t kPieceSize = 262144;
+constexpr size_t kFileCount = 8;
+
+const char *modeName(DurabilityMode mode) {
+  switch (mode) {
+  case DurabilityMode::None:
+    return "none";
+  case DurabilityMode::PieceComplete:
+    return "piece-complete";
+  case DurabilityMode::Periodic:
+    return "periodic (1s)";
+  }
+  return "";
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  fs::path dir = argc > 1 ? fs::path(argv[1])
+                          : fs::temp_directory_path() / "littorrent_durability";
+  size_t sizeMiB = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 2048;
+  size_t totalSize = sizeMiB * 1024 * 1024;
+  size_t blockCount = totalSize / kBlockSize;
+  size_t blocksPerPiece = kPieceSize / kBlockSize;
+
+  std::vector<FileItem> files;
+  for (size_t i = 0; i < kFileCount; i++) {
+    files.emplace_back(dir / ("part" + std::to_string(i)),
+                       totalSize / kFileCount,
+                       static_cast<int64_t>(i * (totalSize / kFileCount)));
+  }
+
+  std::vector<size_t> order(blockCount);
+  for (size_t i = 0; i < blockCount; i++) {
+    order[i] = i;
+  }
+  std::shuffle(order.begin(), order.end(), std::mt19937_64(3));
+  std::vector<uint8_t> block(kBlockSize, 0xC3);
+
+  printf("random-order 16 KiB writes, %zu MiB over %zu files\n", sizeMiB,
+         kFileCount);
+  printf("%-16s %10s %10s %10s\n", "mode", "write s", "final sync", "MiB/s");
+  for (auto mode : {DurabilityMode::None, DurabilityMode::PieceComplete,
+                    DurabilityMode::Periodic}) {
+    fs::remove_all(dir);
+    StorageOptions options;
+    options.durability = mode;
+    options.syncInterval = std::chrono::seconds(1);
+
+    FileManager manager(files, options);
+    std::vector<size_t> remaining(blockCount / blocksPerPiece, blocksPerPiece);
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t index : order) {
+      manager.write(index * kBlockSize, block);
+      size_t piece = index / blocksPerPiece;
+      if (--remaining[piece] == 0) {
+        manager.onRangeComplete(piece * kPieceSize, kPieceSize);
+      }
+    }
+    double writeSeconds = std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+
+    auto syncStart = std::chrono::steady_clock::now();
+    manager.syncAll();
+    double syncSeconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - syncStart)
+                             .count();
+
+    printf("%-16s %10.2f %10.2f %10.1f\n", modeName(mode), writeSeconds,
+           syncSeconds, sizeMiB / (writeSeconds + syncSeconds));
+  }
+
+  fs::remove_all(dir);
+  return 0;
+}
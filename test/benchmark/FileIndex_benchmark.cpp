@@ -0,0 +1,105 @@
+// Random 16 KiB block reads on a torrent made of many small files, plus the
+// cost of mapping a byte offset to its file with a linear scan versus the
+// sorted offset index FileManager uses.
+// Usage: FileIndex_benchmark [directory] [file count] [file size in bytes]
+#include "../Utils/FileManager.h"
+#include "FileItem.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace LitTorrent;
+
+namespace {
+
+constexpr size_t kBlockSize = 16384;
+constexpr int kReads = 20000;
+constexpr int kLookups = 200000;
+
+double seconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  fs::path dir = argc > 1 ? fs::path(argv[1])
+                          : fs::temp_directory_path() / "littorrent_index";
+  size_t fileCount = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 20000;
+  size_t fileSize = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 4000;
+  size_t totalSize = fileCount * fileSize;
+
+  std::vector<FileItem> files;
+  files.reserve(fileCount);
+  for (size_t i = 0; i < fileCount; i++) {
+    files.emplace_back(dir / std::to_string(i % 256) / std::to_string(i),
+                       fileSize, static_cast<int64_t>(i * fileSize));
+  }
+
+  // Pure lookup: which file holds a random byte
+  std::mt19937_64 rng(7);
+  std::vector<uint64_t> offsets(kLookups);
+  for (auto &offset : offsets) {
+    offset = rng() % totalSize;
+  }
+
+  size_t checksum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kLookups / 100; i++) {
+    for (size_t f = 0; f < files.size(); f++) {
+      uint64_t begin = files[f].getOffset();
+      if (offsets[i] >= begin && offsets[i] < begin + files[f].getSize()) {
+        checksum += f;
+        break;
+      }
+    }
+  }
+  double linear = seconds(start) / (kLookups / 100);
+
+  std::vector<uint64_t> starts;
+  for (const auto &file : files) {
+    starts.push_back(file.getOffset());
+  }
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kLookups; i++) {
+    checksum += std::upper_bound(starts.begin(), starts.end(), offsets[i]) -
+                starts.begin();
+  }
+  double indexed = seconds(start) / kLookups;
+
+  printf("%zu files of %zu bytes\n", fileCount, fileSize);
+  printf("  offset lookup, linear scan:  %10.1f ns\n", linear * 1e9);
+  printf("  offset lookup, sorted index: %10.1f ns\n", indexed * 1e9);
+
+  // End to end block reads
+  FileManager manager(files);
+  std::vector<uint8_t> chunk(1 << 20, 0x5A);
+  for (size_t offset = 0; offset < totalSize; offset += chunk.size()) {
+    size_t length = std::min(chunk.size(), totalSize - offset);
+    manager.write(offset, ByteSpan(chunk.data(), length));
+  }
+
+  size_t blockCount = totalSize / kBlockSize;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kReads; i++) {
+    checksum += manager.read((rng() % blockCount) * kBlockSize, kBlockSize)[0];
+  }
+  double reads = seconds(start);
+  auto stats = manager.getCacheStats();
+  printf("  random 16 KiB block reads:   %10.0f reads/s\n", kReads / reads);
+  printf("  descriptor cache: %llu hits, %llu misses, %llu evictions\n",
+         static_cast<unsigned long long>(stats.hits),
+         static_cast<unsigned long long>(stats.misses),
+         static_cast<unsigned long long>(stats.evictions));
+  printf("  (checksum %zu)\n", checksum);
+
+  manager.close();
+  fs::remove_all(dir);
+  return 0;
+}
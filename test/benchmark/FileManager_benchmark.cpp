@@ -0,0 +1,92 @@
+// Random 16 KiB block reads through FileManager from 1 to 32 threads, with
+// pread, copies out of a mapping, and zero-copy views of a mapping.
+// Usage: FileManager_benchmark [directory] [file size in MiB]
+#include "../Utils/FileManager.h"
+#include "FileItem.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace LitTorrent;
+
+namespace {
+
+constexpr size_t kBlockSize = 16384;
+constexpr int kReadsPerThread = 4096;
+
+template <typename ReadFn>
+double run(ReadFn readBlock, size_t blockCount, int threadCount) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> readers;
+  for (int t = 0; t < threadCount; t++) {
+    readers.emplace_back([&, t] {
+      std::mt19937_64 rng(t + 1);
+      for (int i = 0; i < kReadsPerThread; i++) {
+        size_t block = rng() % blockCount;
+        if (readBlock(block * kBlockSize) != kBlockSize) {
+          std::abort();
+        }
+      }
+    });
+  }
+  for (auto &reader : readers) {
+    reader.join();
+  }
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  fs::path dir = argc > 1 ? fs::path(argv[1])
+                          : fs::temp_directory_path() / "littorrent_bench";
+  size_t sizeMiB = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 256;
+  size_t totalSize = sizeMiB * 1024 * 1024;
+  size_t blockCount = totalSize / kBlockSize;
+
+  fs::create_directories(dir);
+  std::vector<FileItem> files{FileItem(dir / "read_bench.bin", totalSize, 0)};
+  StorageOptions mmapOptions;
+  mmapOptions.ioMode = IoMode::Mmap;
+  FileManager preadManager(files);
+  FileManager mmapManager(files, mmapOptions);
+
+  // Fill the file so reads hit real data
+  std::vector<uint8_t> block(kBlockSize, 0xA5);
+  for (size_t b = 0; b < blockCount; b++) {
+    preadManager.write(b * kBlockSize, block);
+  }
+
+  auto report = [&](const char *label, auto readBlock) {
+    printf("%s\n%8s %12s %12s\n", label, "threads", "reads/s", "MiB/s");
+    for (int threads : {1, 2, 4, 8, 16, 32}) {
+      double seconds = run(readBlock, blockCount, threads);
+      double reads = static_cast<double>(threads) * kReadsPerThread;
+      printf("%8d %12.0f %12.1f\n", threads, reads / seconds,
+             reads * kBlockSize / seconds / (1024 * 1024));
+    }
+  };
+
+  printf("random %zu KiB reads, %zu MiB file\n", kBlockSize / 1024, sizeMiB);
+  report("pread", [&](size_t start) {
+    return preadManager.read(start, kBlockSize).size();
+  });
+  report("mmap copy", [&](size_t start) {
+    return mmapManager.read(start, kBlockSize).size();
+  });
+  report("mmap view", [&](size_t start) {
+    return mmapManager.view(start, kBlockSize).data.size();
+  });
+
+  preadManager.close();
+  mmapManager.close();
+  fs::remove(dir / "read_bench.bin");
+  return 0;
+}
@@ -0,0 +1,105 @@
+// Measures the torrent write and verification pipeline with the disk taken
+// out of the picture: blocks are written through Torrent::writeBlocks onto
+// the in-memory backend and every piece is hashed. Raw MemoryStorage write
+// bandwidth and plain memcpy are printed alongside for reference.
+// Usage: MemoryStorage_benchmark [MiB=1024] [piece KiB=1024]
+#include "../Utils/MemoryStorage.h"
+#include "../Utils/SHA1.h"
+#include "FileItem.h"
+#include "LitTorrent/Torrent.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace LitTorrent;
+
+namespace {
+
+constexpr size_t kBlockSize = 16384;
+
+template <typename Fn> double timed(Fn fn) {
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  size_t sizeMiB = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1024;
+  size_t pieceSize = (argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1024)
+                     << 10;
+  size_t total = sizeMiB << 20;
+  size_t pieceCount = total / pieceSize;
+
+  // Every piece has the same content, so one hash serves them all
+  std::vector<uint8_t> piece(pieceSize);
+  for (size_t i = 0; i < pieceSize; i++) {
+    piece[i] = static_cast<uint8_t>(i * 31 + 7);
+  }
+  Hash hash = HexToHash(
+      SHA1::computeHash(std::string(piece.begin(), piece.end())));
+
+  printf("%zu MiB, %zu KiB pieces, %zu KiB blocks\n", sizeMiB,
+         pieceSize >> 10, kBlockSize >> 10);
+  printf("%-28s %10s\n", "path", "MiB/s");
+
+  std::vector<uint8_t> target(total);
+  double seconds = timed([&] {
+    for (size_t offset = 0; offset < total; offset += pieceSize) {
+      std::memcpy(target.data() + offset, piece.data(), pieceSize);
+    }
+  });
+  printf("%-28s %10.1f\n", "memcpy", sizeMiB / seconds);
+  target = std::vector<uint8_t>();
+
+  {
+    MemoryStorage storage(total);
+    seconds = timed([&] {
+      for (size_t offset = 0; offset < total; offset += kBlockSize) {
+        storage.write(offset, ByteSpan(piece.data() + offset % pieceSize,
+                                       kBlockSize));
+      }
+    });
+    printf("%-28s %10.1f\n", "MemoryStorage::write", sizeMiB / seconds);
+  }
+
+  StorageOptions options;
+  options.backend = StorageBackend::Memory;
+  auto torrent = std::make_shared<Torrent>(
+      "memory", "memory",
+      std::vector<FileItem>{FileItem("memory/data.bin", total, 0)},
+      std::vector<std::string>{}, static_cast<int>(pieceSize),
+      std::vector<Hash>(pieceCount, hash), static_cast<int>(kBlockSize),
+      false, options);
+  std::atomic<size_t> verified{0};
+  torrent->setPieceVerifiedCallback(
+      [&](int, bool ok) { verified += ok ? 1 : 0; });
+
+  seconds = timed([&] {
+    std::vector<BlockWrite> blocks;
+    for (size_t p = 0; p < pieceCount; p++) {
+      blocks.clear();
+      for (size_t b = 0; b < pieceSize / kBlockSize; b++) {
+        blocks.push_back(BlockWrite{
+            static_cast<int>(p), static_cast<int>(b),
+            ByteSpan(piece.data() + b * kBlockSize, kBlockSize)});
+      }
+      torrent->writeBlocks(blocks);
+    }
+    torrent->waitForVerification();
+  });
+  printf("%-28s %10.1f\n", "Torrent write + verify", sizeMiB / seconds);
+
+  if (verified.load() != pieceCount) {
+    printf("only %zu of %zu pieces verified\n", verified.load(), pieceCount);
+    return 1;
+  }
+  return 0;
+}
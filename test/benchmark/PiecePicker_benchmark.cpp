@@ -0,0 +1,236 @@
+// Swarm simulation for the PiecePicker: a torrent of a million pieces and
+// five thousand peers, a fifth of them seeds, the others holding a random
+// 0.1-2% of the pieces. Once they have joined, rounds of churn follow:
+// HAVE messages, picks for a sparse peer, a half-complete peer and a seed,
+// pieces completing on our side, files of a thousand pieces changing
+// priority, and peers leaving and being replaced. Each kind of event is
+// timed on its own; picks are also timed against a linear scan for the
+// rarest piece, which is what a picker without availability order has to
+// do.
+// Usage: PiecePicker_benchmark [pieces] [peers] [rounds]
+#include "PiecePicker.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace LitTorrent;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double nanosSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::nano>(Clock::now() - start)
+      .count();
+}
+
+// A peer that is not a seed. Its initial pieces are drawn from its own seed
+// so they need not be stored; HAVEs since are kept
+struct Peer {
+  uint32_t seed;
+  int count;
+  std::vector<int32_t> haves;
+};
+
+template <typename Fn> void forEachInitialPiece(const Peer &peer, int pieces,
+                                                Fn &&fn) {
+  std::mt19937 rng(peer.seed);
+  for (int i = 0; i < peer.count; i++) {
+    fn(static_cast<int>(rng() % pieces));
+  }
+}
+
+// Rarest piece the peer has, by looking at every piece
+int linearRarest(const std::vector<int> &availability,
+                 const std::vector<bool> &weHave,
+                 const std::vector<bool> &peerHas) {
+  int best = -1;
+  for (size_t piece = 0; piece < availability.size(); piece++) {
+    if (!weHave[piece] && peerHas[piece] &&
+        (best < 0 || availability[piece] < availability[best])) {
+      best = static_cast<int>(piece);
+    }
+  }
+  return best;
+}
+
+struct Timer {
+  double nanos = 0;
+  long ops = 0;
+  double perOp() const { return ops ? nanos / ops : 0; }
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+  int pieces = argc > 1 ? std::atoi(argv[1]) : 1 << 20;
+  int peerCount = argc > 2 ? std::atoi(argv[2]) : 5000;
+  int rounds = argc > 3 ? std::atoi(argv[3]) : 50;
+  std::mt19937 rng(42);
+
+  auto start = Clock::now();
+  PiecePicker picker(pieces, 1);
+  double buildMs = nanosSince(start) / 1e6;
+
+  // Availability mirrored in a plain array for the linear scan
+  std::vector<int> availability(pieces, 0);
+  std::vector<bool> weHave(pieces, false);
+
+  std::vector<Peer> peers;
+  int seeds = 0;
+  Timer join;
+  auto addPeer = [&](Peer peer) {
+    auto begin = Clock::now();
+    forEachInitialPiece(peer, pieces,
+                        [&](int piece) { picker.incAvailability(piece); });
+    join.nanos += nanosSince(begin);
+    join.ops += peer.count;
+    forEachInitialPiece(peer, pieces,
+                        [&](int piece) { availability[piece]++; });
+    peers.push_back(std::move(peer));
+  };
+  auto newPeer = [&] {
+    double share = 0.001 + 0.019 * std::uniform_real_distribution<>()(rng);
+    return Peer{static_cast<uint32_t>(rng()),
+                static_cast<int>(share * pieces), {}};
+  };
+  for (int i = 0; i < peerCount; i++) {
+    if (i % 5 == 0) {
+      picker.addSeed();
+      seeds++;
+    } else {
+      addPeer(newPeer());
+    }
+  }
+
+  // Peers to pick for: one like the others, one with half the torrent, and
+  // a seed (an empty bitfield)
+  std::vector<bool> sparse(pieces, false);
+  std::vector<bool> half(pieces, false);
+  for (int piece = 0; piece < pieces; piece++) {
+    sparse[piece] = rng() % 100 == 0;
+    half[piece] = rng() % 2 == 0;
+  }
+  picker.addPeer(sparse);
+  picker.addPeer(half);
+  for (int piece = 0; piece < pieces; piece++) {
+    availability[piece] += sparse[piece] + half[piece];
+  }
+  std::vector<bool> all(pieces, true);
+
+  Timer have, pick, complete, prioritize, leave, linear;
+  std::vector<int> order(pieces);
+  for (int i = 0; i < pieces; i++) {
+    order[i] = i;
+  }
+  std::shuffle(order.begin(), order.end(), rng);
+  size_t completed = 0;
+  long picked = 0;
+
+  for (int round = 0; round < rounds; round++) {
+    // HAVE messages from random peers
+    std::vector<std::pair<int, int>> haves(20000);
+    for (auto &message : haves) {
+      message = {static_cast<int>(rng() % peers.size()),
+                 static_cast<int>(rng() % pieces)};
+    }
+    auto begin = Clock::now();
+    for (const auto &message : haves) {
+      picker.incAvailability(message.second);
+    }
+    have.nanos += nanosSince(begin);
+    have.ops += haves.size();
+    for (const auto &message : haves) {
+      peers[message.first].haves.push_back(message.second);
+      availability[message.second]++;
+    }
+
+    // Requests for 16 pieces at a time
+    begin = Clock::now();
+    for (int i = 0; i < 1000; i++) {
+      const auto &peerHas = i % 3 == 0 ? sparse : i % 3 == 1 ? half : all;
+      picked += picker.pick(i % 3 == 2 ? std::vector<bool>() : peerHas, 16)
+                    .size();
+    }
+    pick.nanos += nanosSince(begin);
+    pick.ops += 1000;
+
+    begin = Clock::now();
+    for (int i = 0; i < 3; i++) {
+      picked += linearRarest(availability, weHave, half) >= 0;
+    }
+    linear.nanos += nanosSince(begin);
+    linear.ops += 3;
+
+    // Pieces of ours completing: started, then verified
+    size_t first = completed;
+    begin = Clock::now();
+    for (int i = 0; i < 200 && completed < order.size(); i++, completed++) {
+      picker.setPartial(order[completed], true);
+      picker.setHave(order[completed], true);
+    }
+    complete.nanos += nanosSince(begin);
+    complete.ops += completed - first;
+    for (size_t i = first; i < completed; i++) {
+      weHave[order[i]] = true;
+    }
+
+    // A file of 1024 pieces raised to High, and another skipped and
+    // brought back
+    int file = static_cast<int>(rng() % (pieces / 1024)) * 1024;
+    begin = Clock::now();
+    for (int piece = file; piece < file + 1024; piece++) {
+      picker.setPriority(piece, DownloadPriority::High);
+    }
+    for (int piece = file; piece < file + 1024; piece++) {
+      picker.setPriority(piece, DownloadPriority::Skip);
+    }
+    for (int piece = file; piece < file + 1024; piece++) {
+      picker.setPriority(piece, DownloadPriority::Normal);
+    }
+    prioritize.nanos += nanosSince(begin);
+    prioritize.ops += 3 * 1024;
+
+    // Two peers leave and are replaced
+    for (int i = 0; i < 2; i++) {
+      size_t index = rng() % peers.size();
+      Peer gone = std::move(peers[index]);
+      peers[index] = std::move(peers.back());
+      peers.pop_back();
+      begin = Clock::now();
+      forEachInitialPiece(gone, pieces,
+                          [&](int piece) { picker.decAvailability(piece); });
+      for (int32_t piece : gone.haves) {
+        picker.decAvailability(piece);
+      }
+      leave.nanos += nanosSince(begin);
+      leave.ops += gone.count + gone.haves.size();
+      forEachInitialPiece(gone, pieces,
+                          [&](int piece) { availability[piece]--; });
+      for (int32_t piece : gone.haves) {
+        availability[piece]--;
+      }
+      addPeer(newPeer());
+    }
+  }
+
+  printf("%d pieces, %d peers (%d seeds), %d rounds, %zu pieces completed\n",
+         pieces, peerCount, seeds, rounds, completed);
+  printf("build %.1f ms, %ld pieces picked\n", buildMs, picked);
+  printf("%-28s %12s %12s\n", "event", "count", "ns each");
+  auto row = [](const char *name, const Timer &timer) {
+    printf("%-28s %12ld %12.1f\n", name, timer.ops, timer.perOp());
+  };
+  row("availability +1 (join)", join);
+  row("availability +1 (HAVE)", have);
+  row("availability -1 (leave)", leave);
+  row("piece completed", complete);
+  row("piece priority changed", prioritize);
+  row("pick 16", pick);
+  row("linear scan for 1", linear);
+  return 0;
+}
@@ -0,0 +1,135 @@
+// Seeding workload through the read cache: peers ask for whole pieces,
+// block by block, with piece popularity following a Zipf distribution,
+// while one peer streams through the torrent from start to end. Compares
+// uncached 16 KiB reads with the cache at several budgets, reporting
+// throughput, hit rate and storage reads.
+// Usage: ReadCache_benchmark [directory] [file size in MiB] [piece KiB]
+#include "../Utils/FileManager.h"
+#include "FileItem.h"
+#include "ReadCache.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace LitTorrent;
+
+namespace {
+
+constexpr size_t kBlockSize = 16384;
+constexpr int kThreads = 8;
+constexpr int kPiecesPerThread = 512;
+
+// Piece indices drawn with probability proportional to 1 / (rank + 1)
+std::vector<size_t> zipfPieces(size_t pieceCount, size_t count,
+                               uint64_t seed) {
+  std::vector<double> weights(pieceCount);
+  for (size_t i = 0; i < pieceCount; i++) {
+    weights[i] = 1.0 / (i + 1);
+  }
+  std::discrete_distribution<size_t> distribution(weights.begin(),
+                                                  weights.end());
+  std::mt19937_64 rng(seed);
+  std::vector<size_t> pieces(count);
+  for (auto &piece : pieces) {
+    // Spread the popular pieces over the file
+    piece = (distribution(rng) * 7919) % pieceCount;
+  }
+  return pieces;
+}
+
+template <typename ReadFn>
+double run(ReadFn readBlock, size_t pieceCount, size_t pieceSize) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> peers;
+  for (int t = 0; t < kThreads; t++) {
+    peers.emplace_back([&, t] {
+      // Thread 0 streams; the others follow popularity
+      auto pieces = zipfPieces(pieceCount, kPiecesPerThread, t + 1);
+      for (int i = 0; i < kPiecesPerThread; i++) {
+        size_t piece = t == 0 ? i % pieceCount : pieces[i];
+        for (size_t offset = 0; offset < pieceSize; offset += kBlockSize) {
+          if (readBlock(piece * pieceSize + offset) != kBlockSize) {
+            std::abort();
+          }
+        }
+      }
+    });
+  }
+  for (auto &peer : peers) {
+    peer.join();
+  }
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  fs::path dir = argc > 1 ? fs::path(argv[1])
+                          : fs::temp_directory_path() / "littorrent_bench";
+  size_t sizeMiB = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 256;
+  size_t pieceSize = (argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 256)
+                     << 10;
+  size_t totalSize = sizeMiB << 20;
+  size_t pieceCount = totalSize / pieceSize;
+
+  fs::create_directories(dir);
+  std::vector<FileItem> files{FileItem(dir / "cache_bench.bin", totalSize, 0)};
+  FileManager storage(files);
+  std::vector<uint8_t> block(kBlockSize, 0xA5);
+  for (size_t offset = 0; offset < totalSize; offset += kBlockSize) {
+    storage.write(offset, block);
+  }
+  auto pool = BufferPool::create({kBlockSize, pieceSize});
+  double requests = static_cast<double>(kThreads) * kPiecesPerThread *
+                    (pieceSize / kBlockSize);
+
+  printf("%zu MiB, %zu KiB pieces, %d peers\n", sizeMiB, pieceSize >> 10,
+         kThreads);
+  printf("%-16s %10s %10s %14s\n", "cache", "MiB/s", "hit rate",
+         "storage reads");
+
+  std::atomic<uint64_t> reads{0};
+  double seconds = run(
+      [&](size_t start) {
+        BlockBuffer buffer = pool->acquire(kBlockSize);
+        storage.readv({ReadSlice{start, buffer.data(), kBlockSize}});
+        reads++;
+        return buffer.size();
+      },
+      pieceCount, pieceSize);
+  printf("%-16s %10.1f %10s %14llu\n", "none",
+         requests * kBlockSize / seconds / (1 << 20), "-",
+         static_cast<unsigned long long>(reads.load()));
+
+  for (size_t budgetMiB : {4, 16, 64}) {
+    reads = 0;
+    auto budget = std::make_shared<CacheBudget>(budgetMiB << 20);
+    ReadCache cache(budget, pool, pieceSize, totalSize, kBlockSize, 0,
+                    [&](uint64_t start, BlockBuffer &buffer) {
+                      storage.readv(
+                          {ReadSlice{start, buffer.data(), buffer.size()}});
+                      reads++;
+                    });
+    seconds = run(
+        [&](size_t start) { return cache.read(start, kBlockSize).size(); },
+        pieceCount, pieceSize);
+    char label[32];
+    snprintf(label, sizeof(label), "ARC %zu MiB", budgetMiB);
+    printf("%-16s %10.1f %9.1f%% %14llu\n", label,
+           requests * kBlockSize / seconds / (1 << 20),
+           cache.getStats().hitRate() * 100,
+           static_cast<unsigned long long>(reads.load()));
+  }
+
+  storage.close();
+  fs::remove(dir / "cache_bench.bin");
+  return 0;
+}
@@ -0,0 +1,109 @@
+// Recheck of a partly downloaded torrent in a sparse file: a tenth of the
+// pieces, spread over the file, is written, then the torrent is rechecked
+// reading every piece with 1, 2, 4, ... threads up to one per core, and
+// once skipping the holes. The written data is still in the page cache, so
+// the times are mostly hashing; on a cold disk the reads of the holes
+// would add to them.
+// Usage: Recheck_benchmark [directory] [file size in MiB] [piece KiB]
+#include "../Utils/SHA1.h"
+#include "FileItem.h"
+#include "LitTorrent/Torrent.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace LitTorrent;
+
+namespace {
+
+constexpr int kBlockSize = 16384;
+
+std::vector<uint8_t> pieceContent(size_t piece, size_t pieceSize) {
+  std::vector<uint8_t> data(pieceSize);
+  std::mt19937 rng(static_cast<uint32_t>(piece));
+  for (auto &byte : data) {
+    byte = static_cast<uint8_t>(rng());
+  }
+  return data;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  fs::path dir = argc > 1 ? fs::path(argv[1])
+                          : fs::temp_directory_path() / "littorrent_bench";
+  size_t sizeMiB = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1024;
+  size_t pieceSize = (argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1024)
+                     << 10;
+  size_t totalSize = sizeMiB << 20;
+  size_t pieceCount = totalSize / pieceSize;
+
+  // Every tenth piece is downloaded; the others expect data never written
+  std::vector<Hash> hashes(pieceCount);
+  for (size_t piece = 0; piece < pieceCount; piece++) {
+    if (piece % 10 == 0) {
+      auto data = pieceContent(piece, pieceSize);
+      hashes[piece] =
+          HexToHash(SHA1::computeHash(std::string(data.begin(), data.end())));
+    } else {
+      hashes[piece][0] = 1;
+    }
+  }
+
+  fs::create_directories(dir);
+  fs::path path = dir / "recheck_bench.bin";
+  fs::remove(path);
+  std::vector<FileItem> files{FileItem(path, totalSize, 0)};
+  auto torrent = std::make_shared<Torrent>(
+      "recheck", dir.string(), files, std::vector<std::string>{},
+      static_cast<int>(pieceSize), hashes, kBlockSize);
+  torrent->ensureFilesExist();
+  for (size_t piece = 0; piece < pieceCount; piece += 10) {
+    auto data = pieceContent(piece, pieceSize);
+    for (size_t offset = 0; offset < pieceSize; offset += kBlockSize) {
+      torrent->writeBlock(static_cast<int>(piece),
+                          static_cast<int>(offset / kBlockSize),
+                          ByteSpan(data.data() + offset, kBlockSize));
+    }
+  }
+  torrent->waitForVerification();
+
+  printf("%zu MiB, %zu KiB pieces, %d verified\n", sizeMiB, pieceSize >> 10,
+         torrent->getVerifiedPieceCount());
+  printf("%-12s %8s %10s %10s %10s %10s\n", "mode", "threads", "seconds",
+         "MiB/s", "hashed MiB", "skipped");
+  auto run = [&](bool skipHoles, unsigned threads) {
+    RecheckOptions options;
+    options.skipHoles = skipHoles;
+    options.threads = threads;
+    auto start = std::chrono::steady_clock::now();
+    RecheckResult result = torrent->recheck(options);
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    if (result.verifiedPieces != torrent->getVerifiedPieceCount()) {
+      std::abort();
+    }
+    printf("%-12s %8u %10.3f %10.1f %10llu %10d\n",
+           skipHoles ? "skip holes" : "read all", threads, seconds,
+           sizeMiB / seconds,
+           static_cast<unsigned long long>(result.bytesHashed >> 20),
+           result.skippedPieces);
+  };
+
+  unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned threads = 1; threads < cores; threads *= 2) {
+    run(false, threads);
+  }
+  run(false, cores);
+  run(true, cores);
+
+  torrent.reset();
+  fs::remove(path);
+  return 0;
+}
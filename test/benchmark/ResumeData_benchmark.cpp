@@ -0,0 +1,70 @@
+// Cost of resume data for a large seed: builds the state of a torrent with
+// every piece verified and some partial ones, then times encoding, the
+// atomic save, loading and decoding. The default is 20 TiB in 4 MiB pieces.
+// Usage: ResumeData_benchmark [TiB=20] [piece MiB=4] [directory]
+#include "Define.h"
+#include "ResumeData.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace LitTorrent;
+
+namespace {
+
+template <typename Fn> double timed(Fn fn) {
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  uint64_t sizeTiB = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20;
+  uint64_t pieceSize = (argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 4)
+                       << 20;
+  fs::path dir = argc > 3 ? fs::path(argv[3])
+                          : fs::temp_directory_path() / "littorrent_bench";
+  fs::create_directories(dir);
+  fs::path path = dir / "bench.resume";
+
+  ResumeData data;
+  data.totalSize = sizeTiB << 40;
+  data.pieceSize = static_cast<int>(pieceSize);
+  data.blockSize = 16384;
+  size_t pieceCount = (data.totalSize + pieceSize - 1) / pieceSize;
+  data.verified.assign(pieceCount, true);
+  size_t blocksPerPiece = pieceSize / data.blockSize;
+  for (size_t piece = 0; piece < pieceCount; piece += pieceCount / 64) {
+    data.verified[piece] = false;
+    data.partial[static_cast<int>(piece)] =
+        std::vector<bool>(blocksPerPiece, true);
+  }
+  for (int file = 0; file < 10000; file++) {
+    data.files.push_back(ResumeFileState{data.totalSize / 10000,
+                                         1700000000000000000 + file});
+  }
+
+  printf("%llu TiB, %zu pieces, %zu files\n",
+         static_cast<unsigned long long>(sizeTiB), pieceCount,
+         data.files.size());
+  ByteArray bytes;
+  double encode = timed([&] { bytes = data.encode(); });
+  double save = timed([&] { data.save(path); });
+  ResumeData loaded;
+  double load = timed([&] { loaded = ResumeData::load(path); });
+  double decode = timed([&] { ResumeData::decode(bytes); });
+
+  printf("%-10s %10zu bytes\n", "size", bytes.size());
+  printf("%-10s %10.1f ms\n", "encode", encode * 1000);
+  printf("%-10s %10.1f ms\n", "save", save * 1000);
+  printf("%-10s %10.1f ms\n", "load", load * 1000);
+  printf("%-10s %10.1f ms\n", "decode", decode * 1000);
+
+  fs::remove(path);
+  return loaded.verified == data.verified ? 0 : 1;
+}
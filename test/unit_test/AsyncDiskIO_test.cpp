@@ -0,0 +1,217 @@
+#include "../Utils/AsyncDiskIO.h"
+#include "../Utils/FileManager.h"
+#include "TorrentTestFixture.h"
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cerrno>
+#include <mutex>
+#include <vector>
+
+using namespace LitTorrent;
+
+class AsyncDiskIOTest : public TorrentTestFixture {
+protected:
+  static constexpr int kPieceCount = 4;
+
+  std::vector<FileItem> files;
+
+  void SetUp() override { setUpTorrentData("async_disk_io_test", kPieceCount); }
+
+  // Lays out files of the given sizes back to back
+  void makeFiles(const std::vector<size_t> &sizes) {
+    size_t offset = 0;
+    for (size_t i = 0; i < sizes.size(); i++) {
+      files.emplace_back(testDir / ("file" + std::to_string(i)), sizes[i],
+                         offset);
+      offset += sizes[i];
+    }
+  }
+
+  static SharedBuffer patternBuffer(size_t start, size_t count) {
+    auto data = std::make_shared<std::vector<uint8_t>>(count);
+    for (size_t i = 0; i < count; i++) {
+      (*data)[i] = static_cast<uint8_t>(((start + i) * 2654435761u) >> 13);
+    }
+    return data;
+  }
+};
+
+TEST_F(AsyncDiskIOTest, WritesAndReadsAcrossFiles) {
+  makeFiles({10000, 3, 20000});
+  FileManager manager(files);
+  AsyncDiskIO io(manager, 8, 4096);
+
+  // Chunks straddle both file boundaries
+  const size_t total = 30003;
+  const size_t chunk = 3000;
+  std::atomic<int> writeErrors{0};
+  for (size_t start = 0; start < total; start += chunk) {
+    io.write(start, patternBuffer(start, std::min(chunk, total - start)),
+             [&](int error) { writeErrors += error != 0; });
+  }
+  io.waitIdle();
+  EXPECT_EQ(writeErrors.load(), 0);
+
+  // Small reads use registered buffers, large ones heap buffers
+  for (size_t count : {size_t(100), size_t(4096), size_t(20000)}) {
+    std::vector<uint8_t> result;
+    int readError = -1;
+    io.read(9990, count, [&](int error, ByteSpan data) {
+      readError = error;
+      result.assign(data.begin(), data.end());
+    });
+    io.waitIdle();
+    EXPECT_EQ(readError, 0);
+    EXPECT_EQ(result, *patternBuffer(9990, count)) << count << " bytes";
+  }
+
+  EXPECT_EQ(manager.read(0, total), *patternBuffer(0, total));
+  auto stats = io.getStats();
+  EXPECT_EQ(stats.submitted, stats.completed);
+}
+
+TEST_F(AsyncDiskIOTest, MoreRequestsThanQueueDepthAllComplete) {
+  makeFiles({4096 * 64});
+  FileManager manager(files);
+  manager.write(0, *patternBuffer(0, 4096 * 64));
+  AsyncDiskIO io(manager, 4, 4096);
+
+  std::atomic<int> ok{0};
+  for (int round = 0; round < 8; round++) {
+    for (size_t block = 0; block < 64; block++) {
+      io.read(block * 4096, 4096, [&, block](int error, ByteSpan data) {
+        auto expected = patternBuffer(block * 4096, 4096);
+        if (error == 0 &&
+            std::equal(data.begin(), data.end(), expected->begin())) {
+          ok++;
+        }
+      });
+    }
+  }
+  io.waitIdle();
+  EXPECT_EQ(ok.load(), 8 * 64);
+}
+
+TEST_F(AsyncDiskIOTest, CallbacksMayQueueFurtherRequests) {
+  makeFiles({4096 * 16});
+  FileManager manager(files);
+  AsyncDiskIO io(manager, 2, 4096);
+
+  std::atomic<int> chained{0};
+  std::function<void(int)> next = [&](int error) {
+    if (error == 0 && ++chained < 16) {
+      size_t block = static_cast<size_t>(chained.load());
+      io.write(block * 4096, patternBuffer(block * 4096, 4096), next);
+    }
+  };
+  io.write(0, patternBuffer(0, 4096), next);
+
+  // Each follow-up is queued before its predecessor stops counting as
+  // active, so waitIdle covers the whole chain
+  io.waitIdle();
+  EXPECT_EQ(chained.load(), 16);
+  EXPECT_EQ(manager.read(0, 4096 * 16), *patternBuffer(0, 4096 * 16));
+}
+
+TEST_F(AsyncDiskIOTest, ThreadFallbackCoalescesQueuedRequests) {
+  makeFiles({40000, 3, 50000});
+  FileManager manager(files);
+  AsyncDiskIO io(manager, 4, 4096, false);
+  EXPECT_FALSE(io.usingIoUring());
+
+  const size_t total = 90003;
+  std::atomic<int> errors{0};
+  for (size_t start = 0; start < total; start += 4096) {
+    io.write(start, patternBuffer(start, std::min<size_t>(4096, total - start)),
+             [&](int error) { errors += error != 0; });
+  }
+  io.waitIdle();
+
+  std::vector<uint8_t> result(total);
+  for (size_t start = 0; start < total; start += 4096) {
+    io.read(start, std::min<size_t>(4096, total - start),
+            [&, start](int error, ByteSpan data) {
+              errors += error != 0;
+              std::copy(data.begin(), data.end(), result.begin() + start);
+            });
+  }
+  io.waitIdle();
+
+  EXPECT_EQ(errors.load(), 0);
+  EXPECT_EQ(result, *patternBuffer(0, total));
+  // However the requests were batched, no batch needed a call per request
+  auto stats = manager.getIoStats();
+  EXPECT_EQ(stats.slices, 2u * ((total + 4095) / 4096));
+  EXPECT_LE(stats.calls, stats.slices);
+}
+
+TEST_F(AsyncDiskIOTest, ReadingMissingFileReportsError) {
+  makeFiles({100});
+  FileManager manager(files);
+  AsyncDiskIO io(manager);
+
+  int readError = 0;
+  io.read(0, 10, [&](int error, ByteSpan) { readError = error; });
+  io.waitIdle();
+  EXPECT_EQ(readError, ENOENT);
+}
+
+TEST_F(AsyncDiskIOTest, RequestsAfterStopAreCancelled) {
+  makeFiles({100});
+  FileManager manager(files);
+  AsyncDiskIO io(manager);
+  io.stop();
+
+  int writeError = 0;
+  io.write(0, patternBuffer(0, 10), [&](int error) { writeError = error; });
+  EXPECT_EQ(writeError, ECANCELED);
+}
+
+TEST_F(AsyncDiskIOTest, TorrentAsyncBlocksCompleteAndVerifyPieces) {
+  auto torrent = makeTorrent();
+
+  std::atomic<int> verified{0};
+  torrent->setPieceVerifiedCallback([&](int, bool ok) { verified += ok; });
+
+  std::atomic<int> writeErrors{0};
+  for (int piece = 0; piece < kPieceCount; piece++) {
+    for (int blk = 0; blk < kBlocksPerPiece; blk++) {
+      ByteSpan bytes = block(piece, blk);
+      auto data = std::make_shared<std::vector<uint8_t>>(bytes.begin(),
+                                                         bytes.end());
+      torrent->writeBlockAsync(piece, blk, data,
+                               [&](int error) { writeErrors += error != 0; });
+    }
+  }
+
+  // Block completions are asynchronous; poll until all pieces are in
+  for (int i = 0; i < 1000 && verified.load() < kPieceCount; i++) {
+    torrent->waitForVerification();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(writeErrors.load(), 0);
+  EXPECT_EQ(verified.load(), kPieceCount);
+
+  std::mutex mutex;
+  std::vector<uint8_t> read;
+  std::atomic<bool> done{false};
+  torrent->readBlockAsync(2, 1, [&](int error, ByteSpan data) {
+    std::lock_guard<std::mutex> lock(mutex);
+    EXPECT_EQ(error, 0);
+    read.assign(data.begin(), data.end());
+    done = true;
+  });
+  for (int i = 0; i < 1000 && !done; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  EXPECT_EQ(read, std::vector<uint8_t>(block(2, 1).begin(),
+                                       block(2, 1).end()));
+}
+
+// Main function
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,130 @@
+#include "BlockStateTable.h"
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace LitTorrent;
+
+TEST(BlockStateTableTest, LastPieceHasItsOwnBlockCount) {
+  BlockStateTable table(3, 4, 2);
+  EXPECT_EQ(table.getBlockCount(0), 4);
+  EXPECT_EQ(table.getBlockCount(2), 2);
+  EXPECT_EQ(table.getRemainingBlocks(2), 2);
+
+  EXPECT_FALSE(table.markAcquired(2, 0));
+  EXPECT_TRUE(table.markAcquired(2, 1));
+  EXPECT_TRUE(table.isPieceComplete(2));
+  EXPECT_FALSE(table.isPieceComplete(1));
+}
+
+TEST(BlockStateTableTest, DuplicateBlocksDoNotCompleteTwice) {
+  BlockStateTable table(1, 2, 2);
+  EXPECT_FALSE(table.markAcquired(0, 0));
+  EXPECT_FALSE(table.markAcquired(0, 0));
+  EXPECT_EQ(table.getRemainingBlocks(0), 1);
+  EXPECT_TRUE(table.markAcquired(0, 1));
+  EXPECT_FALSE(table.markAcquired(0, 1));
+  EXPECT_EQ(table.getRemainingBlocks(0), 0);
+}
+
+TEST(BlockStateTableTest, ResetPieceRestoresAllBlocks) {
+  BlockStateTable table(2, 3, 3);
+  for (int b = 0; b < 3; b++) {
+    table.markAcquired(1, b);
+  }
+  ASSERT_TRUE(table.isPieceComplete(1));
+
+  table.resetPiece(1);
+  EXPECT_EQ(table.getRemainingBlocks(1), 3);
+  EXPECT_FALSE(table.isAcquired(1, 0));
+
+  table.markPieceAcquired(1);
+  EXPECT_TRUE(table.isPieceComplete(1));
+  EXPECT_TRUE(table.isAcquired(1, 2));
+}
+
+// 16 writers hammer overlapping random blocks; each piece must be reported
+// complete exactly once and the final state must be fully acquired
+TEST(BlockStateTableTest, ConcurrentWritersCompleteEachPieceOnce) {
+  const int pieceCount = 512;
+  const int blocksPerPiece = 16;
+  const int threadCount = 16;
+  BlockStateTable table(pieceCount, blocksPerPiece, 5);
+
+  std::vector<std::atomic<int>> completions(pieceCount);
+  std::vector<std::thread> writers;
+  for (int t = 0; t < threadCount; t++) {
+    writers.emplace_back([&, t] {
+      std::mt19937 rng(t);
+      std::vector<std::pair<int, int>> blocks;
+      for (int p = 0; p < pieceCount; p++) {
+        for (int b = 0; b < table.getBlockCount(p); b++) {
+          blocks.emplace_back(p, b);
+        }
+      }
+      std::shuffle(blocks.begin(), blocks.end(), rng);
+      for (const auto &[p, b] : blocks) {
+        if (table.markAcquired(p, b)) {
+          completions[p]++;
+        }
+      }
+    });
+  }
+  for (auto &writer : writers) {
+    writer.join();
+  }
+
+  for (int p = 0; p < pieceCount; p++) {
+    EXPECT_EQ(completions[p].load(), 1) << "piece " << p;
+    EXPECT_EQ(table.getRemainingBlocks(p), 0);
+  }
+}
+
+// Resetting a completed piece while writers re-send its blocks must never
+// produce a completion unless every block is actually present
+TEST(BlockStateTableTest, ResetRacingWithWritersNeverCompletesEarly) {
+  const int blocksPerPiece = 8;
+  for (int round = 0; round < 200; round++) {
+    BlockStateTable table(1, blocksPerPiece, blocksPerPiece);
+    table.markPieceAcquired(0);
+
+    std::atomic<bool> go{false};
+    std::atomic<int> completions{0};
+    std::thread resetter([&] {
+      while (!go) {
+      }
+      table.resetPiece(0);
+    });
+    std::thread writer([&] {
+      while (!go) {
+      }
+      for (int b = 0; b < blocksPerPiece; b += 2) {
+        if (table.markAcquired(0, b)) {
+          bool allPresent = true;
+          for (int i = 0; i < blocksPerPiece; i++) {
+            allPresent &= table.isAcquired(0, i);
+          }
+          EXPECT_TRUE(allPresent);
+          completions++;
+        }
+      }
+    });
+    go = true;
+    resetter.join();
+    writer.join();
+
+    // Odd blocks were never re-sent, so the piece cannot be complete
+    EXPECT_EQ(completions.load(), 0);
+    EXPECT_FALSE(table.isPieceComplete(0));
+  }
+}
+
+// Main function
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
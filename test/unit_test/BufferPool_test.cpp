@@ -0,0 +1,136 @@
+#include "LitTorrent/BufferPool.h"
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using namespace LitTorrent;
+
+TEST(BufferPoolTest, RequestsGetTheSmallestClassThatFits) {
+  auto pool = BufferPool::create({1 << 20, 16384});
+
+  auto block = pool->acquire(16384);
+  auto tail = pool->acquire(100);
+  auto piece = pool->acquire(300000);
+  EXPECT_EQ(block.size(), 16384u);
+  EXPECT_EQ(tail.size(), 100u);
+  EXPECT_EQ(piece.size(), 300000u);
+  EXPECT_TRUE(piece.pooled());
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(block.data()) % 4096, 0u);
+
+  auto stats = pool->getStats();
+  ASSERT_EQ(stats.classes.size(), 2u);
+  EXPECT_EQ(stats.classes[0].bufferSize, 16384u);
+  EXPECT_EQ(stats.classes[0].inUse, 2u);
+  EXPECT_EQ(stats.classes[1].inUse, 1u);
+  EXPECT_EQ(stats.bytesInUse, 2 * 16384u + (1u << 20));
+}
+
+TEST(BufferPoolTest, ReleasedBuffersAreReusedWithoutClearing) {
+  auto pool = BufferPool::create({16384});
+  uint8_t *first;
+  {
+    auto buffer = pool->acquire(16384);
+    std::memset(buffer.data(), 0xAB, buffer.size());
+    first = buffer.data();
+  }
+
+  auto again = pool->acquire(16384);
+  EXPECT_EQ(again.data(), first);
+  EXPECT_EQ(again[0], 0xAB);
+  EXPECT_EQ(again[16383], 0xAB);
+
+  auto stats = pool->getStats();
+  EXPECT_EQ(stats.slabs, 1u);
+  EXPECT_EQ(stats.acquired, 2u);
+  EXPECT_EQ(stats.classes[0].inUse, 1u);
+}
+
+TEST(BufferPoolTest, CopiesAndSubrangesShareTheBuffer) {
+  auto pool = BufferPool::create({16384});
+  BlockBuffer copy;
+  BlockBuffer tail;
+  {
+    auto buffer = pool->acquire(16384);
+    buffer[10000] = 7;
+    copy = buffer;
+    tail = buffer.subrange(10000, 6384);
+  }
+  EXPECT_EQ(tail.size(), 6384u);
+  EXPECT_EQ(tail[0], 7);
+  EXPECT_EQ(tail.data(), copy.data() + 10000);
+  EXPECT_EQ(pool->getStats().classes[0].inUse, 1u);
+
+  copy = BlockBuffer();
+  EXPECT_EQ(pool->getStats().classes[0].inUse, 1u);
+  tail = BlockBuffer();
+  EXPECT_EQ(pool->getStats().classes[0].inUse, 0u);
+  EXPECT_EQ(pool->getStats().bytesInUse, 0u);
+}
+
+TEST(BufferPoolTest, OversizedAndOverBudgetRequestsUseTheHeap) {
+  // Room for a single slab of 16 KiB buffers
+  auto pool = BufferPool::create({16384}, false, size_t(2) << 20);
+  auto large = pool->acquire(20000);
+  EXPECT_FALSE(large.pooled());
+  EXPECT_EQ(large.size(), 20000u);
+
+  std::vector<BlockBuffer> held;
+  size_t perSlab = (size_t(2) << 20) / 16384;
+  for (size_t i = 0; i < perSlab; i++) {
+    held.push_back(pool->acquire(16384));
+    EXPECT_TRUE(held.back().pooled());
+  }
+  auto overflow = pool->acquire(16384);
+  EXPECT_FALSE(overflow.pooled());
+
+  auto stats = pool->getStats();
+  EXPECT_EQ(stats.slabs, 1u);
+  EXPECT_EQ(stats.heapBuffers, 2u);
+  EXPECT_EQ(stats.bytesReserved, size_t(2) << 20);
+}
+
+TEST(BufferPoolTest, BuffersOutliveThePool) {
+  auto pool = BufferPool::create({16384}, true);
+  auto buffer = pool->acquire(16384);
+  pool.reset();
+
+  std::memset(buffer.data(), 1, buffer.size());
+  EXPECT_TRUE(buffer.pooled());
+}
+
+TEST(BufferPoolTest, ConcurrentAcquireAndRelease) {
+  auto pool = BufferPool::create({16384, 65536});
+  std::vector<std::thread> threads;
+  std::atomic<bool> corrupted{false};
+  for (int t = 0; t < 8; t++) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < 2000; i++) {
+        auto buffer = pool->acquire(i % 3 ? 16384 : 65536);
+        std::memset(buffer.data(), t, buffer.size());
+        auto shared = buffer;
+        std::this_thread::yield();
+        if (shared[0] != t || shared[shared.size() - 1] != t) {
+          corrupted = true;
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  auto stats = pool->getStats();
+  EXPECT_FALSE(corrupted.load());
+  EXPECT_EQ(stats.acquired, 16000u);
+  EXPECT_EQ(stats.bytesInUse, 0u);
+  EXPECT_EQ(stats.heapBuffers, 0u);
+}
+
+// Main function
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,298 @@
+#include "LitTorrent/DiskJobScheduler.h"
+#include "Error.h"
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace LitTorrent;
+
+class DiskJobSchedulerTest : public ::testing::Test {
+protected:
+  static constexpr std::array<unsigned, kDiskJobClassCount> kNoLimits{0, 0, 0,
+                                                                       0};
+
+  std::mutex mutex;
+  std::vector<int> order;
+
+  // A job that records its tag when it runs
+  DiskJobScheduler::Job record(int tag) {
+    return [this, tag](DiskJobScheduler::Done done) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        order.push_back(tag);
+      }
+      done();
+    };
+  }
+
+  // Occupies the device's only thread until the returned promise is set
+  static std::promise<void> block(DiskJobScheduler &scheduler,
+                                  uint64_t device = 0) {
+    std::promise<void> gate;
+    auto opened = std::make_shared<std::shared_future<void>>(
+        gate.get_future().share());
+    std::promise<void> started;
+    auto running = started.get_future();
+    scheduler.submit(DiskJobClass::Upload, device, 0,
+                     [opened, &started](DiskJobScheduler::Done done) {
+                       started.set_value();
+                       opened->wait();
+                       done();
+                     });
+    running.wait();
+    return gate;
+  }
+};
+
+TEST_F(DiskJobSchedulerTest, MoreUrgentClassesRunFirst) {
+  DiskJobScheduler scheduler(1, kNoLimits);
+  auto gate = block(scheduler);
+
+  scheduler.submit(DiskJobClass::Recheck, 0, 0, record(3));
+  scheduler.submit(DiskJobClass::HashCheck, 0, 0, record(2));
+  scheduler.submit(DiskJobClass::Write, 0, 0, record(1));
+  scheduler.submit(DiskJobClass::Upload, 0, 0, record(0));
+  gate.set_value();
+  scheduler.waitIdle();
+
+  EXPECT_EQ(order, (std::vector<int>{0, 1, 2, 3}));
+}
+
+TEST_F(DiskJobSchedulerTest, JobsWithinAClassFollowTheElevator) {
+  DiskJobScheduler scheduler(1, kNoLimits);
+  auto gate = block(scheduler);
+
+  for (int position : {50, 10, 70, 30}) {
+    scheduler.submit(DiskJobClass::Write, 0, position, record(position));
+  }
+  gate.set_value();
+  scheduler.waitIdle();
+  EXPECT_EQ(order, (std::vector<int>{10, 30, 50, 70}));
+
+  // The sweep continues upwards from 70 before wrapping around
+  order.clear();
+  auto gate2 = block(scheduler);
+  for (int position : {20, 80, 60}) {
+    scheduler.submit(DiskJobClass::Write, 0, position, record(position));
+  }
+  gate2.set_value();
+  scheduler.waitIdle();
+  EXPECT_EQ(order, (std::vector<int>{80, 20, 60}));
+}
+
+TEST_F(DiskJobSchedulerTest, ClassLimitsLeaveThreadsForUploads) {
+  DiskJobScheduler scheduler(4, {0, 0, 0, 1});
+  std::atomic<int> recheckRunning{0};
+  std::atomic<int> recheckPeak{0};
+
+  for (int i = 0; i < 20; i++) {
+    scheduler.submit(DiskJobClass::Recheck, 0, i,
+                     [&](DiskJobScheduler::Done done) {
+                       int now = ++recheckRunning;
+                       recheckPeak = std::max(recheckPeak.load(), now);
+                       std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                       recheckRunning--;
+                       done();
+                     });
+  }
+
+  // An upload starts while the recheck backlog is still queued
+  std::promise<void> uploaded;
+  auto start = std::chrono::steady_clock::now();
+  scheduler.submit(DiskJobClass::Upload, 0, 0,
+                   [&](DiskJobScheduler::Done done) {
+                     uploaded.set_value();
+                     done();
+                   });
+  uploaded.get_future().wait();
+  auto waited = std::chrono::steady_clock::now() - start;
+
+  EXPECT_LT(waited, std::chrono::milliseconds(50));
+  EXPECT_GT(scheduler.getStats().classes[3].queued, 0u);
+  scheduler.waitIdle();
+  EXPECT_EQ(recheckPeak.load(), 1);
+  EXPECT_EQ(scheduler.getStats().classes[3].completed, 20u);
+}
+
+TEST_F(DiskJobSchedulerTest, AsynchronousJobsHoldTheirSlotUntilDone) {
+  DiskJobScheduler scheduler(2, {0, 1, 0, 0});
+  std::promise<DiskJobScheduler::Done> firstStarted;
+  std::atomic<bool> secondRan{false};
+
+  scheduler.submit(DiskJobClass::Write, 0, 0,
+                   [&](DiskJobScheduler::Done done) {
+                     firstStarted.set_value(done); // finishes later
+                   });
+  scheduler.submit(DiskJobClass::Write, 0, 1,
+                   [&](DiskJobScheduler::Done done) {
+                     secondRan = true;
+                     done();
+                   });
+
+  auto finishFirst = firstStarted.get_future().get();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_FALSE(secondRan.load());
+  EXPECT_EQ(scheduler.getStats().classes[1].running, 1u);
+
+  std::thread([finishFirst] { finishFirst(); }).join();
+  scheduler.waitIdle();
+  EXPECT_TRUE(secondRan.load());
+}
+
+TEST_F(DiskJobSchedulerTest, RunWaitsAndPropagatesExceptions) {
+  DiskJobScheduler scheduler(2, kNoLimits);
+  int value = 0;
+  scheduler.run(DiskJobClass::HashCheck, 0, 0, [&] { value = 42; });
+  EXPECT_EQ(value, 42);
+
+  EXPECT_THROW(scheduler.run(DiskJobClass::HashCheck, 0, 0,
+                             [] { throw std::runtime_error("read failed"); }),
+               std::runtime_error);
+  scheduler.waitIdle();
+}
+
+TEST_F(DiskJobSchedulerTest, StopCancelsQueuedJobs) {
+  DiskJobScheduler scheduler(1, kNoLimits);
+  auto gate = block(scheduler);
+
+  std::atomic<int> ran{0};
+  std::atomic<int> cancelled{0};
+  for (int i = 0; i < 5; i++) {
+    scheduler.submit(
+        DiskJobClass::Recheck, 0, i,
+        [&](DiskJobScheduler::Done done) {
+          ran++;
+          done();
+        },
+        [&] { cancelled++; });
+  }
+
+  std::thread stopper([&] { scheduler.stop(); });
+  // Stopping cancels the queue first, then waits for the running job
+  for (int i = 0; i < 1000 && cancelled.load() < 5; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  gate.set_value();
+  stopper.join();
+
+  EXPECT_EQ(ran.load(), 0);
+  EXPECT_EQ(cancelled.load(), 5);
+  EXPECT_THROW(scheduler.run(DiskJobClass::Upload, 0, 0, [] {}),
+               TorrentException);
+}
+
+TEST_F(DiskJobSchedulerTest, RemovingAnOwnerCancelsOnlyItsJobs) {
+  DiskJobScheduler scheduler(1, kNoLimits);
+  uint64_t leaving = scheduler.addOwner();
+  uint64_t staying = scheduler.addOwner();
+  auto gate = block(scheduler);
+
+  std::atomic<int> cancelled{0};
+  scheduler.submit(DiskJobClass::Write, 0, 0, record(1),
+                   [&] { cancelled++; }, leaving);
+  scheduler.submit(DiskJobClass::Write, 0, 1, record(2),
+                   [&] { cancelled++; }, staying);
+  scheduler.removeOwner(leaving);
+  EXPECT_EQ(cancelled.load(), 1);
+
+  // The removed owner's later jobs never run; the other's still do
+  scheduler.submit(DiskJobClass::Write, 0, 2, record(3),
+                   [&] { cancelled++; }, leaving);
+  EXPECT_EQ(cancelled.load(), 2);
+  EXPECT_THROW(scheduler.run(DiskJobClass::Upload, 0, 0, [] {}, leaving),
+               TorrentException);
+  gate.set_value();
+  scheduler.waitIdle();
+  EXPECT_EQ(order, (std::vector<int>{2}));
+}
+
+TEST_F(DiskJobSchedulerTest, RemoveOwnerWaitsForItsRunningJobs) {
+  DiskJobScheduler scheduler(2, kNoLimits);
+  uint64_t owner = scheduler.addOwner();
+  std::promise<DiskJobScheduler::Done> started;
+  scheduler.submit(
+      DiskJobClass::Write, 0, 0,
+      [&](DiskJobScheduler::Done done) { started.set_value(done); }, nullptr,
+      owner);
+  DiskJobScheduler::Done done = started.get_future().get();
+
+  std::atomic<bool> removed{false};
+  std::thread remover([&] {
+    scheduler.removeOwner(owner);
+    removed = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_FALSE(removed.load());
+  done();
+  remover.join();
+  EXPECT_TRUE(removed.load());
+}
+
+TEST_F(DiskJobSchedulerTest, OwnersOnADeviceShareItsQueue) {
+  DiskJobScheduler scheduler(1, kNoLimits);
+  uint64_t first = scheduler.addOwner();
+  uint64_t second = scheduler.addOwner();
+  auto gate = block(scheduler, 7);
+
+  // Each owner's jobs are swept together, in offset order
+  scheduler.submit(DiskJobClass::Write, 7, 30, record(13), nullptr, first);
+  scheduler.submit(DiskJobClass::Write, 7, 10, record(21), nullptr, second);
+  scheduler.submit(DiskJobClass::Write, 7, 10, record(11), nullptr, first);
+  scheduler.submit(DiskJobClass::Write, 7, 20, record(22), nullptr, second);
+  gate.set_value();
+  scheduler.waitIdle();
+
+  EXPECT_EQ(order, (std::vector<int>{11, 13, 21, 22}));
+  auto stats = scheduler.getStats();
+  ASSERT_EQ(stats.devices.size(), 1u);
+  EXPECT_EQ(stats.devices[0].device, 7u);
+  EXPECT_EQ(stats.devices[0].completed, 5u);
+}
+
+TEST_F(DiskJobSchedulerTest, DevicesHaveTheirOwnQueues) {
+  DiskJobScheduler scheduler(1, kNoLimits);
+  auto gate = block(scheduler, 1);
+
+  // Device 1's only thread is stuck; device 2 carries on regardless
+  scheduler.submit(DiskJobClass::Write, 1, 0, record(1));
+  std::promise<void> ran;
+  scheduler.submit(DiskJobClass::Write, 2, 0,
+                   [&](DiskJobScheduler::Done done) {
+                     std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                     ran.set_value();
+                     done();
+                   });
+  EXPECT_EQ(ran.get_future().wait_for(std::chrono::seconds(5)),
+            std::future_status::ready);
+
+  auto stats = scheduler.getStats();
+  ASSERT_EQ(stats.devices.size(), 2u);
+  EXPECT_EQ(stats.devices[0].device, 1u);
+  EXPECT_EQ(stats.devices[0].running, 1u);
+  EXPECT_EQ(stats.devices[0].queued, 1u);
+  EXPECT_EQ(stats.classes[1].queued, 1u);
+
+  gate.set_value();
+  scheduler.waitIdle();
+  EXPECT_EQ(order, (std::vector<int>{1}));
+
+  stats = scheduler.getStats();
+  EXPECT_EQ(stats.devices[0].completed, 2u);
+  EXPECT_EQ(stats.devices[1].device, 2u);
+  EXPECT_EQ(stats.devices[1].completed, 1u);
+  EXPECT_GE(stats.devices[1].averageLatencyUs, 2000.0);
+  EXPECT_GE(stats.devices[1].maxLatencyUs, stats.devices[1].averageLatencyUs);
+  EXPECT_EQ(stats.devices[0].queued + stats.devices[0].running, 0u);
+}
+
+// Main function
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,569 @@
+#include "../Utils/FileManager.h"
+#include "Error.h"
+#include "FileItem.h"
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <fstream>
+#include <random>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace LitTorrent;
+
+class FileManagerTest : public ::testing::Test {
+protected:
+  static constexpr size_t kBlockSize = 16384;
+
+  fs::path testDir;
+  std::vector<FileItem> files;
+
+  void SetUp() override {
+    testDir = fs::temp_directory_path() / "file_manager_test";
+    fs::remove_all(testDir);
+    fs::create_directories(testDir);
+  }
+
+  void TearDown() override { fs::remove_all(testDir); }
+
+  // Lays out files of the given sizes back to back
+  void makeFiles(const std::vector<size_t> &sizes) {
+    size_t offset = 0;
+    for (size_t i = 0; i < sizes.size(); i++) {
+      files.emplace_back(testDir / ("file" + std::to_string(i)), sizes[i],
+                         offset);
+      offset += sizes[i];
+    }
+  }
+
+  static StorageOptions withMaxOpenFiles(size_t maxOpenFiles) {
+    StorageOptions options;
+    options.maxOpenFiles = maxOpenFiles;
+    return options;
+  }
+
+  // Windows of a single page so small files span several of them
+  static StorageOptions withMmap(size_t windowSize = 4096) {
+    StorageOptions options;
+    options.ioMode = IoMode::Mmap;
+    options.mmapWindowSize = windowSize;
+    return options;
+  }
+
+  static StorageOptions withDirectIo() {
+    StorageOptions options;
+    options.ioMode = IoMode::Direct;
+    return options;
+  }
+
+  static StorageOptions withAllocation(AllocationMode mode) {
+    StorageOptions options;
+    options.allocation = mode;
+    return options;
+  }
+
+  static uint64_t allocatedBytes(const fs::path &path) {
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0 ? uint64_t(st.st_blocks) * 512 : 0;
+  }
+
+  static uint8_t pattern(size_t offset) {
+    return static_cast<uint8_t>((offset * 2654435761u) >> 13);
+  }
+};
+
+TEST_F(FileManagerTest, ReadBackWhatWasWrittenAcrossFiles) {
+  makeFiles({1000, 5000, 10});
+  FileManager manager(files);
+
+  std::vector<uint8_t> data(6010);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = pattern(i);
+  }
+  manager.write(0, data);
+
+  EXPECT_EQ(manager.read(0, data.size()), data);
+  auto middle = manager.read(990, 20);
+  EXPECT_EQ(middle, std::vector<uint8_t>(data.begin() + 990,
+                                         data.begin() + 1010));
+  EXPECT_EQ(fs::file_size(testDir / "file1"), 5000u);
+}
+
+TEST_F(FileManagerTest, EmptyFilesAreSkipped) {
+  makeFiles({10, 0, 0, 10, 0});
+  FileManager manager(files);
+
+  std::vector<uint8_t> data(20);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = pattern(i);
+  }
+  manager.write(0, data);
+  EXPECT_EQ(manager.read(5, 10),
+            std::vector<uint8_t>(data.begin() + 5, data.begin() + 15));
+  EXPECT_FALSE(fs::exists(testDir / "file1"));
+}
+
+TEST_F(FileManagerTest, OffsetsBeyond4GiBMapToTheRightFile) {
+  // Only the last file is touched, so nothing large is created on disk
+  const int64_t fourGiB = int64_t(4) << 30;
+  files.emplace_back(testDir / "huge", static_cast<size_t>(fourGiB + 100), 0);
+  files.emplace_back(testDir / "tail", 100, fourGiB + 100);
+  FileManager manager(files);
+
+  std::vector<uint8_t> data(50, 0x7E);
+  manager.write(static_cast<size_t>(fourGiB + 120), data);
+  EXPECT_EQ(manager.read(static_cast<size_t>(fourGiB + 120), 50), data);
+  EXPECT_FALSE(fs::exists(testDir / "huge"));
+}
+
+TEST_F(FileManagerTest, ReadingMissingFileThrows) {
+  makeFiles({100});
+  FileManager manager(files);
+  try {
+    manager.read(0, 10);
+    FAIL() << "Expected TorrentException";
+  } catch (const TorrentException &e) {
+    EXPECT_EQ(e.code(), ErrorCode::FileNotFound);
+  }
+}
+
+TEST_F(FileManagerTest, ReadOnlyHandleIsUpgradedForWrites) {
+  makeFiles({kBlockSize});
+  {
+    std::ofstream create(files[0].getFilePath(), std::ios::binary);
+    create << std::string(kBlockSize, 'x');
+  }
+  FileManager manager(files);
+  EXPECT_EQ(manager.read(0, 1)[0], 'x');
+
+  manager.write(0, std::vector<uint8_t>{'y'});
+  EXPECT_EQ(manager.read(0, 1)[0], 'y');
+}
+
+TEST_F(FileManagerTest, DescriptorCacheIsBoundedAndEvictsLeastRecentlyUsed) {
+  makeFiles({100, 100, 100, 100, 100});
+  FileManager manager(files, withMaxOpenFiles(2));
+
+  std::vector<uint8_t> data(500, 0x11);
+  manager.write(0, data); // Opens all five, keeping only the last two
+  auto stats = manager.getCacheStats();
+  EXPECT_EQ(stats.misses, 5u);
+  EXPECT_EQ(stats.evictions, 3u);
+  EXPECT_EQ(stats.openFiles, 2u);
+  EXPECT_EQ(stats.capacity, 2u);
+
+  // File 4 is cached, file 0 was evicted
+  manager.write(450, std::vector<uint8_t>(10, 0x22));
+  EXPECT_EQ(manager.getCacheStats().hits, 1u);
+  manager.write(0, std::vector<uint8_t>(10, 0x33));
+  stats = manager.getCacheStats();
+  EXPECT_EQ(stats.misses, 6u);
+  EXPECT_EQ(stats.openFiles, 2u);
+
+  auto readBack = manager.read(0, 500);
+  EXPECT_EQ(readBack[0], 0x33);
+  EXPECT_EQ(readBack[200], 0x11);
+  EXPECT_EQ(readBack[455], 0x22);
+  EXPECT_LE(manager.getCacheStats().openFiles, 2u);
+}
+
+TEST_F(FileManagerTest, ShrinkingCapacityClosesDescriptors) {
+  makeFiles({10, 10, 10, 10});
+  FileManager manager(files, withMaxOpenFiles(8));
+  manager.write(0, std::vector<uint8_t>(40, 1));
+  EXPECT_EQ(manager.getCacheStats().openFiles, 4u);
+
+  manager.setMaxOpenFiles(1);
+  auto stats = manager.getCacheStats();
+  EXPECT_EQ(stats.openFiles, 1u);
+  EXPECT_EQ(stats.evictions, 3u);
+
+  manager.close();
+  EXPECT_EQ(manager.getCacheStats().openFiles, 0u);
+}
+
+TEST_F(FileManagerTest, DurabilityModesKeepDataIntact) {
+  makeFiles({kBlockSize * 3, kBlockSize * 3});
+  std::vector<uint8_t> data(kBlockSize * 6);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = pattern(i);
+  }
+
+  for (auto mode : {DurabilityMode::None, DurabilityMode::PieceComplete,
+                    DurabilityMode::Periodic}) {
+    StorageOptions options;
+    options.durability = mode;
+    options.syncInterval = std::chrono::milliseconds(1);
+    options.maxOpenFiles = 1;
+    {
+      FileManager manager(files, options);
+      for (size_t b = 0; b < 6; b++) {
+        manager.write(b * kBlockSize,
+                      ByteSpan(data.data() + b * kBlockSize, kBlockSize));
+      }
+      // Syncing reopens the evicted first file
+      manager.onRangeComplete(0, data.size());
+      manager.syncAll();
+    }
+    FileManager reader(files);
+    EXPECT_EQ(reader.read(0, data.size()), data);
+  }
+}
+
+// Readers and writers share descriptors; each thread owns a disjoint set of
+// blocks and must always read back exactly what it wrote
+TEST_F(FileManagerTest, ConcurrentReadersAndWritersDoNotInterfere) {
+  const size_t blockCount = 256;
+  makeFiles({kBlockSize * blockCount / 4 + 123, kBlockSize * blockCount / 4,
+             kBlockSize * blockCount / 4, kBlockSize * blockCount / 4 - 123});
+  // Fewer descriptors than files so eviction races with in-flight I/O
+  FileManager manager(files, withMaxOpenFiles(2));
+
+  const int threadCount = 8;
+  std::vector<std::thread> threads;
+  std::atomic<int> mismatches{0};
+  for (int t = 0; t < threadCount; t++) {
+    threads.emplace_back([&, t] {
+      std::mt19937 rng(t);
+      std::vector<uint8_t> block(kBlockSize);
+      for (int iter = 0; iter < 200; iter++) {
+        size_t index = t + threadCount * (rng() % (blockCount / threadCount));
+        size_t start = index * kBlockSize;
+        for (size_t i = 0; i < kBlockSize; i++) {
+          block[i] = static_cast<uint8_t>(pattern(start + i) + iter);
+        }
+        manager.write(start, block);
+        if (manager.read(start, kBlockSize) != block) {
+          mismatches++;
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(mismatches.load(), 0);
+}
+
+TEST_F(FileManagerTest, MmapRoundTripAcrossFilesAndWindows) {
+  makeFiles({10000, 3, 20000});
+  FileManager manager(files, withMmap());
+
+  std::vector<uint8_t> data(30003);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = pattern(i);
+  }
+  // Unaligned writes that straddle both windows and files
+  manager.write(0, ByteSpan(data.data(), 4000));
+  manager.write(4000, ByteSpan(data.data() + 4000, 9000));
+  manager.write(13000, ByteSpan(data.data() + 13000, data.size() - 13000));
+
+  EXPECT_EQ(manager.read(0, data.size()), data);
+  EXPECT_EQ(manager.read(9990, 20),
+            std::vector<uint8_t>(data.begin() + 9990, data.begin() + 10010));
+
+  // Data reaches the files themselves, not just the mapping
+  manager.close();
+  FileManager reader(files);
+  EXPECT_EQ(reader.read(0, data.size()), data);
+}
+
+TEST_F(FileManagerTest, MmapViewIsZeroCopyAndOutlivesEviction) {
+  makeFiles({kBlockSize * 4, kBlockSize});
+  StorageOptions options = withMmap(kBlockSize * 2);
+  options.maxOpenFiles = 1;
+  FileManager manager(files, options);
+
+  std::vector<uint8_t> block(kBlockSize);
+  for (size_t i = 0; i < block.size(); i++) {
+    block[i] = pattern(i);
+  }
+  manager.write(kBlockSize, block);
+  manager.write(kBlockSize * 4, block);
+
+  BlockView first = manager.view(kBlockSize, kBlockSize);
+  BlockView second = manager.view(kBlockSize, kBlockSize);
+  EXPECT_EQ(first.data.data(), second.data.data());
+  EXPECT_TRUE(std::equal(block.begin(), block.end(), first.data.begin()));
+
+  // Touching the other file evicts the first one; the view keeps its
+  // window mapped
+  manager.read(kBlockSize * 4, 1);
+  EXPECT_TRUE(std::equal(block.begin(), block.end(), first.data.begin()));
+
+  // A range crossing a window boundary cannot be a single view
+  BlockView copied = manager.view(kBlockSize + 100, kBlockSize);
+  EXPECT_EQ(copied.data.size(), kBlockSize);
+  EXPECT_EQ(copied.data[0], block[100]);
+}
+
+TEST_F(FileManagerTest, MmapFallsBackToPreadForShortFiles) {
+  makeFiles({kBlockSize});
+  {
+    std::ofstream create(files[0].getFilePath(), std::ios::binary);
+    create << std::string(100, 'x');
+  }
+  FileManager manager(files, withMmap());
+
+  // Mapping past end of file would fault, so the read goes through pread
+  EXPECT_EQ(manager.read(0, 100), std::vector<uint8_t>(100, 'x'));
+  EXPECT_THROW(manager.read(0, 200), TorrentException);
+}
+
+// Writes go through pwrite, never a mapping, so a full disk is an error
+// rather than SIGBUS; mapped windows still see them
+TEST_F(FileManagerTest, MmapReadsSeeWritesMadeAfterMapping) {
+  makeFiles({kBlockSize * 2});
+  FileManager manager(files, withMmap(kBlockSize * 2));
+  std::vector<uint8_t> first(kBlockSize, 'a');
+  std::vector<uint8_t> second(kBlockSize, 'b');
+  manager.write(0, first);
+  BlockView view = manager.view(0, kBlockSize);
+  EXPECT_TRUE(std::equal(first.begin(), first.end(), view.data.begin()));
+
+  manager.write(0, second);
+  EXPECT_TRUE(std::equal(second.begin(), second.end(), view.data.begin()));
+  EXPECT_EQ(manager.read(0, kBlockSize), second);
+}
+
+TEST_F(FileManagerTest, VectoredIoCoalescesAdjacentSlicesAcrossFiles) {
+  makeFiles({40000, 3, 50000});
+  FileManager manager(files);
+
+  const size_t total = 90003;
+  std::vector<uint8_t> data(total);
+  for (size_t i = 0; i < total; i++) {
+    data[i] = pattern(i);
+  }
+
+  // Blocks handed over out of order, as they arrive from peers
+  std::vector<WriteSlice> writes;
+  for (size_t start = 0; start < total; start += kBlockSize) {
+    writes.push_back(WriteSlice{
+        start, ByteSpan(data.data() + start,
+                        std::min<size_t>(kBlockSize, total - start))});
+  }
+  std::mt19937 rng(7);
+  std::shuffle(writes.begin(), writes.end(), rng);
+  manager.writev(writes);
+
+  // One run covering three files: one pwritev per file
+  EXPECT_EQ(manager.getIoStats().calls, 3u);
+  EXPECT_EQ(manager.read(0, total), data);
+
+  // Two runs separated by a gap are issued separately
+  std::vector<uint8_t> first(100), second(100);
+  manager.readv({ReadSlice{50000, second.data(), second.size()},
+                 ReadSlice{1000, first.data(), first.size()}});
+  EXPECT_EQ(manager.getIoStats().calls, 5u);
+  EXPECT_EQ(first, std::vector<uint8_t>(data.begin() + 1000,
+                                        data.begin() + 1100));
+  EXPECT_EQ(second, std::vector<uint8_t>(data.begin() + 50000,
+                                         data.begin() + 50100));
+}
+
+TEST_F(FileManagerTest, DeviceExtentsSplitRangesAcrossDevices) {
+  // /dev/shm is a tmpfs on its own device wherever it exists
+  fs::path other = "/dev/shm/file_manager_test";
+  struct stat here, there;
+  if (::stat(testDir.c_str(), &here) != 0 ||
+      ::stat("/dev/shm", &there) != 0 || here.st_dev == there.st_dev) {
+    GTEST_SKIP() << "no second device to spread files over";
+  }
+  fs::remove_all(other);
+  fs::create_directories(other);
+
+  makeFiles({100, 200});
+  files.emplace_back(other / "file2", 300, 300);
+  files.emplace_back(testDir / "file3", 400, 600);
+  FileManager manager(files);
+
+  // Devices are known before the files exist, from their directories
+  auto extents = manager.deviceExtents(50, 800);
+  ASSERT_EQ(extents.size(), 3u);
+  EXPECT_EQ(extents[0].device, uint64_t(here.st_dev));
+  EXPECT_EQ(extents[0].start, 50u);
+  EXPECT_EQ(extents[0].length, 250u);
+  EXPECT_EQ(extents[1].device, uint64_t(there.st_dev));
+  EXPECT_EQ(extents[1].start, 300u);
+  EXPECT_EQ(extents[1].length, 300u);
+  EXPECT_EQ(extents[2].device, uint64_t(here.st_dev));
+  EXPECT_EQ(extents[2].length, 250u);
+
+  manager.allocate();
+  extents = manager.deviceExtents(0, 300);
+  ASSERT_EQ(extents.size(), 1u);
+  EXPECT_EQ(extents[0].length, 300u);
+
+  manager.close();
+  fs::remove_all(other);
+}
+
+TEST_F(FileManagerTest, SparseAllocationReservesNothing) {
+  makeFiles({1 << 20, 0});
+  FileManager manager(files, withAllocation(AllocationMode::Sparse));
+  manager.allocate();
+
+  EXPECT_EQ(fs::file_size(files[0].getFilePath()), 1u << 20);
+  EXPECT_TRUE(fs::exists(files[1].getFilePath()));
+  EXPECT_EQ(allocatedBytes(files[0].getFilePath()), 0u);
+}
+
+TEST_F(FileManagerTest, FullAllocationRunsInBackground) {
+  makeFiles({1 << 20, 3 << 20});
+  FileManager manager(files, withAllocation(AllocationMode::Full));
+  manager.allocate();
+
+  // Files exist at full length right away; blocks follow
+  EXPECT_EQ(fs::file_size(files[1].getFilePath()), 3u << 20);
+  manager.waitForAllocation();
+
+  auto status = manager.getAllocationStatus();
+  EXPECT_FALSE(status.inProgress);
+  EXPECT_TRUE(status.error.empty()) << status.error;
+  if (!status.fallocateSupported) {
+    GTEST_SKIP() << "fallocate not supported on " << testDir;
+  }
+  EXPECT_EQ(status.bytesAllocated, 4u << 20);
+  EXPECT_GE(allocatedBytes(files[0].getFilePath()), 1u << 20);
+  EXPECT_GE(allocatedBytes(files[1].getFilePath()), 3u << 20);
+
+  // Data written after preallocation is intact
+  std::vector<uint8_t> data(100, 0x42);
+  manager.write((1 << 20) - 50, data);
+  EXPECT_EQ(manager.read((1 << 20) - 50, 100), data);
+}
+
+TEST_F(FileManagerTest, OnFirstWriteAllocatesFilesAsTheyAreWritten) {
+  makeFiles({1 << 20, 0, 1 << 20});
+  FileManager manager(files, withAllocation(AllocationMode::OnFirstWrite));
+  manager.allocate();
+
+  EXPECT_FALSE(fs::exists(files[0].getFilePath()));
+  EXPECT_TRUE(fs::exists(files[1].getFilePath()));
+  EXPECT_FALSE(fs::exists(files[2].getFilePath()));
+
+  manager.write(1 << 20, std::vector<uint8_t>(kBlockSize, 0x17));
+  EXPECT_FALSE(fs::exists(files[0].getFilePath()));
+  EXPECT_EQ(fs::file_size(files[2].getFilePath()), 1u << 20);
+  if (manager.getAllocationStatus().fallocateSupported) {
+    EXPECT_GE(allocatedBytes(files[2].getFilePath()), 1u << 20);
+  }
+}
+
+TEST_F(FileManagerTest, DataExtentsSkipHolesAndMissingFiles) {
+  makeFiles({1 << 20, 1 << 20, 1 << 20});
+  FileManager manager(files);
+  EXPECT_TRUE(manager.dataExtents(0, 3 << 20).empty());
+
+  manager.write(0, std::vector<uint8_t>(1, 0)); // creates file 0
+  manager.write(1 << 20, std::vector<uint8_t>(1, 0)); // and file 1
+  auto probe = manager.dataExtents(4096, (1 << 20) - 4096);
+  if (!probe.empty()) {
+    GTEST_SKIP() << "filesystem does not report holes";
+  }
+
+  // Data at 256 KiB, and a run across the boundary of files 0 and 1
+  std::vector<uint8_t> data(64 << 10, 0x5A);
+  manager.write(256 << 10, data);
+  manager.write((1 << 20) - (64 << 10), data);
+  manager.write(1 << 20, data);
+
+  auto extents = manager.dataExtents(64 << 10, (3 << 20) - (64 << 10));
+  ASSERT_EQ(extents.size(), 2u);
+  EXPECT_EQ(extents[0].start, 256u << 10);
+  EXPECT_EQ(extents[0].length, 64u << 10);
+  EXPECT_EQ(extents[1].start, (1u << 20) - (64 << 10));
+  EXPECT_EQ(extents[1].length, 128u << 10);
+
+  // Clipped to the range asked for
+  extents = manager.dataExtents((256 << 10) + 100, 1000);
+  ASSERT_EQ(extents.size(), 1u);
+  EXPECT_EQ(extents[0].start, (256u << 10) + 100);
+  EXPECT_EQ(extents[0].length, 1000u);
+}
+
+// File boundaries at odd offsets leave every block with unaligned edges,
+// and the last file ends inside a block
+TEST_F(FileManagerTest, DirectIoRoundTripAcrossUnalignedFileBoundaries) {
+  makeFiles({5000, 3, 20000, kBlockSize * 3 + 100});
+  FileManager manager(files, withDirectIo());
+  const size_t total = 5000 + 3 + 20000 + kBlockSize * 3 + 100;
+
+  std::vector<uint8_t> data(total);
+  for (size_t i = 0; i < total; i++) {
+    data[i] = pattern(i);
+  }
+  std::vector<size_t> starts;
+  for (size_t start = 0; start < total; start += kBlockSize) {
+    starts.push_back(start);
+  }
+  std::shuffle(starts.begin(), starts.end(), std::mt19937(7));
+  for (size_t start : starts) {
+    size_t count = std::min(kBlockSize, total - start);
+    manager.write(start, ByteSpan(data.data() + start, count));
+  }
+
+  EXPECT_EQ(manager.read(0, total), data);
+  // Unaligned reads within a single file
+  EXPECT_EQ(manager.read(5003 + 4000, 333),
+            std::vector<uint8_t>(data.begin() + 9003, data.begin() + 9336));
+  EXPECT_EQ(fs::file_size(files[3].getFilePath()), kBlockSize * 3 + 100);
+
+  manager.close();
+  FileManager buffered(files);
+  EXPECT_EQ(buffered.read(0, total), data);
+
+  // Descriptors would be the buffered ones, so asynchronous I/O is kept on
+  // the aligned path, unless the filesystem rejected O_DIRECT
+  int probe = ::open(files[0].getFilePath().c_str(), O_RDONLY | O_DIRECT);
+  EXPECT_EQ(manager.hasDescriptors(), probe < 0);
+  EXPECT_TRUE(buffered.hasDescriptors());
+  if (probe >= 0) {
+    ::close(probe);
+  }
+}
+
+// Writers of neighbouring 100-byte ranges share 4 KiB blocks, whose
+// read-modify-write must not lose either side's bytes
+TEST_F(FileManagerTest, DirectIoConcurrentEdgeWritesDoNotLoseData) {
+  const size_t chunk = 100;
+  const size_t total = chunk * 2000;
+  makeFiles({total});
+  FileManager manager(files, withDirectIo());
+
+  const size_t threadCount = 8;
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < threadCount; t++) {
+    threads.emplace_back([&, t] {
+      std::vector<uint8_t> data(chunk);
+      for (size_t start = t * chunk; start < total;
+           start += threadCount * chunk) {
+        for (size_t i = 0; i < chunk; i++) {
+          data[i] = pattern(start + i);
+        }
+        manager.write(start, data);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  auto result = manager.read(0, total);
+  size_t mismatches = 0;
+  for (size_t i = 0; i < total; i++) {
+    mismatches += result[i] != pattern(i);
+  }
+  EXPECT_EQ(mismatches, 0u);
+}
+
+// Main function
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,257 @@
+#include "Error.h"
+#include "PiecePicker.h"
+#include "TorrentTestFixture.h"
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
+#include <set>
+#include <sys/stat.h>
+#include <thread>
+
+using namespace LitTorrent;
+
+class FilePriorityTest : public TorrentTestFixture {
+protected:
+  static constexpr int kPieceCount = 8;
+
+  std::vector<FileItem> files;
+
+  void SetUp() override {
+    setUpTorrentData("file_priority_test", kPieceCount);
+
+    // b.bin starts inside piece 1 and ends inside piece 4, so pieces 2 and
+    // 3 are its alone
+    uint64_t bStart = kPieceSize + 100;
+    uint64_t bEnd = 4 * kPieceSize + 200;
+    files = {FileItem(testDir / "a.bin", bStart, 0),
+             FileItem(testDir / "b.bin", bEnd - bStart, bStart),
+             FileItem(testDir / "c.bin", content.size() - bEnd, bEnd)};
+  }
+
+  std::shared_ptr<Torrent>
+  makeTorrent(const StorageOptions &options = StorageOptions()) {
+    return TorrentTestFixture::makeTorrent(files, options);
+  }
+
+  static uint64_t allocatedOnDisk(const fs::path &path) {
+    struct stat st {};
+    EXPECT_EQ(::stat(path.c_str(), &st), 0) << path;
+    return static_cast<uint64_t>(st.st_blocks) * 512;
+  }
+};
+
+TEST_F(FilePriorityTest, PiecesTakeTheHighestPriorityOfTheirFiles) {
+  auto torrent = makeTorrent();
+  for (int piece = 0; piece < kPieceCount; piece++) {
+    EXPECT_EQ(torrent->getPiecePriority(piece), DownloadPriority::Normal);
+  }
+
+  torrent->setFilePriority(1, DownloadPriority::Skip);
+  torrent->setFilePriority(2, DownloadPriority::Low);
+  EXPECT_EQ(torrent->getFilePriority(1), DownloadPriority::Skip);
+  EXPECT_EQ(torrent->getPiecePriority(0), DownloadPriority::Normal);
+  // Shared with a.bin and c.bin
+  EXPECT_EQ(torrent->getPiecePriority(1), DownloadPriority::Normal);
+  EXPECT_EQ(torrent->getPiecePriority(2), DownloadPriority::Skip);
+  EXPECT_EQ(torrent->getPiecePriority(3), DownloadPriority::Skip);
+  EXPECT_EQ(torrent->getPiecePriority(4), DownloadPriority::Low);
+  EXPECT_EQ(torrent->getPiecePriority(7), DownloadPriority::Low);
+
+  torrent->setFilePriority(1, DownloadPriority::High);
+  EXPECT_EQ(torrent->getPiecePriority(1), DownloadPriority::High);
+  EXPECT_EQ(torrent->getPiecePriority(4), DownloadPriority::High);
+  EXPECT_EQ(torrent->getPiecePriority(5), DownloadPriority::Low);
+
+  EXPECT_THROW(torrent->setFilePriority(3, DownloadPriority::Low),
+               TorrentException);
+  EXPECT_THROW(torrent->setFilePriorities({DownloadPriority::Low}),
+               TorrentException);
+}
+
+TEST_F(FilePriorityTest, PicksFollowPriorities) {
+  auto torrent = makeTorrent();
+  torrent->setFilePriorities({DownloadPriority::Low, DownloadPriority::Skip,
+                              DownloadPriority::High});
+
+  // c.bin's pieces, then a.bin's; pieces 2 and 3 never
+  auto picked = torrent->pickPieces({}, kPieceCount);
+  ASSERT_EQ(picked.size(), 6u);
+  EXPECT_EQ(std::set<int>(picked.begin(), picked.begin() + 4),
+            (std::set<int>{4, 5, 6, 7}));
+  EXPECT_EQ(std::set<int>(picked.begin() + 4, picked.end()),
+            (std::set<int>{0, 1}));
+
+  // Started pieces come first within their priority only
+  torrent->writeBlock(0, 0, ByteSpan(content.data(), kBlockSize));
+  picked = torrent->pickPieces({}, 5);
+  ASSERT_EQ(picked.size(), 5u);
+  EXPECT_EQ(picked[4], 0);
+
+  // A skipped file brought back brings its pieces back
+  torrent->setFilePriority(1, DownloadPriority::Normal);
+  picked = torrent->pickPieces({}, kPieceCount);
+  ASSERT_EQ(picked.size(), 8u);
+  EXPECT_EQ(std::set<int>(picked.begin() + 4, picked.begin() + 7),
+            (std::set<int>{1, 2, 3}));
+  EXPECT_EQ(picked[7], 0);
+}
+
+TEST_F(FilePriorityTest, SkippedFilesAreNotCreated) {
+  for (auto mode : {AllocationMode::Sparse, AllocationMode::OnFirstWrite,
+                    AllocationMode::Full}) {
+    fs::remove_all(testDir);
+    fs::create_directories(testDir);
+    StorageOptions options;
+    options.allocation = mode;
+    auto torrent = makeTorrent(options);
+    torrent->setFilePriority(1, DownloadPriority::Skip);
+    torrent->ensureFilesExist();
+    while (torrent->getAllocationStatus().inProgress) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    EXPECT_FALSE(fs::exists(testDir / "b.bin"));
+    auto status = torrent->getAllocationStatus();
+    EXPECT_TRUE(status.error.empty()) << status.error;
+    if (mode == AllocationMode::Full && status.fallocateSupported) {
+      EXPECT_EQ(status.bytesAllocated,
+                files[0].getSize() + files[2].getSize());
+    }
+    if (mode != AllocationMode::OnFirstWrite) {
+      EXPECT_TRUE(fs::exists(testDir / "a.bin"));
+      EXPECT_TRUE(fs::exists(testDir / "c.bin"));
+    }
+  }
+}
+
+TEST_F(FilePriorityTest, StraddlingPiecesAreStillDownloaded) {
+  StorageOptions options;
+  options.allocation = AllocationMode::OnFirstWrite;
+  auto torrent = makeTorrent(options);
+  torrent->setFilePriority(1, DownloadPriority::Skip);
+  torrent->ensureFilesExist();
+
+  writePiece(*torrent, 1);
+  writePiece(*torrent, 4);
+  torrent->waitForVerification();
+  EXPECT_TRUE(torrent->isPieceVerified(1));
+  EXPECT_TRUE(torrent->isPieceVerified(4));
+
+  // The skipped file holds their bytes without being preallocated
+  ASSERT_TRUE(fs::exists(testDir / "b.bin"));
+  EXPECT_EQ(fs::file_size(testDir / "b.bin"), files[1].getSize());
+  EXPECT_LT(allocatedOnDisk(testDir / "b.bin"), files[1].getSize());
+  auto stored = torrent->readPiece(4);
+  EXPECT_TRUE(std::equal(stored.begin(), stored.end(),
+                         content.begin() + 4 * kPieceSize));
+
+  auto picked = torrent->pickPieces({}, kPieceCount);
+  EXPECT_EQ(std::set<int>(picked.begin(), picked.end()),
+            (std::set<int>{0, 5, 6, 7}));
+
+  // Verified pieces stay out of the order whatever their priority
+  torrent->setFilePriority(1, DownloadPriority::High);
+  picked = torrent->pickPieces({}, 2);
+  EXPECT_EQ(std::set<int>(picked.begin(), picked.end()),
+            (std::set<int>{2, 3}));
+  torrent->setFilePriority(1, DownloadPriority::Skip);
+  torrent->setFilePriority(1, DownloadPriority::Low);
+  picked = torrent->pickPieces({}, kPieceCount);
+  EXPECT_EQ(picked.size(), 6u);
+}
+
+// A million pieces over a thousand files: a change touches the file's own
+// pieces and leaves its neighbours as they were
+TEST_F(FilePriorityTest, ChangesOnALargeTorrentAreLocal) {
+  const int pieceSize = 16384;
+  const int pieceCount = 1 << 20;
+  const uint64_t fileSize = uint64_t(pieceSize) * 1024 + 1000;
+  std::vector<FileItem> large;
+  uint64_t total = uint64_t(pieceSize) * pieceCount;
+  for (uint64_t offset = 0; offset < total; offset += fileSize) {
+    large.emplace_back("f" + std::to_string(large.size()),
+                       std::min(fileSize, total - offset),
+                       static_cast<int64_t>(offset));
+  }
+  StorageOptions options;
+  options.backend = StorageBackend::Memory;
+  Torrent torrent("large", "", large, std::vector<std::string>{}, pieceSize,
+                  std::vector<Hash>(pieceCount), pieceSize, false, options);
+
+  // File 500 runs from inside one piece to inside another
+  size_t file = 500;
+  uint64_t start = static_cast<uint64_t>(large[file].getOffset());
+  int first = static_cast<int>(start / pieceSize);
+  int last = static_cast<int>((start + large[file].getSize() - 1) / pieceSize);
+  ASSERT_NE(start % pieceSize, 0u);
+
+  auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; i < 100; i++) {
+    torrent.setFilePriority(file, DownloadPriority::Skip);
+    torrent.setFilePriority(file, DownloadPriority::High);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - begin;
+  EXPECT_LT(elapsed, std::chrono::seconds(1));
+
+  torrent.setFilePriority(file, DownloadPriority::Skip);
+  EXPECT_EQ(torrent.getPiecePriority(first), DownloadPriority::Normal);
+  EXPECT_EQ(torrent.getPiecePriority(first + 1), DownloadPriority::Skip);
+  EXPECT_EQ(torrent.getPiecePriority(last - 1), DownloadPriority::Skip);
+  EXPECT_EQ(torrent.getPiecePriority(last), DownloadPriority::Normal);
+  torrent.setFilePriority(file + 1, DownloadPriority::Skip);
+  EXPECT_EQ(torrent.getPiecePriority(last), DownloadPriority::Skip);
+  EXPECT_EQ(torrent.getPiecePriority(first - 1), DownloadPriority::Normal);
+
+  // Each skipped file takes the pieces it has to itself, which for the
+  // second starts with the one it shares with the first
+  uint64_t nextEnd = static_cast<uint64_t>(large[file + 1].getOffset()) +
+                     large[file + 1].getSize();
+  int nextLast = static_cast<int>((nextEnd - 1) / pieceSize);
+  auto picked = torrent.pickPieces({}, pieceCount);
+  EXPECT_EQ(picked.size(),
+            size_t(pieceCount - (last - first - 1) - (nextLast - last)));
+}
+
+// The picker on its own: pieces move between priorities one at a time
+TEST(PiecePickerPriorityTest, SetPriorityKeepsAvailabilityOrder) {
+  PiecePicker picker(6, 1);
+  picker.addPeer(std::vector<bool>{true, true, true, true, true, true});
+  picker.addPeer(std::vector<bool>{true, true, true, false, false, false});
+  picker.setPriority(0, DownloadPriority::High);
+  picker.setPriority(5, DownloadPriority::Low);
+  picker.setPriority(4, DownloadPriority::Skip);
+  EXPECT_EQ(picker.getPriority(0), DownloadPriority::High);
+
+  // High, then Normal rarest first, then Low
+  auto picked = picker.pick({}, 6);
+  ASSERT_EQ(picked.size(), 5u);
+  EXPECT_EQ(picked[0], 0);
+  EXPECT_EQ(picked[1], 3);
+  EXPECT_EQ(std::set<int>(picked.begin() + 2, picked.begin() + 4),
+            (std::set<int>{1, 2}));
+  EXPECT_EQ(picked[4], 5);
+
+  // Availability changes follow a piece into its new priority
+  picker.incAvailability(4);
+  picker.setPriority(4, DownloadPriority::High);
+  picker.decAvailability(0);
+  EXPECT_EQ(picker.pick({}, 2), (std::vector<int>{0, 4}));
+
+  // A partial piece at Skip is not picked
+  picker.setPartial(3, true);
+  picker.setPriority(3, DownloadPriority::Skip);
+  picked = picker.pick({}, 6);
+  EXPECT_EQ(std::count(picked.begin(), picked.end(), 3), 0);
+  picker.setHave(3, true);
+  picker.setHave(3, false);
+  picked = picker.pick({}, 6);
+  EXPECT_EQ(picked.size(), 5u);
+  EXPECT_EQ(std::count(picked.begin(), picked.end(), 3), 0);
+}
+
+// Main function
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
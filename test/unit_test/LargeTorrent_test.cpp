@@ -0,0 +1,203 @@
+#include "Error.h"
+#include "FileItem.h"
+#include "LitTorrent/Torrent.h"
+#include "../Utils/SHA1.h"
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+using namespace LitTorrent;
+
+// Torrents past the 32-bit range, on synthetic metadata in memory: 4 TiB in
+// 2M pieces of 2 MiB, of which only the pieces written take any space
+class LargeTorrentTest : public ::testing::Test {
+protected:
+  static constexpr int kPieceSize = 2 << 20;
+  static constexpr int kBlockSize = 16384;
+  static constexpr int kPieceCount = 2 << 20;
+  static constexpr int kBlocksPerPiece = kPieceSize / kBlockSize;
+  // The last piece is short, ending inside its last block
+  static constexpr uint64_t kTotalSize =
+      uint64_t(kPieceSize) * kPieceCount - 100;
+
+  // Pieces at 2 MiB, 4 GiB, 2 TiB and the end of the torrent
+  const std::vector<int> written{1, 2048, kPieceCount / 2, kPieceCount - 1};
+
+  static uint64_t pieceLength(int piece) {
+    return std::min<uint64_t>(kPieceSize,
+                              kTotalSize - uint64_t(kPieceSize) * piece);
+  }
+
+  // Distinct for every piece, so data landing at a wrapped offset shows
+  static std::vector<uint8_t> pieceContent(int piece) {
+    std::vector<uint8_t> data(pieceLength(piece));
+    for (size_t i = 0; i < data.size(); i++) {
+      data[i] = static_cast<uint8_t>((i * 7 + piece * 13 + 1) & 0xFF);
+    }
+    return data;
+  }
+
+  // Pieces not written expect data that is never there
+  std::vector<Hash> makeHashes(int pieceCount) {
+    std::vector<Hash> hashes(pieceCount);
+    for (auto &hash : hashes) {
+      hash[0] = 1;
+    }
+    for (int piece : written) {
+      if (piece < pieceCount) {
+        auto data = pieceContent(piece);
+        hashes[piece] = HexToHash(
+            SHA1::computeHash(std::string(data.begin(), data.end())));
+      }
+    }
+    return hashes;
+  }
+
+  // Four files of 1 TiB, the last one short
+  std::shared_ptr<Torrent> makeTorrent(std::vector<Hash> hashes,
+                                       uint64_t totalSize = kTotalSize) {
+    const uint64_t fileSize = uint64_t(1) << 40;
+    std::vector<FileItem> files;
+    for (uint64_t offset = 0; offset < totalSize; offset += fileSize) {
+      files.emplace_back("large_" + std::to_string(files.size()),
+                         std::min(fileSize, totalSize - offset),
+                         static_cast<int64_t>(offset));
+    }
+    StorageOptions options;
+    options.backend = StorageBackend::Memory;
+    options.memoryChunkSize = kPieceSize;
+    return std::make_shared<Torrent>("large", "", files,
+                                     std::vector<std::string>{}, kPieceSize,
+                                     std::move(hashes), kBlockSize, false,
+                                     options);
+  }
+
+  void writePiece(Torrent &torrent, int piece) {
+    auto data = pieceContent(piece);
+    for (int blk = 0; blk < torrent.getBlockCount(piece); blk++) {
+      torrent.writeBlock(piece, blk,
+                         ByteSpan(data.data() + size_t(blk) * kBlockSize,
+                                  torrent.getBlockSize(piece, blk)));
+    }
+  }
+
+#ifdef __GLIBC__
+  // Heap in use, over every arena and mapped chunk. Unlike resident memory
+  // it does not depend on what earlier tests freed
+  static uint64_t allocatedBytes() {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+  }
+#endif
+};
+
+TEST_F(LargeTorrentTest, GeometryPastFourGiB) {
+  auto torrent = makeTorrent(makeHashes(kPieceCount));
+  EXPECT_EQ(torrent->getTotalSize(), kTotalSize);
+  EXPECT_EQ(torrent->getPieceCount(), kPieceCount);
+  EXPECT_EQ(torrent->getPieceSize(kPieceCount - 2), kPieceSize);
+  EXPECT_EQ(uint64_t(torrent->getPieceSize(kPieceCount - 1)),
+            pieceLength(kPieceCount - 1));
+  EXPECT_EQ(torrent->getBlockCount(kPieceCount - 1), kBlocksPerPiece);
+  EXPECT_EQ(torrent->getBlockSize(kPieceCount - 1, kBlocksPerPiece - 1),
+            kBlockSize - 100);
+  EXPECT_EQ(torrent->getFiles().back().getOffset(), int64_t(3) << 40);
+  EXPECT_EQ(torrent->getDownloaded(), 0u);
+  EXPECT_EQ(torrent->getLeft(), kTotalSize);
+  EXPECT_EQ(torrent->getUploaded(), 0u);
+}
+
+TEST_F(LargeTorrentTest, PiecesPastFourGiBLandAtTheirOffsets) {
+  auto torrent = makeTorrent(makeHashes(kPieceCount));
+  for (int piece : written) {
+    writePiece(*torrent, piece);
+  }
+  torrent->waitForVerification();
+
+  uint64_t downloaded = 0;
+  for (int piece : written) {
+    EXPECT_TRUE(torrent->isPieceVerified(piece)) << piece;
+    auto data = pieceContent(piece);
+    auto stored = torrent->readPiece(piece);
+    ASSERT_EQ(stored.size(), data.size());
+    EXPECT_TRUE(std::equal(data.begin(), data.end(), stored.begin())) << piece;
+    auto block = torrent->readBlock(piece, kBlocksPerPiece - 1);
+    EXPECT_TRUE(std::equal(block.begin(), block.end(),
+                           data.begin() + size_t(kBlocksPerPiece - 1) *
+                                              kBlockSize))
+        << piece;
+    downloaded += data.size();
+  }
+  EXPECT_EQ(torrent->getVerifiedPieceCount(), int(written.size()));
+  EXPECT_EQ(torrent->getDownloaded(), downloaded);
+  EXPECT_EQ(torrent->getDownloadedBytes(), downloaded);
+  EXPECT_EQ(torrent->getLeft(), kTotalSize - downloaded);
+
+  // Nothing wrapped around onto the start of the torrent
+  auto first = torrent->readPiece(0);
+  EXPECT_TRUE(std::all_of(first.begin(), first.end(),
+                          [](uint8_t byte) { return byte == 0; }));
+  EXPECT_FALSE(torrent->isPieceVerified(0));
+}
+
+TEST_F(LargeTorrentTest, RecheckReadsOnlyWrittenPieces) {
+  auto torrent = makeTorrent(makeHashes(kPieceCount));
+  for (int piece : written) {
+    writePiece(*torrent, piece);
+  }
+  torrent->waitForVerification();
+
+  auto result = torrent->recheck();
+  EXPECT_FALSE(result.cancelled);
+  EXPECT_EQ(result.verifiedPieces, int(written.size()));
+  EXPECT_EQ(result.failedPieces, 0);
+  EXPECT_EQ(result.skippedPieces, kPieceCount - int(written.size()));
+  EXPECT_EQ(torrent->getVerifiedPieceCount(), int(written.size()));
+}
+
+// The state kept per piece is a fixed number of bytes, so doubling the piece
+// count doubles the memory and no more
+TEST_F(LargeTorrentTest, MemoryPerPieceIsConstant) {
+#ifdef __GLIBC__
+  auto perPiece = [&](int pieceCount) {
+    uint64_t before = allocatedBytes();
+    auto torrent = makeTorrent(makeHashes(pieceCount),
+                               uint64_t(kPieceSize) * pieceCount);
+    uint64_t after = allocatedBytes();
+    EXPECT_EQ(torrent->getPieceCount(), pieceCount);
+    return double(after - std::min(before, after)) / pieceCount;
+  };
+
+  // The hash, block bitmap and counters: well under 100 bytes a piece
+  double half = perPiece(kPieceCount / 2);
+  double full = perPiece(kPieceCount);
+  EXPECT_LT(full, 96.0);
+  EXPECT_NEAR(full, half, 1.0);
+#else
+  GTEST_SKIP() << "heap statistics need glibc";
+#endif
+}
+
+TEST_F(LargeTorrentTest, TooManyPiecesAreRejected) {
+  // 2^31 pieces of 16 KiB
+  EXPECT_THROW(
+      {
+        std::vector<FileItem> files{
+            FileItem("too_many", uint64_t(kBlockSize) << 31, 0)};
+        StorageOptions options;
+        options.backend = StorageBackend::Memory;
+        Torrent torrent("too many", "", files, std::vector<std::string>{},
+                        kBlockSize, std::vector<Hash>{}, kBlockSize, false,
+                        options);
+      },
+      TorrentException);
+}
+
+// Main function
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,344 @@
+#include "../Utils/MemoryStorage.h"
+#include "../Utils/SHA1.h"
+#include "Error.h"
+#include "FileItem.h"
+#include "LitTorrent/Torrent.h"
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace LitTorrent;
+
+class MemoryStorageTest : public ::testing::Test {
+protected:
+  static uint8_t pattern(size_t offset) {
+    return static_cast<uint8_t>((offset * 2654435761u) >> 13);
+  }
+
+  static std::vector<uint8_t> patternBytes(size_t start, size_t count) {
+    std::vector<uint8_t> data(count);
+    for (size_t i = 0; i < count; i++) {
+      data[i] = pattern(start + i);
+    }
+    return data;
+  }
+
+  // Torrents of four two-block pieces of pattern bytes, laid out under a
+  // directory that the memory backend never creates
+  static constexpr int kPieceSize = 32768;
+  static constexpr int kBlockSize = 16384;
+  static constexpr int kPieceCount = 4;
+
+  fs::path dir = fs::temp_directory_path() / "memory_storage_test";
+  std::vector<uint8_t> content = patternBytes(0, kPieceSize * kPieceCount);
+
+  std::shared_ptr<Torrent>
+  makeTorrent(const std::vector<size_t> &fileSizes,
+              StorageOptions options = StorageOptions()) {
+    std::vector<Hash> hashes;
+    for (int i = 0; i < kPieceCount; i++) {
+      std::string piece(content.begin() + i * kPieceSize,
+                        content.begin() + (i + 1) * kPieceSize);
+      hashes.push_back(HexToHash(SHA1::computeHash(piece)));
+    }
+    std::vector<FileItem> files;
+    size_t offset = 0;
+    for (size_t i = 0; i < fileSizes.size(); i++) {
+      files.emplace_back(dir / ("file" + std::to_string(i)), fileSizes[i],
+                         offset);
+      offset += fileSizes[i];
+    }
+    options.backend = StorageBackend::Memory;
+    auto torrent = std::make_shared<Torrent>(
+        "memory", dir.string(), files, std::vector<std::string>{},
+        kPieceSize, hashes, kBlockSize, false, options);
+    torrent->ensureFilesExist();
+    return torrent;
+  }
+
+  // Write a piece's blocks taken from data, the content by default
+  void writePiece(Torrent &torrent, int piece,
+                  const std::vector<uint8_t> *data = nullptr) {
+    const std::vector<uint8_t> &source = data ? *data : content;
+    for (int blk = 0; blk < kPieceSize / kBlockSize; blk++) {
+      torrent.writeBlock(
+          piece, blk,
+          ByteSpan(source.data() + piece * kPieceSize + blk * kBlockSize,
+                   kBlockSize));
+    }
+  }
+
+  std::vector<uint8_t> contentAt(size_t start, size_t count) const {
+    return std::vector<uint8_t>(content.begin() + start,
+                                content.begin() + start + count);
+  }
+};
+
+TEST_F(MemoryStorageTest, ReadBackAcrossChunks) {
+  MemoryStorage storage(10000, 4096);
+  storage.write(4000, patternBytes(4000, 5000));
+
+  EXPECT_EQ(storage.read(4000, 5000), patternBytes(4000, 5000));
+  // Unwritten bytes read as zeros
+  EXPECT_EQ(storage.read(0, 10), std::vector<uint8_t>(10, 0));
+  EXPECT_EQ(storage.read(9500, 500), std::vector<uint8_t>(500, 0));
+}
+
+TEST_F(MemoryStorageTest, ChunksAreAllocatedOnFirstWrite) {
+  MemoryStorage storage(size_t(64) << 20, 1 << 20);
+  storage.allocate();
+  EXPECT_EQ(storage.stat().size, size_t(64) << 20);
+  EXPECT_EQ(storage.stat().bytesAllocated, 0u);
+
+  // Straddles a chunk boundary
+  storage.write((3 << 20) - 10, std::vector<uint8_t>(20, 1));
+  EXPECT_EQ(storage.stat().bytesAllocated, 2u << 20);
+  storage.read(0, 1 << 20);
+  EXPECT_EQ(storage.stat().bytesAllocated, 2u << 20);
+}
+
+TEST_F(MemoryStorageTest, FullAllocationReservesEverything) {
+  MemoryStorage storage(5000, 1024, AllocationMode::Full);
+  storage.allocate();
+  EXPECT_EQ(storage.stat().bytesAllocated, 5000u);
+  EXPECT_EQ(storage.getAllocationStatus().bytesAllocated, 5000u);
+}
+
+TEST_F(MemoryStorageTest, DataExtentsFollowChunks) {
+  MemoryStorage storage(10 * 4096 + 100, 4096);
+  storage.write(2 * 4096 + 5, std::vector<uint8_t>(4096, 1));
+  storage.write(10 * 4096, std::vector<uint8_t>(1, 1));
+
+  auto extents = storage.dataExtents(100, 10 * 4096);
+  ASSERT_EQ(extents.size(), 2u);
+  EXPECT_EQ(extents[0].start, 2u * 4096);
+  EXPECT_EQ(extents[0].length, 2u * 4096);
+  EXPECT_EQ(extents[1].start, 10u * 4096);
+  EXPECT_EQ(extents[1].length, 100u);
+
+  MemoryStorage full(5000, 1024, AllocationMode::Full);
+  full.allocate();
+  extents = full.dataExtents(0, 5000);
+  ASSERT_EQ(extents.size(), 1u);
+  EXPECT_EQ(extents[0].length, 5000u);
+}
+
+TEST_F(MemoryStorageTest, ViewsPointIntoChunks) {
+  MemoryStorage storage(8192, 4096);
+  storage.write(0, patternBytes(0, 8192));
+
+  BlockView first = storage.view(100, 200);
+  BlockView second = storage.view(100, 200);
+  EXPECT_EQ(first.data.data(), second.data.data());
+  EXPECT_EQ(std::vector<uint8_t>(first.data.begin(), first.data.end()),
+            patternBytes(100, 200));
+
+  // Views across a chunk boundary own a copy
+  BlockView spanning = storage.view(4000, 200);
+  EXPECT_NE(spanning.owner, nullptr);
+  EXPECT_EQ(std::vector<uint8_t>(spanning.data.begin(), spanning.data.end()),
+            patternBytes(4000, 200));
+}
+
+TEST_F(MemoryStorageTest, VectoredIoRoundTrip) {
+  MemoryStorage storage(30000, 4096);
+  auto data = patternBytes(0, 30000);
+  std::vector<WriteSlice> writes;
+  for (size_t start = 0; start < data.size(); start += 7000) {
+    size_t count = std::min<size_t>(7000, data.size() - start);
+    writes.push_back(WriteSlice{start, ByteSpan(data.data() + start, count)});
+  }
+  storage.writev(writes);
+
+  std::vector<uint8_t> result(data.size());
+  storage.readv({ReadSlice{10000, result.data() + 10000, 20000},
+                 ReadSlice{0, result.data(), 10000}});
+  EXPECT_EQ(result, data);
+}
+
+TEST_F(MemoryStorageTest, RangesPastTheEndThrow) {
+  MemoryStorage storage(100);
+  EXPECT_THROW(storage.read(90, 20), TorrentException);
+  EXPECT_THROW(storage.write(101, std::vector<uint8_t>(1)), TorrentException);
+  EXPECT_NO_THROW(storage.read(100, 0));
+}
+
+TEST_F(MemoryStorageTest, ConcurrentWritersShareChunkCreation) {
+  MemoryStorage storage(1 << 20, 1 << 16);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < 8; t++) {
+    threads.emplace_back([&, t] {
+      for (size_t start = t * 1024; start < (1 << 20); start += 8 * 1024) {
+        storage.write(start, patternBytes(start, 1024));
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(storage.read(0, 1 << 20), patternBytes(0, 1 << 20));
+  EXPECT_EQ(storage.stat().bytesAllocated, 1u << 20);
+}
+
+// A torrent on the memory backend verifies pieces without creating files
+TEST_F(MemoryStorageTest, TorrentRunsWithoutTouchingDisk) {
+  fs::remove_all(dir);
+  auto torrent = makeTorrent({50000, 81072});
+
+  std::atomic<int> verified{0};
+  torrent->setPieceVerifiedCallback([&](int, bool ok) { verified += ok; });
+  for (int piece = 0; piece < kPieceCount; piece++) {
+    writePiece(*torrent, piece);
+  }
+  torrent->waitForVerification();
+
+  EXPECT_EQ(verified.load(), kPieceCount);
+  {
+    auto piece = torrent->readPiece(2);
+    EXPECT_EQ(std::vector<uint8_t>(piece.begin(), piece.end()),
+              contentAt(2 * kPieceSize, kPieceSize));
+  }
+  EXPECT_EQ(torrent->getStorageStat().bytesAllocated,
+            uint64_t(kPieceSize) * kPieceCount);
+  EXPECT_FALSE(fs::exists(dir));
+
+  // Asynchronous reads are served by the thread pool
+  std::atomic<bool> done{false};
+  std::vector<uint8_t> block;
+  torrent->readBlockAsync(1, 1, [&](int error, ByteSpan data) {
+    EXPECT_EQ(error, 0);
+    block.assign(data.begin(), data.end());
+    done = true;
+  });
+  for (int i = 0; i < 1000 && !done; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_TRUE(done.load());
+  EXPECT_EQ(block, contentAt(kPieceSize + kBlockSize, kBlockSize));
+
+  // Once warm, reads and pool-buffer writes take no new memory
+  auto before = torrent->getBufferPoolStats();
+  for (int i = 0; i < 100; i++) {
+    auto data = torrent->readBlock(i % kPieceCount, i % 2);
+    EXPECT_TRUE(data.pooled());
+    std::atomic<bool> written{false};
+    torrent->writeBlockAsync(i % kPieceCount, i % 2, data,
+                             [&](int error) {
+                               EXPECT_EQ(error, 0);
+                               written = true;
+                             });
+    for (int wait = 0; wait < 1000 && !written; wait++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  torrent->waitForVerification();
+  auto after = torrent->getBufferPoolStats();
+  EXPECT_EQ(after.slabs, before.slabs);
+  EXPECT_EQ(after.heapBuffers, 0u);
+  EXPECT_GE(after.acquired, before.acquired + 100);
+  ASSERT_EQ(after.classes.size(), 2u);
+  EXPECT_EQ(after.classes[0].bufferSize, size_t(kBlockSize));
+  EXPECT_EQ(after.classes[1].bufferSize, size_t(kPieceSize));
+
+  // Every buffer is back in the pool once the torrent is gone
+  auto pool = torrent->getBufferPool();
+  torrent.reset();
+  EXPECT_EQ(pool->getStats().bytesInUse, 0u);
+}
+
+// With a cache budget, pieces are hashed from memory and only those that
+// pass are written; a corrupt piece leaves storage untouched
+TEST_F(MemoryStorageTest, WriteCacheHashesPiecesInMemory) {
+  StorageOptions options;
+  options.cacheSize = 4 * kPieceSize;
+  auto torrent = makeTorrent({131072}, options);
+
+  std::atomic<int> verified{0};
+  std::atomic<int> failed{0};
+  torrent->setPieceVerifiedCallback([&](int, bool ok) {
+    verified += ok;
+    failed += !ok;
+  });
+  auto corrupt = content;
+  corrupt[3 * kPieceSize + 5] ^= 0xFF;
+  for (int piece = 0; piece < kPieceCount; piece++) {
+    writePiece(*torrent, piece, &corrupt);
+  }
+  torrent->waitForVerification();
+
+  EXPECT_EQ(verified.load(), kPieceCount - 1);
+  EXPECT_EQ(failed.load(), 1);
+  auto stats = torrent->getWriteCacheStats();
+  EXPECT_EQ(stats.hashedInMemory, uint64_t(kPieceCount));
+  EXPECT_EQ(stats.discarded, 1u);
+  EXPECT_EQ(stats.writtenThrough, 0u);
+  EXPECT_EQ(stats.cachedPieces, 0u);
+  {
+    auto piece = torrent->readPiece(1);
+    EXPECT_EQ(std::vector<uint8_t>(piece.begin(), piece.end()),
+              contentAt(kPieceSize, kPieceSize));
+    auto rejected = torrent->readPiece(3);
+    EXPECT_EQ(std::vector<uint8_t>(rejected.begin(), rejected.end()),
+              std::vector<uint8_t>(kPieceSize, 0));
+  }
+
+  // A partial piece is written out when the torrent goes away
+  torrent->writeBlock(3, 0,
+                      ByteSpan(content.data() + 3 * kPieceSize, kBlockSize));
+  EXPECT_EQ(torrent->getWriteCacheStats().cachedPieces, 1u);
+  torrent->flushWriteCache();
+  auto piece = torrent->readBlock(3, 0);
+  EXPECT_EQ(std::vector<uint8_t>(piece.begin(), piece.end()),
+            contentAt(3 * kPieceSize, kBlockSize));
+}
+
+// Blocks of verified pieces are served from the read cache after the first
+// request for their piece; blocks of unverified pieces bypass it
+TEST_F(MemoryStorageTest, ReadCacheServesVerifiedPieces) {
+  StorageOptions options;
+  options.cacheSize = 4 * kPieceSize;
+  auto torrent = makeTorrent({131072}, options);
+  for (int piece = 0; piece < kPieceCount - 1; piece++) {
+    writePiece(*torrent, piece);
+  }
+  torrent->waitForVerification();
+
+  for (int round = 0; round < 3; round++) {
+    for (int piece = 0; piece < kPieceCount - 1; piece++) {
+      for (int block = 0; block < 2; block++) {
+        auto data = torrent->readBlock(piece, block);
+        ASSERT_EQ(std::vector<uint8_t>(data.begin(), data.end()),
+                  contentAt(piece * kPieceSize + block * kBlockSize,
+                            kBlockSize));
+      }
+    }
+  }
+  torrent->readBlock(kPieceCount - 1, 0);
+
+  std::atomic<bool> done{false};
+  torrent->readBlockAsync(2, 1, [&](int error, ByteSpan data) {
+    EXPECT_EQ(error, 0);
+    EXPECT_EQ(std::vector<uint8_t>(data.begin(), data.end()),
+              contentAt(2 * kPieceSize + kBlockSize, kBlockSize));
+    done = true;
+  });
+  for (int i = 0; i < 1000 && !done; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_TRUE(done.load());
+
+  auto stats = torrent->getReadCacheStats();
+  EXPECT_EQ(stats.misses, uint64_t(kPieceCount - 1));
+  EXPECT_EQ(stats.hits,
+            uint64_t(6 * (kPieceCount - 1) - (kPieceCount - 1) + 1));
+  EXPECT_EQ(stats.cachedBytes, size_t(kPieceSize) * (kPieceCount - 1));
+  EXPECT_GT(stats.hitRate(), 0.8);
+}
+
+// Main function
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,267 @@
+#include "Error.h"
+#include "FileItem.h"
+#include "LitTorrent/Torrent.h"
+#include "PiecePicker.h"
+#include "../Utils/SHA1.h"
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
+#include <set>
+#include <vector>
+
+using namespace LitTorrent;
+
+namespace {
+
+std::vector<bool> bitfield(int pieceCount, std::initializer_list<int> pieces) {
+  std::vector<bool> bits(pieceCount, false);
+  for (int piece : pieces) {
+    bits[piece] = true;
+  }
+  return bits;
+}
+
+} // namespace
+
+TEST(PiecePickerTest, RarestPiecesComeFirst) {
+  PiecePicker picker(6, 1);
+  picker.addPeer(bitfield(6, {0, 1, 2, 3, 4, 5}));
+  picker.addPeer(bitfield(6, {0, 1, 2, 3}));
+  picker.addPeer(bitfield(6, {0, 1}));
+  picker.incAvailability(0); // HAVE
+
+  auto picked = picker.pick(bitfield(6, {0, 1, 2, 3, 4, 5}), 6);
+  ASSERT_EQ(picked.size(), 6u);
+  std::set<int> rarest(picked.begin(), picked.begin() + 2);
+  EXPECT_EQ(rarest, (std::set<int>{4, 5}));
+  std::set<int> next(picked.begin() + 2, picked.begin() + 4);
+  EXPECT_EQ(next, (std::set<int>{2, 3}));
+  EXPECT_EQ(picked[4], 1);
+  EXPECT_EQ(picked[5], 0);
+  EXPECT_EQ(picker.getAvailability(0), 4);
+  EXPECT_EQ(picker.getAvailability(5), 1);
+
+  // Only what the peer has, and no more than asked
+  picked = picker.pick(bitfield(6, {0, 1, 3}), 2);
+  EXPECT_EQ(picked, (std::vector<int>{3, 1}));
+}
+
+TEST(PiecePickerTest, PeersLeavingLowerAvailability) {
+  PiecePicker picker(4, 1);
+  auto a = bitfield(4, {0, 1});
+  auto b = bitfield(4, {1, 2, 3});
+  picker.addPeer(a);
+  picker.addPeer(b);
+  picker.addPeer(b);
+  EXPECT_EQ(picker.getAvailability(1), 3);
+
+  picker.removePeer(b);
+  picker.removePeer(b);
+  EXPECT_EQ(picker.getAvailability(1), 1);
+  EXPECT_EQ(picker.getAvailability(2), 0);
+  // Nothing goes below zero
+  picker.decAvailability(2);
+  EXPECT_EQ(picker.getAvailability(2), 0);
+
+  // A peer holding nobody else's pieces can still be served
+  picker.addPeer(bitfield(4, {3}));
+  EXPECT_EQ(picker.pick(bitfield(4, {3}), 4), (std::vector<int>{3}));
+}
+
+TEST(PiecePickerTest, TiesAreBrokenAtRandom) {
+  const int pieceCount = 64;
+  PiecePicker picker(pieceCount, 7);
+  std::vector<bool> all(pieceCount, true);
+  picker.addPeer(all);
+
+  std::set<int> first;
+  for (int i = 0; i < 200; i++) {
+    first.insert(picker.pick(all, 1)[0]);
+  }
+  EXPECT_GT(first.size(), 32u);
+
+  // Two pickers with different seeds order their ties differently
+  PiecePicker other(pieceCount, 8);
+  other.addPeer(all);
+  EXPECT_NE(picker.pick(all, pieceCount), other.pick(all, pieceCount));
+}
+
+TEST(PiecePickerTest, PartialPiecesAreFinishedFirst) {
+  PiecePicker picker(5, 1);
+  picker.addPeer(bitfield(5, {0, 1, 2, 3, 4}));
+  picker.addPeer(bitfield(5, {2, 3}));
+  picker.addPeer(bitfield(5, {3}));
+  picker.setPartial(3, true);
+  picker.setPartial(2, true);
+  EXPECT_EQ(picker.getPartialCount(), 2);
+
+  // The commonest pieces, but started: rarest of them first
+  auto picked = picker.pick(bitfield(5, {0, 1, 2, 3, 4}), 3);
+  ASSERT_EQ(picked.size(), 3u);
+  EXPECT_EQ(picked[0], 2);
+  EXPECT_EQ(picked[1], 3);
+  EXPECT_NE(picked[2], 2);
+  EXPECT_NE(picked[2], 3);
+
+  // Partial pieces the peer lacks are passed over
+  picked = picker.pick(bitfield(5, {0, 3}), 5);
+  EXPECT_EQ(picked, (std::vector<int>{3, 0}));
+
+  picker.setPartial(3, false);
+  EXPECT_FALSE(picker.isPartial(3));
+  EXPECT_EQ(picker.getPartialCount(), 1);
+}
+
+TEST(PiecePickerTest, PiecesWeHaveAreNeverPicked) {
+  PiecePicker picker(4, 1);
+  std::vector<bool> all(4, true);
+  picker.addPeer(all);
+  picker.addPeer(bitfield(4, {0, 1}));
+  picker.setPartial(2, true);
+  picker.setHave(2, true);
+  picker.setHave(0, true);
+  EXPECT_TRUE(picker.have(2));
+  EXPECT_FALSE(picker.isPartial(2));
+  picker.setPartial(2, true);
+  EXPECT_FALSE(picker.isPartial(2));
+
+  // Availability still counts while we hold a piece
+  picker.incAvailability(0);
+  picker.incAvailability(0);
+  EXPECT_EQ(picker.getAvailability(0), 4);
+  auto picked = picker.pick(all, 4);
+  std::set<int> wanted(picked.begin(), picked.end());
+  EXPECT_EQ(wanted, (std::set<int>{1, 3}));
+  EXPECT_EQ(picked[0], 3);
+
+  // A piece found damaged goes back in the order where it belongs
+  picker.setHave(0, false);
+  picker.setHave(2, false);
+  picked = picker.pick(all, 4);
+  ASSERT_EQ(picked.size(), 4u);
+  EXPECT_EQ(picked[3], 0);
+  EXPECT_EQ(picked[2], 1);
+}
+
+TEST(PiecePickerTest, SeedsCountWithoutReordering) {
+  PiecePicker picker(3, 1);
+  picker.addPeer(bitfield(3, {1}));
+  picker.addSeed();
+  picker.addSeed();
+  EXPECT_EQ(picker.getAvailability(0), 2);
+  EXPECT_EQ(picker.getAvailability(1), 3);
+
+  // A seed is served everything, pieces only seeds hold first
+  auto picked = picker.pick({}, 3);
+  ASSERT_EQ(picked.size(), 3u);
+  EXPECT_EQ(picked[2], 1);
+  // Others hold none of those
+  EXPECT_EQ(picker.pick(bitfield(3, {1}), 3), (std::vector<int>{1}));
+
+  picker.removeSeed();
+  picker.removeSeed();
+  picker.removeSeed();
+  EXPECT_EQ(picker.getAvailability(0), 0);
+}
+
+// Random churn against a plain count per piece: every pick walks the
+// wanted pieces in availability order
+TEST(PiecePickerTest, ChurnKeepsTheOrder) {
+  const int pieceCount = 200;
+  PiecePicker picker(pieceCount, 3);
+  std::vector<int> availability(pieceCount, 0);
+  std::vector<bool> have(pieceCount, false);
+  std::mt19937 rng(11);
+
+  for (int step = 0; step < 20000; step++) {
+    int piece = static_cast<int>(rng() % pieceCount);
+    switch (rng() % 8) {
+    case 0:
+    case 1:
+    case 2:
+      picker.incAvailability(piece);
+      availability[piece]++;
+      break;
+    case 3:
+    case 4:
+      picker.decAvailability(piece);
+      availability[piece] = std::max(0, availability[piece] - 1);
+      break;
+    case 5:
+      picker.setHave(piece, !have[piece]);
+      have[piece] = !have[piece];
+      break;
+    default: {
+      auto picked = picker.pick({}, pieceCount);
+      size_t wanted = std::count(have.begin(), have.end(), false);
+      ASSERT_EQ(picked.size(), wanted);
+      for (size_t i = 0; i < picked.size(); i++) {
+        ASSERT_FALSE(have[picked[i]]);
+        ASSERT_EQ(picker.getAvailability(picked[i]),
+                  availability[picked[i]]);
+        if (i > 0) {
+          ASSERT_LE(availability[picked[i - 1]], availability[picked[i]]);
+        }
+      }
+      break;
+    }
+    }
+  }
+}
+
+// The torrent keeps its picker up to date as blocks arrive and pieces
+// verify
+TEST(PiecePickerTest, TorrentPicksWhatItLacks) {
+  const int pieceSize = 32768;
+  const int blockSize = 16384;
+  const int pieceCount = 4;
+  std::vector<uint8_t> content(pieceSize * pieceCount);
+  for (size_t i = 0; i < content.size(); i++) {
+    content[i] = static_cast<uint8_t>(i * 31 + 7);
+  }
+  std::vector<Hash> hashes;
+  for (int i = 0; i < pieceCount; i++) {
+    hashes.push_back(HexToHash(SHA1::computeHash(
+        std::string(content.begin() + i * pieceSize,
+                    content.begin() + (i + 1) * pieceSize))));
+  }
+  StorageOptions options;
+  options.backend = StorageBackend::Memory;
+  std::vector<FileItem> files{FileItem("picker.bin", content.size(), 0)};
+  auto torrent = std::make_shared<Torrent>(
+      "picker", "", files, std::vector<std::string>{}, pieceSize, hashes,
+      blockSize, false, options);
+
+  std::vector<bool> all(pieceCount, true);
+  torrent->addPeerAvailability(all);
+  torrent->addPeerAvailability(bitfield(pieceCount, {0, 1, 3}));
+  torrent->addPieceAvailability(3);
+  EXPECT_EQ(torrent->getPieceAvailability(3), 3);
+  EXPECT_EQ(torrent->pickPieces(all, 1), (std::vector<int>{2}));
+
+  // A piece with a block written is finished first
+  torrent->writeBlock(3, 0, ByteSpan(content.data() + 3 * pieceSize,
+                                     blockSize));
+  EXPECT_EQ(torrent->pickPieces(all, 1), (std::vector<int>{3}));
+
+  torrent->writeBlock(3, 1, ByteSpan(content.data() + 3 * pieceSize +
+                                         blockSize,
+                                     blockSize));
+  torrent->writePiece(2, ByteSpan(content.data() + 2 * pieceSize,
+                                  pieceSize));
+  torrent->waitForVerification();
+  auto picked = torrent->pickPieces(all, pieceCount);
+  EXPECT_EQ(std::set<int>(picked.begin(), picked.end()),
+            (std::set<int>{0, 1}));
+
+  torrent->removePeerAvailability(all);
+  EXPECT_EQ(torrent->getPieceAvailability(0), 1);
+  EXPECT_THROW(torrent->addPieceAvailability(pieceCount), TorrentException);
+}
+
+// Main function
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,113 @@
+#include "PieceVerifier.h"
+#include "../Utils/AtomicBitfield.h"
+#include "../Utils/SHA1.h"
+
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+using namespace LitTorrent;
+
+TEST(AtomicBitfieldTest, SetAndResetReportPreviousValue) {
+  AtomicBitfield bits(130);
+  EXPECT_EQ(bits.size(), 130u);
+  EXPECT_FALSE(bits.test(129));
+
+  EXPECT_FALSE(bits.set(129));
+  EXPECT_TRUE(bits.set(129));
+  EXPECT_TRUE(bits.test(129));
+
+  EXPECT_TRUE(bits.reset(129));
+  EXPECT_FALSE(bits.reset(129));
+  EXPECT_FALSE(bits.test(129));
+}
+
+TEST(AtomicBitfieldTest, RangeOperationsCrossWordBoundaries) {
+  AtomicBitfield bits(1000);
+  EXPECT_EQ(bits.setRange(60, 600), 540u);
+  EXPECT_EQ(bits.setRange(50, 70), 10u);
+  EXPECT_TRUE(bits.test(50));
+  EXPECT_TRUE(bits.test(599));
+  EXPECT_FALSE(bits.test(600));
+
+  EXPECT_EQ(bits.resetRange(0, 1000), 550u);
+  EXPECT_FALSE(bits.test(300));
+}
+
+class PieceVerifierTest : public ::testing::Test {
+protected:
+  static constexpr int64_t kPieceSize = 1024;
+  static constexpr int kPieceCount = 64;
+  // Last piece is 100 bytes short
+  static constexpr int64_t kTotalSize = kPieceSize * kPieceCount - 100;
+
+  std::vector<std::vector<uint8_t>> pieces;
+  std::vector<Hash> hashes;
+
+  void SetUp() override {
+    for (int i = 0; i < kPieceCount; i++) {
+      int64_t length = std::min(kPieceSize, kTotalSize - i * kPieceSize);
+      std::vector<uint8_t> data(length, static_cast<uint8_t>(i));
+      hashes.push_back(
+          HexToHash(SHA1::computeHash(std::string(data.begin(), data.end()))));
+      pieces.push_back(std::move(data));
+    }
+  }
+};
+
+TEST_F(PieceVerifierTest, CountersTrackVerifiedPiecesAndBytes) {
+  PieceVerifier verifier(hashes, kPieceSize, kTotalSize);
+  EXPECT_EQ(verifier.getVerifiedPieceCount(), 0);
+  EXPECT_EQ(verifier.getVerifiedBytes(), 0);
+
+  EXPECT_TRUE(verifier.verify(0, pieces[0]));
+  EXPECT_TRUE(verifier.verify(kPieceCount - 1, pieces[kPieceCount - 1]));
+  EXPECT_EQ(verifier.getVerifiedPieceCount(), 2);
+  EXPECT_EQ(verifier.getVerifiedBytes(), kPieceSize + kPieceSize - 100);
+
+  // Verifying the same piece again does not double count
+  EXPECT_TRUE(verifier.verify(0, pieces[0]));
+  EXPECT_EQ(verifier.getVerifiedPieceCount(), 2);
+
+  // A failed re-verification drops the piece
+  EXPECT_FALSE(verifier.verify(0, pieces[1]));
+  EXPECT_EQ(verifier.getVerifiedPieceCount(), 1);
+  EXPECT_EQ(verifier.getVerifiedBytes(), kPieceSize - 100);
+  EXPECT_FALSE(verifier.isPieceVerified(0));
+
+  verifier.reset();
+  EXPECT_EQ(verifier.getVerifiedPieceCount(), 0);
+  EXPECT_EQ(verifier.getVerifiedBytes(), 0);
+  EXPECT_DOUBLE_EQ(verifier.getProgress(), 0.0);
+}
+
+TEST_F(PieceVerifierTest, ConcurrentVerificationKeepsCountersExact) {
+  PieceVerifier verifier(hashes, kPieceSize, kTotalSize);
+
+  // Every thread verifies every piece; neighbouring bits share words
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; t++) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < kPieceCount; i++) {
+        int piece = (i + t * 7) % kPieceCount;
+        verifier.verify(piece, pieces[piece]);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(verifier.getVerifiedPieceCount(), kPieceCount);
+  EXPECT_EQ(verifier.getVerifiedBytes(), kTotalSize);
+  EXPECT_DOUBLE_EQ(verifier.getProgress(), 100.0);
+
+  auto status = verifier.getVerificationStatus();
+  EXPECT_EQ(std::count(status.begin(), status.end(), true), kPieceCount);
+}
+
+// Main function
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
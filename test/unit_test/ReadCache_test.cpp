@@ -0,0 +1,205 @@
+#include "ReadCache.h"
+#include "WriteCache.h"
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace LitTorrent;
+
+class ReadCacheTest : public ::testing::Test {
+protected:
+  static constexpr size_t kBlock = 16384;
+  static constexpr uint64_t kPiece = 4 * kBlock;
+  static constexpr uint64_t kTotal = 16 * kPiece;
+
+  std::atomic<int> reads_{0};
+  std::mutex mutex_;
+  std::vector<std::pair<uint64_t, size_t>> requests_;
+  std::shared_ptr<BufferPool> pool_ = BufferPool::create({kBlock, kPiece});
+
+  static uint8_t pattern(uint64_t offset) {
+    return static_cast<uint8_t>((offset * 2654435761u) >> 13);
+  }
+
+  std::unique_ptr<ReadCache> makeCache(std::shared_ptr<CacheBudget> budget,
+                                       size_t lineSize = 0) {
+    return std::make_unique<ReadCache>(
+        budget, pool_, kPiece, kTotal, kBlock, lineSize,
+        [this](uint64_t start, BlockBuffer &buffer) {
+          reads_++;
+          {
+            std::lock_guard<std::mutex> lock(mutex_);
+            requests_.emplace_back(start, buffer.size());
+          }
+          for (size_t i = 0; i < buffer.size(); i++) {
+            buffer[i] = pattern(start + i);
+          }
+        });
+  }
+
+  static bool matches(const BlockBuffer &data, uint64_t start) {
+    for (size_t i = 0; i < data.size(); i++) {
+      if (data[i] != pattern(start + i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+TEST_F(ReadCacheTest, FirstRequestReadsTheWholePiece) {
+  auto budget = std::make_shared<CacheBudget>(8 * kPiece);
+  auto cache = makeCache(budget);
+
+  for (int block = 0; block < 4; block++) {
+    uint64_t start = 2 * kPiece + block * kBlock;
+    auto data = cache->read(start, kBlock);
+    ASSERT_EQ(data.size(), kBlock);
+    EXPECT_TRUE(matches(data, start));
+  }
+  EXPECT_EQ(reads_.load(), 1);
+  ASSERT_EQ(requests_.size(), 1u);
+  EXPECT_EQ(requests_[0], std::make_pair(2 * kPiece, size_t(kPiece)));
+
+  auto stats = cache->getStats();
+  EXPECT_EQ(stats.misses, 1u);
+  EXPECT_EQ(stats.hits, 3u);
+  EXPECT_DOUBLE_EQ(stats.hitRate(), 0.75);
+  EXPECT_EQ(stats.cachedBytes, kPiece);
+  EXPECT_EQ(budget->used(), kPiece);
+}
+
+TEST_F(ReadCacheTest, ReadAheadWindowsSplitPieces) {
+  auto budget = std::make_shared<CacheBudget>(8 * kPiece);
+  auto cache = makeCache(budget, kBlock + 1);
+
+  cache->read(kPiece + 3 * kBlock, kBlock);
+  cache->read(kPiece + 2 * kBlock, kBlock);
+  cache->read(kPiece, kBlock);
+  cache->read(kPiece + kBlock, kBlock);
+  ASSERT_EQ(requests_.size(), 2u);
+  EXPECT_EQ(requests_[0], std::make_pair(kPiece + 2 * kBlock, 2 * kBlock));
+  EXPECT_EQ(requests_[1], std::make_pair(kPiece, 2 * kBlock));
+  EXPECT_EQ(cache->getStats().cachedLines, 2u);
+}
+
+// Pieces requested again survive a peer reading everything once
+TEST_F(ReadCacheTest, ScanDoesNotEvictFrequentPieces) {
+  auto budget = std::make_shared<CacheBudget>(4 * kPiece);
+  auto cache = makeCache(budget);
+
+  for (int round = 0; round < 2; round++) {
+    cache->read(0, kBlock);
+    cache->read(kPiece, kBlock);
+  }
+  for (uint64_t piece = 2; piece < 16; piece++) {
+    cache->read(piece * kPiece, kBlock);
+  }
+
+  int before = reads_.load();
+  EXPECT_TRUE(matches(cache->read(0, kBlock), 0));
+  EXPECT_TRUE(matches(cache->read(kPiece + kBlock, kBlock), kPiece + kBlock));
+  EXPECT_EQ(reads_.load(), before);
+  EXPECT_LE(budget->used(), 4 * kPiece);
+  EXPECT_GT(cache->getStats().evictions, 0u);
+}
+
+// A line evicted from the recent list and requested again grows that list
+TEST_F(ReadCacheTest, GhostHitsAdaptTheRecentShare) {
+  auto budget = std::make_shared<CacheBudget>(2 * kPiece);
+  auto cache = makeCache(budget);
+
+  cache->read(0, kBlock);
+  cache->read(kPiece, kBlock);
+  cache->read(2 * kPiece, kBlock);
+  EXPECT_EQ(cache->getStats().recentTargetBytes, 0u);
+  cache->read(0, kBlock);
+
+  auto stats = cache->getStats();
+  EXPECT_EQ(stats.ghostHits, 1u);
+  EXPECT_EQ(stats.recentTargetBytes, kPiece);
+  EXPECT_EQ(stats.misses, 4u);
+}
+
+// Clean lines are given back before the write cache flushes anything
+TEST_F(ReadCacheTest, SharedBudgetEvictsReadsBeforeWrites) {
+  auto budget = std::make_shared<CacheBudget>(3 * kPiece);
+  auto cache = makeCache(budget);
+  int flushes = 0;
+  WriteCache writes(budget, pool_, kPiece, kTotal, kBlock,
+                    [&](std::vector<WriteSlice>) { flushes++; });
+
+  cache->read(0, kBlock);
+  cache->read(kPiece, kBlock);
+  std::vector<uint8_t> block(kBlock, 1);
+  EXPECT_TRUE(writes.insert(5, 0, block));
+  EXPECT_TRUE(writes.insert(6, 0, block));
+  EXPECT_TRUE(writes.insert(7, 0, block));
+  EXPECT_EQ(flushes, 0);
+  EXPECT_EQ(cache->getStats().cachedBytes, 0u);
+  EXPECT_EQ(budget->used(), 3 * kPiece);
+
+  // With only dirty data left, a partial piece is flushed to make room
+  auto data = cache->read(3 * kPiece, kBlock);
+  EXPECT_TRUE(matches(data, 3 * kPiece));
+  EXPECT_EQ(flushes, 1);
+  EXPECT_EQ(cache->getStats().cachedLines, 1u);
+}
+
+TEST_F(ReadCacheTest, PiecesLargerThanTheBudgetAreNotCached) {
+  auto budget = std::make_shared<CacheBudget>(kPiece / 2);
+  auto cache = makeCache(budget);
+
+  EXPECT_TRUE(matches(cache->read(kBlock, kBlock), kBlock));
+  EXPECT_TRUE(matches(cache->read(kBlock, kBlock), kBlock));
+  EXPECT_EQ(reads_.load(), 2);
+  EXPECT_EQ(requests_[0], std::make_pair(uint64_t(kBlock), size_t(kBlock)));
+  EXPECT_EQ(cache->getStats().bypassed, 2u);
+  EXPECT_EQ(budget->used(), 0u);
+}
+
+TEST_F(ReadCacheTest, InvalidateDropsThePiece) {
+  auto budget = std::make_shared<CacheBudget>(8 * kPiece);
+  auto cache = makeCache(budget, kBlock);
+
+  cache->read(kPiece, kBlock);
+  cache->read(kPiece + kBlock, kBlock);
+  cache->read(2 * kPiece, kBlock);
+  cache->invalidate(1);
+  EXPECT_EQ(cache->getStats().cachedLines, 1u);
+  EXPECT_EQ(budget->used(), kBlock);
+
+  cache->read(kPiece, kBlock);
+  EXPECT_EQ(reads_.load(), 4);
+}
+
+TEST_F(ReadCacheTest, ConcurrentRequestsShareOneRead) {
+  auto budget = std::make_shared<CacheBudget>(8 * kPiece);
+  auto cache = makeCache(budget);
+
+  std::atomic<int> bad{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; t++) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < 200; i++) {
+        uint64_t start = ((t + i) % 8) * kPiece + (i % 4) * kBlock;
+        bad += !matches(cache->read(start, kBlock), start);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(bad.load(), 0);
+  EXPECT_EQ(reads_.load(), 8);
+  EXPECT_EQ(cache->getStats().hits, 8u * 200 - 8);
+}
+
+// Main function
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,358 @@
+#include "../Utils/MemoryStorage.h"
+#include "TorrentTestFixture.h"
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+
+using namespace LitTorrent;
+
+class RecheckTest : public TorrentTestFixture {
+protected:
+  static constexpr int kPieceCount = 8;
+
+  void SetUp() override {
+    setUpTorrentData("recheck_test", kPieceCount);
+    // Piece 7 is all zeros
+    std::fill(content.begin() + 7 * kPieceSize, content.end(), 0);
+    hashContent();
+  }
+
+  // Whether the filesystem under the test directory reports holes
+  bool holesReported() {
+    fs::path probe = testDir / "probe";
+    std::vector<FileItem> files{FileItem(probe, 1 << 20, 0)};
+    auto storage = makeStorage(files, StorageOptions());
+    storage->allocate();
+    bool reported = storage->dataExtents(0, 1 << 20).empty();
+    storage->close();
+    fs::remove(probe);
+    return reported;
+  }
+};
+
+// A restarted torrent finds its pieces again, hashing only what is on disk
+TEST_F(RecheckTest, OnlyAllocatedRegionsAreHashed) {
+  if (!holesReported()) {
+    GTEST_SKIP() << "filesystem does not report holes";
+  }
+  {
+    auto torrent = makeTorrent();
+    writePiece(*torrent, 1);
+    writePiece(*torrent, 5);
+    torrent->waitForVerification();
+  }
+
+  auto torrent = makeTorrent();
+  std::atomic<int> reported{0};
+  torrent->setPieceVerifiedCallback([&](int, bool ok) { reported += ok; });
+  auto result = torrent->recheck();
+  EXPECT_FALSE(result.cancelled);
+  EXPECT_EQ(reported.load(), 3);
+  // Piece 7 lies in a hole and is all zeros, so it is intact unread
+  EXPECT_EQ(result.verifiedPieces, 3);
+  EXPECT_EQ(result.failedPieces, 0);
+  EXPECT_EQ(result.skippedPieces, 5);
+  EXPECT_EQ(result.bytesHashed, 2u * kPieceSize);
+  EXPECT_TRUE(torrent->isPieceVerified(1));
+  EXPECT_TRUE(torrent->isPieceVerified(5));
+  EXPECT_TRUE(torrent->isPieceVerified(7));
+  EXPECT_EQ(torrent->getVerifiedPieceCount(), 3);
+
+  // Without skipping, the same state costs a read of everything
+  RecheckOptions readAll;
+  readAll.skipHoles = false;
+  result = torrent->recheck(readAll);
+  EXPECT_EQ(result.verifiedPieces, 3);
+  EXPECT_EQ(result.failedPieces, 5);
+  EXPECT_EQ(result.skippedPieces, 0);
+  EXPECT_EQ(result.bytesHashed, uint64_t(kPieceCount) * kPieceSize);
+  EXPECT_EQ(reported.load(), 3);
+
+  // Pieces found missing download as usual
+  writePiece(*torrent, 0);
+  torrent->waitForVerification();
+  EXPECT_EQ(torrent->getVerifiedPieceCount(), 4);
+}
+
+TEST_F(RecheckTest, DamagedPieceIsDroppedFromTheReadCache) {
+  StorageOptions options;
+  options.cacheSize = 4 * kPieceSize;
+  auto torrent = makeTorrent(options);
+  for (int piece = 0; piece < kPieceCount; piece++) {
+    writePiece(*torrent, piece);
+  }
+  torrent->waitForVerification();
+  ASSERT_EQ(torrent->getVerifiedPieceCount(), kPieceCount);
+  torrent->readBlock(3, 0);
+  EXPECT_EQ(torrent->getReadCacheStats().cachedLines, 1u);
+
+  // Piece 3 lies in b.bin, which starts inside piece 1
+  size_t firstSize = kPieceSize + kBlockSize + 100;
+  {
+    std::fstream file(testDir / "b.bin",
+                      std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(3 * kPieceSize + 10 - firstSize);
+    file.put(static_cast<char>(~content[3 * kPieceSize + 10]));
+  }
+
+  auto result = torrent->recheck();
+  EXPECT_EQ(result.verifiedPieces, kPieceCount - 1);
+  EXPECT_EQ(result.failedPieces, 1);
+  EXPECT_FALSE(torrent->isPieceVerified(3));
+  EXPECT_EQ(torrent->getReadCacheStats().cachedLines, 0u);
+  EXPECT_NE(torrent->readBlock(3, 0)[10], content[3 * kPieceSize + 10]);
+
+  writePiece(*torrent, 3);
+  torrent->waitForVerification();
+  EXPECT_TRUE(torrent->isPieceVerified(3));
+}
+
+// The memory backend's unallocated chunks are holes as well
+TEST_F(RecheckTest, MemoryChunksNeverWrittenAreSkipped) {
+  StorageOptions options;
+  options.backend = StorageBackend::Memory;
+  options.memoryChunkSize = kPieceSize;
+  auto torrent = makeTorrent(options);
+  writePiece(*torrent, 2);
+  torrent->writeBlock(4, 0, block(4, 0));
+  torrent->waitForVerification();
+
+  auto result = torrent->recheck();
+  EXPECT_EQ(result.verifiedPieces, 2);
+  EXPECT_EQ(result.failedPieces, 1);
+  EXPECT_EQ(result.skippedPieces, kPieceCount - 3);
+  EXPECT_EQ(result.bytesHashed, 2u * kPieceSize);
+  EXPECT_TRUE(torrent->isPieceVerified(2));
+  EXPECT_FALSE(torrent->isPieceVerified(4));
+}
+
+TEST_F(RecheckTest, RunsCoverEveryPieceOnceInOrder) {
+  const int pieceCount = 50;
+  const int piecesPerRun = 3;
+  std::mutex mutex;
+  std::vector<std::pair<int, std::thread::id>> order;
+  std::atomic<int> progressCalls{0};
+  RecheckJob job(
+      pieceCount, piecesPerRun, 4,
+      [&](int piece, RecheckResult &tally) {
+        std::lock_guard<std::mutex> lock(mutex);
+        order.emplace_back(piece, std::this_thread::get_id());
+        tally.verifiedPieces++;
+        tally.bytesHashed += piece;
+      },
+      [&](int checked, int total) {
+        EXPECT_LE(checked, total);
+        progressCalls++;
+      });
+  auto result = job.wait();
+
+  EXPECT_FALSE(result.cancelled);
+  EXPECT_EQ(result.verifiedPieces, pieceCount);
+  EXPECT_EQ(result.bytesHashed, uint64_t(pieceCount * (pieceCount - 1) / 2));
+  EXPECT_EQ(progressCalls.load(), pieceCount);
+  EXPECT_TRUE(job.done());
+
+  // Every run went to one thread, which checked it front to back
+  std::map<int, std::thread::id> owner;
+  std::map<int, int> lastInRun;
+  for (const auto &entry : order) {
+    int run = entry.first / piecesPerRun;
+    if (owner.count(run)) {
+      EXPECT_EQ(owner[run], entry.second);
+      EXPECT_EQ(lastInRun[run] + 1, entry.first);
+    }
+    owner[run] = entry.second;
+    lastInRun[run] = entry.first;
+  }
+  EXPECT_EQ(order.size(), size_t(pieceCount));
+}
+
+TEST_F(RecheckTest, CancelFromProgressStopsEarly) {
+  StorageOptions options;
+  options.backend = StorageBackend::Memory;
+  auto torrent = makeTorrent(options);
+  for (int piece = 0; piece < kPieceCount; piece++) {
+    writePiece(*torrent, piece);
+  }
+  torrent->waitForVerification();
+
+  RecheckOptions recheck;
+  recheck.threads = 2;
+  recheck.skipHoles = false;
+  std::atomic<int> calls{0};
+  recheck.progress = [&](int checked, int total) {
+    EXPECT_EQ(total, kPieceCount);
+    EXPECT_FALSE(torrent->startRecheck());
+    calls++;
+    if (checked == 2) {
+      torrent->cancelRecheck();
+    }
+  };
+  auto result = torrent->recheck(recheck);
+  EXPECT_TRUE(result.cancelled);
+  EXPECT_LT(calls.load(), kPieceCount);
+  EXPECT_EQ(result.verifiedPieces, calls.load());
+  // Nothing checked is lost, nothing unchecked is touched
+  EXPECT_EQ(torrent->getVerifiedPieceCount(), kPieceCount);
+
+  // Another check starts once this one is over
+  EXPECT_TRUE(torrent->startRecheck());
+  EXPECT_FALSE(torrent->waitForRecheck().cancelled);
+}
+
+// Blocks keep arriving while the check runs, and pieces completed either
+// way end up verified
+TEST_F(RecheckTest, DownloadContinuesDuringRecheck) {
+  auto torrent = makeTorrent();
+  for (int piece = 0; piece < 4; piece++) {
+    writePiece(*torrent, piece);
+  }
+  torrent->waitForVerification();
+
+  RecheckOptions options;
+  options.threads = 2;
+  options.skipHoles = false;
+  for (int piece = 4; piece < kPieceCount; piece++) {
+    ASSERT_TRUE(torrent->startRecheck(options));
+    writePiece(*torrent, piece);
+    auto result = torrent->waitForRecheck();
+    torrent->waitForVerification();
+    EXPECT_FALSE(result.cancelled);
+    EXPECT_TRUE(torrent->isPieceVerified(piece));
+  }
+  EXPECT_EQ(torrent->getVerifiedPieceCount(), kPieceCount);
+  // Piece 7 is zeros, so a check that reaches it before its blocks finds
+  // the hole intact and the blocks are then dropped as duplicates; only a
+  // check that reads holes counts it
+  auto result = torrent->recheck(options);
+  EXPECT_EQ(result.verifiedPieces, kPieceCount);
+}
+
+// Memory storage that reports the whole torrent as a hole, as a snapshot
+// taken before anything was downloaded would; ranges asked for on their
+// own are reported as they are
+class StaleExtentStorage : public MemoryStorage {
+public:
+  StaleExtentStorage(uint64_t size, size_t chunkSize)
+      : MemoryStorage(size, chunkSize), size_(size) {}
+
+  std::vector<DataExtent> dataExtents(uint64_t start,
+                                      uint64_t count) const override {
+    if (start == 0 && count == size_) {
+      return {};
+    }
+    return MemoryStorage::dataExtents(start, count);
+  }
+
+private:
+  uint64_t size_;
+};
+
+TEST_F(RecheckTest, PiecesVerifiedAfterTheSnapshotAreKept) {
+  StorageOptions options;
+  options.storageFactory = [&](const std::vector<FileItem> &,
+                               const StorageOptions &) {
+    return std::make_unique<StaleExtentStorage>(content.size(), kPieceSize);
+  };
+  auto torrent = makeTorrent(options);
+  for (int piece = 0; piece < 4; piece++) {
+    writePiece(*torrent, piece);
+  }
+  torrent->waitForVerification();
+
+  std::atomic<int> lost{0};
+  torrent->setPieceVerifiedCallback([&](int, bool ok) { lost += !ok; });
+  auto result = torrent->recheck();
+  EXPECT_EQ(lost.load(), 0);
+  // Pieces 0-3 read after all, piece 7 all zeros
+  EXPECT_EQ(result.verifiedPieces, 5);
+  EXPECT_EQ(result.failedPieces, 0);
+  EXPECT_EQ(result.skippedPieces, 3);
+  EXPECT_EQ(torrent->getVerifiedPieceCount(), 5);
+}
+
+// Memory storage whose reads take a while once slowed, counting them
+class SlowReadStorage : public MemoryStorage {
+public:
+  using MemoryStorage::MemoryStorage;
+
+  void readv(std::vector<ReadSlice> slices) const override {
+    if (slow) {
+      reads++;
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    MemoryStorage::readv(std::move(slices));
+  }
+
+  std::atomic<bool> slow{false};
+  mutable std::atomic<int> reads{0};
+};
+
+// Torrents given one scheduler share its queues, so an upload from one is
+// served ahead of the other's recheck on the same device
+TEST_F(RecheckTest, UploadsOvertakeAnotherTorrentsRecheck) {
+  StorageOptions options;
+  options.backend = StorageBackend::Memory;
+  options.diskScheduler = std::make_shared<DiskJobScheduler>(
+      1, std::array<unsigned, kDiskJobClassCount>{0, 0, 0, 0});
+  auto seeding = makeTorrent(options);
+
+  SlowReadStorage *slowStorage = nullptr;
+  StorageOptions checkingOptions = options;
+  checkingOptions.storageFactory = [&](const std::vector<FileItem> &,
+                                       const StorageOptions &) {
+    auto created = std::make_unique<SlowReadStorage>(content.size());
+    slowStorage = created.get();
+    return created;
+  };
+  auto checking = makeTorrent(checkingOptions);
+  for (int piece = 0; piece < kPieceCount; piece++) {
+    writePiece(*seeding, piece);
+    writePiece(*checking, piece);
+  }
+  seeding->waitForVerification();
+  checking->waitForVerification();
+
+  slowStorage->slow = true;
+  RecheckOptions recheck;
+  recheck.threads = 2;
+  recheck.skipHoles = false;
+  ASSERT_TRUE(checking->startRecheck(recheck));
+  while (slowStorage->reads.load() == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  std::promise<int> uploaded;
+  std::atomic<int> readsAtUpload{0};
+  seeding->readBlockAsync(0, 0, [&](int error, ByteSpan) {
+    readsAtUpload = slowStorage->reads.load();
+    uploaded.set_value(error);
+  });
+  auto upload = uploaded.get_future();
+  ASSERT_EQ(upload.wait_for(std::chrono::seconds(5)),
+            std::future_status::ready);
+  EXPECT_EQ(upload.get(), 0);
+  // Only the recheck reads already started went first
+  EXPECT_LE(readsAtUpload.load(), 2);
+
+  auto result = checking->waitForRecheck();
+  EXPECT_EQ(result.verifiedPieces, kPieceCount);
+  EXPECT_EQ(slowStorage->reads.load(), kPieceCount);
+  auto stats = options.diskScheduler->getStats();
+  EXPECT_EQ(stats.classes[size_t(DiskJobClass::Upload)].completed, 1u);
+  EXPECT_EQ(stats.classes[size_t(DiskJobClass::Recheck)].completed,
+            uint64_t(kPieceCount));
+}
+
+// Main function
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,204 @@
+#include "Error.h"
+#include "ResumeData.h"
+#include "TorrentTestFixture.h"
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <fstream>
+
+using namespace LitTorrent;
+
+class ResumeDataTest : public TorrentTestFixture {
+protected:
+  static constexpr int kPieceCount = 4;
+
+  fs::path resumePath;
+
+  void SetUp() override {
+    setUpTorrentData("resume_data_test", kPieceCount);
+    resumePath = testDir / "torrent.resume";
+  }
+
+  // Pieces 0, 2 and 3 verified; blocks 0 and 2 of piece 1 written
+  void download(Torrent &torrent) {
+    writePiece(torrent, 0);
+    writePiece(torrent, 2);
+    writePiece(torrent, 3);
+    torrent.writeBlock(1, 0, block(1, 0));
+    torrent.writeBlock(1, 2, block(1, 2));
+    torrent.waitForVerification();
+  }
+};
+
+TEST_F(ResumeDataTest, EncodeDecodeRoundTrip) {
+  ResumeData data;
+  data.infoHash[3] = 0x7F;
+  data.totalSize = 123456789012;
+  data.pieceSize = 1 << 22;
+  data.blockSize = 16384;
+  data.allocation = AllocationMode::Full;
+  data.verified = {true, false, true, true, false, false, false, false, true};
+  data.partial[1] = std::vector<bool>(256, false);
+  data.partial[1][255] = true;
+  data.files = {ResumeFileState{100, 1700000000123456789}, ResumeFileState{}};
+
+  ResumeData decoded = ResumeData::decode(data.encode());
+  EXPECT_EQ(decoded.infoHash, data.infoHash);
+  EXPECT_EQ(decoded.totalSize, data.totalSize);
+  EXPECT_EQ(decoded.pieceSize, data.pieceSize);
+  EXPECT_EQ(decoded.blockSize, data.blockSize);
+  EXPECT_EQ(decoded.allocation, AllocationMode::Full);
+  EXPECT_EQ(decoded.verified, data.verified);
+  EXPECT_EQ(decoded.partial, data.partial);
+  ASSERT_EQ(decoded.files.size(), 2u);
+  EXPECT_EQ(decoded.files[0], data.files[0]);
+  EXPECT_EQ(decoded.files[1], data.files[1]);
+}
+
+TEST_F(ResumeDataTest, MalformedDataIsRejected) {
+  ResumeData data;
+  data.pieceSize = kPieceSize;
+  data.blockSize = kBlockSize;
+  data.verified = std::vector<bool>(20, true);
+  ByteArray bytes = data.encode();
+
+  auto expectInvalid = [](const ByteArray &bytes) {
+    try {
+      ResumeData::decode(bytes);
+      FAIL() << "decoded malformed resume data";
+    } catch (const TorrentException &e) {
+      EXPECT_EQ(e.code(), ErrorCode::InvalidResumeData);
+    }
+  };
+  expectInvalid(ByteArray(bytes.begin(), bytes.begin() + bytes.size() / 2));
+  expectInvalid(ByteArray{'l', 'e'});
+
+  std::string text(bytes.begin(), bytes.end());
+  std::string wrongFormat = text;
+  wrongFormat.replace(wrongFormat.find("LitTorrent"), 10, "OtherTools");
+  expectInvalid(ByteArray(wrongFormat.begin(), wrongFormat.end()));
+  std::string wrongCount = text;
+  wrongCount.replace(wrongCount.find("piece-counti20e"), 15,
+                     "piece-counti90e");
+  expectInvalid(ByteArray(wrongCount.begin(), wrongCount.end()));
+}
+
+TEST_F(ResumeDataTest, SaveReplacesTheFileAtomically) {
+  ResumeData first;
+  first.pieceSize = 1;
+  first.blockSize = 1;
+  first.verified = {true};
+  first.save(resumePath);
+  ResumeData second = first;
+  second.verified = {false, true};
+  second.save(resumePath);
+
+  EXPECT_EQ(ResumeData::load(resumePath).verified, second.verified);
+  EXPECT_FALSE(fs::exists(resumePath.string() + ".tmp"));
+  EXPECT_THROW(ResumeData::load(testDir / "missing.resume"),
+               TorrentException);
+}
+
+// A restarted torrent takes the saved state without hashing anything
+TEST_F(ResumeDataTest, RestartRestoresStateWithoutRehashing) {
+  {
+    auto torrent = makeTorrent();
+    download(*torrent);
+    EXPECT_TRUE(torrent->saveResumeData(resumePath));
+    EXPECT_FALSE(torrent->saveResumeData(resumePath));
+  }
+
+  auto torrent = makeTorrent();
+  std::atomic<int> reported{0};
+  torrent->setPieceVerifiedCallback([&](int, bool) { reported++; });
+  auto result = torrent->loadResumeData(resumePath);
+  ASSERT_TRUE(result.loaded) << result.error;
+  EXPECT_EQ(result.verifiedPieces, 3);
+  EXPECT_EQ(result.partialPieces, 1);
+  EXPECT_EQ(result.changedFiles, 0);
+  EXPECT_EQ(reported.load(), 0);
+  EXPECT_EQ(torrent->getVerifiedPieceCount(), 3);
+  EXPECT_TRUE(torrent->isPieceVerified(2));
+  EXPECT_FALSE(torrent->isPieceVerified(1));
+  EXPECT_FALSE(torrent->saveResumeData(resumePath));
+
+  // The missing blocks complete piece 1 as if nothing had happened
+  torrent->writeBlock(1, 1, block(1, 1));
+  torrent->writeBlock(1, 3, block(1, 3));
+  torrent->waitForVerification();
+  EXPECT_EQ(reported.load(), 1);
+  EXPECT_EQ(torrent->getVerifiedPieceCount(), kPieceCount);
+  EXPECT_TRUE(torrent->saveResumeData(resumePath));
+}
+
+TEST_F(ResumeDataTest, ChangedFileDropsOnlyItsPieces) {
+  {
+    auto torrent = makeTorrent();
+    download(*torrent);
+    torrent->saveResumeData(resumePath);
+  }
+  auto mtime = fs::last_write_time(testDir / "b.bin");
+  fs::last_write_time(testDir / "b.bin", mtime + std::chrono::seconds(1));
+
+  auto torrent = makeTorrent();
+  auto result = torrent->loadResumeData(resumePath);
+  ASSERT_TRUE(result.loaded) << result.error;
+  EXPECT_EQ(result.changedFiles, 1);
+  EXPECT_EQ(result.verifiedPieces, 1);
+  EXPECT_EQ(result.partialPieces, 0);
+  EXPECT_TRUE(torrent->isPieceVerified(0));
+  EXPECT_FALSE(torrent->isPieceVerified(2));
+  // What was dropped needs saving again
+  EXPECT_TRUE(torrent->saveResumeData(resumePath));
+}
+
+TEST_F(ResumeDataTest, DataForAnotherTorrentIsIgnored) {
+  {
+    auto torrent = makeTorrent();
+    download(*torrent);
+    torrent->saveResumeData(resumePath);
+  }
+
+  auto other = makeTorrent(StorageOptions(), kBlockSize / 2);
+  auto result = other->loadResumeData(resumePath);
+  EXPECT_FALSE(result.loaded);
+  EXPECT_FALSE(result.error.empty());
+  EXPECT_EQ(other->getVerifiedPieceCount(), 0);
+
+  auto missing = makeTorrent()->loadResumeData(testDir / "none.resume");
+  EXPECT_FALSE(missing.loaded);
+}
+
+// Blocks still held in the write cache are not on disk, so they are left
+// out until the torrent flushes them on shutdown and saves again
+TEST_F(ResumeDataTest, SavesOnDestructionAndSkipsCachedBlocks) {
+  StorageOptions options;
+  options.cacheSize = 4 * kPieceSize;
+  options.resumeDataPath = resumePath.string();
+  options.resumeSaveInterval = std::chrono::hours(1);
+  {
+    auto torrent = makeTorrent(options);
+    download(*torrent);
+    EXPECT_EQ(torrent->getWriteCacheStats().cachedPieces, 1u);
+    EXPECT_TRUE(torrent->saveResumeData(resumePath));
+    auto saved = ResumeData::load(resumePath);
+    EXPECT_EQ(saved.verified, (std::vector<bool>{true, false, true, true}));
+    EXPECT_TRUE(saved.partial.empty());
+  }
+
+  auto saved = ResumeData::load(resumePath);
+  ASSERT_EQ(saved.partial.count(1), 1u);
+  EXPECT_EQ(saved.partial[1],
+            (std::vector<bool>{true, false, true, false}));
+
+  auto torrent = makeTorrent();
+  auto result = torrent->loadResumeData(resumePath);
+  EXPECT_EQ(result.verifiedPieces, 3);
+  EXPECT_EQ(result.partialPieces, 1);
+}
+
+// Main function
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "FileItem.h"
+#include "LitTorrent/Torrent.h"
+#include "../Utils/SHA1.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace LitTorrent {
+
+// Shared by the tests that drive a Torrent over real files: a scratch
+// directory, pieceCount pieces of patterned content with their hashes, and
+// helpers to build the torrent and write its blocks
+class TorrentTestFixture : public ::testing::Test {
+protected:
+  static constexpr int kPieceSize = 65536;
+  static constexpr int kBlockSize = 16384;
+  static constexpr int kBlocksPerPiece = kPieceSize / kBlockSize;
+
+  fs::path testDir;
+  std::vector<uint8_t> content;
+  std::vector<Hash> hashes;
+
+  void setUpTorrentData(const std::string &dirName, int pieceCount) {
+    testDir = fs::temp_directory_path() / dirName;
+    fs::remove_all(testDir);
+    fs::create_directories(testDir);
+
+    content.resize(static_cast<size_t>(kPieceSize) * pieceCount);
+    for (size_t i = 0; i < content.size(); i++) {
+      content[i] = static_cast<uint8_t>((i * 13 + 5) & 0xFF);
+    }
+    hashContent();
+  }
+
+  // Recompute the piece hashes after content has been changed
+  void hashContent() {
+    hashes.clear();
+    for (size_t offset = 0; offset < content.size(); offset += kPieceSize) {
+      std::string piece(content.begin() + offset,
+                        content.begin() + offset + kPieceSize);
+      hashes.push_back(HexToHash(SHA1::computeHash(piece)));
+    }
+  }
+
+  void TearDown() override { fs::remove_all(testDir); }
+
+  // Files are neither created nor allocated
+  std::shared_ptr<Torrent>
+  makeTorrent(const std::vector<FileItem> &files,
+              const StorageOptions &options = StorageOptions(),
+              int blockSize = kBlockSize) {
+    return std::make_shared<Torrent>(
+        testDir.filename().string(), testDir.string(), files,
+        std::vector<std::string>{}, kPieceSize, hashes, blockSize, false,
+        options);
+  }
+
+  // Two files with the boundary inside piece 1, created up front
+  std::shared_ptr<Torrent>
+  makeTorrent(const StorageOptions &options = StorageOptions(),
+              int blockSize = kBlockSize) {
+    size_t firstSize = kPieceSize + kBlockSize + 100;
+    std::vector<FileItem> files{
+        FileItem(testDir / "a.bin", firstSize, 0),
+        FileItem(testDir / "b.bin", content.size() - firstSize, firstSize)};
+    auto torrent = makeTorrent(files, options, blockSize);
+    torrent->ensureFilesExist();
+    return torrent;
+  }
+
+  ByteSpan block(int piece, int blk) const {
+    return ByteSpan(content.data() + piece * kPieceSize + blk * kBlockSize,
+                    kBlockSize);
+  }
+
+  void writePiece(Torrent &torrent, int piece) {
+    for (int blk = 0; blk < kBlocksPerPiece; blk++) {
+      torrent.writeBlock(piece, blk, block(piece, blk));
+    }
+  }
+};
+
+} // namespace LitTorrent
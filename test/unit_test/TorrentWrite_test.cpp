@@ -0,0 +1,193 @@
+#include "../Utils/MemoryStorage.h"
+#include "Error.h"
+#include "TorrentTestFixture.h"
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <thread>
+
+// Counts heap allocations made while counting is enabled, so the write path
+// can be checked for hidden copies
+static std::atomic<bool> gCountAllocations{false};
+static std::atomic<size_t> gAllocationCount{0};
+
+void *operator new(std::size_t size) {
+  if (gCountAllocations.load(std::memory_order_relaxed)) {
+    gAllocationCount.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (void *ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+using namespace LitTorrent;
+
+class TorrentWriteTest : public TorrentTestFixture {
+protected:
+  static constexpr int kPieceCount = 4;
+
+  void SetUp() override { setUpTorrentData("torrent_write_test", kPieceCount); }
+
+  std::vector<uint8_t> readFile(const fs::path &path) const {
+    std::ifstream in(path, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), {});
+  }
+};
+
+TEST_F(TorrentWriteTest, SpanWritesDoNotAllocatePerBlock) {
+  auto torrent = makeTorrent();
+
+  // First writes open the file handles
+  torrent->writeBlock(0, 0, block(0, 0));
+  torrent->writeBlock(3, 0, block(3, 0));
+
+  gAllocationCount = 0;
+  gCountAllocations = true;
+  // Block 1 of piece 1 straddles the file boundary; none of these blocks
+  // completes a piece
+  for (int blk = 1; blk < 3; blk++) {
+    torrent->writeBlock(0, blk, block(0, blk));
+    torrent->writeBlock(1, blk, block(1, blk));
+  }
+  gCountAllocations = false;
+
+  EXPECT_EQ(gAllocationCount.load(), 0u);
+}
+
+TEST_F(TorrentWriteTest, SharedBufferWriteDoesNotCopy) {
+  auto torrent = makeTorrent();
+  torrent->writeBlock(2, 0, block(2, 0));
+
+  auto owned = std::make_shared<const std::vector<uint8_t>>(
+      block(2, 1).begin(), block(2, 1).end());
+
+  gAllocationCount = 0;
+  gCountAllocations = true;
+  torrent->writeBlock(2, 1, owned);
+  gCountAllocations = false;
+
+  EXPECT_EQ(gAllocationCount.load(), 0u);
+  EXPECT_EQ(owned.use_count(), 1);
+}
+
+TEST_F(TorrentWriteTest, SpanWritesLandAcrossFileBoundary) {
+  auto torrent = makeTorrent();
+  for (int piece = 0; piece < kPieceCount; piece++) {
+    for (int blk = 0; blk < kPieceSize / kBlockSize; blk++) {
+      torrent->writeBlock(piece, blk, block(piece, blk));
+    }
+  }
+  torrent->waitForVerification();
+  torrent->closeFiles();
+
+  auto a = readFile(testDir / "a.bin");
+  auto b = readFile(testDir / "b.bin");
+  a.insert(a.end(), b.begin(), b.end());
+  EXPECT_EQ(a, content);
+  EXPECT_EQ(torrent->getVerifiedPieceCount(), kPieceCount);
+}
+
+// Memory storage whose reads fail on demand, as a disk returning EIO would
+class FailingReadStorage : public MemoryStorage {
+public:
+  explicit FailingReadStorage(uint64_t size) : MemoryStorage(size) {}
+
+  void readv(std::vector<ReadSlice> slices) const override {
+    if (failReads) {
+      throw TorrentException(ErrorCode::FileReadError, "Injected read error");
+    }
+    MemoryStorage::readv(std::move(slices));
+  }
+
+  std::atomic<bool> failReads{false};
+};
+
+TEST_F(TorrentWriteTest, UnreadablePieceIsDownloadedAgain) {
+  FailingReadStorage *storage = nullptr;
+  StorageOptions options;
+  options.storageFactory = [&](const std::vector<FileItem> &,
+                               const StorageOptions &) {
+    auto created = std::make_unique<FailingReadStorage>(content.size());
+    storage = created.get();
+    return created;
+  };
+  std::vector<FileItem> files{FileItem("failing.bin", content.size(), 0)};
+  auto torrent = std::make_shared<Torrent>(
+      "failing", "", files, std::vector<std::string>{}, kPieceSize, hashes,
+      kBlockSize, false, options);
+  std::atomic<int> failures{0};
+  torrent->setPieceVerifiedCallback([&](int piece, bool verified) {
+    failures += piece == 2 && !verified;
+  });
+
+  storage->failReads = true;
+  for (int blk = 0; blk < kPieceSize / kBlockSize; blk++) {
+    torrent->writeBlock(2, blk, block(2, blk));
+  }
+  torrent->waitForVerification();
+  EXPECT_EQ(failures.load(), 1);
+  EXPECT_FALSE(torrent->isPieceVerified(2));
+  auto picked = torrent->pickPieces({}, kPieceCount);
+  EXPECT_EQ(std::count(picked.begin(), picked.end(), 2), 1);
+
+  // Once the disk is readable again the piece completes as usual
+  storage->failReads = false;
+  for (int blk = 0; blk < kPieceSize / kBlockSize; blk++) {
+    torrent->writeBlock(2, blk, block(2, blk));
+  }
+  torrent->waitForVerification();
+  EXPECT_TRUE(torrent->isPieceVerified(2));
+}
+
+// Endgame duplicates of a verified piece's blocks are dropped rather than
+// reopening a write cache entry that would never complete
+TEST_F(TorrentWriteTest, DuplicatesOfVerifiedBlocksLeaveTheCacheEmpty) {
+  StorageOptions options;
+  options.cacheSize = 4 * kPieceSize;
+  auto torrent = makeTorrent(options);
+  writePiece(*torrent, 0);
+  torrent->waitForVerification();
+  ASSERT_TRUE(torrent->isPieceVerified(0));
+  ASSERT_EQ(torrent->getWriteCacheStats().cachedBytes, 0u);
+
+  std::vector<uint8_t> garbage(kBlockSize, 0xAB);
+  torrent->writeBlock(0, 1, ByteSpan(garbage));
+  torrent->writeBlocks({BlockWrite{0, 2, ByteSpan(garbage)}});
+  std::atomic<int> completions{0};
+  torrent->writeBlockAsync(
+      0, 3, std::make_shared<std::vector<uint8_t>>(garbage),
+      [&](int error) {
+        EXPECT_EQ(error, 0);
+        completions++;
+      });
+  for (int i = 0; i < 1000 && completions.load() == 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_EQ(completions.load(), 1);
+
+  auto stats = torrent->getWriteCacheStats();
+  EXPECT_EQ(stats.cachedPieces, 0u);
+  EXPECT_EQ(stats.cachedBytes, 0u);
+  torrent->flushWriteCache();
+  EXPECT_TRUE(torrent->isPieceVerified(0));
+  for (int blk = 1; blk < kBlocksPerPiece; blk++) {
+    auto data = torrent->readBlock(0, blk);
+    EXPECT_TRUE(std::equal(data.begin(), data.end(), block(0, blk).begin()))
+        << "block " << blk;
+  }
+}
+
+// Main function
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
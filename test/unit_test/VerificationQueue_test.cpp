@@ -0,0 +1,245 @@
+#include "VerificationQueue.h"
+#include "FileItem.h"
+#include "LitTorrent/Torrent.h"
+#include "../Utils/SHA1.h"
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+using namespace LitTorrent;
+
+// Holds the single worker inside the first job until released, so the
+// remaining submissions pile up and their execution order can be observed
+class BlockingHandler {
+public:
+  void operator()(int pieceIndex) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!firstSeen_) {
+      firstSeen_ = true;
+      started_.notify_all();
+      released_.wait(lock, [this] { return release_; });
+    }
+    order_.push_back(pieceIndex);
+  }
+
+  void waitUntilBlocked() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    started_.wait(lock, [this] { return firstSeen_; });
+  }
+
+  void release() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    release_ = true;
+    released_.notify_all();
+  }
+
+  std::vector<int> order() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return order_;
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable started_;
+  std::condition_variable released_;
+  bool firstSeen_ = false;
+  bool release_ = false;
+  std::vector<int> order_;
+};
+
+TEST(VerificationQueueTest, RunsEverySubmittedPieceOnce) {
+  std::atomic<int> calls{0};
+  std::vector<std::atomic<int>> perPiece(64);
+  VerificationQueue queue(
+      [&](int piece) {
+        calls++;
+        perPiece[piece]++;
+      },
+      4);
+
+  for (int i = 0; i < 64; i++) {
+    queue.submit(i);
+  }
+  queue.waitIdle();
+
+  EXPECT_EQ(calls.load(), 64);
+  for (auto &count : perPiece) {
+    EXPECT_EQ(count.load(), 1);
+  }
+  EXPECT_EQ(queue.pending(), 0u);
+}
+
+TEST(VerificationQueueTest, DuplicateSubmitWhilePendingIsIgnored) {
+  BlockingHandler handler;
+  VerificationQueue queue([&](int piece) { handler(piece); }, 1);
+
+  queue.submit(0);
+  handler.waitUntilBlocked();
+  queue.submit(1);
+  queue.submit(1);
+  queue.submit(1);
+  EXPECT_EQ(queue.pending(), 1u);
+
+  handler.release();
+  queue.waitIdle();
+  EXPECT_EQ(handler.order(), (std::vector<int>{0, 1}));
+}
+
+TEST(VerificationQueueTest, TimeCriticalPiecesJumpTheQueue) {
+  BlockingHandler handler;
+  VerificationQueue queue([&](int piece) { handler(piece); }, 1);
+
+  queue.submit(0);
+  handler.waitUntilBlocked();
+  queue.submit(1);
+  queue.submit(2);
+  queue.submit(3, VerifyPriority::TimeCritical);
+
+  handler.release();
+  queue.waitIdle();
+  EXPECT_EQ(handler.order(), (std::vector<int>{0, 3, 1, 2}));
+}
+
+TEST(VerificationQueueTest, SetTimeCriticalPromotesPendingPiece) {
+  BlockingHandler handler;
+  VerificationQueue queue([&](int piece) { handler(piece); }, 1);
+
+  queue.submit(0);
+  handler.waitUntilBlocked();
+  queue.submit(1);
+  queue.submit(2);
+  queue.setTimeCritical(2, true);
+
+  handler.release();
+  queue.waitIdle();
+  EXPECT_EQ(handler.order(), (std::vector<int>{0, 2, 1}));
+}
+
+TEST(VerificationQueueTest, StopDropsPendingJobs) {
+  BlockingHandler handler;
+  VerificationQueue queue([&](int piece) { handler(piece); }, 1);
+
+  queue.submit(0);
+  handler.waitUntilBlocked();
+  queue.submit(1);
+  queue.submit(2);
+
+  handler.release();
+  queue.stop();
+  queue.submit(3);
+
+  auto order = handler.order();
+  ASSERT_FALSE(order.empty());
+  EXPECT_EQ(order.front(), 0);
+  EXPECT_EQ(std::count(order.begin(), order.end(), 3), 0);
+}
+
+class TorrentVerificationTest : public ::testing::Test {
+protected:
+  static constexpr int kPieceSize = 32768;
+  static constexpr int kBlockSize = 16384;
+  static constexpr int kPieceCount = 4;
+
+  fs::path testDir;
+  std::vector<uint8_t> content;
+  std::vector<Hash> hashes;
+
+  void SetUp() override {
+    testDir = fs::temp_directory_path() / "verification_queue_test";
+    fs::remove_all(testDir);
+    fs::create_directories(testDir);
+
+    content.resize(kPieceSize * kPieceCount);
+    for (size_t i = 0; i < content.size(); i++) {
+      content[i] = static_cast<uint8_t>((i * 31 + 7) & 0xFF);
+    }
+    for (int i = 0; i < kPieceCount; i++) {
+      std::string piece(content.begin() + i * kPieceSize,
+                        content.begin() + (i + 1) * kPieceSize);
+      hashes.push_back(HexToHash(SHA1::computeHash(piece)));
+    }
+  }
+
+  void TearDown() override { fs::remove_all(testDir); }
+
+  std::shared_ptr<Torrent> makeTorrent() {
+    std::vector<FileItem> files{
+        FileItem(testDir / "data.bin", content.size(), 0)};
+    return std::make_shared<Torrent>("data.bin", testDir.string(), files,
+                                     std::vector<std::string>{}, kPieceSize,
+                                     hashes, kBlockSize);
+  }
+
+  std::vector<uint8_t> block(int piece, int blk) const {
+    auto begin = content.begin() + piece * kPieceSize + blk * kBlockSize;
+    return std::vector<uint8_t>(begin, begin + kBlockSize);
+  }
+};
+
+TEST_F(TorrentVerificationTest, CompletedPieceIsVerifiedAsynchronously) {
+  auto torrent = makeTorrent();
+  torrent->ensureFilesExist();
+
+  std::mutex mutex;
+  std::vector<std::pair<int, bool>> results;
+  torrent->setPieceVerifiedCallback([&](int piece, bool ok) {
+    std::lock_guard<std::mutex> lock(mutex);
+    results.emplace_back(piece, ok);
+  });
+
+  for (int piece = 0; piece < kPieceCount; piece++) {
+    for (int blk = 0; blk < 2; blk++) {
+      EXPECT_TRUE(torrent->writeBlock(piece, blk, block(piece, blk)));
+    }
+  }
+  torrent->waitForVerification();
+
+  EXPECT_EQ(results.size(), static_cast<size_t>(kPieceCount));
+  for (const auto &[piece, ok] : results) {
+    EXPECT_TRUE(ok) << "piece " << piece;
+  }
+  for (int piece = 0; piece < kPieceCount; piece++) {
+    EXPECT_TRUE(torrent->isPieceVerified(piece));
+  }
+}
+
+TEST_F(TorrentVerificationTest, FailedPieceResetsBlockState) {
+  auto torrent = makeTorrent();
+  torrent->ensureFilesExist();
+
+  std::atomic<int> failures{0};
+  std::atomic<int> successes{0};
+  torrent->setPieceVerifiedCallback([&](int, bool ok) {
+    (ok ? successes : failures)++;
+  });
+
+  auto corrupt = block(1, 0);
+  corrupt[0] ^= 0xFF;
+  torrent->writeBlock(1, 0, corrupt);
+  torrent->writeBlock(1, 1, block(1, 1));
+  torrent->waitForVerification();
+
+  EXPECT_EQ(failures.load(), 1);
+  EXPECT_FALSE(torrent->isPieceVerified(1));
+
+  // Block state was reset, so a single re-sent block must not complete the
+  // piece again; both blocks have to arrive
+  torrent->writeBlock(1, 0, block(1, 0));
+  torrent->waitForVerification();
+  EXPECT_EQ(successes.load(), 0);
+
+  torrent->writeBlock(1, 1, block(1, 1));
+  torrent->waitForVerification();
+  EXPECT_EQ(successes.load(), 1);
+  EXPECT_TRUE(torrent->isPieceVerified(1));
+}
+
+// Main function
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
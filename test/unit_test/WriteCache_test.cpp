@@ -0,0 +1,176 @@
+#include "WriteCache.h"
+
+#include <gtest/gtest.h>
+#include <map>
+#include <mutex>
+#include <vector>
+
+using namespace LitTorrent;
+
+class WriteCacheTest : public ::testing::Test {
+protected:
+  static constexpr size_t kBlock = 16384;
+  static constexpr uint64_t kPiece = 4 * kBlock;
+
+  std::mutex mutex_;
+  std::map<uint64_t, std::vector<uint8_t>> written_; // offset -> bytes
+  std::shared_ptr<BufferPool> pool_ = BufferPool::create({kBlock, kPiece});
+
+  std::unique_ptr<WriteCache> makeCache(std::shared_ptr<CacheBudget> budget,
+                                        uint64_t totalSize = 8 * kPiece) {
+    return std::make_unique<WriteCache>(
+        budget, pool_, kPiece, totalSize, kBlock,
+        [this](std::vector<WriteSlice> slices) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          for (const auto &slice : slices) {
+            written_[slice.start].assign(slice.data.begin(),
+                                          slice.data.end());
+          }
+        });
+  }
+
+  static std::vector<uint8_t> block(uint8_t value) {
+    return std::vector<uint8_t>(kBlock, value);
+  }
+};
+
+TEST_F(WriteCacheTest, CompletePieceIsHashedFromMemory) {
+  auto budget = std::make_shared<CacheBudget>(4 * kPiece);
+  auto cache = makeCache(budget);
+
+  for (int i = 0; i < 4; i++) {
+    EXPECT_TRUE(cache->insert(1, i * kBlock, block(uint8_t(i))));
+  }
+  EXPECT_EQ(budget->used(), kPiece);
+
+  auto piece = cache->takeComplete(1);
+  ASSERT_TRUE(piece);
+  ASSERT_EQ(piece.size(), kPiece);
+  EXPECT_EQ(piece[0], 0);
+  EXPECT_EQ(piece[3 * kBlock], 3);
+  EXPECT_TRUE(written_.empty());
+
+  cache->release(1, true);
+  EXPECT_EQ(budget->used(), 0u);
+  auto stats = cache->getStats();
+  EXPECT_EQ(stats.hashedInMemory, 1u);
+  EXPECT_EQ(stats.cachedBlocks, 4u);
+  EXPECT_EQ(stats.cachedPieces, 0u);
+  EXPECT_EQ(stats.discarded, 0u);
+}
+
+TEST_F(WriteCacheTest, FailedPieceNeverReachesTheWriter) {
+  auto budget = std::make_shared<CacheBudget>(4 * kPiece);
+  auto cache = makeCache(budget);
+
+  for (int i = 0; i < 4; i++) {
+    cache->insert(0, i * kBlock, block(0xEE));
+  }
+  ASSERT_TRUE(cache->takeComplete(0));
+  cache->release(0, false);
+
+  EXPECT_TRUE(written_.empty());
+  EXPECT_EQ(cache->getStats().discarded, 1u);
+  EXPECT_EQ(budget->used(), 0u);
+}
+
+// Going over the budget flushes the most complete piece; its remaining
+// blocks are then written through and it is hashed from storage
+TEST_F(WriteCacheTest, PressureFlushesTheMostCompletePiece) {
+  auto budget = std::make_shared<CacheBudget>(2 * kPiece);
+  auto cache = makeCache(budget);
+
+  cache->insert(0, 0, block(1));
+  cache->insert(1, 0, block(2));
+  cache->insert(1, kBlock, block(3));
+  EXPECT_TRUE(cache->insert(2, 0, block(4)));
+
+  EXPECT_EQ(written_.size(), 2u);
+  EXPECT_EQ(written_[kPiece], block(2));
+  EXPECT_EQ(written_[kPiece + kBlock], block(3));
+  EXPECT_FALSE(cache->insert(1, 2 * kBlock, block(5)));
+  EXPECT_TRUE(cache->insert(0, kBlock, block(6)));
+
+  EXPECT_FALSE(cache->takeComplete(1));
+  auto stats = cache->getStats();
+  EXPECT_EQ(stats.flushedPieces, 1u);
+  EXPECT_EQ(stats.writtenThrough, 1u);
+  EXPECT_EQ(stats.cachedPieces, 2u);
+  EXPECT_EQ(budget->getStats().reclaims, 1u);
+  cache->release(1, true);
+  EXPECT_EQ(budget->used(), 2 * kPiece);
+}
+
+TEST_F(WriteCacheTest, PiecesLargerThanTheBudgetAreWrittenThrough) {
+  auto budget = std::make_shared<CacheBudget>(kPiece / 2);
+  auto cache = makeCache(budget);
+
+  EXPECT_FALSE(cache->insert(0, 0, block(1)));
+  EXPECT_FALSE(cache->insert(0, kBlock, block(1)));
+  EXPECT_FALSE(cache->takeComplete(0));
+  EXPECT_EQ(budget->used(), 0u);
+  EXPECT_EQ(cache->getStats().writtenThrough, 2u);
+  EXPECT_EQ(budget->getStats().refusals, 0u);
+}
+
+TEST_F(WriteCacheTest, ShortLastPieceReservesItsOwnSize) {
+  auto budget = std::make_shared<CacheBudget>(4 * kPiece);
+  auto cache = makeCache(budget, kPiece + kBlock + 100);
+
+  EXPECT_TRUE(cache->insert(1, 0, block(7)));
+  EXPECT_TRUE(cache->insert(1, kBlock, std::vector<uint8_t>(100, 8)));
+  EXPECT_EQ(budget->used(), kBlock + 100);
+  auto piece = cache->takeComplete(1);
+  ASSERT_TRUE(piece);
+  EXPECT_EQ(piece.size(), kBlock + 100);
+  EXPECT_EQ(piece[kBlock + 99], 8);
+}
+
+TEST_F(WriteCacheTest, FlushAllWritesPartialPieces) {
+  auto budget = std::make_shared<CacheBudget>(4 * kPiece);
+  auto cache = makeCache(budget);
+
+  cache->insert(0, kBlock, block(1));
+  cache->insert(3, 0, block(2));
+  cache->insert(3, 3 * kBlock, block(3));
+  cache->flushAll();
+
+  EXPECT_EQ(written_.size(), 3u);
+  EXPECT_EQ(written_[kBlock], block(1));
+  EXPECT_EQ(written_[3 * kPiece + 3 * kBlock], block(3));
+  EXPECT_EQ(budget->used(), 0u);
+  EXPECT_FALSE(cache->insert(3, kBlock, block(4)));
+}
+
+// Two caches on one budget: the read-side consumer (rank 0) is asked first
+TEST_F(WriteCacheTest, LowerRankedConsumersAreReclaimedFirst) {
+  struct Clean : CacheBudget::Consumer {
+    CacheBudget *budget;
+    size_t held;
+    size_t reclaim(size_t bytes) override {
+      size_t freed = std::min(bytes, held);
+      held -= freed;
+      budget->release(freed);
+      return freed;
+    }
+  } clean;
+  auto budget = std::make_shared<CacheBudget>(2 * kPiece);
+  clean.budget = budget.get();
+  clean.held = kPiece;
+  ASSERT_TRUE(budget->reserve(kPiece));
+  budget->attach(&clean, 0);
+  auto cache = makeCache(budget);
+
+  cache->insert(0, 0, block(1));
+  cache->insert(1, 0, block(2));
+  EXPECT_EQ(clean.held, 0u);
+  EXPECT_TRUE(written_.empty());
+  EXPECT_EQ(cache->getStats().cachedPieces, 2u);
+  budget->detach(&clean);
+}
+
+// Main function
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}